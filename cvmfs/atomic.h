@@ -81,6 +81,35 @@ static int32_t inline __attribute__((used)) atomic_cas32(atomic_int32 *a,
   return __sync_bool_compare_and_swap(a, cmp, newval);
 }
 
+
+static void inline __attribute__((used)) atomic_write32(atomic_int32 *a,
+                                                        int32_t value)
+{
+  while (!__sync_bool_compare_and_swap(a, atomic_read32(a), value)) { }
+}
+
+
+static void inline __attribute__((used)) atomic_write64(atomic_int64 *a,
+                                                        int64_t value)
+{
+  while (!__sync_bool_compare_and_swap(a, atomic_read64(a), value)) { }
+}
+
+
+/**
+ * Pointer versions for lock-free lists.  The exchange is an acquire barrier.
+ */
+template <typename T>
+static inline bool atomic_cas_ptr(T **a, T *cmp, T *newval) {
+  return __sync_bool_compare_and_swap(a, cmp, newval);
+}
+
+
+template <typename T>
+static inline T *atomic_xchg_ptr(T **a, T *newval) {
+  return __sync_lock_test_and_set(a, newval);
+}
+
 #ifdef CVMFS_NAMESPACE_GUARD
 }
 #endif
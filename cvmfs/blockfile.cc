@@ -0,0 +1,258 @@
+/**
+ * This file is part of the CernVM File System.
+ *
+ * Block files are only ever read by the machine that wrote them, so the
+ * header and the offset table are stored in host byte order.
+ */
+
+#include "cvmfs_config.h"
+#include "blockfile.h"
+
+#include <alloca.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+#include "compression.h"
+#include "hash.h"
+#include "logging.h"
+#include "platform.h"
+#include "smalloc.h"
+
+using namespace std;  // NOLINT
+
+namespace blockfile {
+
+static const char kMagic[4] = {'C', 'V', 'B', 'F'};
+static const unsigned kZChunk = 16384;
+
+
+uint64_t Index::BlockLength(const unsigned block_idx) const {
+  assert(block_idx < num_blocks());
+  if (block_idx + 1 < num_blocks())
+    return block_size;
+  return size - static_cast<uint64_t>(block_idx) * block_size;
+}
+
+
+static inline unsigned GetNumBlocks(const uint64_t size,
+                                    const unsigned block_size)
+{
+  return (size + block_size - 1) / block_size;
+}
+
+
+static bool Pread(const int fd, void *buf, const size_t nbytes,
+                  const uint64_t offset)
+{
+  size_t pos = 0;
+  while (pos < nbytes) {
+    const ssize_t retval = pread(fd, static_cast<char *>(buf) + pos,
+                                 nbytes - pos, offset + pos);
+    if (retval <= 0)
+      return false;
+    pos += retval;
+  }
+  return true;
+}
+
+
+/**
+ * Cuts the first size bytes of fd_src into blocks, compresses them one by one
+ * and writes the resulting block file into fdest.
+ *
+ * @param[out] size_on_disk  Number of bytes written to fdest
+ * \return True on success, false otherwise
+ */
+bool Write(const int fd_src, const uint64_t size, const unsigned block_size,
+           FILE *fdest, uint64_t *size_on_disk)
+{
+  assert((block_size > 0) && (block_size <= kMaxBlockSize));
+  const unsigned num_blocks = GetNumBlocks(size, block_size);
+  vector<uint64_t> offsets(num_blocks + 1);
+  offsets[0] = sizeof(Header) + offsets.size() * sizeof(uint64_t);
+
+  Header header;
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.block_size = block_size;
+  header.num_blocks = num_blocks;
+  header.size = size;
+
+  bool result = false;
+  void *block = smalloc(block_size);
+  // Blocks first, the offset table is known only afterwards
+  if (fseek(fdest, offsets[0], SEEK_SET) != 0)
+    goto write_final;
+  for (unsigned i = 0; i < num_blocks; ++i) {
+    const uint64_t offset = static_cast<uint64_t>(i) * block_size;
+    const size_t length = (i + 1 < num_blocks) ? block_size : size - offset;
+    if (!Pread(fd_src, block, length, offset))
+      goto write_final;
+
+    void *zblock;
+    uint64_t zsize;
+    if (!zlib::CompressMem2Mem(block, length, &zblock, &zsize))
+      goto write_final;
+    const size_t written = fwrite(zblock, 1, zsize, fdest);
+    free(zblock);
+    if (written != zsize)
+      goto write_final;
+    offsets[i + 1] = offsets[i] + zsize;
+  }
+
+  if ((fseek(fdest, 0, SEEK_SET) != 0) ||
+      (fwrite(&header, sizeof(header), 1, fdest) != 1) ||
+      (fwrite(&offsets[0], sizeof(uint64_t), offsets.size(), fdest) !=
+       offsets.size()) ||
+      (fflush(fdest) != 0))
+  {
+    goto write_final;
+  }
+  *size_on_disk = offsets[num_blocks];
+  result = true;
+
+ write_final:
+  free(block);
+  LogCvmfs(kLogCache, kLogDebug, "wrote block file of %u blocks (%s)",
+           num_blocks, result ? "ok" : "failed");
+  return result;
+}
+
+
+/**
+ * Reads and validates the header and the offset table of a block file.
+ *
+ * @param[in] file_size  Size of the block file on disk
+ * \return False if fd does not contain a consistent block file
+ */
+bool ReadIndex(const int fd, const uint64_t file_size, Index *index) {
+  Header header;
+  if ((file_size < sizeof(header)) || !Pread(fd, &header, sizeof(header), 0))
+    return false;
+  if ((memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) ||
+      (header.version != kVersion) ||
+      (header.block_size == 0) || (header.block_size > kMaxBlockSize) ||
+      (header.num_blocks != GetNumBlocks(header.size, header.block_size)))
+  {
+    return false;
+  }
+
+  const uint64_t table_size =
+    (static_cast<uint64_t>(header.num_blocks) + 1) * sizeof(uint64_t);
+  if (file_size < sizeof(header) + table_size)
+    return false;
+  index->offsets.resize(header.num_blocks + 1);
+  if (!Pread(fd, &index->offsets[0], table_size, sizeof(header)))
+    return false;
+
+  if (index->offsets[0] != sizeof(header) + table_size)
+    return false;
+  for (unsigned i = 0; i < header.num_blocks; ++i) {
+    if (index->offsets[i + 1] <= index->offsets[i])
+      return false;
+  }
+  if (index->offsets[header.num_blocks] != file_size)
+    return false;
+
+  index->size = header.size;
+  index->block_size = header.block_size;
+  return true;
+}
+
+
+/**
+ * Decompresses a single block into a newly malloced buffer that has to be
+ * freed by the caller.
+ */
+bool ReadBlock(const int fd, const Index &index, const unsigned block_idx,
+               void **buffer, uint64_t *size)
+{
+  assert(block_idx < index.num_blocks());
+  const uint64_t zsize =
+    index.offsets[block_idx + 1] - index.offsets[block_idx];
+  void *zblock = smalloc(zsize);
+  if (!Pread(fd, zblock, zsize, index.offsets[block_idx])) {
+    free(zblock);
+    return false;
+  }
+  const bool retval = zlib::DecompressMem2Mem(zblock, zsize, buffer, size);
+  free(zblock);
+  if (!retval)
+    return false;
+  if (*size != index.BlockLength(block_idx)) {
+    free(*buffer);
+    *buffer = NULL;
+    return false;
+  }
+  return true;
+}
+
+
+/**
+ * Like zlib::CompressFd2Null() but operates on the decoded content of a block
+ * file.  Used by cvmfs_fsck.
+ *
+ * \return False if fd is not a valid block file or on I/O errors
+ */
+bool CompressFd2Null(const int fd, hash::Any *compressed_hash) {
+  return blockfile::CompressFd2Null(fd, zlib::kZlibDefault, compressed_hash);
+}
+
+
+/**
+ * Like above but reproduces an object stored with the given compression
+ * algorithm.
+ */
+bool CompressFd2Null(const int fd, const zlib::Algorithms algorithm,
+                     hash::Any *compressed_hash)
+{
+  platform_stat64 info;
+  if (platform_fstat(fd, &info) != 0)
+    return false;
+  Index index;
+  if (!ReadIndex(fd, info.st_size, &index))
+    return false;
+  zlib::Compressor *compressor = zlib::Compressor::Construct(algorithm);
+  if (compressor == NULL)
+    return false;
+
+  unsigned char out[kZChunk];
+  hash::ContextPtr hash_context(compressed_hash->algorithm);
+  hash_context.buffer = alloca(hash_context.size);
+  hash::Init(hash_context);
+
+  bool result = false;
+  zlib::StreamStates state = zlib::kStreamEnd;
+  for (unsigned i = 0; i <= index.num_blocks(); ++i) {
+    void *block = NULL;
+    uint64_t block_size = 0;
+    const bool last = (i == index.num_blocks());
+    if (!last && !ReadBlock(fd, index, i, &block, &block_size))
+      goto compress_fd2null_final;
+
+    const unsigned char *in = static_cast<unsigned char *>(block);
+    size_t in_size = block_size;
+    do {
+      size_t have = kZChunk;
+      state = compressor->Deflate(last, &in, &in_size, out, &have);
+      if (state == zlib::kStreamError) {
+        free(block);
+        goto compress_fd2null_final;
+      }
+      hash::Update(out, have, hash_context);
+    } while (state == zlib::kStreamContinue);
+    free(block);
+  }
+
+  hash::Final(hash_context, compressed_hash);
+  result = true;
+
+ compress_fd2null_final:
+  delete compressor;
+  return result;
+}
+
+}  // namespace blockfile
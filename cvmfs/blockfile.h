@@ -0,0 +1,69 @@
+/**
+ * This file is part of the CernVM File System.
+ *
+ * A seekable compressed file format for the local cache.  The file is cut
+ * into blocks of fixed (uncompressed) size, each of which is an independent
+ * zlib stream.  An index of block offsets at the beginning of the file allows
+ * to decompress only the blocks that are touched by a read.
+ *
+ * Layout: Header | offsets[num_blocks + 1] | block 0 | block 1 | ...
+ * where offsets[i] is the position of block i in the file and
+ * offsets[num_blocks] is the file size.
+ */
+
+#ifndef CVMFS_BLOCKFILE_H_
+#define CVMFS_BLOCKFILE_H_
+
+#include <stdint.h>
+
+#include <cstdio>
+#include <vector>
+
+#include "compression.h"
+
+namespace hash {
+struct Any;
+}
+
+namespace blockfile {
+
+const unsigned kDefaultBlockSize = 64*1024;
+const unsigned kMaxBlockSize = 16*1024*1024;
+const uint32_t kVersion = 1;
+
+struct Header {
+  char magic[4];  /**< "CVBF" */
+  uint32_t version;
+  uint32_t block_size;
+  uint32_t num_blocks;
+  uint64_t size;  /**< uncompressed size */
+};
+
+
+/**
+ * The in-memory representation of a block file's header and offset table.
+ */
+struct Index {
+  Index() : size(0), block_size(0) { }
+  unsigned num_blocks() const {
+    return offsets.empty() ? 0 : offsets.size() - 1;
+  }
+  uint64_t BlockLength(const unsigned block_idx) const;
+
+  uint64_t size;
+  unsigned block_size;
+  std::vector<uint64_t> offsets;
+};
+
+bool Write(const int fd_src, const uint64_t size, const unsigned block_size,
+           FILE *fdest, uint64_t *size_on_disk);
+bool ReadIndex(const int fd, const uint64_t file_size, Index *index);
+bool ReadBlock(const int fd, const Index &index, const unsigned block_idx,
+               void **buffer, uint64_t *size);
+bool CompressFd2Null(const int fd, hash::Any *compressed_hash);
+bool CompressFd2Null(const int fd, const zlib::Algorithms algorithm,
+                     hash::Any *compressed_hash);
+
+}  // namespace blockfile
+
+#endif  // CVMFS_BLOCKFILE_H_
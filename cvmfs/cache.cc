@@ -21,7 +21,17 @@
  * rename().  This concept is taken over from GROW-FS.
  *
  * Identical URLs won't be concurrently downloaded.  The first thread performs
- * the download and informs the other, waiting threads on pipes.
+ * the download and informs the other, waiting threads on pipes.  Across
+ * processes sharing the cache directory, the downloading thread holds a lock
+ * file in txn.  Other processes wait for the lock and pick up the committed
+ * file instead of downloading it again.
+ *
+ * In compressed cache mode, downloaded files are converted into block files
+ * (see blockfile.h) before they are committed.  File descriptors returned by
+ * the Fetch*() functions have to be read with cache::Pread() and closed with
+ * cache::Close(), which transparently decompress the touched blocks.  Plain
+ * files and block files can coexist in the cache; a cached file that is
+ * smaller than the object's decompressed size is a block file.
  */
 
 #define __STDC_FORMAT_MACROS
@@ -35,16 +45,22 @@
 #include <pthread.h>
 #include <dirent.h>
 #include <inttypes.h>
+#include <sys/file.h>
 
 #include <cassert>
 #include <cstring>
 #include <cstdlib>
 #include <cstdio>
+#include <ctime>
 
+#include <algorithm>
+#include <list>
 #include <map>
 #include <vector>
 
 #include "platform.h"
+#include "blockfile.h"
+#include "catalog.h"
 #include "directory_entry.h"
 #include "quota.h"
 #include "util.h"
@@ -118,6 +134,155 @@ pthread_key_t thread_local_storage_;
 vector<ThreadLocalStorage *> *tls_blocks_;
 pthread_mutex_t lock_tls_blocks_ = PTHREAD_MUTEX_INITIALIZER;
 atomic_int64 num_download_;
+atomic_int64 num_download_dedup_;  /**< committed by another process while
+  waiting for its lock file */
+
+typedef map< hash::Any, PartialObject * > PartialObjects;
+
+PartialObjects *partial_objects_ = NULL;  /**< objects currently read by
+  range requests */
+pthread_mutex_t lock_partial_objects_ = PTHREAD_MUTEX_INITIALIZER;
+uint64_t partial_threshold_ = 0;  /**< zero switches off range requests */
+unsigned partial_block_size_ = 256*1024;
+/**
+ * Reads that start more than this many blocks beyond the decompressed prefix
+ * of a partial object fetch the entire object instead.
+ */
+const unsigned kFarReadBlocks = 8;
+/**
+ * Processes wait at most this long for another process to download an
+ * object, then they download it themselves.
+ */
+const unsigned kInflightTimeoutMs = 30000;
+
+/**
+ * An open file descriptor to a block file.
+ */
+struct BlockFile {
+  explicit BlockFile(const hash::Any &c) : checksum(c) { }
+  hash::Any checksum;
+  blockfile::Index index;
+};
+typedef map< int, BlockFile * > BlockFiles;
+
+BlockFiles *block_files_ = NULL;  /**< maps file descriptors to the index of
+  the block file they point to */
+pthread_mutex_t lock_block_files_ = PTHREAD_MUTEX_INITIALIZER;
+atomic_int32 num_block_files_;  /**< allows Pread() to skip the lookup */
+unsigned compressed_block_size_ = 0;  /**< zero stores objects decompressed */
+
+
+/**
+ * Keeps decompressed blocks of block files in memory, bounded by the sum of
+ * the block sizes.  Blocks are identified by the content hash of the object
+ * and the block number.
+ */
+class BlockCache : SingleCopy {
+ public:
+  BlockCache() : size_(0), max_size_(0) {
+    atomic_init64(&num_hits_);
+    atomic_init64(&num_misses_);
+    int retval = pthread_mutex_init(&lock_, NULL);
+    assert(retval == 0);
+  }
+
+  ~BlockCache() {
+    SetMaxSize(0);
+    pthread_mutex_destroy(&lock_);
+  }
+
+  void SetMaxSize(const uint64_t max_size) {
+    LockMutex(&lock_);
+    max_size_ = max_size;
+    Shrink();
+    UnlockMutex(&lock_);
+  }
+
+  /**
+   * Copies size bytes from offset of a cached block into dest.
+   */
+  bool Lookup(const hash::Any &checksum, const unsigned block_idx,
+              const uint64_t offset, const uint64_t size, char *dest)
+  {
+    LockMutex(&lock_);
+    Blocks::iterator iter = blocks_.find(Key(checksum, block_idx));
+    if (iter == blocks_.end()) {
+      UnlockMutex(&lock_);
+      atomic_inc64(&num_misses_);
+      return false;
+    }
+    lru_.splice(lru_.end(), lru_, iter->second);
+    assert(offset + size <= iter->second->size);
+    memcpy(dest, static_cast<char *>(iter->second->data) + offset, size);
+    UnlockMutex(&lock_);
+    atomic_inc64(&num_hits_);
+    return true;
+  }
+
+  /**
+   * Takes ownership of data.
+   */
+  void Insert(const hash::Any &checksum, const unsigned block_idx,
+              void *data, const uint64_t size)
+  {
+    LockMutex(&lock_);
+    const Key key(checksum, block_idx);
+    if ((size > max_size_) || (blocks_.find(key) != blocks_.end())) {
+      UnlockMutex(&lock_);
+      free(data);
+      return;
+    }
+    Entry entry;
+    entry.key = key;
+    entry.data = data;
+    entry.size = size;
+    blocks_[key] = lru_.insert(lru_.end(), entry);
+    size_ += size;
+    Shrink();
+    UnlockMutex(&lock_);
+  }
+
+  string GetStats() {
+    LockMutex(&lock_);
+    const uint64_t size = size_;
+    const uint64_t num_blocks = blocks_.size();
+    UnlockMutex(&lock_);
+    return "blocks: " + StringifyInt(num_blocks) + "    " +
+      "size: " + StringifyInt(size / 1024) + "kB    " +
+      "hits: " + StringifyInt(atomic_read64(&num_hits_)) + "    " +
+      "misses: " + StringifyInt(atomic_read64(&num_misses_)) + "\n";
+  }
+
+ private:
+  typedef pair<hash::Any, unsigned> Key;
+  struct Entry {
+    Key key;
+    void *data;
+    uint64_t size;
+  };
+  typedef list<Entry> Lru;
+  typedef map<Key, Lru::iterator> Blocks;
+
+  void Shrink() {
+    while (size_ > max_size_) {
+      const Entry &victim = lru_.front();
+      size_ -= victim.size;
+      free(victim.data);
+      blocks_.erase(victim.key);
+      lru_.pop_front();
+    }
+  }
+
+  Lru lru_;  /**< least recently used block first */
+  Blocks blocks_;
+  uint64_t size_;
+  uint64_t max_size_;
+  atomic_int64 num_hits_;
+  atomic_int64 num_misses_;
+  pthread_mutex_t lock_;
+};
+
+BlockCache *block_cache_ = NULL;
 
 CacheModes cache_mode_;
 
@@ -144,6 +309,40 @@ static void TLSDestructor(void *data) {
   CleanupTLS(tls);
 }
 
+
+/**
+ * Returns the thread local storage of the calling thread, creates it on first
+ * use.
+ */
+static ThreadLocalStorage *GetTLS() {
+  ThreadLocalStorage *tls = static_cast<ThreadLocalStorage *>(
+                            pthread_getspecific(thread_local_storage_));
+  if (tls != NULL)
+    return tls;
+
+  tls = new ThreadLocalStorage();
+  int retval = pipe(tls->pipe_wait);
+  assert(retval == 0);
+  tls->download_job.destination = download::kDestinationFile;
+  tls->download_job.compressed = true;
+  tls->download_job.probe_hosts = true;
+  retval = pthread_setspecific(thread_local_storage_, tls);
+  assert(retval == 0);
+  pthread_mutex_lock(&lock_tls_blocks_);
+  tls_blocks_->push_back(tls);
+  pthread_mutex_unlock(&lock_tls_blocks_);
+  return tls;
+}
+
+
+/**
+ * Sets the download priority of the objects fetched by the calling thread,
+ * e.g. low for prefetching.
+ */
+void SetFetchPriority(const download::Priorities priority) {
+  GetTLS()->download_job.priority = priority;
+}
+
 /**
  * Initializes the cache directory with the 256 subdirectories and /txn.
  *
@@ -153,8 +352,13 @@ bool Init(const string &cache_path) {
   cache_mode_ = kCacheReadWrite;
   cache_path_ = new string(cache_path);
   queues_download_ = new ThreadQueues();
+  partial_objects_ = new PartialObjects();
+  block_files_ = new BlockFiles();
+  block_cache_ = new BlockCache();
+  atomic_init32(&num_block_files_);
   tls_blocks_ = new vector<ThreadLocalStorage *>();
   atomic_init64(&num_download_);
+  atomic_init64(&num_download_dedup_);
 
   if (!MakeCacheDirectories(cache_path, 0700))
     return false;
@@ -180,9 +384,20 @@ void Fini() {
   pthread_key_delete(thread_local_storage_);
   delete cache_path_;
   delete queues_download_;
+  delete partial_objects_;
+  for (BlockFiles::iterator i = block_files_->begin(),
+       iEnd = block_files_->end(); i != iEnd; ++i)
+  {
+    delete i->second;
+  }
+  delete block_files_;
+  delete block_cache_;
   delete tls_blocks_;
   cache_path_ = NULL;
   queues_download_ = NULL;
+  partial_objects_ = NULL;
+  block_files_ = NULL;
+  block_cache_ = NULL;
   tls_blocks_ = NULL;
 }
 
@@ -402,30 +617,211 @@ static bool CommitFromMem(const hash::Any &id, const unsigned char *buffer,
 }
 
 
+/**
+ * Takes the lock file that announces the download of an object to the other
+ * processes of a shared cache.  Waits up to kInflightTimeoutMs if another
+ * process holds it.
+ *
+ * @param[in] checksum  content hash of the object
+ * @param[out] waited   true if another process held the lock
+ * \return file descriptor of the locked file, -1 if locking failed or timed
+ *         out
+ */
+static int LockInflight(const hash::Any &checksum, bool *waited) {
+  *waited = false;
+  const string path = *cache_path_ + "/txn/inflight." + checksum.ToString();
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CREAT, 0600);
+  if (fd < 0)
+    return -1;
+  const unsigned kPollMs = 50;
+  for (unsigned waited_ms = 0; waited_ms <= kInflightTimeoutMs;
+       waited_ms += kPollMs)
+  {
+    if (flock(fd, LOCK_EX | LOCK_NB) == 0)
+      return fd;
+    if (errno != EWOULDBLOCK)
+      break;
+    *waited = true;
+    SafeSleepMs(kPollMs);
+  }
+  if (*waited) {
+    LogCvmfs(kLogCache, kLogDebug, "gave up waiting for the download of %s "
+             "by another process", checksum.ToString().c_str());
+  }
+  close(fd);
+  return -1;
+}
+
+
+/**
+ * Like LockInflight() but fails instead of blocking if another process holds
+ * the lock.
+ */
+static int TryLockInflight(const hash::Any &checksum) {
+  const string path = *cache_path_ + "/txn/inflight." + checksum.ToString();
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CREAT, 0600);
+  if (fd < 0)
+    return -1;
+  if (flock(fd, LOCK_EX | LOCK_NB) == 0)
+    return fd;
+  close(fd);
+  return -1;
+}
+
+
+/**
+ * Removes and releases a lock file taken by LockInflight().  A process
+ * that opened the file before can still get the lock; it finds the object in
+ * the cache or downloads it a second time.
+ */
+static void UnlockInflight(const int fd, const hash::Any &checksum) {
+  if (fd < 0)
+    return;
+  unlink((*cache_path_ + "/txn/inflight." + checksum.ToString()).c_str());
+  close(fd);
+}
+
+
+/**
+ * Holds the lock file of LockInflight() for the lifetime of the object.
+ */
+class InflightGuard {
+ public:
+  explicit InflightGuard(const hash::Any &checksum) : checksum_(checksum) {
+    fd_ = LockInflight(checksum_, &waited_);
+  }
+  ~InflightGuard() { UnlockInflight(fd_, checksum_); }
+  bool waited() const { return waited_; }
+ private:
+  hash::Any checksum_;
+  int fd_;
+  bool waited_;
+};
+
+
+/**
+ * Replaces the decompressed file of a running transaction by a block file, if
+ * that saves space.  On failure, the transaction is left untouched.
+ *
+ * @param[in,out] temp_path  Temporary file of the transaction
+ * @param[in] size           Decompressed size of the file
+ * @param[out] size_on_disk  Size of the file that will be committed
+ */
+static void CompressTransaction(string *temp_path, const uint64_t size,
+                                uint64_t *size_on_disk)
+{
+  *size_on_disk = size;
+  const int fd_src = ::open(temp_path->c_str(), O_RDONLY);
+  if (fd_src < 0)
+    return;
+
+  const string block_template = GetTempName();
+  char block_path[block_template.length() + 1];
+  memcpy(block_path, block_template.data(), block_template.length());
+  block_path[block_template.length()] = '\0';
+  FILE *fblock = NULL;
+  const int fd_block = ::mkstemp(block_path);
+  if ((fd_block < 0) || ((fblock = fdopen(fd_block, "w")) == NULL)) {
+    if (fd_block >= 0) {
+      close(fd_block);
+      unlink(block_path);
+    }
+    close(fd_src);
+    return;
+  }
+
+  uint64_t block_size_on_disk;
+  const bool retval = blockfile::Write(fd_src, size, compressed_block_size_,
+                                       fblock, &block_size_on_disk);
+  fclose(fblock);
+  close(fd_src);
+  if (!retval || (block_size_on_disk >= size)) {
+    LogCvmfs(kLogCache, kLogDebug, "keeping %s decompressed",
+             temp_path->c_str());
+    unlink(block_path);
+    return;
+  }
+
+  LogCvmfs(kLogCache, kLogDebug, "compressed %s: %"PRIu64" --> %"PRIu64,
+           temp_path->c_str(), size, block_size_on_disk);
+  unlink(temp_path->c_str());
+  *temp_path = block_path;
+  *size_on_disk = block_size_on_disk;
+}
+
+
+/**
+ * Registers fd for Pread() if it points to a block file.  Plain files have
+ * exactly the decompressed size of the object.  Files of a different size
+ * that are not valid block files are returned as they are.
+ *
+ * \return fd or the negative error code that was passed in
+ */
+static int RegisterFd(const int fd, const hash::Any &checksum,
+                      const uint64_t size)
+{
+  if (fd < 0)
+    return fd;
+  platform_stat64 info;
+  if ((platform_fstat(fd, &info) != 0) ||
+      (static_cast<uint64_t>(info.st_size) == size))
+  {
+    return fd;
+  }
+
+  BlockFile *block_file = new BlockFile(checksum);
+  if (!blockfile::ReadIndex(fd, info.st_size, &block_file->index) ||
+      (block_file->index.size != size))
+  {
+    LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
+             "size check failure for cached copy of %s, expected %"PRIu64", "
+             "got %"PRId64, checksum.ToString().c_str(), size,
+             static_cast<int64_t>(info.st_size));
+    delete block_file;
+    return fd;
+  }
+
+  pthread_mutex_lock(&lock_block_files_);
+  BlockFiles::iterator iter = block_files_->find(fd);
+  if (iter != block_files_->end()) {
+    // A stale entry of an fd that was closed without Close()
+    delete iter->second;
+    iter->second = block_file;
+  } else {
+    (*block_files_)[fd] = block_file;
+    atomic_inc32(&num_block_files_);
+  }
+  pthread_mutex_unlock(&lock_block_files_);
+  return fd;
+}
+
+
 /**
  * Returns a read-only file descriptor for a specific catalog entry, which could
  * be a complete file in the CAS as well as a chunk of a file.
  * After successful call, the data resides in local cache.
  * File is downloaded via HTTP if it is not in the local cache.
  * If multiple concurrent requests arrive for a file, the requests are queued
- * and only the first one performs the download.
+ * and only the first one performs the download.  If another process sharing
+ * the cache is downloading the file, the first request waits for its commit.
  *
  * @param[in] checksum     content hash of the file to be fetched
  * @param[in] hash_suffix  optional hash suffix to append in the download job
  * @param[in] size         the required disk size of the downloaded data chunk
+ * @param[in] compression_alg  how the object is stored on the server
  * @param[in] cvmfs_path   Path of the chunk as seen in cvmfs
  *
  * \return Read-only file descriptor for the file pointing into local cache.
  *         On failure a negative error code.
  */
-static int Fetch(const hash::Any &checksum,
-                 const string    &hash_suffix,
-                 const uint64_t   size,
-                 const string    &cvmfs_path)
+static int Fetch(const hash::Any        &checksum,
+                 const string           &hash_suffix,
+                 const uint64_t          size,
+                 const zlib::Algorithms  compression_alg,
+                 const string           &cvmfs_path)
 {
   CallGuard call_guard;
   int fd_return;  // Read-only file descriptor that is returned
-  int retval;
 
   // Try to open from local cache
   if ((fd_return = cache::Open(checksum)) >= 0) {
@@ -444,23 +840,16 @@ static int Fetch(const hash::Any &checksum,
     return -ENOSPC;
   }
 
-  // Initialize TLS
-  ThreadLocalStorage *tls = static_cast<ThreadLocalStorage *>(
-                            pthread_getspecific(thread_local_storage_));
-  if (tls == NULL) {
-    tls = new ThreadLocalStorage();
-    retval = pipe(tls->pipe_wait);
-    assert(retval == 0);
-    tls->download_job.destination = download::kDestinationFile;
-    tls->download_job.compressed = true;
-    tls->download_job.probe_hosts = true;
-    retval = pthread_setspecific(thread_local_storage_, tls);
-    assert(retval == 0);
-    pthread_mutex_lock(&lock_tls_blocks_);
-    tls_blocks_->push_back(tls);
-    pthread_mutex_unlock(&lock_tls_blocks_);
+  // Written by a newer publisher
+  if (compression_alg >= zlib::kNumAlgorithms) {
+    LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
+             "unsupported compression algorithm %d for %s",
+             compression_alg, cvmfs_path.c_str());
+    return -EIO;
   }
 
+  ThreadLocalStorage *tls = GetTLS();
+
   // Lock queue and start downloading or enqueue
   pthread_mutex_lock(&lock_queues_download_);
   ThreadQueues::iterator iDownloadQueue = queues_download_->find(checksum);
@@ -489,17 +878,32 @@ static int Fetch(const hash::Any &checksum,
     pthread_mutex_unlock(&lock_queues_download_);
   }
 
-  // The download path starts here
-  LogCvmfs(kLogCache, kLogDebug, "downloading %s", cvmfs_path.c_str());
-  atomic_inc64(&num_download_);
-
+  bool waited;
+  const int fd_inflight = LockInflight(checksum, &waited);
   const string url = "/data" + checksum.MakePath(1, 2) + hash_suffix;
   string final_path;
   string temp_path;
-  int fd;  // Used to write the downloaded file
+  int fd = -1;  // Used to write the downloaded file
   FILE *f = NULL;
   int result = -EIO;
 
+  if (waited) {
+    // Another process downloaded the file meanwhile, unless it failed
+    result = cache::Open(checksum);
+    if (result >= 0) {
+      LogCvmfs(kLogCache, kLogDebug, "%s downloaded by another process",
+               cvmfs_path.c_str());
+      atomic_inc64(&num_download_dedup_);
+      quota::Touch(checksum);
+      goto fetch_finalize;
+    }
+    result = -EIO;
+  }
+
+  // The download path starts here
+  LogCvmfs(kLogCache, kLogDebug, "downloading %s", cvmfs_path.c_str());
+  atomic_inc64(&num_download_);
+
   fd = StartTransaction(checksum, &final_path, &temp_path);
   if (fd < 0) {
     LogCvmfs(kLogCache, kLogDebug, "could not start transaction on %s",
@@ -516,6 +920,7 @@ static int Fetch(const hash::Any &checksum,
   }
 
   tls->download_job.url = &url;
+  tls->download_job.compressed = (compression_alg != zlib::kNoCompression);
   tls->download_job.destination_file = f;
   tls->download_job.expected_hash = &checksum;
   download::Fetch(&tls->download_job);
@@ -545,13 +950,16 @@ static int Fetch(const hash::Any &checksum,
     LogCvmfs(kLogCache, kLogDebug, "trying to commit %s", final_path.c_str());
     fclose(f);
     fd = -1;
+    uint64_t size_on_disk = size;
+    if (compressed_block_size_ > 0)
+      CompressTransaction(&temp_path, size, &size_on_disk);
     fd_return = ::open(temp_path.c_str(), O_RDONLY);
     if (fd_return < 0) {
       result = -errno;
       goto fetch_finalize;
     }
     result = cache::CommitTransaction(final_path, temp_path, cvmfs_path,
-                                      checksum, size);
+                                      checksum, size_on_disk);
     if (result == 0) {
       platform_disable_kcache(fd_return);
       result = fd_return;
@@ -574,6 +982,7 @@ static int Fetch(const hash::Any &checksum,
     else close(fd);
     AbortTransaction(temp_path);
   }
+  UnlockInflight(fd_inflight, checksum);
 
   // Signal the waiting threads and remove the queue
   pthread_mutex_lock(&lock_queues_download_);
@@ -599,7 +1008,9 @@ static int Fetch(const hash::Any &checksum,
  *         On failure a negative error code.
  */
 int FetchDirent(const catalog::DirectoryEntry &d, const string &cvmfs_path) {
-  return Fetch(d.checksum(), "", d.size(), cvmfs_path);
+  return RegisterFd(Fetch(d.checksum(), "", d.size(),
+                          d.compression_algorithm(), cvmfs_path),
+                    d.checksum(), d.size());
 }
 
 
@@ -607,16 +1018,592 @@ int FetchDirent(const catalog::DirectoryEntry &d, const string &cvmfs_path) {
  * Returns a read-only file descriptor for a specific file chunk
  * After successful call, the file chunk resides in local cache.
  *
- * @param[in] chunk       Demanded file chunk
- * @param[in] cvmfs_path  Path of the full file as seen in cvmfs
+ * @param[in] chunk            Demanded file chunk
+ * @param[in] compression_alg  Compression algorithm of the full file
+ * @param[in] cvmfs_path       Path of the full file as seen in cvmfs
+ * \return Read-only file descriptor for the file pointing into local cache.
+ *         On failure a negative error code.
+ */
+int FetchChunk(const FileChunk &chunk,
+               const zlib::Algorithms compression_alg,
+               const string &cvmfs_path)
+{
+  return RegisterFd(Fetch(chunk.content_hash(),
+                          FileChunk::kCasSuffix,
+                          chunk.size(),
+                          compression_alg,
+                          cvmfs_path),
+                    chunk.content_hash(), chunk.size());
+}
+
+
+/**
+ * Like FetchDirent() but for callers that only know the content hash and size
+ * of a non-chunked file, such as the prefetcher.
+ *
+ * @param[in] checksum    Content hash of the file
+ * @param[in] size        Decompressed size of the file
+ * @param[in] compression_alg  Compression algorithm of the file
+ * @param[in] cvmfs_path  Path of the file as seen in cvmfs
  * \return Read-only file descriptor for the file pointing into local cache.
  *         On failure a negative error code.
  */
-int FetchChunk(const FileChunk &chunk, const string &cvmfs_path) {
-  return Fetch(chunk.content_hash(),
-               FileChunk::kCasSuffix,
-               chunk.size(),
-               cvmfs_path);
+int FetchFile(const hash::Any &checksum, const uint64_t size,
+              const zlib::Algorithms compression_alg,
+              const string &cvmfs_path)
+{
+  return RegisterFd(Fetch(checksum, "", size, compression_alg, cvmfs_path),
+                    checksum, size);
+}
+
+
+/**
+ * Reads from a file descriptor returned by one of the Fetch*() functions.
+ * For block files, only the touched blocks are decompressed, or taken from
+ * the in-memory block cache.  Same semantics as pread().
+ */
+ssize_t Pread(const int fd, void *buf, const size_t size, const off_t offset) {
+  if (atomic_read32(&num_block_files_) == 0)
+    return pread(fd, buf, size, offset);
+
+  BlockFile *block_file = NULL;
+  pthread_mutex_lock(&lock_block_files_);
+  BlockFiles::const_iterator iter = block_files_->find(fd);
+  if (iter != block_files_->end())
+    block_file = iter->second;
+  pthread_mutex_unlock(&lock_block_files_);
+  if (!block_file)
+    return pread(fd, buf, size, offset);
+
+  const blockfile::Index &index = block_file->index;
+  if (static_cast<uint64_t>(offset) >= index.size)
+    return 0;
+  const uint64_t end =
+    std::min(index.size, static_cast<uint64_t>(offset) + size);
+  char *dest = static_cast<char *>(buf);
+  uint64_t pos = offset;
+  while (pos < end) {
+    const unsigned block_idx = pos / index.block_size;
+    const uint64_t block_start =
+      static_cast<uint64_t>(block_idx) * index.block_size;
+    const uint64_t offset_in_block = pos - block_start;
+    const uint64_t nbytes =
+      std::min(end, block_start + index.BlockLength(block_idx)) - pos;
+    if (!block_cache_->Lookup(block_file->checksum, block_idx,
+                              offset_in_block, nbytes, dest))
+    {
+      void *block;
+      uint64_t block_size;
+      if (!blockfile::ReadBlock(fd, index, block_idx, &block, &block_size)) {
+        LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
+                 "failed to decompress block %u of %s", block_idx,
+                 block_file->checksum.ToString().c_str());
+        errno = EIO;
+        return -1;
+      }
+      memcpy(dest, static_cast<char *>(block) + offset_in_block, nbytes);
+      block_cache_->Insert(block_file->checksum, block_idx, block, block_size);
+    }
+    dest += nbytes;
+    pos += nbytes;
+  }
+  return end - offset;
+}
+
+
+/**
+ * Closes a file descriptor returned by one of the Fetch*() functions.
+ */
+int Close(const int fd) {
+  if (atomic_read32(&num_block_files_) > 0) {
+    pthread_mutex_lock(&lock_block_files_);
+    BlockFiles::iterator iter = block_files_->find(fd);
+    if (iter != block_files_->end()) {
+      delete iter->second;
+      block_files_->erase(iter);
+      atomic_dec32(&num_block_files_);
+    }
+    pthread_mutex_unlock(&lock_block_files_);
+  }
+  return close(fd);
+}
+
+
+/**
+ * Makes a file descriptor returned by one of the Fetch*() functions readable
+ * with plain read() and pread().  Block files are decompressed into an
+ * unlinked temporary file, fd is closed in that case.  Used by libcvmfs,
+ * which hands out the file descriptors, on a cache that is shared with a
+ * Fuse client in compressed mode.
+ *
+ * \return A plain file descriptor or a negative error code
+ */
+int ToPlainFd(const int fd) {
+  if ((fd < 0) || (atomic_read32(&num_block_files_) == 0))
+    return fd;
+  pthread_mutex_lock(&lock_block_files_);
+  const bool is_block_file = (block_files_->find(fd) != block_files_->end());
+  pthread_mutex_unlock(&lock_block_files_);
+  if (!is_block_file)
+    return fd;
+
+  const string plain_template = GetTempName();
+  char plain_path[plain_template.length() + 1];
+  memcpy(plain_path, plain_template.data(), plain_template.length());
+  plain_path[plain_template.length()] = '\0';
+  const int fd_plain = ::mkstemp(plain_path);
+  if (fd_plain < 0) {
+    Close(fd);
+    return -errno;
+  }
+  unlink(plain_path);
+
+  const unsigned kBufSize = 64*1024;
+  char *buf = static_cast<char *>(smalloc(kBufSize));
+  int result = fd_plain;
+  off_t pos = 0;
+  ssize_t nbytes;
+  while ((nbytes = Pread(fd, buf, kBufSize, pos)) > 0) {
+    if (write(fd_plain, buf, nbytes) != nbytes) {
+      nbytes = -1;
+      break;
+    }
+    pos += nbytes;
+  }
+  if (nbytes < 0) {
+    LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
+             "failed to decompress block file (%d)", errno);
+    close(fd_plain);
+    result = -EIO;
+  } else {
+    lseek(fd_plain, 0, SEEK_SET);
+  }
+  free(buf);
+  Close(fd);
+  return result;
+}
+
+
+/**
+ * Switches on the compressed cache mode for new downloads if block_size is
+ * greater than zero.  Block files that are already in the cache are read in
+ * either case.
+ */
+void SetCompressedParameters(const unsigned block_size,
+                             const uint64_t memcache_size)
+{
+  compressed_block_size_ = std::min(block_size, blockfile::kMaxBlockSize);
+  block_cache_->SetMaxSize(memcache_size);
+  LogCvmfs(kLogCache, kLogDebug, "compressed cache block size %u bytes, "
+           "block cache %"PRIu64" bytes", compressed_block_size_,
+           memcache_size);
+}
+
+
+string GetBlockCacheStats() {
+  return block_cache_->GetStats();
+}
+
+
+void SetPartialParameters(const uint64_t threshold, const unsigned block_size)
+{
+  partial_threshold_ = threshold;
+  if (block_size > 0)
+    partial_block_size_ = block_size;
+  LogCvmfs(kLogCache, kLogDebug, "partial fetch threshold %"PRIu64" bytes, "
+           "block size %u bytes", partial_threshold_, partial_block_size_);
+}
+
+
+/**
+ * Files of at least this size are opened as partial objects.  Zero if range
+ * requests are switched off.
+ */
+uint64_t GetPartialThreshold() {
+  return partial_threshold_;
+}
+
+
+PartialObject::PartialObject(const hash::Any &checksum, const uint64_t size,
+                             const string &cvmfs_path)
+{
+  checksum_ = checksum;
+  size_ = size;
+  cvmfs_path_ = cvmfs_path;
+  url_ = "/data" + checksum.MakePath(1, 2);
+  fd_ = -1;
+  fd_complete_ = -1;
+  file_ = NULL;
+  pos_compressed_ = 0;
+  pos_decompressed_ = 0;
+  complete_ = false;
+  broken_ = false;
+  fetching_ = false;
+  refcount_ = 1;
+  lock_ =
+    reinterpret_cast<pthread_mutex_t *>(smalloc(sizeof(pthread_mutex_t)));
+  int retval = pthread_mutex_init(lock_, NULL);
+  assert(retval == 0);
+  cond_fetched_ =
+    reinterpret_cast<pthread_cond_t *>(smalloc(sizeof(pthread_cond_t)));
+  retval = pthread_cond_init(cond_fetched_, NULL);
+  assert(retval == 0);
+}
+
+
+PartialObject::~PartialObject() {
+  if (file_) {
+    fclose(file_);
+    zlib::DecompressFini(&zstream_);
+  }
+  if (!complete_ && !temp_path_.empty())
+    AbortTransaction(temp_path_);
+  if (fd_ >= 0)
+    close(fd_);
+  if (fd_complete_ >= 0)
+    cache::Close(fd_complete_);
+  free(hash_context_.buffer);
+  pthread_cond_destroy(cond_fetched_);
+  free(cond_fetched_);
+  pthread_mutex_destroy(lock_);
+  free(lock_);
+}
+
+
+/**
+ * Creates the temporary file that receives the decompressed prefix.
+ */
+bool PartialObject::Start() {
+  int fd = StartTransaction(checksum_, &final_path_, &temp_path_);
+  if (fd < 0) {
+    temp_path_ = "";
+    return false;
+  }
+  file_ = fdopen(fd, "w");
+  if (!file_) {
+    close(fd);
+    return false;
+  }
+  fd_ = ::open(temp_path_.c_str(), O_RDONLY);
+  if (fd_ < 0) {
+    fclose(file_);
+    file_ = NULL;
+    return false;
+  }
+  platform_disable_kcache(fd_);
+
+  zlib::DecompressInit(&zstream_);
+  hash_context_ = hash::ContextPtr(checksum_.algorithm);
+  hash_context_.buffer = smalloc(hash_context_.size);
+  hash::Init(hash_context_);
+  atomic_inc64(&num_download_);
+  LogCvmfs(kLogCache, kLogDebug, "start partial download of %s into %s",
+           cvmfs_path_.c_str(), temp_path_.c_str());
+  return true;
+}
+
+
+/**
+ * Downloads the next block of the compressed stream and appends its
+ * decompressed contents to the temporary file.  Only the reader that set
+ * fetching_ calls this, without holding lock_.  The new size of the readable
+ * prefix is published by the caller.
+ *
+ * @param[out] pos_decompressed  size of the decompressed prefix
+ * @param[out] complete          true if the file is verified and committed
+ */
+bool PartialObject::FetchNextBlock(uint64_t *pos_decompressed,
+                                   bool *complete)
+{
+  *complete = false;
+  download::JobInfo download_job(&url_, false, true, NULL);
+  download_job.range_offset = pos_compressed_;
+  download_job.range_size = partial_block_size_;
+  download::Fetch(&download_job);
+  if (download_job.error_code != download::kFailOk) {
+    LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
+             "failed to fetch range %"PRIu64"+%u of %s (error %d)",
+             pos_compressed_, partial_block_size_, cvmfs_path_.c_str(),
+             download_job.error_code);
+    return false;
+  }
+
+  unsigned char *data =
+    reinterpret_cast<unsigned char *>(download_job.destination_mem.data);
+  uint64_t nbytes = download_job.destination_mem.size;
+  if (!download_job.partial_content) {
+    // The server ignored the Range header and sent the entire object
+    if (nbytes < pos_compressed_) {
+      free(download_job.destination_mem.data);
+      return false;
+    }
+    data += pos_compressed_;
+    nbytes -= pos_compressed_;
+  }
+  if (nbytes == 0) {
+    LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
+             "compressed stream of %s truncated at %"PRIu64,
+             cvmfs_path_.c_str(), pos_compressed_);
+    free(download_job.destination_mem.data);
+    return false;
+  }
+
+  hash::Update(data, nbytes, hash_context_);
+  zlib::StreamStates retval =
+    zlib::DecompressZStream2File(&zstream_, file_, data, nbytes);
+  free(download_job.destination_mem.data);
+  if ((retval == zlib::kStreamError) || (fflush(file_) != 0)) {
+    LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
+             "failed to decompress %s at %"PRIu64, cvmfs_path_.c_str(),
+             pos_compressed_);
+    return false;
+  }
+  pos_compressed_ += nbytes;
+  *pos_decompressed = zstream_.total_out;
+  LogCvmfs(kLogCache, kLogDebug, "partial object %s: %"PRIu64" compressed, "
+           "%"PRIu64" decompressed bytes", cvmfs_path_.c_str(),
+           pos_compressed_, *pos_decompressed);
+
+  if (retval == zlib::kStreamEnd) {
+    *complete = Finalize(*pos_decompressed);
+    return *complete;
+  }
+  if (*pos_decompressed > size_) {
+    LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
+             "size check failure for %s, expected %"PRIu64", got more",
+             cvmfs_path_.c_str(), size_);
+    return false;
+  }
+  return true;
+}
+
+
+/**
+ * Gives up on the range requests and downloads the entire object the regular
+ * way.  Inflating the compressed stream block by block up to a far offset
+ * takes one round trip per block, whereas a single download streams.  The
+ * temporary file of the prefix is dropped, readers that are still on it keep
+ * their data because fd_ stays open.  Same calling convention as
+ * FetchNextBlock().
+ *
+ * \return A file descriptor to be read with cache::Pread(), or a negative
+ *         error code.
+ */
+int PartialObject::FetchEntirely() {
+  LogCvmfs(kLogCache, kLogDebug, "read far beyond the %"PRIu64" bytes "
+           "prefix of %s, fetching the entire object", zstream_.total_out,
+           cvmfs_path_.c_str());
+  const int fd = RegisterFd(Fetch(checksum_, "", size_, zlib::kZlibDefault,
+                                  cvmfs_path_),
+                            checksum_, size_);
+  if (fd < 0)
+    return fd;
+
+  fclose(file_);
+  file_ = NULL;
+  zlib::DecompressFini(&zstream_);
+  AbortTransaction(temp_path_);
+  temp_path_ = "";
+  return fd;
+}
+
+
+/**
+ * Verifies the content hash of the complete stream and commits the file into
+ * the cache.  The open read-only file descriptor stays valid.
+ */
+bool PartialObject::Finalize(const uint64_t size_decompressed) {
+  fclose(file_);
+  file_ = NULL;
+  zlib::DecompressFini(&zstream_);
+
+  hash::Any match_hash(checksum_.algorithm);
+  hash::Final(hash_context_, &match_hash);
+  if (match_hash != checksum_) {
+    LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
+             "hash verification of %s failed (expected %s, got %s)",
+             cvmfs_path_.c_str(), checksum_.ToString().c_str(),
+             match_hash.ToString().c_str());
+    return false;
+  }
+  if (size_decompressed != size_) {
+    LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
+             "size check failure for %s, expected %"PRIu64", got %"PRIu64,
+             cvmfs_path_.c_str(), size_, size_decompressed);
+    return false;
+  }
+
+  if (cache_mode_ == kCacheReadOnly) {
+    AbortTransaction(temp_path_);
+    temp_path_ = "";
+    return true;
+  }
+  CommitTransaction(final_path_, temp_path_, cvmfs_path_, checksum_, size_);
+  temp_path_ = "";
+  return true;
+}
+
+
+/**
+ * Reads from the decompressed prefix, fetching more blocks of the compressed
+ * stream as required.  One reader at a time fetches; the others wait only if
+ * they need data beyond the prefix.  A read far beyond the prefix fetches the
+ * entire object instead.
+ *
+ * \return Number of bytes read or a negative error code.
+ */
+int64_t PartialObject::Read(char *buffer, const size_t size,
+                            const off_t offset)
+{
+  const uint64_t end = std::min(size_, static_cast<uint64_t>(offset) + size);
+  LockMutex(lock_);
+  while (!complete_ && !broken_ && (pos_decompressed_ < end)) {
+    if (fetching_) {
+      pthread_cond_wait(cond_fetched_, lock_);
+      continue;
+    }
+    fetching_ = true;
+    const bool far = static_cast<uint64_t>(offset) >
+      pos_decompressed_ + kFarReadBlocks * partial_block_size_;
+    UnlockMutex(lock_);
+
+    uint64_t pos_decompressed = 0;
+    bool complete = false;
+    int fd_complete = -1;
+    bool retval;
+    if (far) {
+      fd_complete = FetchEntirely();
+      retval = complete = (fd_complete >= 0);
+      pos_decompressed = size_;
+    } else {
+      retval = FetchNextBlock(&pos_decompressed, &complete);
+    }
+
+    LockMutex(lock_);
+    fetching_ = false;
+    if (retval) {
+      pos_decompressed_ = pos_decompressed;
+      complete_ = complete;
+      if (fd_complete >= 0)
+        fd_complete_ = fd_complete;
+    } else {
+      broken_ = true;
+    }
+    pthread_cond_broadcast(cond_fetched_);
+  }
+  if (broken_) {
+    UnlockMutex(lock_);
+    return -EIO;
+  }
+  const int fd = (fd_complete_ >= 0) ? fd_complete_ : fd_;
+  UnlockMutex(lock_);
+
+  // Data below pos_decompressed_ is immutable
+  const int64_t nbytes = cache::Pread(fd, buffer, size, offset);
+  if (nbytes < 0)
+    return -errno;
+  return nbytes;
+}
+
+
+/**
+ * Opens a large file for reading with range requests.  If the file is already
+ * in the cache or if it is not a zlib stream, the function behaves like
+ * FetchDirent() and partial is set to NULL.  Otherwise partial points to a
+ * (possibly shared) partial object that needs to be released with
+ * ClosePartial().
+ *
+ * \return Negative error code on failure.  If partial is NULL, a read-only
+ *         file descriptor into the cache.
+ */
+int OpenPartial(const catalog::DirectoryEntry &d, const string &cvmfs_path,
+                PartialObject **partial)
+{
+  CallGuard call_guard;
+  *partial = NULL;
+  if (d.compression_algorithm() != zlib::kZlibDefault)
+    return FetchDirent(d, cvmfs_path);
+
+  int fd_return = cache::Open(d.checksum());
+  if (fd_return >= 0) {
+    if (cache_mode_ == kCacheReadWrite)
+      quota::Touch(d.checksum());
+    return RegisterFd(fd_return, d.checksum(), d.size());
+  }
+
+  if (cache_mode_ == kCacheReadOnly)
+    return -EROFS;
+  if (d.size() > quota::GetMaxFileSize())
+    return -ENOSPC;
+
+  pthread_mutex_lock(&lock_partial_objects_);
+  PartialObjects::iterator iter = partial_objects_->find(d.checksum());
+  if (iter != partial_objects_->end()) {
+    PartialObject *existing = iter->second;
+    LockMutex(existing->lock_);
+    const bool usable = !existing->broken_;
+    UnlockMutex(existing->lock_);
+    if (usable) {
+      existing->refcount_++;
+      pthread_mutex_unlock(&lock_partial_objects_);
+      *partial = existing;
+      return 0;
+    }
+    // Broken objects stay with their current readers only
+    partial_objects_->erase(iter);
+  }
+
+  // Another process downloads the object, wait for it like FetchDirent() does
+  const int fd_inflight = TryLockInflight(d.checksum());
+  if (fd_inflight < 0) {
+    pthread_mutex_unlock(&lock_partial_objects_);
+    return FetchDirent(d, cvmfs_path);
+  }
+  fd_return = cache::Open(d.checksum());
+  if (fd_return >= 0) {
+    UnlockInflight(fd_inflight, d.checksum());
+    pthread_mutex_unlock(&lock_partial_objects_);
+    quota::Touch(d.checksum());
+    return RegisterFd(fd_return, d.checksum(), d.size());
+  }
+
+  PartialObject *new_object =
+    new PartialObject(d.checksum(), d.size(), cvmfs_path);
+  // The object is fetched on demand, possibly never entirely.  Other
+  // processes must not wait for it; they download the object themselves.
+  const bool started = new_object->Start();
+  UnlockInflight(fd_inflight, d.checksum());
+  if (!started) {
+    pthread_mutex_unlock(&lock_partial_objects_);
+    delete new_object;
+    LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
+             "failed to start partial download of %s", cvmfs_path.c_str());
+    return -EIO;
+  }
+  (*partial_objects_)[d.checksum()] = new_object;
+  pthread_mutex_unlock(&lock_partial_objects_);
+
+  *partial = new_object;
+  return 0;
+}
+
+
+void ClosePartial(PartialObject *partial) {
+  pthread_mutex_lock(&lock_partial_objects_);
+  partial->refcount_--;
+  if (partial->refcount_ > 0) {
+    pthread_mutex_unlock(&lock_partial_objects_);
+    return;
+  }
+  PartialObjects::iterator iter = partial_objects_->find(partial->checksum_);
+  if ((iter != partial_objects_->end()) && (iter->second == partial))
+    partial_objects_->erase(iter);
+  pthread_mutex_unlock(&lock_partial_objects_);
+
+  LogCvmfs(kLogCache, kLogDebug, "closing partial object %s (%s)",
+           partial->cvmfs_path_.c_str(),
+           partial->complete_ ? "complete" : "incomplete");
+  delete partial;
 }
 
 
@@ -625,6 +1612,15 @@ int64_t GetNumDownloads() {
 }
 
 
+/**
+ * Number of fetches that took the file another process had downloaded while
+ * they waited.
+ */
+int64_t GetNumDeduplicatedDownloads() {
+  return atomic_read64(&num_download_dedup_);
+}
+
+
 CatalogManager::CatalogManager(const string &repo_name,
                                const bool ignore_signature)
 {
@@ -635,6 +1631,8 @@ CatalogManager::CatalogManager(const string &repo_name,
   loaded_inodes_ = all_inodes_ = 0;
   atomic_init32(&certificate_hits_);
   atomic_init32(&certificate_misses_);
+  if (cache_path_)
+    signature_cache_.Load(*cache_path_ + "/signatures." + repo_name);
 }
 
 
@@ -678,6 +1676,55 @@ void CatalogManager::ActivateCatalog(const catalog::Catalog *catalog) {
 }
 
 
+/**
+ * Changed nested catalogs that are not in the cache are loaded lazily after a
+ * remount, so that the remount does not block on downloads.
+ */
+bool CatalogManager::IsCatalogCached(const hash::Any &hash) {
+  return FileExists(*cache_path_ + hash.MakePath(1, 2));
+}
+
+
+/**
+ * Pins a catalog that is already in the cache.
+ *
+ * \return false if the catalog is not in the cache, otherwise true and the
+ *         result of loading the catalog in load_error
+ */
+static bool LoadCachedCatalog(const hash::Any &hash, const string &cvmfs_path,
+                              string *catalog_path,
+                              catalog::LoadError *load_error)
+{
+  const string cache_path = *cache_path_ + hash.MakePath(1, 2);
+  *catalog_path = cache_path + "T";
+  int retval = rename(cache_path.c_str(), catalog_path->c_str());
+  if (retval != 0)
+    return false;
+  LogCvmfs(kLogCache, kLogDebug, "found catalog %s in cache",
+           hash.ToString().c_str());
+
+  if (cache_mode_ == kCacheReadWrite) {
+    const int64_t size = GetFileSize(catalog_path->c_str());
+    assert(size > 0);
+    const bool pin_retval = quota::Pin(hash, uint64_t(size), cvmfs_path, true);
+    if (!pin_retval) {
+      quota::Remove(hash);
+      unlink(catalog_path->c_str());
+      LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
+               "failed to pin cached copy of catalog %s (no space)",
+               hash.ToString().c_str());
+      *load_error = catalog::kLoadNoSpace;
+      return true;
+    }
+  }
+  // Pinned, can be safely renamed
+  retval = rename(catalog_path->c_str(), cache_path.c_str());
+  *catalog_path = cache_path;
+  *load_error = catalog::kLoadNew;
+  return true;
+}
+
+
 catalog::LoadError CatalogManager::LoadCatalogCas(const hash::Any &hash,
                                                   const string &cvmfs_path,
                                                   std::string *catalog_path)
@@ -686,37 +1733,24 @@ catalog::LoadError CatalogManager::LoadCatalogCas(const hash::Any &hash,
   int64_t size;
   int retval;
   bool pin_retval;
+  catalog::LoadError load_error;
 
   // Try from cache
-  const string cache_path = *cache_path_ + hash.MakePath(1, 2);
-  *catalog_path = cache_path + "T";
-  retval = rename(cache_path.c_str(), catalog_path->c_str());
-  if (retval == 0) {
-    LogCvmfs(kLogCache, kLogDebug, "found catalog %s in cache",
-             hash.ToString().c_str());
-
-    if (cache_mode_ == kCacheReadWrite) {
-      size = GetFileSize(catalog_path->c_str());
-      assert(size > 0);
-      pin_retval = quota::Pin(hash, uint64_t(size), cvmfs_path, true);
-      if (!pin_retval) {
-        quota::Remove(hash);
-        unlink(catalog_path->c_str());
-        LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
-                 "failed to pin cached copy of catalog %s (no space)",
-                 hash.ToString().c_str());
-        return catalog::kLoadNoSpace;
-      }
-    }
-    // Pinned, can be safely renamed
-    retval = rename(catalog_path->c_str(), cache_path.c_str());
-    *catalog_path = cache_path;
-    return catalog::kLoadNew;
-  }
+  if (LoadCachedCatalog(hash, cvmfs_path, catalog_path, &load_error))
+    return load_error;
 
   if (cache_mode_ == kCacheReadOnly)
     return catalog::kLoadFail;
 
+  // Another process of a shared cache might download the catalog already
+  InflightGuard inflight(hash);
+  if (inflight.waited() &&
+      LoadCachedCatalog(hash, cvmfs_path, catalog_path, &load_error))
+  {
+    atomic_inc64(&num_download_dedup_);
+    return load_error;
+  }
+
   // Download
   string temp_path;
   int catalog_fd = StartTransaction(hash, catalog_path, &temp_path);
@@ -731,6 +1765,7 @@ catalog::LoadError CatalogManager::LoadCatalogCas(const hash::Any &hash,
 
   const string url = "/data" + hash.MakePath(1, 2) + "C";
   download::JobInfo download_catalog(&url, true, true, catalog_file, &hash);
+  download_catalog.priority = download::kPriorityHigh;
   download::Fetch(&download_catalog);
   fclose(catalog_file);
   if (download_catalog.error_code != download::kFailOk) {
@@ -766,6 +1801,174 @@ catalog::LoadError CatalogManager::LoadCatalogCas(const hash::Any &hash,
 }
 
 
+/**
+ * Downloads a catalog into the cache as a regular, unpinned object.  It is
+ * pinned once it is loaded by LoadCatalogCas().
+ */
+bool CatalogManager::PrefetchCatalog(const hash::Any &hash,
+                                     const string &cvmfs_path,
+                                     string *catalog_path)
+{
+  *catalog_path = *cache_path_ + hash.MakePath(1, 2);
+  if (FileExists(*catalog_path))
+    return true;
+  InflightGuard inflight(hash);
+  if (inflight.waited() && FileExists(*catalog_path)) {
+    atomic_inc64(&num_download_dedup_);
+    return true;
+  }
+
+  string temp_path;
+  int catalog_fd = StartTransaction(hash, catalog_path, &temp_path);
+  if (catalog_fd < 0)
+    return false;
+  FILE *catalog_file = fdopen(catalog_fd, "w");
+  if (!catalog_file) {
+    AbortTransaction(temp_path);
+    return false;
+  }
+
+  const string url = "/data" + hash.MakePath(1, 2) + "C";
+  download::JobInfo download_catalog(&url, true, true, catalog_file, &hash);
+  download::Fetch(&download_catalog);
+  fclose(catalog_file);
+  if (download_catalog.error_code != download::kFailOk) {
+    LogCvmfs(kLogCache, kLogDebug, "unable to prefetch catalog %s (%d)",
+             hash.ToString().c_str(), download_catalog.error_code);
+    AbortTransaction(temp_path);
+    return false;
+  }
+
+  const int64_t size = GetFileSize(temp_path.c_str());
+  if ((size <= 0) || (uint64_t(size) > quota::GetMaxFileSize())) {
+    AbortTransaction(temp_path);
+    return false;
+  }
+  return CommitTransaction(*catalog_path, temp_path, cvmfs_path, hash,
+                           uint64_t(size)) == 0;
+}
+
+
+/**
+ * Reads the hash and the publish date of the root catalog that was loaded
+ * last from the cvmfschecksum file.  The hash is null if the catalog is not
+ * in the cache.
+ */
+void CatalogManager::ReadChecksum(hash::Any *hash, uint64_t *last_modified) {
+  const string checksum_path = (*cache_path_) + "/cvmfschecksum." + repo_name_;
+  *hash = hash::Any();
+  *last_modified = 0;
+
+  FILE *file_checksum = fopen(checksum_path.c_str(), "r");
+  char tmp[40];
+  if (file_checksum && (fread(tmp, 1, 40, file_checksum) == 40)) {
+    *hash = hash::Any(hash::kSha1, hash::HexPtr(string(tmp, 40)));
+    if (!FileExists("." + hash->MakePath(1, 2))) {
+      LogCvmfs(kLogCache, kLogDebug, "found checksum hint without catalog");
+      *hash = hash::Any();
+    } else {
+      // Get local last modified time
+      char buf_modified;
+      string str_modified;
+      if ((fread(&buf_modified, 1, 1, file_checksum) == 1) &&
+          (buf_modified == 'T'))
+      {
+        while (fread(&buf_modified, 1, 1, file_checksum) == 1)
+          str_modified += string(&buf_modified, 1);
+        *last_modified = String2Uint64(str_modified);
+        LogCvmfs(kLogCache, kLogDebug, "cached copy publish date %s",
+                 StringifyTime(*last_modified, true).c_str());
+      }
+    }
+  } else {
+    LogCvmfs(kLogCache, kLogDebug, "unable to read local checksum");
+  }
+  if (file_checksum) fclose(file_checksum);
+}
+
+
+/**
+ * Fetches and verifies the manifest ahead of the TTL.  For a new revision,
+ * also downloads the new root catalog and those of the changed nested
+ * catalogs that are currently loaded.  The following remount then neither
+ * needs the network nor the signature checks.
+ */
+catalog::LoadError CatalogManager::Prefetch() {
+  if (cache_mode_ == kCacheReadOnly)
+    return catalog::kLoadFail;
+
+  hash::Any cache_hash;
+  uint64_t cache_last_modified;
+  ReadChecksum(&cache_hash, &cache_last_modified);
+  cache::ManifestEnsemble ensemble(this);
+  manifest::Failures manifest_failure =
+    manifest::Fetch("", repo_name_, cache_last_modified, &cache_hash,
+                    &ensemble);
+  if (manifest_failure != manifest::kFailOk) {
+    LogCvmfs(kLogCache, kLogDebug, "failed to prefetch manifest (%d)",
+             manifest_failure);
+    return catalog::kLoadFail;
+  }
+  const hash::Any root_hash = ensemble.manifest->catalog_hash();
+  const bool is_new = root_hash != cache_hash;
+
+  if (is_new) {
+    ReadLock();
+    const map<PathString, hash::Any> mounted_catalogs = mounted_catalogs_;
+    Unlock();
+
+    // Breadth-first through the new tree, as far as it is loaded right now
+    catalog::Catalog::NestedCatalogList queue;
+    catalog::Catalog::NestedCatalog root;
+    root.path = PathString("", 0);
+    root.hash = root_hash;
+    queue.push_back(root);
+    for (unsigned i = 0; i < queue.size(); ++i) {
+      const string mountpoint(queue[i].path.GetChars(),
+                              queue[i].path.GetLength());
+      const string cvmfs_path = "file catalog at " + repo_name_ + ":" +
+        (mountpoint.empty() ? "/" : mountpoint) + " (" +
+        queue[i].hash.ToString() + ")";
+      string catalog_path;
+      if (!PrefetchCatalog(queue[i].hash, cvmfs_path, &catalog_path)) {
+        if (i == 0)
+          return catalog::kLoadFail;
+        continue;
+      }
+
+      catalog::Catalog *catalog = catalog::Catalog::AttachFreely(
+        mountpoint, catalog_path, queue[i].hash);
+      if (!catalog)
+        continue;
+      catalog::Catalog::NestedCatalogList *nested =
+        catalog->ListNestedCatalogs();
+      for (unsigned j = 0; j < nested->size(); ++j) {
+        map<PathString, hash::Any>::const_iterator iter =
+          mounted_catalogs.find((*nested)[j].path);
+        if ((iter != mounted_catalogs.end()) &&
+            (iter->second != (*nested)[j].hash))
+        {
+          queue.push_back((*nested)[j]);
+        }
+      }
+      delete catalog;
+    }
+    LogCvmfs(kLogCache, kLogDebug, "prefetched revision with root catalog %s "
+             "and %u changed nested catalogs",
+             root_hash.ToString().c_str(), queue.size() - 1);
+
+    if (ensemble.cert_buf) {
+      CommitFromMem(ensemble.manifest->certificate(),
+                    ensemble.cert_buf, ensemble.cert_size,
+                    "certificate for " + repo_name_);
+    }
+  }
+
+  prefetched_manifest_.Set(*ensemble.manifest, time(NULL) + GetTTL());
+  return is_new ? catalog::kLoadNew : catalog::kLoadUp2Date;
+}
+
+
 catalog::LoadError CatalogManager::LoadCatalog(const PathString &mountpoint,
                                                const hash::Any  &hash,
                                                std::string      *catalog_path,
@@ -798,39 +2001,18 @@ catalog::LoadError CatalogManager::LoadCatalog(const PathString &mountpoint,
   const string checksum_path = (*cache_path_) + "/cvmfschecksum." + repo_name_;
   hash::Any cache_hash;
   uint64_t cache_last_modified = 0;
+  ReadChecksum(&cache_hash, &cache_last_modified);
 
-  // Load local checksum
-  FILE *file_checksum = fopen(checksum_path.c_str(), "r");
-  char tmp[40];
-  if (file_checksum && (fread(tmp, 1, 40, file_checksum) == 40)) {
-    cache_hash = hash::Any(hash::kSha1, hash::HexPtr(string(tmp, 40)));
-    if (!FileExists("." + cache_hash.MakePath(1, 2))) {
-      LogCvmfs(kLogCache, kLogDebug, "found checksum hint without catalog");
-      cache_hash = hash::Any();
-    } else {
-      // Get local last modified time
-      char buf_modified;
-      string str_modified;
-      if ((fread(&buf_modified, 1, 1, file_checksum) == 1) &&
-          (buf_modified == 'T'))
-      {
-        while (fread(&buf_modified, 1, 1, file_checksum) == 1)
-          str_modified += string(&buf_modified, 1);
-        cache_last_modified = String2Uint64(str_modified);
-        LogCvmfs(kLogCache, kLogDebug, "cached copy publish date %s",
-                 StringifyTime(cache_last_modified, true).c_str());
-      }
-    }
-  } else {
-    LogCvmfs(kLogCache, kLogDebug, "unable to read local checksum");
-  }
-  if (file_checksum) fclose(file_checksum);
-
-  // Load and verify remote checksum
-  manifest::Failures manifest_failure;
+  // Load and verify remote checksum, unless Prefetch() did so recently.  The
+  // dry run of a remount leaves the prefetched manifest for the remount.
+  manifest::Failures manifest_failure = manifest::kFailOk;
   cache::ManifestEnsemble ensemble(this);
-  manifest_failure = manifest::Fetch("", repo_name_, cache_last_modified,
-                                     &cache_hash, &ensemble);
+  if (!prefetched_manifest_.Get(catalog_path != NULL, cache_last_modified,
+                                time(NULL), &ensemble))
+  {
+    manifest_failure = manifest::Fetch("", repo_name_, cache_last_modified,
+                                       &cache_hash, &ensemble);
+  }
   if (manifest_failure != manifest::kFailOk) {
     LogCvmfs(kLogCache, kLogDebug, "failed to fetch manifest (%d)",
              manifest_failure);
@@ -860,6 +2042,7 @@ catalog::LoadError CatalogManager::LoadCatalog(const PathString &mountpoint,
   }
 
   offline_mode_ = false;
+  certificate_hint_ = ensemble.manifest->certificate();
   cvmfs_path += " (" + ensemble.manifest->catalog_hash().ToString() + ")";
   LogCvmfs(kLogCache, kLogDebug, "remote checksum is %s",
            ensemble.manifest->catalog_hash().ToString().c_str());
@@ -903,17 +2086,19 @@ catalog::LoadError CatalogManager::LoadCatalog(const PathString &mountpoint,
   loaded_catalogs_[mountpoint] = ensemble.manifest->catalog_hash();
   *catalog_hash = ensemble.manifest->catalog_hash();
 
-  // Store new manifest and certificate
-  CommitFromMem(ensemble.manifest->certificate(),
-                ensemble.cert_buf, ensemble.cert_size,
-                "certificate for " + repo_name_);
+  // Store new manifest and certificate (Prefetch() stored the certificate)
+  if (ensemble.cert_buf) {
+    CommitFromMem(ensemble.manifest->certificate(),
+                  ensemble.cert_buf, ensemble.cert_size,
+                  "certificate for " + repo_name_);
+  }
   int fdchksum = open(checksum_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
   if (fdchksum >= 0) {
     string cache_checksum =
       ensemble.manifest->catalog_hash().ToString() +
       "T" + StringifyInt(ensemble.manifest->publish_timestamp());
 
-    file_checksum = fdopen(fdchksum, "w");
+    FILE *file_checksum = fdopen(fdchksum, "w");
     if (file_checksum) {
       if (fwrite(&(cache_checksum[0]), 1, cache_checksum.length(),
                  file_checksum) != cache_checksum.length())
@@ -6,7 +6,10 @@
 #define CVMFS_CACHE_H_
 
 #include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
 
+#include <cstdio>
 #include <string>
 #include <map>
 #include <vector>
@@ -16,6 +19,10 @@
 #include "shortstring.h"
 #include "atomic.h"
 #include "manifest_fetch.h"
+#include "compression.h"
+#include "download.h"
+#include "hash.h"
+#include "util.h"
 
 namespace catalog {
 class DirectoryEntry;
@@ -39,19 +46,96 @@ void Fini();
 int Open(const hash::Any &id);
 int FetchDirent(const catalog::DirectoryEntry &d,
                 const std::string &cvmfs_path);
-int FetchChunk(const FileChunk &chunk, const std::string &cvmfs_path);
+int FetchChunk(const FileChunk &chunk,
+               const zlib::Algorithms compression_alg,
+               const std::string &cvmfs_path);
+int FetchFile(const hash::Any &checksum, const uint64_t size,
+              const zlib::Algorithms compression_alg,
+              const std::string &cvmfs_path);
 int64_t GetNumDownloads();
+int64_t GetNumDeduplicatedDownloads();
+void SetFetchPriority(const download::Priorities priority);
+ssize_t Pread(const int fd, void *buf, const size_t size, const off_t offset);
+int Close(const int fd);
+int ToPlainFd(const int fd);
+
+void SetCompressedParameters(const unsigned block_size,
+                             const uint64_t memcache_size);
+std::string GetBlockCacheStats();
 
 CacheModes GetCacheMode();
 void TearDown2ReadOnly();
 
 
+/**
+ * A large, non-chunked file that is fetched piece by piece with HTTP range
+ * requests while it is read.  Objects are stored zlib-compressed on the
+ * server, so the compressed stream can only be inflated front to back.  The
+ * partial object keeps the inflate state and the running content hash and
+ * fetches further blocks of the compressed stream only when a read goes
+ * beyond the decompressed prefix.  Once the stream is complete and the
+ * content hash matches, the file is committed into the cache like any other
+ * download.
+ *
+ * Note that bytes served from an incomplete partial object have not been
+ * verified yet.  The mode is therefore opt-in.
+ */
+class PartialObject : SingleCopy {
+  friend int OpenPartial(const catalog::DirectoryEntry &d,
+                         const std::string &cvmfs_path,
+                         PartialObject **partial);
+  friend void ClosePartial(PartialObject *partial);
+
+ public:
+  int64_t Read(char *buffer, const size_t size, const off_t offset);
+
+ private:
+  PartialObject(const hash::Any &checksum, const uint64_t size,
+                const std::string &cvmfs_path);
+  ~PartialObject();
+  bool Start();
+  bool FetchNextBlock(uint64_t *pos_decompressed, bool *complete);
+  int FetchEntirely();
+  bool Finalize(const uint64_t size_decompressed);
+
+  hash::Any checksum_;
+  uint64_t size_;  /**< Decompressed size, as stored in the catalog */
+  std::string cvmfs_path_;
+  std::string url_;
+  std::string final_path_;
+  std::string temp_path_;
+  int fd_;  /**< Read-only file descriptor to the (partial) file */
+  int fd_complete_;  /**< Set if the object was fetched entirely */
+  // Owned by the reader that set fetching_
+  FILE *file_;  /**< Sink for decompressed data, NULL once complete */
+  z_stream zstream_;
+  hash::ContextPtr hash_context_;
+  uint64_t pos_compressed_;  /**< Bytes of the compressed stream fetched */
+  // Protected by lock_
+  uint64_t pos_decompressed_;  /**< Size of the readable prefix */
+  bool complete_;
+  bool broken_;
+  bool fetching_;  /**< A reader fetches without holding lock_ */
+  unsigned refcount_;
+  pthread_mutex_t *lock_;
+  pthread_cond_t *cond_fetched_;
+};
+
+void SetPartialParameters(const uint64_t threshold, const unsigned block_size);
+uint64_t GetPartialThreshold();
+int OpenPartial(const catalog::DirectoryEntry &d,
+                const std::string &cvmfs_path,
+                PartialObject **partial);
+void ClosePartial(PartialObject *partial);
+
+
 /**
  * A catalog manager that fetches its catalogs remotely and stores
  * them in the cache.
  */
 class CatalogManager : public catalog::AbstractCatalogManager {
-  friend class ManifestEnsemble;  // Maintains certificate hit/miss counters
+  // Certificate hint, signature cache, and hit/miss counters
+  friend class ManifestEnsemble;
 
  public:
   CatalogManager(const std::string &repo_name,
@@ -59,6 +143,7 @@ class CatalogManager : public catalog::AbstractCatalogManager {
   virtual ~CatalogManager() { };
 
   bool InitFixed(const hash::Any &root_hash);
+  catalog::LoadError Prefetch();
 
   hash::Any GetRootHash() {
     ReadLock();
@@ -68,7 +153,9 @@ class CatalogManager : public catalog::AbstractCatalogManager {
   }
   std::string GetCertificateStats() {
     return "hits: " + StringifyInt(atomic_read32(&certificate_hits_)) + "    " +
-    "misses: " + StringifyInt(atomic_read32(&certificate_misses_)) + "\n";
+    "misses: " + StringifyInt(atomic_read32(&certificate_misses_)) + "\n" +
+    "  verified signatures reused: " +
+    StringifyInt(signature_cache_.num_hits()) + "\n";
   }
   bool offline_mode() const { return offline_mode_; }
   uint64_t all_inodes() const { return all_inodes_; }
@@ -84,11 +171,15 @@ class CatalogManager : public catalog::AbstractCatalogManager {
                                   const hash::Any  &catalog_hash,
                                   catalog::Catalog *parent_catalog);
   void ActivateCatalog(const catalog::Catalog *catalog);
+  bool IsCatalogCached(const hash::Any &hash);
 
  private:
   catalog::LoadError LoadCatalogCas(const hash::Any &hash,
                                     const std::string &cvmfs_path,
                                     std::string *catalog_path);
+  bool PrefetchCatalog(const hash::Any &hash, const std::string &cvmfs_path,
+                       std::string *catalog_path);
+  void ReadChecksum(hash::Any *hash, uint64_t *last_modified);
 
   /**
    * required for unpinning
@@ -101,18 +192,29 @@ class CatalogManager : public catalog::AbstractCatalogManager {
   bool offline_mode_;  /**< cached copy used because there is no network */
   atomic_int32 certificate_hits_;
   atomic_int32 certificate_misses_;
+  hash::Any certificate_hint_;  /**< certificate of the last manifest */
+  manifest::SignatureCache signature_cache_;
+  /**
+   * Verified by Prefetch() ahead of the TTL, used by the next remount instead
+   * of fetching the manifest again.
+   */
+  manifest::PrefetchedManifest prefetched_manifest_;
   uint64_t all_inodes_;
   uint64_t loaded_inodes_;
 };
 
 
 /**
- * Tries to fetch the certificate from cache
+ * Tries to fetch the certificate from cache.  The certificate of the last
+ * manifest is the hint on the next one.  Verified signatures are remembered
+ * in the cache directory.
  */
 class ManifestEnsemble : public manifest::ManifestEnsemble {
  public:
   explicit ManifestEnsemble(cache::CatalogManager *catalog_mgr) {
     catalog_mgr_ = catalog_mgr;
+    certificate_hint = catalog_mgr->certificate_hint_;
+    signature_cache = &catalog_mgr->signature_cache_;
   }
   void FetchCertificate(const hash::Any &hash);
  private:
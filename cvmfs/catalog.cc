@@ -164,7 +164,7 @@ bool Catalog::OpenDatabase(const string &db_path) {
 
   // Read Catalog Counter Statistics
   const bool statistics_loaded =
-    (database().schema_version() < Database::kLatestSupportedSchema -
+    (database().schema_version() < Database::kLatestSchema -
                                    Database::kSchemaEpsilon)
       ? counters_.ReadFromDatabase(database(), LegacyMode::kLegacy)
       : counters_.ReadFromDatabase(database());
@@ -296,6 +296,58 @@ bool Catalog::ListingMd5Path(const hash::Md5 &md5path,
 }
 
 
+/**
+ * Collects the path hashes of the entries that were added, removed, or
+ * modified with respect to a previous revision of this catalog.  Both
+ * databases are compared by sqlite, the previous one is attached for the
+ * time of the query.
+ * @return false if the catalogs cannot be compared
+ */
+bool Catalog::ListChangedMd5Paths(const Catalog &previous,
+                                  vector<hash::Md5> *md5paths) const
+{
+  // Catalogs before schema 2.1 have a different set of columns
+  if ((schema() < 2.1-Database::kSchemaEpsilon) ||
+      (previous.schema() < 2.1-Database::kSchemaEpsilon))
+  {
+    return false;
+  }
+  const string fields = "md5path_1, md5path_2, hardlinks, hash, size, mode, "
+                        "mtime, flags, name, symlink, uid, gid";
+  const string previous_path = previous.database_path();
+  bool retval;
+
+  pthread_mutex_lock(lock_);
+  Sql attach(database(), "ATTACH :path AS previous;");
+  retval = attach.BindText(1, previous_path) && attach.Execute();
+  if (retval) {
+    {
+      Sql diff(database(),
+        "SELECT md5path_1, md5path_2 FROM "
+        "(SELECT " + fields + " FROM catalog EXCEPT "
+        " SELECT " + fields + " FROM previous.catalog) "
+        "UNION "
+        "SELECT md5path_1, md5path_2 FROM "
+        "(SELECT " + fields + " FROM previous.catalog EXCEPT "
+        " SELECT " + fields + " FROM catalog);");
+      while (diff.FetchRow())
+        md5paths->push_back(diff.RetrieveMd5(0, 1));
+      retval = (diff.GetLastError() == SQLITE_DONE);
+    }
+    // The previous database must not be in use anymore
+    Sql detach(database(), "DETACH previous;");
+    retval = detach.Execute() && retval;
+  }
+  pthread_mutex_unlock(lock_);
+
+  if (!retval) {
+    LogCvmfs(kLogCatalog, kLogDebug, "failed to compare %s with %s",
+             database_path().c_str(), previous_path.c_str());
+  }
+  return retval;
+}
+
+
 bool Catalog::AllChunksBegin() {
   return sql_all_chunks_->Open();
 }
@@ -128,6 +128,8 @@ class Catalog : public SingleCopy {
     return ListingMd5PathStat(hash::Md5(path.GetChars(), path.GetLength()),
                               listing);
   }
+  bool ListChangedMd5Paths(const Catalog &previous,
+                           std::vector<hash::Md5> *md5paths) const;
   bool AllChunksBegin();
   bool AllChunksNext(hash::Any *hash, ChunkTypes *type);
   bool AllChunksEnd();
@@ -151,7 +153,10 @@ class Catalog : public SingleCopy {
   inline Catalog* parent() const { return parent_; }
   inline uint64_t max_row_id() const { return max_row_id_; }
   inline InodeRange inode_range() const { return inode_range_; }
-  inline void set_inode_range(const InodeRange value) { inode_range_ = value; }
+  inline void set_inode_range(const InodeRange value) {
+    inode_range_ = value;
+    hardlink_groups_.clear();  // cached inodes depend on the range
+  }
   inline std::string database_path() const { return database_->filename(); }
   inline PathString root_prefix() const { return root_prefix_; }
   inline hash::Any hash() const { return catalog_hash_; }
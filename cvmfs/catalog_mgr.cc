@@ -9,6 +9,8 @@
 #include <inttypes.h>
 #include <cassert>
 
+#include <algorithm>
+
 #include "logging.h"
 #include "smalloc.h"
 #include "shortstring.h"
@@ -76,10 +78,13 @@ bool AbstractCatalogManager::Init() {
 
 /**
  * Remounts the root catalog if necessary.  If a newer root catalog exists,
- * it is mounted and replaces the currently mounted tree (all existing catalogs
- * are detached)
+ * it is mounted and replaces the currently mounted tree.  Nested catalogs
+ * that did not change are moved into the new tree, see Transplant().
+ * If diff is given, it is filled with the changes of the new tree.
  */
-LoadError AbstractCatalogManager::Remount(const bool dry_run) {
+LoadError AbstractCatalogManager::Remount(const bool dry_run,
+                                          RemountDiff *diff)
+{
   LogCvmfs(kLogCatalog, kLogDebug,
            "remounting repositories (dry run %d)", dry_run);
   if (dry_run)
@@ -97,17 +102,35 @@ LoadError AbstractCatalogManager::Remount(const bool dry_run) {
                                            &catalog_hash);
   if (load_error == kLoadNew) {
     inode_t old_inode_gauge = inode_gauge_;
-    DetachAll();
+    // The old tree is taken apart while the new one is built
+    Catalog *old_root = catalogs_.empty() ? NULL : GetRootCatalog();
+    catalogs_.clear();
+    if (old_root)
+      UnloadCatalog(old_root);
     inode_gauge_ = AbstractCatalogManager::kInodeOffset;
 
     Catalog *new_root = CreateCatalog(PathString("", 0), catalog_hash, NULL);
     assert(new_root);
     bool retval = AttachCatalog(catalog_path, new_root);
     assert(retval);
+    if (old_root) {
+      const unsigned num_kept = Transplant(old_root, new_root, diff);
+      delete old_root;
+      LogCvmfs(kLogCatalog, kLogDebug,
+               "kept %u unchanged nested catalogs", num_kept);
+    }
 
     if (inode_annotation_) {
       inode_annotation_->IncGeneration(old_inode_gauge);
     }
+    if (diff) {
+      for (map<const Catalog *, inode_t>::iterator
+           i = diff->inode_shifts.begin(), iEnd = diff->inode_shifts.end();
+           i != iEnd; ++i)
+      {
+        i->second = AnnotateOffset(i->first->inode_range()) - i->second;
+      }
+    }
   }
   Unlock();
 
@@ -115,6 +138,194 @@ LoadError AbstractCatalogManager::Remount(const bool dry_run) {
 }
 
 
+/**
+ * Decides if a cached directory entry is stale after the remount.  Entries of
+ * unchanged catalogs stay valid.  Unchanged entries of replaced catalogs stay
+ * valid, too, they are moved to the successor catalog.  The md5paths have to
+ * be sorted.
+ *
+ * With remap_inode, an entry gets the inode of the new generation, like a
+ * fresh lookup.  The inodes of unchanged catalogs move with their inode
+ * range.  Row ids of replaced catalogs, hard link groups, and nested catalog
+ * roots do not map that simply; these entries are looked up again.
+ * Otherwise the entry keeps its inode, e.g. if it is cached by inode.
+ */
+bool RemountDiff::IsStale(const hash::Md5 &md5path, DirectoryEntry *dirent,
+                          const bool remap_inode) const
+{
+  const bool changed = binary_search(md5paths.begin(), md5paths.end(),
+                                     md5path);
+  if (dirent->IsNegative())
+    return changed || new_nested;
+
+  map<const Catalog *, Catalog *>::const_iterator successor =
+    successors.find(dirent->catalog());
+  if ((successor == successors.end()) || (successor->second == NULL))
+    return true;
+  const bool kept = (successor->second == dirent->catalog());
+  if (!kept && changed)
+    return true;
+  if (!remap_inode) {
+    dirent->set_catalog(successor->second);
+    return false;
+  }
+
+  if (kept && (dirent->hardlink_group() == 0) &&
+      !dirent->IsNestedCatalogRoot())
+  {
+    map<const Catalog *, inode_t>::const_iterator shift =
+      inode_shifts.find(dirent->catalog());
+    if (shift == inode_shifts.end())
+      return true;
+    dirent->set_inode(dirent->inode() + shift->second);
+    return false;
+  }
+  return !successor->second->LookupMd5Path(md5path, dirent);
+}
+
+
+/**
+ * Compares a replaced catalog with its successor, see RemountDiff.
+ */
+static void DiffCatalogs(const Catalog *old_catalog,
+                         Catalog *new_catalog,
+                         RemountDiff *diff)
+{
+  diff->successors[old_catalog] = new_catalog;
+  if (!diff->complete)
+    return;
+
+  diff->num_rows += old_catalog->max_row_id() + new_catalog->max_row_id();
+  if ((diff->num_rows > RemountDiff::kMaxRows) ||
+      !new_catalog->ListChangedMd5Paths(*old_catalog, &diff->md5paths))
+  {
+    LogCvmfs(kLogCatalog, kLogDebug, "changes in %s not determined",
+             new_catalog->path().c_str());
+    diff->complete = false;
+    diff->md5paths.clear();
+    return;
+  }
+
+  // Lookups of a directory that became a nested catalog have been negative
+  // in the parent catalog
+  const Catalog::NestedCatalogList *nested = new_catalog->ListNestedCatalogs();
+  for (Catalog::NestedCatalogList::const_iterator i = nested->begin(),
+       iEnd = nested->end(); i != iEnd; ++i)
+  {
+    hash::Any previous_hash;
+    if (!old_catalog->FindNested(i->path, &previous_hash))
+      diff->new_nested = true;
+  }
+}
+
+
+/**
+ * Moves the nested catalogs of old_catalog, which is no longer part of the
+ * tree, below its successor new_catalog.  Unchanged nested catalogs are
+ * re-parented together with their subtrees and open databases.  Changed
+ * nested catalogs are mounted in their new version and handled recursively,
+ * if the new version is in the cache.  Otherwise, they are dropped like the
+ * vanished ones and mounted again on the next lookup.  The caller deletes
+ * old_catalog.
+ *
+ * @return number of catalogs that were kept
+ */
+unsigned AbstractCatalogManager::Transplant(Catalog *old_catalog,
+                                            Catalog *new_catalog,
+                                            RemountDiff *diff)
+{
+  if (diff)
+    DiffCatalogs(old_catalog, new_catalog, diff);
+  unsigned num_kept = 0;
+  CatalogList children = old_catalog->GetChildren();
+  for (CatalogList::const_iterator i = children.begin(),
+       iEnd = children.end(); i != iEnd; ++i)
+  {
+    Catalog *child = *i;
+    old_catalog->RemoveChild(child);
+    hash::Any new_hash;
+    const bool found = new_catalog->FindNested(child->path(), &new_hash);
+    if (found && (new_hash == child->hash())) {
+      new_catalog->AddChild(child);
+      num_kept += AdoptSubtree(child, diff);
+      continue;
+    }
+    if (!found || new_hash.IsNull()) {
+      DropSubtree(child);
+      continue;
+    }
+
+    // Changed, the successor takes over the mountpoint
+    UnloadCatalog(child);
+    Catalog *successor = NULL;
+    if (IsCatalogCached(new_hash))
+      successor = MountCatalog(child->path(), new_hash, new_catalog);
+    if (successor) {
+      num_kept += Transplant(child, successor, diff);
+    } else if (diff) {
+      // Negative entries below the mountpoint cannot be checked
+      LogCvmfs(kLogCatalog, kLogDebug, "changes in %s not determined",
+               child->path().c_str());
+      diff->complete = false;
+    }
+    CatalogList orphans = child->GetChildren();
+    for (CatalogList::const_iterator j = orphans.begin(),
+         jEnd = orphans.end(); j != jEnd; ++j)
+    {
+      child->RemoveChild(*j);
+      DropSubtree(*j);
+    }
+    delete child;
+  }
+  return num_kept;
+}
+
+
+/**
+ * Registers a re-parented subtree with the catalog manager.  The catalogs
+ * get inode ranges of the new generation.  Until Remount() finishes, the
+ * inode shifts of the diff hold the old offsets.
+ *
+ * @return number of catalogs in the subtree
+ */
+unsigned AbstractCatalogManager::AdoptSubtree(Catalog *catalog,
+                                              RemountDiff *diff)
+{
+  if (diff) {
+    diff->successors[catalog] = catalog;
+    diff->inode_shifts[catalog] = AnnotateOffset(catalog->inode_range());
+  }
+  catalog->set_inode_range(AcquireInodes(catalog->max_row_id()));
+  catalogs_.push_back(catalog);
+  unsigned result = 1;
+  CatalogList children = catalog->GetChildren();
+  for (CatalogList::const_iterator i = children.begin(),
+       iEnd = children.end(); i != iEnd; ++i)
+  {
+    result += AdoptSubtree(*i, diff);
+  }
+  return result;
+}
+
+
+/**
+ * Unloads and frees a subtree that is not registered with the catalog
+ * manager anymore.
+ */
+void AbstractCatalogManager::DropSubtree(Catalog *catalog) {
+  CatalogList children = catalog->GetChildren();
+  for (CatalogList::const_iterator i = children.begin(),
+       iEnd = children.end(); i != iEnd; ++i)
+  {
+    catalog->RemoveChild(*i);
+    DropSubtree(*i);
+  }
+  ReleaseInodes(catalog->inode_range());
+  UnloadCatalog(catalog);
+  delete catalog;
+}
+
+
 /**
  * Detaches everything except the root catalog
  */
@@ -105,6 +105,39 @@ class InodeGenerationAnnotation : public InodeAnnotation {
 };
 
 
+/**
+ * Describes what a remount changed, so that caches of directory entries can be
+ * invalidated selectively.  The previously mounted catalogs are mapped to
+ * their successors, which are the catalogs themselves if they are unchanged.
+ * Catalogs that are gone have no successor.  For replaced catalogs, the path
+ * hashes of added, removed, and modified entries are listed.  If the changes
+ * cannot be determined, complete is false and all cached entries are stale.
+ */
+struct RemountDiff {
+  /**
+   * Comparing catalogs blocks the file system, larger changes are not worth
+   * the time.  The comparison takes a few microseconds per row.
+   */
+  static const uint64_t kMaxRows = 10000;
+
+  RemountDiff() : complete(true), new_nested(false), num_rows(0) { }
+
+  bool IsStale(const hash::Md5 &md5path, DirectoryEntry *dirent,
+               const bool remap_inode) const;
+
+  std::map<const Catalog *, Catalog *> successors;
+  /**
+   * Unchanged catalogs get a new inode range.  The inodes of their entries
+   * move by this much.
+   */
+  std::map<const Catalog *, inode_t> inode_shifts;
+  std::vector<hash::Md5> md5paths;
+  bool complete;
+  bool new_nested;  /**< negative entries may be hidden by a nested catalog */
+  uint64_t num_rows;  /**< number of rows of the compared catalogs */
+};
+
+
 class AbstractCatalogManager;
 /**
  * Here, the Cwd Buffer is registered in order to save the inodes of
@@ -139,7 +172,7 @@ class AbstractCatalogManager {
 
   void SetInodeAnnotation(InodeAnnotation *new_annotation);
   virtual bool Init();
-  LoadError Remount(const bool dry_run);
+  LoadError Remount(const bool dry_run, RemountDiff *diff = NULL);
   void DetachNested();
 
   //bool LookupInode(const inode_t inode, const LookupOptions options,
@@ -208,6 +241,11 @@ class AbstractCatalogManager {
                                 hash::Any   *catalog_hash) = 0;
   virtual void UnloadCatalog(const Catalog *catalog) { };
   virtual void ActivateCatalog(const Catalog *catalog) { };
+  /**
+   * Tells if LoadCatalog() finds the catalog without downloading it.  On
+   * remount, only such changed nested catalogs are mounted right away.
+   */
+  virtual bool IsCatalogCached(const hash::Any &hash) { return true; }
 
   /**
    * Create a new Catalog object.
@@ -231,6 +269,10 @@ class AbstractCatalogManager {
   void DetachCatalog(Catalog *catalog);
   void DetachSubtree(Catalog *catalog);
   void DetachAll() { if (!catalogs_.empty()) DetachSubtree(GetRootCatalog()); }
+  unsigned Transplant(Catalog *old_catalog, Catalog *new_catalog,
+                      RemountDiff *diff);
+  unsigned AdoptSubtree(Catalog *catalog, RemountDiff *diff);
+  void DropSubtree(Catalog *catalog);
   bool IsAttached(const PathString &root_path,
                   Catalog **attached_catalog) const;
 
@@ -274,6 +316,13 @@ class AbstractCatalogManager {
                                         const int level) const;
 
   InodeRange AcquireInodes(uint64_t size);
+  /**
+   * Inode of row 0 of a catalog in the current generation
+   */
+  inline inode_t AnnotateOffset(const InodeRange range) const {
+    return inode_annotation_ ?
+      inode_annotation_->Annotate(range.offset) : range.offset;
+  }
   void ReleaseInodes(const InodeRange chunk);
 };  // class CatalogManager
 
@@ -31,7 +31,8 @@ WritableCatalog::WritableCatalog(const string     &path,
   sql_chunks_remove_(NULL),
   sql_max_link_id_(NULL),
   sql_inc_linkcount_(NULL),
-  dirty_(false)
+  dirty_(false),
+  compression_schema_(false)
 {
   read_only_ = false;
 }
@@ -145,6 +146,11 @@ void WritableCatalog::AddEntry(const DirectoryEntry &entry,
     sql_insert_->Execute();
   assert(retval);
   sql_insert_->Reset();
+  if (entry.IsRegular() &&
+      (entry.compression_algorithm() != zlib::kZlibDefault))
+  {
+    RequireCompressionSchema();
+  }
 
   delta_counters_.Increment(entry);
 }
@@ -220,6 +226,11 @@ void WritableCatalog::UpdateEntry(const DirectoryEntry &entry,
     sql_update_->Execute();
   assert(retval);
   sql_update_->Reset();
+  if (entry.IsRegular() &&
+      (entry.compression_algorithm() != zlib::kZlibDefault))
+  {
+    RequireCompressionSchema();
+  }
 }
 
 void WritableCatalog::AddFileChunk(const std::string &entry_path,
@@ -271,6 +282,29 @@ void WritableCatalog::RemoveFileChunks(const std::string &entry_path) {
 }
 
 
+/**
+ * Raises the schema of the catalog once it refers to an object that is not
+ * zlib compressed.  Catalogs without such objects stay readable by older
+ * clients.
+ */
+void WritableCatalog::RequireCompressionSchema() {
+  if (compression_schema_ ||
+      (schema() > Database::kCompressionSchema - Database::kSchemaEpsilon))
+  {
+    return;
+  }
+  SetDirty();
+  Sql sql_schema(database(), "INSERT OR REPLACE INTO properties "
+                             "(key, value) VALUES ('schema', :schema);");
+  bool retval = sql_schema.BindDouble(1, Database::kCompressionSchema) &&
+                sql_schema.Execute();
+  assert(retval);
+  compression_schema_ = true;
+  LogCvmfs(kLogCatalog, kLogVerboseMsg, "raised schema of catalog %s to %f",
+           path().ToString().c_str(), Database::kCompressionSchema);
+}
+
+
 /**
  * Sets the last modified time stamp of this catalog to current time.
  */
@@ -617,6 +651,11 @@ void WritableCatalog::CopyToParent() {
   retval = Sql(database(), "DETACH other;").Execute();
   assert(retval);
   parent->SetDirty();
+  if (compression_schema_ ||
+      (schema() > Database::kCompressionSchema - Database::kSchemaEpsilon))
+  {
+    parent->RequireCompressionSchema();
+  }
 
   // Change the just copied nested catalog root to an ordinary directory
   // (the nested catalog is merged into it's parent)
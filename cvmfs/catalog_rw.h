@@ -75,6 +75,7 @@ class WritableCatalog : public Catalog {
   void RemoveNestedCatalog(const std::string &mountpoint,
                            Catalog **attached_reference);
 
+  void RequireCompressionSchema();
   void UpdateLastModified();
   void IncrementRevision();
   void SetRevision(const uint64_t new_revision);
@@ -115,6 +116,7 @@ class WritableCatalog : public Catalog {
   SqlIncLinkcount     *sql_inc_linkcount_;
 
   bool dirty_;  /**< Indicates if the catalog has been changed */
+  bool compression_schema_;  /**< Schema raised to kCompressionSchema */
 
   DeltaCounters delta_counters_;
 
@@ -21,7 +21,8 @@ using namespace std;  // NOLINT
 namespace catalog {
 
 const float Database::kLatestSchema = 2.5;
-const float Database::kLatestSupportedSchema = 2.5;  // + 1.X catalogs (r/o)
+const float Database::kLatestSupportedSchema = 2.6;  // + 1.X catalogs (r/o)
+const float Database::kCompressionSchema = 2.6;
 const float Database::kSchemaEpsilon = 0.0005;  // floats get imprecise in SQlite
 
 
@@ -96,8 +97,8 @@ Database::Database(const std::string filename,
            schema_version_);
   if ( (schema_version_ >= 2.0-kSchemaEpsilon)                   &&
        (!IsEqualSchema(schema_version_, kLatestSupportedSchema)) &&
-       (!IsEqualSchema(schema_version_, 2.4)           ||
-        !IsEqualSchema(kLatestSupportedSchema, 2.5)) )
+       (!IsEqualSchema(schema_version_, kLatestSchema))          &&
+       (!IsEqualSchema(schema_version_, 2.4)) )
   {
     LogCvmfs(kLogCatalog, kLogDebug, "schema version %f not supported (%s)",
              schema_version_, filename.c_str());
@@ -289,6 +290,10 @@ unsigned SqlDirent::CreateDatabaseFlags(const DirectoryEntry &entry) const {
 
   if (entry.IsChunkedFile())
     database_flags |= kFlagFileChunk;
+  if (entry.IsRegular()) {
+    database_flags |= (entry.compression_algorithm() << kFlagPosCompression) &
+                      kFlagCompressionMask;
+  }
 
   return database_flags;
 }
@@ -467,6 +472,8 @@ DirectoryEntry SqlLookup::GetDirent(const Catalog *catalog) const {
   result.size_     = RetrieveInt64(2);
   result.mtime_    = RetrieveInt64(4);
   result.checksum_ = RetrieveSha1Blob(0);
+  result.compression_algorithm_ = static_cast<zlib::Algorithms>(
+    (database_flags & kFlagCompressionMask) >> kFlagPosCompression);
   result.name_.Assign(name, strlen(name));
   result.symlink_.Assign(symlink, strlen(symlink));
   ExpandSymlink(&result.symlink_);
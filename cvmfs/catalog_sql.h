@@ -53,6 +53,11 @@ class Database {
  public:
   static const float kLatestSchema;
   static const float kLatestSupportedSchema;  // + 1.X catalogs (r/o)
+  /**
+   * Catalogs that refer to objects which are not zlib compressed.  Older
+   * clients refuse them instead of failing on the objects.
+   */
+  static const float kCompressionSchema;
   static const float kSchemaEpsilon;  // floats get imprecise in SQlite
 
   static bool IsEqualSchema(const float value, const float compare) {
@@ -194,6 +199,9 @@ class SqlDirent : public Sql {
   const static int kFlagLink                = 8;
   const static int kFlagFileStat            = 16;  // currently unused
   const static int kFlagFileChunk           = 64;
+  // Compression algorithm of regular files (zlib::Algorithms), 0 for zlib
+  const static int kFlagPosCompression      = 8;
+  const static int kFlagCompressionMask     = 7 << kFlagPosCompression;
 
  protected:
   /**
@@ -158,6 +158,88 @@ void DecompressFini(z_stream *strm) {
 }
 
 
+bool ParseCompressionAlgorithm(const string &name, Algorithms *algorithm) {
+  const string upper = ToUpper(name);
+  if ((upper == "ZLIB") || (upper == "DEFAULT"))
+    *algorithm = kZlibDefault;
+  else if (upper == "NONE")
+    *algorithm = kNoCompression;
+  else
+    return false;
+  return true;
+}
+
+
+string AlgorithmName(const Algorithms algorithm) {
+  switch (algorithm) {
+    case kZlibDefault:
+      return "zlib";
+    case kNoCompression:
+      return "none";
+    default:
+      return "unknown";
+  }
+}
+
+
+Compressor *Compressor::Construct(const Algorithms algorithm) {
+  switch (algorithm) {
+    case kZlibDefault:
+      return new ZlibCompressor();
+    case kNoCompression:
+      return new EchoCompressor();
+    default:
+      return NULL;
+  }
+}
+
+
+ZlibCompressor::ZlibCompressor() : Compressor(kZlibDefault) {
+  CompressInit(&stream_);
+}
+
+
+ZlibCompressor::~ZlibCompressor() {
+  CompressFini(&stream_);
+}
+
+
+StreamStates ZlibCompressor::Deflate(
+  const bool flush,
+  const unsigned char **inbuf, size_t *inbufsize,
+  unsigned char *outbuf, size_t *outbufsize)
+{
+  stream_.next_in = const_cast<unsigned char *>(*inbuf);
+  stream_.avail_in = *inbufsize;
+  stream_.next_out = outbuf;
+  stream_.avail_out = *outbufsize;
+  const int z_ret = deflate(&stream_, flush ? Z_FINISH : Z_NO_FLUSH);
+  if (z_ret == Z_STREAM_ERROR)
+    return kStreamError;
+
+  *inbuf += *inbufsize - stream_.avail_in;
+  *inbufsize = stream_.avail_in;
+  *outbufsize -= stream_.avail_out;
+  if (z_ret == Z_STREAM_END)
+    return kStreamEnd;
+  return (stream_.avail_out == 0) ? kStreamContinue : kStreamEnd;
+}
+
+
+StreamStates EchoCompressor::Deflate(
+  const bool flush __attribute__((unused)),
+  const unsigned char **inbuf, size_t *inbufsize,
+  unsigned char *outbuf, size_t *outbufsize)
+{
+  const size_t nbytes = min(*inbufsize, *outbufsize);
+  memcpy(outbuf, *inbuf, nbytes);
+  *inbuf += nbytes;
+  *inbufsize -= nbytes;
+  *outbufsize = nbytes;
+  return (*inbufsize > 0) ? kStreamContinue : kStreamEnd;
+}
+
+
 StreamStates DecompressZStream2File(z_stream *strm, FILE *f, const void *buf,
                                     const int64_t size)
 {
@@ -577,6 +659,106 @@ bool CompressMem2File(const unsigned char *buf, const size_t size,
 }
 
 
+/**
+ * Runs a piece of input through the compressor and hashes the output.  The
+ * output is also written to fdest unless it is NULL.
+ */
+static bool CompressPiece(Compressor *compressor, const bool flush,
+                          const unsigned char *data, size_t size,
+                          FILE *fdest, const hash::ContextPtr &hash_context)
+{
+  unsigned char out[kZChunk];
+  StreamStates state;
+  do {
+    size_t have = kZChunk;
+    state = compressor->Deflate(flush, &data, &size, out, &have);
+    if (state == kStreamError)
+      return false;
+    if (fdest && ((fwrite(out, 1, have, fdest) != have) || ferror(fdest)))
+      return false;
+    hash::Update(out, have, hash_context);
+  } while (state == kStreamContinue);
+  return true;
+}
+
+
+/**
+ * Like CompressMem2File() but with the given compression algorithm.
+ */
+bool CompressMem2File(const Algorithms algorithm,
+                      const unsigned char *buf, const size_t size,
+                      FILE *fdest, hash::Any *compressed_hash)
+{
+  Compressor *compressor = Compressor::Construct(algorithm);
+  if (compressor == NULL)
+    return false;
+  hash::ContextPtr hash_context(compressed_hash->algorithm);
+  hash_context.buffer = alloca(hash_context.size);
+  hash::Init(hash_context);
+
+  bool result = false;
+  size_t offset = 0;
+  bool flush;
+  do {
+    const size_t used = min(static_cast<size_t>(kZChunk), size - offset);
+    flush = (offset + used == size);
+    if (!CompressPiece(compressor, flush, buf + offset, used, fdest,
+                       hash_context))
+    {
+      goto compress_mem2file_final;
+    }
+    offset += used;
+  } while (!flush);
+
+  hash::Final(hash_context, compressed_hash);
+  result = true;
+
+ compress_mem2file_final:
+  delete compressor;
+  LogCvmfs(kLogCompress, kLogDebug, "%s compression finished with result %d",
+           AlgorithmName(algorithm).c_str(), result);
+  return result;
+}
+
+
+/**
+ * Computes the content hash an object would have if the file behind fd_src
+ * was stored with the given compression algorithm.  Reads from the beginning
+ * of the file, independent of the file position.
+ */
+bool CompressFd2Null(const int fd_src, const Algorithms algorithm,
+                     hash::Any *compressed_hash)
+{
+  Compressor *compressor = Compressor::Construct(algorithm);
+  if (compressor == NULL)
+    return false;
+  unsigned char in[kZChunk];
+  hash::ContextPtr hash_context(compressed_hash->algorithm);
+  hash_context.buffer = alloca(hash_context.size);
+  hash::Init(hash_context);
+
+  bool result = false;
+  off_t offset = 0;
+  bool flush;
+  do {
+    const ssize_t bytes_read = pread(fd_src, in, kZChunk, offset);
+    if (bytes_read < 0)
+      goto compress_fd2null_final;
+    flush = (static_cast<size_t>(bytes_read) < kZChunk);
+    if (!CompressPiece(compressor, flush, in, bytes_read, NULL, hash_context))
+      goto compress_fd2null_final;
+    offset += bytes_read;
+  } while (!flush);
+
+  hash::Final(hash_context, compressed_hash);
+  result = true;
+
+ compress_fd2null_final:
+  delete compressor;
+  return result;
+}
+
+
 /**
  * User of this function has to free out_buf.
  */
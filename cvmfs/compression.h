@@ -32,6 +32,84 @@ enum StreamStates {
   kStreamEnd,
 };
 
+/**
+ * Compression algorithms of objects in the content-addressable storage.  The
+ * value is stored in the catalog flags of regular files, so the numbers must
+ * not change.  Objects without an algorithm in the catalog are zlib streams.
+ */
+enum Algorithms {
+  kZlibDefault = 0,
+  kNoCompression,
+  kNumAlgorithms,  // Must be the last
+};
+
+bool ParseCompressionAlgorithm(const std::string &name, Algorithms *algorithm);
+std::string AlgorithmName(const Algorithms algorithm);
+
+
+/**
+ * Stream compressor for one object.  Deflate() consumes input and fills the
+ * output buffer.  It returns kStreamContinue if the output buffer is full and
+ * it has to be called again with the remaining input, kStreamEnd otherwise.
+ * Once flush is set, the input is the last piece of the object.
+ */
+class Compressor {
+ public:
+  static Compressor *Construct(const Algorithms algorithm);
+  virtual ~Compressor() { }
+
+  /**
+   * @param[in] flush           true for the last piece of input
+   * @param[in,out] inbuf       input, advanced by the consumed bytes
+   * @param[in,out] inbufsize   remaining input bytes
+   * @param[in] outbuf          output buffer
+   * @param[in,out] outbufsize  capacity of outbuf, number of written bytes
+   */
+  virtual StreamStates Deflate(const bool flush,
+                               const unsigned char **inbuf, size_t *inbufsize,
+                               unsigned char *outbuf, size_t *outbufsize) = 0;
+  Algorithms algorithm() const { return algorithm_; }
+
+ protected:
+  explicit Compressor(const Algorithms algorithm) : algorithm_(algorithm) { }
+
+ private:
+  Algorithms algorithm_;
+};
+
+
+/**
+ * The legacy zlib stream at the default compression level.  The level must
+ * not change because local verification (fsck, the scrubber) reproduces
+ * content hashes by compressing again.
+ */
+class ZlibCompressor : public Compressor {
+ public:
+  ZlibCompressor();
+  ~ZlibCompressor();
+  StreamStates Deflate(const bool flush,
+                       const unsigned char **inbuf, size_t *inbufsize,
+                       unsigned char *outbuf, size_t *outbufsize);
+
+ private:
+  z_stream stream_;
+};
+
+
+/**
+ * Stores objects as they are.  Clients neither need to inflate them nor does
+ * the publisher spend CPU on them, which pays off for data that is already
+ * compressed, such as archives and images.
+ */
+class EchoCompressor : public Compressor {
+ public:
+  EchoCompressor() : Compressor(kNoCompression) { }
+  StreamStates Deflate(const bool flush,
+                       const unsigned char **inbuf, size_t *inbufsize,
+                       unsigned char *outbuf, size_t *outbufsize);
+};
+
+
 void CompressInit(z_stream *strm);
 void DecompressInit(z_stream *strm);
 void CompressFini(z_stream *strm);
@@ -55,6 +133,11 @@ bool DecompressFile2File(FILE *fsrc, FILE *fdest);
 
 bool CompressMem2File(const unsigned char *buf, const size_t size,
                       FILE *fdest, hash::Any *compressed_hash);
+bool CompressMem2File(const Algorithms algorithm,
+                      const unsigned char *buf, const size_t size,
+                      FILE *fdest, hash::Any *compressed_hash);
+bool CompressFd2Null(const int fd_src, const Algorithms algorithm,
+                     hash::Any *compressed_hash);
 
 // User of these functions has to free out_buf, if successful
 bool CompressMem2Mem(const void *buf, const int64_t size,
@@ -38,6 +38,7 @@
 #include <stdint.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <pthread.h>
@@ -69,9 +70,12 @@
 #include "tracer.h"
 #include "download.h"
 #include "cache.h"
+#include "blockfile.h"
 #include "nfs_maps.h"
 #include "hash.h"
 #include "talk.h"
+#include "prefetch.h"
+#include "scrubber.h"
 #include "monitor.h"
 #include "signature.h"
 #include "quota.h"
@@ -115,6 +119,8 @@ const uint64_t kDefaultCacheSizeMb = 1024*1024*1024;  // 1G
 const unsigned int kShortTermTTL = 180;  /**< If catalog reload fails, try again
                                               in 3 minutes */
 const time_t kIndefiniteDeadline = time_t(-1);
+const unsigned kRefresherPoll = 30;  /**< Seconds between two looks at the
+                                          catalog deadline */
 
 const int kMaxInitIoDelay = 32; /**< Maximum start value for exponential
                                      backoff */
@@ -180,6 +186,10 @@ pid_t pid_ = 0;  /**< will be set after deamon() */
 time_t boot_time_;
 unsigned max_ttl_ = 0;
 pthread_mutex_t lock_max_ttl_ = PTHREAD_MUTEX_INITIALIZER;
+unsigned refresh_ahead_ = 0;  /**< seconds before TTL expiry, 0 is off */
+bool refresher_spawned_ = false;
+pthread_t thread_refresher_;
+int pipe_refresher_[2];
 catalog::InodeGenerationAnnotation *inode_annotation_ = NULL;
 cache::CatalogManager *catalog_manager_ = NULL;
 quota::ListenerHandle *unpin_listener_ = NULL;
@@ -211,6 +221,18 @@ uint64_t next_directory_handle_ = 0;
 // contains inode to chunklist and handle to fd maps
 ChunkTables *chunk_tables_;
 
+/**
+ * Large files that are read by HTTP range requests.  Their file handles have
+ * the kPartialHandleFlag bit set.
+ */
+typedef google::dense_hash_map<uint64_t, cache::PartialObject *,
+                               hash_murmur<uint64_t> >
+        PartialHandles;
+PartialHandles *partial_handles_ = NULL;
+pthread_mutex_t lock_partial_handles_ = PTHREAD_MUTEX_INITIALIZER;
+uint64_t next_partial_handle_ = 0;
+const uint64_t kPartialHandleFlag = uint64_t(1) << 62;
+
 atomic_int64 num_fs_open_;
 atomic_int64 num_fs_dir_open_;
 atomic_int64 num_fs_lookup_;
@@ -223,6 +245,7 @@ atomic_int32 num_io_error_;
 atomic_int32 open_files_; /**< number of currently open files by Fuse calls */
 atomic_int32 open_dirs_; /**< number of currently open directories */
 unsigned max_open_files_; /**< maximum allowed number of open files */
+unsigned num_download_threads_ = 1;
 const int kNumReservedFd = 512;  /**< Number of reserved file descriptors for
                                       internal use */
 
@@ -398,9 +421,57 @@ catalog::LoadError RemountStart() {
 }
 
 
+static bool FilterMd5PathCache(const hash::Md5 &md5path,
+                               catalog::DirectoryEntry *dirent, void *data)
+{
+  return static_cast<catalog::RemountDiff *>(data)->IsStale(md5path, dirent,
+                                                            true);
+}
+
+
+static bool FilterInodeCache(const fuse_ino_t &ino,
+                             catalog::DirectoryEntry *dirent, void *data)
+{
+  PathString path;
+  const bool found = nfs_maps_ ? nfs_maps::GetPath(ino, &path) :
+                                 inode_tracker_->FindPath(ino, &path);
+  if (!found)
+    return true;
+  return static_cast<catalog::RemountDiff *>(data)->IsStale(
+    hash::Md5(path.GetChars(), path.GetLength()), dirent, false);
+}
+
+
+/**
+ * Removes the entries from the meta-data caches that do not match the new
+ * catalog revision anymore.  Inodes are not reused by a remount, so the path
+ * cache stays valid.
+ */
+static void InvalidateCaches(catalog::RemountDiff *diff) {
+  if (!diff->complete) {
+    LogCvmfs(kLogCvmfs, kLogDebug, "dropping meta-data caches");
+    inode_cache_->Drop();
+    path_cache_->Drop();
+    md5path_cache_->Drop();
+    return;
+  }
+
+  // The cached root entry carries the root inode of the previous generation
+  diff->md5paths.push_back(hash::Md5("", 0));
+  sort(diff->md5paths.begin(), diff->md5paths.end());
+  const unsigned num_inodes = inode_cache_->Filter(FilterInodeCache, diff);
+  const unsigned num_md5paths =
+    md5path_cache_->Filter(FilterMd5PathCache, diff);
+  LogCvmfs(kLogCvmfs, kLogDebug, "%u entries changed, invalidated %u inode "
+           "cache entries and %u md5path cache entries",
+           unsigned(diff->md5paths.size() - 1), num_inodes, num_md5paths);
+}
+
+
 /**
  * If the caches are drained out, a new catalog revision is applied and
- * kernel caches are activated again.
+ * kernel caches are activated again.  The userspace meta-data caches keep the
+ * entries that did not change.
  */
 static void RemountFinish() {
   if (!atomic_cas32(&reload_critical_section_, 0, 1))
@@ -417,19 +488,19 @@ static void RemountFinish() {
     inode_cache_->Pause();
     path_cache_->Pause();
     md5path_cache_->Pause();
-    inode_cache_->Drop();
-    path_cache_->Drop();
-    md5path_cache_->Drop();
 
     // Ensure that all Fuse callbacks left the catalog query code
     remount_fence_->Block();
-    catalog::LoadError retval = catalog_manager_->Remount(false);
+    catalog::RemountDiff diff;
+    catalog::LoadError retval = catalog_manager_->Remount(false, &diff);
     if (inode_annotation_) {
       inode_generation_info_.inode_generation =
         inode_annotation_->GetGeneration();
     }
     remount_fence_->Unblock();
 
+    if (retval == catalog::kLoadNew)
+      InvalidateCaches(&diff);
     inode_cache_->Resume();
     path_cache_->Resume();
     md5path_cache_->Resume();
@@ -480,6 +551,46 @@ static void RemountCheck() {
 }
 
 
+/**
+ * Checks the manifest shortly before the catalog TTL expires.  A new revision
+ * is downloaded and verified ahead of time, so that RemountStart() and
+ * RemountFinish() on the request path find everything in the cache.
+ */
+static void *MainRefresher(void *data __attribute__((unused))) {
+  LogCvmfs(kLogCvmfs, kLogDebug, "starting catalog refresher");
+  struct pollfd watch_term;
+  watch_term.fd = pipe_refresher_[0];
+  watch_term.events = POLLIN | POLLPRI;
+  time_t refreshed_deadline = 0;
+  while (true) {
+    const time_t deadline = catalogs_valid_until_;
+    const time_t refresh_at = deadline - time_t(refresh_ahead_);
+    time_t now = time(NULL);
+    if ((deadline != refreshed_deadline) && (now >= refresh_at) &&
+        !atomic_read32(&maintenance_mode_) && !atomic_read32(&drainout_mode_))
+    {
+      catalog::LoadError retval = catalog_manager_->Prefetch();
+      LogCvmfs(kLogCvmfs, kLogDebug, "refreshed catalogs ahead of TTL (%d)",
+               retval);
+      refreshed_deadline = deadline;
+      now = time(NULL);
+    }
+
+    time_t timeout = kRefresherPoll;
+    if ((deadline != refreshed_deadline) && (refresh_at > now))
+      timeout = std::min(timeout, refresh_at - now);
+    watch_term.revents = 0;
+    int retval = poll(&watch_term, 1, timeout * 1000);
+    if ((retval < 0) && (errno == EINTR))
+      continue;
+    if (retval != 0)
+      break;
+  }
+  LogCvmfs(kLogCvmfs, kLogDebug, "stopping catalog refresher");
+  return NULL;
+}
+
+
 static bool GetDirentForInode(const fuse_ino_t ino,
                               catalog::DirectoryEntry *dirent)
 {
@@ -1025,7 +1136,8 @@ static void cvmfs_open(fuse_req_t req, fuse_ino_t ino,
       chunk_tables_->Lock();
       // Check again to avoid race
       if (!chunk_tables_->inode2chunks.Contains(ino)) {
-        chunk_tables_->inode2chunks.Insert(ino, FileChunkReflist(chunks, path));
+        chunk_tables_->inode2chunks.Insert(ino,
+          FileChunkReflist(chunks, path, dirent.compression_algorithm()));
         chunk_tables_->inode2references.Insert(ino, 1);
       } else {
         uint32_t refctr;
@@ -1053,7 +1165,40 @@ static void cvmfs_open(fuse_req_t req, fuse_ino_t ino,
     return;
   }
 
-  fd = cache::FetchDirent(dirent, string(path.GetChars(), path.GetLength()));
+  const uint64_t partial_threshold = cache::GetPartialThreshold();
+  if (partial_threshold && (dirent.size() >= partial_threshold)) {
+    cache::PartialObject *partial;
+    fd = cache::OpenPartial(dirent, string(path.GetChars(), path.GetLength()),
+                            &partial);
+    if (partial) {
+      if (atomic_xadd32(&open_files_, 1) >=
+          (static_cast<int>(max_open_files_))-kNumReservedFd)
+      {
+        atomic_dec32(&open_files_);
+        cache::ClosePartial(partial);
+        LogCvmfs(kLogCvmfs, kLogSyslogErr,
+                 "open file descriptor limit exceeded");
+        fuse_reply_err(req, EMFILE);
+        return;
+      }
+
+      pthread_mutex_lock(&lock_partial_handles_);
+      const uint64_t partial_handle = next_partial_handle_;
+      (*partial_handles_)[partial_handle] = partial;
+      ++next_partial_handle_;
+      pthread_mutex_unlock(&lock_partial_handles_);
+      LogCvmfs(kLogCvmfs, kLogDebug,
+               "file %s opened for range requests (handle %"PRIu64")",
+               path.c_str(), partial_handle);
+
+      fi->keep_cache = 0;
+      fi->fh = partial_handle | kPartialHandleFlag;
+      fuse_reply_open(req, fi);
+      return;
+    }
+  } else {
+    fd = cache::FetchDirent(dirent, string(path.GetChars(), path.GetLength()));
+  }
 
   if (fd >= 0) {
     if (atomic_xadd32(&open_files_, 1) <
@@ -1074,7 +1219,7 @@ static void cvmfs_open(fuse_req_t req, fuse_ino_t ino,
       fuse_reply_open(req, fi);
       return;
     } else {
-      if (close(fd) == 0) atomic_dec32(&open_files_);
+      if (cache::Close(fd) == 0) atomic_dec32(&open_files_);
       LogCvmfs(kLogCvmfs, kLogSyslogErr, "open file descriptor limit exceeded");
       fuse_reply_err(req, EMFILE);
       return;
@@ -1170,9 +1315,10 @@ static void cvmfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
       // Open file descriptor to chunk
       if ((chunk_fd.fd == -1) || (chunk_fd.chunk_idx != chunk_idx)) {
         // TODO: read-ahead
-        if (chunk_fd.fd != -1) close(chunk_fd.fd);
+        if (chunk_fd.fd != -1) cache::Close(chunk_fd.fd);
         string verbose_path = "Part of " + chunks.path.ToString();
         chunk_fd.fd = cache::FetchChunk(*chunks.list->AtPtr(chunk_idx),
+                                        chunks.compression_alg,
                                         verbose_path);
         if (chunk_fd.fd < 0) {
           chunk_fd.fd = -1;
@@ -1195,8 +1341,8 @@ static void cvmfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
       size_t bytes_to_read_in_chunk =
         std::min(bytes_to_read, remaining_bytes_in_chunk);
       const size_t bytes_fetched =
-        pread(chunk_fd.fd, data + overall_bytes_fetched,
-              bytes_to_read_in_chunk, offset_in_chunk);
+        cache::Pread(chunk_fd.fd, data + overall_bytes_fetched,
+                     bytes_to_read_in_chunk, offset_in_chunk);
 
       if (bytes_fetched == (size_t)-1) {
         LogCvmfs(kLogCvmfs, kLogSyslogErr, "read err no %d result %d (%s)",
@@ -1223,9 +1369,29 @@ static void cvmfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
     UnlockMutex(handle_lock);
     LogCvmfs(kLogCvmfs, kLogDebug, "released chunk file descriptor %d",
              chunk_fd.fd);
+  } else if (fi->fh & kPartialHandleFlag) {
+    const uint64_t partial_handle = fi->fh & ~kPartialHandleFlag;
+    cache::PartialObject *partial = NULL;
+    pthread_mutex_lock(&lock_partial_handles_);
+    PartialHandles::const_iterator iter_handle =
+      partial_handles_->find(partial_handle);
+    if (iter_handle != partial_handles_->end())
+      partial = iter_handle->second;
+    pthread_mutex_unlock(&lock_partial_handles_);
+    if (!partial) {
+      fuse_reply_err(req, EBADF);
+      return;
+    }
+
+    const int64_t nbytes = partial->Read(data, size, off);
+    if (nbytes < 0) {
+      fuse_reply_err(req, -nbytes);
+      return;
+    }
+    overall_bytes_fetched = nbytes;
   } else {
     const int64_t fd = fi->fh;
-    overall_bytes_fetched = pread(fd, data, size, off);
+    overall_bytes_fetched = cache::Pread(fd, data, size, off);
   }
 
   // Push it to user
@@ -1279,10 +1445,27 @@ static void cvmfs_release(fuse_req_t req, fuse_ino_t ino,
     chunk_tables_->Unlock();
 
     if (chunk_fd.fd != -1)
-      close(chunk_fd.fd);
+      cache::Close(chunk_fd.fd);
     atomic_dec32(&open_files_);
+  } else if (fi->fh & kPartialHandleFlag) {
+    const uint64_t partial_handle = fi->fh & ~kPartialHandleFlag;
+    LogCvmfs(kLogCvmfs, kLogDebug, "releasing partial handle %"PRIu64,
+             partial_handle);
+    cache::PartialObject *partial = NULL;
+    pthread_mutex_lock(&lock_partial_handles_);
+    PartialHandles::iterator iter_handle =
+      partial_handles_->find(partial_handle);
+    if (iter_handle != partial_handles_->end()) {
+      partial = iter_handle->second;
+      partial_handles_->erase(iter_handle);
+    }
+    pthread_mutex_unlock(&lock_partial_handles_);
+    if (partial) {
+      cache::ClosePartial(partial);
+      atomic_dec32(&open_files_);
+    }
   } else {
-    if (close(fd) == 0) {
+    if (cache::Close(fd) == 0) {
       atomic_dec32(&open_files_);
     }
   }
@@ -1379,18 +1562,21 @@ static void cvmfs_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
       if (fd < 0) {
         attribute_value = "Not in cache";
       } else {
+        // Cache entries that differ in size from the file are block files
         hash::Any hash(hash::kSha1);
-        FILE *f = fdopen(fd, "r");
-        if (!f) {
-          fuse_reply_err(req, EIO);
-          return;
+        platform_stat64 info;
+        bool retval = (platform_fstat(fd, &info) == 0);
+        if (retval && (static_cast<uint64_t>(info.st_size) != d.size())) {
+          retval =
+            blockfile::CompressFd2Null(fd, d.compression_algorithm(), &hash);
+        } else if (retval) {
+          retval = zlib::CompressFd2Null(fd, d.compression_algorithm(), &hash);
         }
-        if (!zlib::CompressFile2Null(f, &hash)) {
-          fclose(f);
+        close(fd);
+        if (!retval) {
           fuse_reply_err(req, EIO);
           return;
         }
-        fclose(f);
         attribute_value = hash.ToString() + " (SHA-1)";
       }
     } else {
@@ -1533,6 +1719,17 @@ bool Evict(const string &path) {
 }
 
 
+/**
+ * Objects in the compressed cache mode take less space than their size.
+ */
+static uint64_t GetSizeOnDisk(const int fd, const uint64_t size) {
+  platform_stat64 info;
+  if (platform_fstat(fd, &info) != 0)
+    return size;
+  return info.st_size;
+}
+
+
 bool Pin(const string &path) {
   catalog::DirectoryEntry dirent;
   remount_fence_->Enter();
@@ -1550,15 +1747,18 @@ bool Pin(const string &path) {
                    "Part of " + path, false);
       if (!retval)
         return false;
-      int fd = cache::FetchChunk(*chunks.AtPtr(i), "Part of " + path);
+      int fd = cache::FetchChunk(*chunks.AtPtr(i),
+                                 dirent.compression_algorithm(),
+                                 "Part of " + path);
       if (fd < 0) {
         quota::Unpin(chunks.AtPtr(i)->content_hash());
         return false;
       }
       retval =
-        quota::Pin(chunks.AtPtr(i)->content_hash(), chunks.AtPtr(i)->size(),
+        quota::Pin(chunks.AtPtr(i)->content_hash(),
+                   GetSizeOnDisk(fd, chunks.AtPtr(i)->size()),
                    "Part of " + path, false);
-      close(fd);
+      cache::Close(fd);
       if (!retval)
         return false;
     }
@@ -1574,12 +1774,48 @@ bool Pin(const string &path) {
     return false;
   }
   // Again because it was overwritten by FetchDirent
-  retval = quota::Pin(dirent.checksum(), dirent.size(), path, false);
-  close(fd);
+  retval = quota::Pin(dirent.checksum(), GetSizeOnDisk(fd, dirent.size()),
+                      path, false);
+  cache::Close(fd);
   return retval;
 }
 
 
+/**
+ * Resolves a regular file into the content-addressed objects it is made of:
+ * either the file itself or its chunks.  Used by the prefetcher.
+ */
+bool ListContent(const string &path, vector<FileChunk> *content,
+                 bool *chunked, zlib::Algorithms *compression_alg)
+{
+  catalog::DirectoryEntry dirent;
+  remount_fence_->Enter();
+  const bool found = GetDirentForPath(PathString(path), &dirent);
+  if (!found || !dirent.IsRegular()) {
+    remount_fence_->Leave();
+    return false;
+  }
+
+  *chunked = dirent.IsChunkedFile();
+  *compression_alg = dirent.compression_algorithm();
+  if (*chunked) {
+    FileChunkList chunks;
+    const bool retval =
+      dirent.catalog()->ListFileChunks(PathString(path), &chunks);
+    remount_fence_->Leave();
+    if (!retval || chunks.IsEmpty())
+      return false;
+    for (unsigned i = 0; i < chunks.size(); ++i)
+      content->push_back(*chunks.AtPtr(i));
+    return true;
+  }
+  remount_fence_->Leave();
+
+  content->push_back(FileChunk(dirent.checksum(), 0, dirent.size()));
+  return true;
+}
+
+
 /**
  * Do after-daemon() initialization
  */
@@ -1679,12 +1915,16 @@ static int Init(const loader::LoaderExports *loader_exports) {
   unsigned timeout_direct = cvmfs::kDefaultTimeout;
   unsigned proxy_reset_after = 0;
   unsigned host_reset_after = 0;
+  unsigned host_probe_interval = 0;
+  unsigned hedge_percent = 0;
+  bool health_scoreboard = false;
   unsigned max_retries = 1;
   unsigned backoff_init = 2000;
   unsigned backoff_max = 10000;
   string tracefile = "";
   string cachedir = string(cvmfs::kDefaultCachedir);
   unsigned max_ttl = 0;
+  unsigned refresh_ahead = 0;
   int kcache_timeout = 0;
   bool diskless = false;
   bool rebuild_cachedb = false;
@@ -1693,6 +1933,16 @@ static int Init(const loader::LoaderExports *loader_exports) {
   string nfs_shared_dir = string(cvmfs::kDefaultCachedir);
   bool shared_cache = false;
   int64_t quota_limit = cvmfs::kDefaultCacheSizeMb;
+  bool quota_in_memory = false;
+  quota::PolicyType quota_policy = quota::kPolicyLru;
+  bool quota_rebuild_background = false;
+  uint64_t partial_threshold = 0;
+  unsigned partial_block_size = 0;
+  unsigned compressed_block_size = 0;
+  uint64_t block_cache_size = 16*1024*1024;
+  uint64_t scrub_rate = 0;
+  unsigned scrub_max_cpu = 10;
+  unsigned scrub_interval = 24*3600;
   string hostname = "localhost";
   string proxies = "";
   string dns_server = "";
@@ -1746,20 +1996,71 @@ static int Init(const loader::LoaderExports *loader_exports) {
     proxy_reset_after = String2Uint64(parameter);
   if (options::GetValue("CVMFS_HOST_RESET_AFTER", &parameter))
     host_reset_after = String2Uint64(parameter);
+  if (options::GetValue("CVMFS_HOST_PROBE_INTERVAL", &parameter))
+    host_probe_interval = String2Uint64(parameter);
+  if (options::GetValue("CVMFS_HEDGE_PERCENT", &parameter))
+    hedge_percent = String2Uint64(parameter);
+  if (options::GetValue("CVMFS_HEALTH_SCOREBOARD", &parameter) &&
+      options::IsOn(parameter))
+  {
+    health_scoreboard = true;
+  }
   if (options::GetValue("CVMFS_MAX_RETRIES", &parameter))
     max_retries = String2Uint64(parameter);
   if (options::GetValue("CVMFS_BACKOFF_INIT", &parameter))
     backoff_init = String2Uint64(parameter)*1000;
   if (options::GetValue("CVMFS_BACKOFF_MAX", &parameter))
     backoff_max = String2Uint64(parameter)*1000;
+  if (options::GetValue("CVMFS_DOWNLOAD_THREADS", &parameter) &&
+      (String2Uint64(parameter) > 0))
+  {
+    cvmfs::num_download_threads_ = String2Uint64(parameter);
+  }
   if (options::GetValue("CVMFS_TRACEFILE", &parameter))
     tracefile = parameter;
   if (options::GetValue("CVMFS_MAX_TTL", &parameter))
     max_ttl = String2Uint64(parameter);
+  if (options::GetValue("CVMFS_REFRESH_AHEAD", &parameter))
+    refresh_ahead = String2Uint64(parameter);
   if (options::GetValue("CVMFS_KCACHE_TIMEOUT", &parameter))
     kcache_timeout = String2Int64(parameter);
   if (options::GetValue("CVMFS_QUOTA_LIMIT", &parameter))
     quota_limit = String2Int64(parameter) * 1024*1024;
+  if (options::GetValue("CVMFS_QUOTA_INMEMORY", &parameter) &&
+      options::IsOn(parameter))
+  {
+    quota_in_memory = true;
+  }
+  if (options::GetValue("CVMFS_QUOTA_POLICY", &parameter) &&
+      !quota::ReplacementPolicy::ParseType(parameter, &quota_policy))
+  {
+    *g_boot_error = "unknown cache replacement policy " + parameter;
+    return loader::kFailOptions;
+  }
+  if (options::GetValue("CVMFS_QUOTA_REBUILD_BACKGROUND", &parameter) &&
+      options::IsOn(parameter))
+  {
+    quota_rebuild_background = true;
+  }
+  if (options::GetValue("CVMFS_PARTIAL_FETCH_THRESHOLD", &parameter))
+    partial_threshold = String2Uint64(parameter) * 1024*1024;
+  if (options::GetValue("CVMFS_PARTIAL_FETCH_BLOCKSIZE", &parameter))
+    partial_block_size = String2Uint64(parameter) * 1024;
+  if (options::GetValue("CVMFS_COMPRESSED_CACHE", &parameter) &&
+      options::IsOn(parameter))
+  {
+    compressed_block_size = blockfile::kDefaultBlockSize;
+    if (options::GetValue("CVMFS_COMPRESSED_CACHE_BLOCKSIZE", &parameter))
+      compressed_block_size = String2Uint64(parameter) * 1024;
+    if (options::GetValue("CVMFS_COMPRESSED_CACHE_MEMCACHE", &parameter))
+      block_cache_size = String2Uint64(parameter) * 1024*1024;
+  }
+  if (options::GetValue("CVMFS_SCRUB_RATE", &parameter))
+    scrub_rate = String2Uint64(parameter) * 1024;
+  if (options::GetValue("CVMFS_SCRUB_MAX_CPU", &parameter))
+    scrub_max_cpu = String2Uint64(parameter);
+  if (options::GetValue("CVMFS_SCRUB_INTERVAL", &parameter))
+    scrub_interval = String2Uint64(parameter) * 3600;
   if (options::GetValue("CVMFS_HTTP_PROXY", &parameter))
     proxies = parameter;
   if (options::GetValue("CVMFS_DNS_SERVER", &parameter))
@@ -1847,6 +2148,7 @@ static int Init(const loader::LoaderExports *loader_exports) {
   g_uid = geteuid();
   g_gid = getegid();
   cvmfs::max_ttl_ = max_ttl;
+  cvmfs::refresh_ahead_ = refresh_ahead;
   if (kcache_timeout) {
     cvmfs::kcache_timeout_ =
       (kcache_timeout == -1) ? 0.0 : double(kcache_timeout);
@@ -1889,6 +2191,9 @@ static int Init(const loader::LoaderExports *loader_exports) {
   cvmfs::directory_handles_->set_empty_key((uint64_t)(-1));
   cvmfs::directory_handles_->set_deleted_key((uint64_t)(-2));
   cvmfs::chunk_tables_ = new ChunkTables();
+  cvmfs::partial_handles_ = new cvmfs::PartialHandles();
+  cvmfs::partial_handles_->set_empty_key((uint64_t)(-1));
+  cvmfs::partial_handles_->set_deleted_key((uint64_t)(-2));
 
   // Runtime counters
   atomic_init64(&cvmfs::num_fs_open_);
@@ -1971,6 +2276,8 @@ static int Init(const loader::LoaderExports *loader_exports) {
     return loader::kFailCacheDir;
   }
   CreateFile("./.cvmfscache", 0600);
+  cache::SetPartialParameters(partial_threshold, partial_block_size);
+  cache::SetCompressedParameters(compressed_block_size, block_cache_size);
   g_cache_ready = true;
 
   // Start NFS maps module, if necessary
@@ -2010,6 +2317,9 @@ static int Init(const loader::LoaderExports *loader_exports) {
   if (quota_limit < 0)
     quota_limit = 0;
   int64_t quota_threshold = quota_limit/2;
+  quota::SetInMemory(quota_in_memory);
+  quota::SetPolicy(quota_policy);
+  quota::SetRebuildInBackground(quota_rebuild_background);
   if (shared_cache) {
     if (!quota::InitShared(loader_exports->program_name, ".",
                            (uint64_t)quota_limit, (uint64_t)quota_threshold))
@@ -2042,6 +2352,8 @@ static int Init(const loader::LoaderExports *loader_exports) {
              "CernVM-FS: quota initialized, current size %luMB",
              quota::GetSize()/(1024*1024));
   }
+  if (scrub_rate > 0)
+    scrubber::Init(".", scrub_rate, scrub_max_cpu, scrub_interval);
 
   // Monitor, check for maximum number of open files
   if (cvmfs::UseWatchdog()) {
@@ -2073,7 +2385,13 @@ static int Init(const loader::LoaderExports *loader_exports) {
   download::SetTimeout(timeout, timeout_direct);
   download::SetProxyGroupResetDelay(proxy_reset_after);
   download::SetHostResetDelay(host_reset_after);
+  download::SetHostProbeInterval(host_probe_interval);
+  download::SetHedgeLimit(hedge_percent);
   download::SetRetryParameters(max_retries, backoff_init, backoff_max);
+  // Shared among all repositories if the cache is shared, failures are not
+  // fatal
+  if (health_scoreboard)
+    download::SetHealthScoreboard("./health.scoreboard");
   g_download_ready = true;
 
   signature::Init();
@@ -2192,17 +2510,25 @@ static void Spawn() {
   } else {
     cvmfs::catalogs_valid_until_ = cvmfs::kIndefiniteDeadline;
   }
+  if (!cvmfs::fixed_catalog_ && (cvmfs::refresh_ahead_ > 0)) {
+    MakePipe(cvmfs::pipe_refresher_);
+    retval = pthread_create(&cvmfs::thread_refresher_, NULL,
+                            cvmfs::MainRefresher, NULL);
+    assert(retval == 0);
+    cvmfs::refresher_spawned_ = true;
+  }
 
   cvmfs::pid_ = getpid();
   if (cvmfs::UseWatchdog() && g_monitor_ready) {
     monitor::Spawn();
   }
-  download::Spawn();
+  download::Spawn(cvmfs::num_download_threads_);
   quota::Spawn();
   cvmfs::unpin_listener_ =
     quota::RegisterUnpinListener(cvmfs::catalog_manager_,
                                  *cvmfs::repository_name_);
   talk::Spawn();
+  scrubber::Spawn();
   if (cvmfs::nfs_maps_)
     nfs_maps::Spawn();
 
@@ -2222,7 +2548,16 @@ static string GetErrorMsg() {
 
 static void Fini() {
   signal(SIGALRM, SIG_DFL);
+  if (cvmfs::refresher_spawned_) {
+    const char quit = 'T';
+    WritePipe(cvmfs::pipe_refresher_[1], &quit, 1);
+    pthread_join(cvmfs::thread_refresher_, NULL);
+    ClosePipe(cvmfs::pipe_refresher_);
+    cvmfs::refresher_spawned_ = false;
+  }
   tracer::Fini();
+  prefetch::Fini();
+  scrubber::Fini();
   if (g_signature_ready) signature::Fini();
   if (g_download_ready) download::Fini();
   if (g_talk_ready) talk::Fini();
@@ -2246,6 +2581,7 @@ static void Fini() {
   delete cvmfs::inode_annotation_;
   delete cvmfs::directory_handles_;
   delete cvmfs::chunk_tables_;
+  delete cvmfs::partial_handles_;
   delete cvmfs::inode_tracker_;
   delete cvmfs::path_cache_;
   delete cvmfs::inode_cache_;
@@ -2261,6 +2597,7 @@ static void Fini() {
   cvmfs::inode_annotation_ = NULL;
   cvmfs::directory_handles_ = NULL;
   cvmfs::chunk_tables_ = NULL;
+  cvmfs::partial_handles_ = NULL;
   cvmfs::inode_tracker_ = NULL;
   cvmfs::path_cache_ = NULL;
   cvmfs::inode_cache_ = NULL;
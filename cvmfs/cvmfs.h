@@ -13,6 +13,7 @@
 #include <vector>
 
 #include "catalog_mgr.h"
+#include "file_chunk.h"
 #include "lru.h"
 #include "loader.h"
 
@@ -30,6 +31,8 @@ extern bool nfs_maps_;
 
 bool Evict(const std::string &path);
 bool Pin(const std::string &path);
+bool ListContent(const std::string &path, std::vector<FileChunk> *content,
+                 bool *chunked, zlib::Algorithms *compression_alg);
 catalog::LoadError RemountStart();
 void GetReloadStatus(bool *drainout_mode, bool *maintenance_mode);
 unsigned GetRevision();
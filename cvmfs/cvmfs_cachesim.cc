@@ -0,0 +1,216 @@
+/**
+ * This file is part of the CernVM File System.
+ *
+ * This tool replays file accesses recorded by the tracer against the cache
+ * replacement policies of the quota manager.  It reports hit ratios for a
+ * given cache size so that a policy can be chosen per site.
+ */
+
+#define _FILE_OFFSET_BITS 64
+#define __STDC_FORMAT_MACROS
+
+#include "cvmfs_config.h"
+
+#include <sys/stat.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <cstdlib>
+
+#include <string>
+#include <vector>
+
+#include "platform.h"
+#include "util.h"
+#include "hash.h"
+#include "logging.h"
+#include "quota_policy.h"
+
+using namespace std;  // NOLINT
+
+enum Errors {
+  kErrorOk = 0,
+  kErrorOperational = 1,
+  kErrorUsage = 2,
+};
+
+/**
+ * Event code of open() calls in tracer logs (tracer::kFuseOpen).  The tracer
+ * itself is not linked into this tool.
+ */
+const int kTraceOpen = 1;
+
+struct Access {
+  hash::Any hash;
+  uint64_t size;
+};
+
+string *g_mountpoint = NULL;
+uint64_t g_default_size = 64*1024;
+uint64_t g_num_unsized = 0;
+
+
+static void Usage() {
+  LogCvmfs(kLogCvmfs, kLogStdout,
+           "CernVM File System cache simulator, version %s\n\n"
+           "This tool replays the file accesses of tracer logs against the\n"
+           "cache replacement policies.\n\n"
+           "Usage: cvmfs_cachesim -c <cache size in MB> [-p policy,...] "
+           "[-m mount point]\n"
+           "                      [-s default file size in KB] "
+           "<trace file> ...\n"
+           "Options:\n"
+           "  -c cache size in megabytes\n"
+           "  -p comma separated list of policies (lru, 2q, gdsf), "
+           "default: all\n"
+           "  -m mounted repository, used to determine file sizes\n"
+           "  -s file size if it cannot be determined, default: 64\n\n"
+           "Trace files are csv files written by the tracer or lists of paths.",
+           VERSION);
+}
+
+
+/**
+ * Only open() calls are cache accesses.  Lines that are not in csv format are
+ * taken as a path.
+ */
+static bool ParseLine(const string &raw_line, string *path) {
+  const string line = Trim(raw_line);
+  if (line.empty())
+    return false;
+  if (line[0] != '"') {
+    *path = line;
+    return true;
+  }
+
+  const vector<string> fields = SplitCsvLine(line);
+  if ((fields.size() < 3) ||
+      (String2Int64(fields[1]) != kTraceOpen))
+  {
+    return false;
+  }
+  *path = fields[2];
+  return true;
+}
+
+
+static uint64_t GetSize(const string &path) {
+  if (g_mountpoint) {
+    platform_stat64 info;
+    if (platform_stat((*g_mountpoint + path).c_str(), &info) == 0)
+      return info.st_size;
+  }
+  g_num_unsized++;
+  return g_default_size;
+}
+
+
+static bool ReadTrace(const string &trace_file, vector<Access> *accesses) {
+  FILE *f = fopen(trace_file.c_str(), "r");
+  if (f == NULL) {
+    LogCvmfs(kLogCvmfs, kLogStderr, "failed to open %s", trace_file.c_str());
+    return false;
+  }
+
+  string line;
+  string path;
+  while (GetLineFile(f, &line)) {
+    if (!ParseLine(line, &path))
+      continue;
+    Access access;
+    access.hash = hash::Any(hash::kSha1);
+    hash::HashMem(reinterpret_cast<const unsigned char *>(path.data()),
+                  path.length(), &access.hash);
+    access.size = GetSize(path);
+    accesses->push_back(access);
+  }
+  fclose(f);
+  return true;
+}
+
+
+static double Ratio(const uint64_t part, const uint64_t total) {
+  return (total == 0) ? 0.0 : 100.0 * double(part) / double(total);
+}
+
+
+int main(int argc, char **argv) {
+  uint64_t capacity = 0;
+  vector<quota::PolicyType> policies;
+  vector<string> policy_names;
+
+  char c;
+  while ((c = getopt(argc, argv, "hc:p:m:s:")) != -1) {
+    switch (c) {
+      case 'h':
+        Usage();
+        return kErrorOk;
+      case 'c':
+        capacity = String2Uint64(optarg) * 1024*1024;
+        break;
+      case 'p':
+        policy_names = SplitString(optarg, ',');
+        break;
+      case 'm':
+        g_mountpoint = new string(MakeCanonicalPath(optarg));
+        break;
+      case 's':
+        g_default_size = String2Uint64(optarg) * 1024;
+        break;
+      case '?':
+      default:
+        Usage();
+        return kErrorUsage;
+    }
+  }
+  if ((capacity == 0) || (optind >= argc)) {
+    Usage();
+    return kErrorUsage;
+  }
+
+  if (policy_names.empty()) {
+    policies.push_back(quota::kPolicyLru);
+    policies.push_back(quota::kPolicy2Q);
+    policies.push_back(quota::kPolicyGdsf);
+  }
+  for (unsigned i = 0; i < policy_names.size(); ++i) {
+    quota::PolicyType type;
+    if (!quota::ReplacementPolicy::ParseType(policy_names[i], &type)) {
+      LogCvmfs(kLogCvmfs, kLogStderr, "unknown policy %s",
+               policy_names[i].c_str());
+      return kErrorUsage;
+    }
+    policies.push_back(type);
+  }
+
+  vector<Access> accesses;
+  for (int i = optind; i < argc; ++i) {
+    if (!ReadTrace(argv[i], &accesses))
+      return kErrorOperational;
+  }
+  LogCvmfs(kLogCvmfs, kLogStdout, "%lu accesses, cache size %"PRIu64" MB",
+           accesses.size(), capacity / (1024*1024));
+  if (g_num_unsized > 0) {
+    LogCvmfs(kLogCvmfs, kLogStdout, "%"PRIu64" accesses with default size",
+             g_num_unsized);
+  }
+
+  LogCvmfs(kLogCvmfs, kLogStdout, "%-8s %12s %10s %10s %12s",
+           "policy", "hits", "hit ratio", "byte ratio", "evictions");
+  for (unsigned i = 0; i < policies.size(); ++i) {
+    quota::CacheSimulator simulator(policies[i], capacity);
+    for (unsigned j = 0; j < accesses.size(); ++j)
+      simulator.Access(accesses[j].hash, accesses[j].size);
+    LogCvmfs(kLogCvmfs, kLogStdout,
+             "%-8s %12"PRIu64" %9.2f%% %9.2f%% %12"PRIu64,
+             quota::ReplacementPolicy::GetName(policies[i]).c_str(),
+             simulator.num_hits(),
+             Ratio(simulator.num_hits(), simulator.num_accesses()),
+             Ratio(simulator.bytes_hit(), simulator.bytes_accessed()),
+             simulator.num_evictions());
+  }
+
+  return kErrorOk;
+}
@@ -29,6 +29,7 @@
 #include "hash.h"
 #include "atomic.h"
 #include "compression.h"
+#include "blockfile.h"
 #include "smalloc.h"
 #include "logging.h"
 
@@ -186,6 +187,25 @@ static void *MainCheck(void *data __attribute__((unused))) {
                path.c_str());
       atomic_inc32(&g_num_err_operational);
     } else {
+      // Objects of the compressed cache mode are stored as block files.  The
+      // cache does not know the compression algorithm of an object, so the
+      // others are tried as well.
+      for (int i = 0; (i < zlib::kNumAlgorithms) &&
+           (hash.ToString() != hash_name); ++i)
+      {
+        const zlib::Algorithms algorithm = static_cast<zlib::Algorithms>(i);
+        if ((algorithm != zlib::kZlibDefault) &&
+            zlib::CompressFd2Null(fd_src, algorithm, &hash) &&
+            (hash.ToString() == hash_name))
+        {
+          break;
+        }
+        if (blockfile::CompressFd2Null(fd_src, algorithm, &hash) && g_verbose &&
+            (hash.ToString() == hash_name))
+        {
+          LogCvmfs(kLogCvmfs, kLogStdout, "%s is a block file", path.c_str());
+        }
+      }
       if (hash.ToString() != hash_name) {
         if (g_fix_errors) {
           const string quarantaine_path = "./quarantaine/" + hash_name;
@@ -334,7 +354,9 @@ int main(int argc, char **argv) {
     LogCvmfs(kLogCvmfs, kLogStdout, "Temorary file catalogs were found.");
 
   if (atomic_read32(&g_force_rebuild)) {
-    if (unlink("cachedb") == 0) {
+    // An in-memory cache catalog is rebuilt if its snapshot is missing
+    const bool snapshot_unlinked = (unlink("cachedb.snapshot") == 0);
+    if ((unlink("cachedb") == 0) || snapshot_unlinked) {
       LogCvmfs(kLogCvmfs, kLogStdout,
                "Fix: managed cache db unlinked, will be rebuilt on next mount");
       atomic_inc32(&g_num_err_fixed);
@@ -38,6 +38,10 @@ DirectoryEntryBase::Differences DirectoryEntryBase::CompareTo(
     result |= Difference::kChecksum;
   }
 
+  if (compression_algorithm() != other.compression_algorithm()) {
+    result |= Difference::kCompressionAlgorithm;
+  }
+
   return result;
 }
 
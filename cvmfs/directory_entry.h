@@ -19,6 +19,7 @@
 #include "platform.h"
 #include "util.h"
 #include "hash.h"
+#include "compression.h"
 #include "shortstring.h"
 #include "globals.h"
 #include "bigvector.h"
@@ -67,6 +68,7 @@ class DirectoryEntryBase {
     static const unsigned int kHardlinkGroup                = 0x080; // 000010000000
     static const unsigned int kNestedCatalogTransitionFlags = 0x100; // 000100000000
     static const unsigned int kChunkedFileFlag              = 0x200; // 001000000000
+    static const unsigned int kCompressionAlgorithm         = 0x400; // 010000000000
   };
   typedef unsigned int Differences;
 
@@ -85,7 +87,8 @@ class DirectoryEntryBase {
     gid_(0),
     size_(0),
     mtime_(0),
-    linkcount_(1) // generally a normal file has linkcount 1 -> default
+    linkcount_(1), // generally a normal file has linkcount 1 -> default
+    compression_algorithm_(zlib::kZlibDefault)
     { }
 
   // accessors
@@ -107,6 +110,9 @@ class DirectoryEntryBase {
 
   inline hash::Any checksum() const            { return checksum_; }
   inline const hash::Any *checksum_ptr() const { return &checksum_; }
+  inline zlib::Algorithms compression_algorithm() const {
+    return compression_algorithm_;
+  }
 
   inline uint64_t size() const {
     return (IsLink()) ? symlink().GetLength() : size_;
@@ -128,6 +134,9 @@ class DirectoryEntryBase {
     assert(linkcount > 0);
     linkcount_ = linkcount;
   }
+  inline void set_compression_algorithm(const zlib::Algorithms algorithm) {
+    compression_algorithm_ = algorithm;
+  }
 
   /**
    * Converts to a stat struct as required by many Fuse callbacks.
@@ -182,6 +191,8 @@ class DirectoryEntryBase {
   // checksum is not part of the file system intrinsics, though can be computed
   // just using the file contents... we therefore put it in this base class.
   hash::Any checksum_;
+  // the checksum is taken over the object as stored with this algorithm
+  zlib::Algorithms compression_algorithm_;
 };
 
 /**
@@ -252,6 +263,7 @@ class DirectoryEntry : public DirectoryEntryBase {
   inline uint32_t hardlink_group() const { return hardlink_group_; }
   inline time_t cached_mtime() const     { return cached_mtime_; }
 
+  inline void set_catalog(Catalog *value)               { catalog_ = value; }
   inline void set_hardlink_group(const uint32_t group) { hardlink_group_ = group; }
   inline void set_cached_mtime(const time_t value)     { cached_mtime_ = value; }
 
@@ -9,9 +9,13 @@
  * The module starts in single-threaded mode and can be switched to multi-
  * threaded mode by Spawn().  In multi-threaded mode, the Fetch() function still
  * blocks but there is a separate I/O thread using asynchronous I/O, which
- * maintains all concurrent connections simultaneously.  As there might be more
+ * maintains all concurrent connections simultaneously.  Jobs are submitted
+ * through a lock-free queue with an eventfd doorbell; the fetching thread
+ * waits for completion on a futex in the JobInfo.  As there might be more
  * than 1024 file descriptors for the CernVM-FS process, the I/O thread uses
- * poll and the libcurl multi socket interface.
+ * epoll (poll on OS X) and the libcurl multi socket interface.  Sockets are
+ * registered by libcurl's socket callback, the thread sleeps until there is
+ * socket activity, a new job, or libcurl's timer expires.
  *
  * While downloading, files can be decompressed and the secure hash can be
  * calculated on the fly.
@@ -22,6 +26,24 @@
  * fail-over to the next host in the chain until all hosts are probed.
  * Similarly a chain of proxy sets can be configured.  Inside a proxy set,
  * proxies are selected randomly (load-balancing set).
+ *
+ * Completed transfers feed decayed latency and throughput estimates per proxy
+ * and per host.  Proxies are selected randomly weighted by these estimates,
+ * and a proxy or host that is much slower than an alternative is demoted
+ * even if it does not fail.
+ *
+ * Optionally, an I/O thread sends a duplicate ("hedge") of a transfer that
+ * has no response after the 95th percentile of recent first-byte latencies
+ * to another proxy or host.  The first successful response wins, the other
+ * transfer is cancelled.
+ *
+ * An I/O thread keeps no more transfers in flight than it has connections.
+ * Further jobs wait in one queue per priority, so that catalogs and the
+ * manifest do not queue behind bulk data inside libcurl.
+ *
+ * Optionally, the cvmfs2 processes of a node share the health of proxies and
+ * hosts through a scoreboard file, so that a failover in one mount spares the
+ * other mounts the timeout of the broken proxy or host.
  */
 
 //TODO: MS for time summing
@@ -36,20 +58,32 @@
 #include <pthread.h>
 #include <alloca.h>
 #include <errno.h>
-#include <poll.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/time.h>
+#ifdef __APPLE__
+#include <poll.h>
+#else
+#include <sys/epoll.h>
+#endif
 
 #include <cassert>
 #include <cstdlib>
 #include <cstring>
 #include <cstdio>
 
+#include <algorithm>
+#include <deque>
+#include <map>
 #include <set>
 
 #include "duplex_curl.h"
 #include "logging.h"
 #include "atomic.h"
+#include "murmur.h"
 #include "hash.h"
+#include "platform.h"
 #include "prng.h"
 #include "util.h"
 #include "compression.h"
@@ -59,24 +93,81 @@ using namespace std;  // NOLINT
 
 namespace download {
 
-Prng prng_;
+Prng prng_;  /**< Protected by lock_options_ */
 
-set<CURL *> *pool_handles_idle_ = NULL;
-set<CURL *> *pool_handles_inuse_ = NULL;
 uint32_t pool_max_handles_;
-CURLM *curl_multi_ = NULL;
 curl_slist *http_headers_ = NULL;
 curl_slist *http_headers_nocache_ = NULL;
 
-pthread_t thread_download_;
+/**
+ * Transfer state of a download I/O thread.  Every I/O thread has its own curl
+ * multi handle, pool of easy handles, and statistics, so that the threads
+ * share nothing but the options.  The synchronous mode uses the handle pool
+ * and the statistics of a context without thread.
+ */
+struct IoContext {
+  CURLM *curl_multi;
+  set<CURL *> *pool_handles_idle;
+  set<CURL *> *pool_handles_inuse;
+  uint32_t pool_max_handles;
+  Statistics *statistics;
+
+  pthread_t thread;
+  int pipe_terminate[2];
+  /**
+   * Submitted jobs in reverse order, pushed by Fetch() and taken all at once
+   * by the I/O thread.  Pushing onto the empty queue rings the doorbell, which
+   * is an eventfd or, where there is none, a pipe.
+   */
+  JobInfo *jobs_head;
+  int doorbell_jobs[2];
+  atomic_int32 num_jobs;  /**< Submitted and not yet completed */
+  /**
+   * Taken jobs that wait for a free connection, one queue per priority.  Low
+   * priority jobs may use at most half of the connections.
+   */
+  vector< deque<JobInfo *> > *jobs_waiting;
+  uint32_t num_active_low;
+
+  /**
+   * Sockets watched by the I/O thread.  On Linux, this is an epoll set;
+   * libcurl keeps a marker for registered sockets by curl_multi_assign().  On
+   * OS X, sockets are collected in an array for poll() with an index from
+   * socket to array position.
+   */
+#ifdef __APPLE__
+  vector<struct pollfd> *watch_fds;
+  map<int, unsigned> *watch_fds_index;
+#else
+  int epoll_fd;
+#endif
+
+  /**
+   * Absolute time in milliseconds when libcurl wants to be called on timeout,
+   * set by its timer callback.  0 if there is no timer.
+   */
+  uint64_t timer_deadline;
+
+  /**
+   * Hedged requests.  Jobs that might get a duplicate, original jobs that
+   * race a duplicate, and a ring of recent first-byte latencies from which
+   * the delay until a duplicate is sent is taken (0: not enough samples).
+   */
+  set<JobInfo *> *hedge_candidates;
+  set<JobInfo *> *hedged_jobs;
+  vector<double> *first_byte_ms;
+  unsigned first_byte_next;
+  uint64_t hedge_delay_ms;
+
+  Prng prng;  /**< Backoff jitter, seeded from prng_ */
+};
+
+IoContext *context_sync_ = NULL;
+vector<IoContext *> *io_threads_ = NULL;
 atomic_int32 multi_threaded_;
-int pipe_terminate_[2];
-
-int pipe_jobs_[2];
-struct pollfd *watch_fds_ = NULL;
-uint32_t watch_fds_size_ = 0;
-uint32_t watch_fds_inuse_ = 0;
-uint32_t watch_fds_max_;
+const unsigned kCompletionTimeoutMs = 1000;
+const unsigned kMaxEvents = 64;  /**< Events handled per wake-up */
+int watch_marker_;  /**< socketp of registered sockets */
 
 pthread_mutex_t lock_options_ = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t lock_synchronous_mode_ = PTHREAD_MUTEX_INITIALIZER;
@@ -98,6 +189,22 @@ unsigned opt_backoff_init_ms_ = 0;
 unsigned opt_backoff_max_ms_ = 0;
 
 bool opt_ipv4_only_ = false;
+bool opt_pipelining_ = false;
+unsigned opt_hedge_percent_ = 0;  /**< Max. duplicates per 100 jobs */
+const unsigned kHedgeNumSamples = 256;  /**< first-byte latencies per thread */
+const unsigned kHedgeMinSamples = 32;
+const uint64_t kHedgeMinDelayMs = 50;
+
+/**
+ * If opt_host_probe_interval_ is > 0, a background thread started by Spawn()
+ * probes the host chain every opt_host_probe_interval_ seconds.
+ */
+unsigned opt_host_probe_interval_ = 0;
+pthread_t thread_probe_;
+bool probe_thread_running_ = false;
+bool probe_thread_terminate_ = false;
+pthread_mutex_t lock_probe_ = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t cond_probe_ = PTHREAD_COND_INITIALIZER;
 
 
 /**
@@ -118,9 +225,52 @@ unsigned opt_proxy_groups_reset_after_ = 0;
 time_t opt_timestamp_backup_host_ = 0;
 unsigned opt_host_reset_after_ = 0;
 
-// Writes and reads should be atomic because reading happens in a different
-// thread than writing.
-Statistics *statistics_;
+/**
+ * Latency and throughput estimates of proxies and hosts by name, protected by
+ * lock_options_.  They survive changes of the proxy and host chains.
+ */
+map<string, EndpointEstimate> *proxy_estimates_ = NULL;
+map<string, EndpointEstimate> *host_estimates_ = NULL;
+const double kEstimateWeight = 0.2;  /**< of a new sample */
+const uint64_t kEstimateMinSamples = 8;  /**< before demoting an endpoint */
+const double kDemoteFactor = 4.0;  /**< cost ratio that demotes an endpoint */
+const time_t kEstimateMaxAge = 600;  /**< older estimates count as unknown */
+const double kMinThroughputBytes = 64 * 1024;  /**< smaller: latency only */
+const double kCostObjectSize = 64 * 1024;  /**< typical object for GetCost */
+
+/**
+ * The node-wide health scoreboard is a file mapped by all cvmfs2 processes,
+ * typically in the shared cache directory.  Connection failures mark the
+ * failed proxy or host, other processes avoid marked endpoints for
+ * kScoreboardFailureTtl seconds or until a successful transfer clears the
+ * mark.  Successful transfers also publish the cost estimate
+ * (EndpointEstimate::GetCost()), which seeds the proxy selection of processes
+ * without an estimate of their own.
+ *
+ * Endpoints (scheme://host[:port]) are hashed into a fixed table with linear
+ * probing.  Slots are never freed.  Lookups are lock-free, a new slot is
+ * claimed under lock_scoreboard_ and an flock() on the file.
+ */
+const uint32_t kScoreboardMagic = 0x43564842;
+const uint32_t kScoreboardNumSlots = 512;
+const unsigned kScoreboardMaxEndpoint = 232;
+const time_t kScoreboardFailureTtl = 300;  /**< marks expire afterwards */
+struct ScoreboardHeader {
+  uint32_t magic;
+  uint32_t num_slots;
+  char padding[248];
+};
+struct ScoreboardSlot {
+  atomic_int32 in_use;  /**< set once the endpoint is written */
+  atomic_int32 cost_ms;
+  atomic_int64 timestamp_cost;
+  atomic_int64 timestamp_failure;  /**< 0 if healthy */
+  char endpoint[kScoreboardMaxEndpoint];
+};
+int scoreboard_fd_ = -1;
+ScoreboardHeader *scoreboard_ = NULL;
+ScoreboardSlot *scoreboard_slots_ = NULL;
+pthread_mutex_t lock_scoreboard_ = PTHREAD_MUTEX_INITIALIZER;
 
 string Statistics::Print() const {
   return
@@ -129,7 +279,266 @@ string Statistics::Print() const {
     "Number of requests: " + StringifyInt(num_requests) + "\n" +
     "Number of retries: " + StringifyInt(num_retries) + "\n" +
     "Number of proxy failovers: " + StringifyInt(num_proxy_failover) + "\n" +
-    "Number of host failovers: " + StringifyInt(num_host_failover) + "\n";
+    "Number of host failovers: " + StringifyInt(num_host_failover) + "\n" +
+    "Number of I/O thread wake-ups: " + StringifyInt(num_wakeups) + "\n" +
+    "Number of submitted jobs: " + StringifyInt(num_jobs_submitted) +
+    " in " + StringifyInt(num_job_batches) + " batches\n" +
+    "Number of slow proxy/host demotions: " + StringifyInt(num_demotions) +
+    "\n" +
+    "Number of hedged requests: " + StringifyInt(num_hedges) + " (" +
+    StringifyInt(num_hedges_won) + " answered first)\n";
+}
+
+
+void Statistics::Add(const Statistics &other) {
+  transferred_bytes += other.transferred_bytes;
+  transfer_time += other.transfer_time;
+  num_requests += other.num_requests;
+  num_retries += other.num_retries;
+  num_proxy_failover += other.num_proxy_failover;
+  num_host_failover += other.num_host_failover;
+  num_wakeups += other.num_wakeups;
+  num_jobs_submitted += other.num_jobs_submitted;
+  num_job_batches += other.num_job_batches;
+  num_demotions += other.num_demotions;
+  num_hedges += other.num_hedges;
+  num_hedges_won += other.num_hedges_won;
+}
+
+
+void EndpointEstimate::AddSample(const double sample_latency_ms,
+                                 const double sample_throughput,
+                                 const time_t now)
+{
+  if (!IsRecent(now)) {
+    latency_ms = sample_latency_ms;
+    throughput = sample_throughput;
+    num_samples = 0;
+  } else {
+    latency_ms += kEstimateWeight * (sample_latency_ms - latency_ms);
+    if (sample_throughput > 0.0) {
+      if (throughput > 0.0)
+        throughput += kEstimateWeight * (sample_throughput - throughput);
+      else
+        throughput = sample_throughput;
+    }
+  }
+  num_samples++;
+  timestamp = now;
+}
+
+
+/**
+ * Expected time in milliseconds to fetch a typical object.
+ */
+double EndpointEstimate::GetCost() const {
+  double cost = latency_ms;
+  if (throughput > 0.0)
+    cost += 1000.0 * kCostObjectSize / throughput;
+  return cost;
+}
+
+
+bool EndpointEstimate::IsRecent(const time_t now) const {
+  return (num_samples > 0) && (now - timestamp <= kEstimateMaxAge);
+}
+
+
+/**
+ * Returns the estimate of an endpoint if there is a recent one, NULL
+ * otherwise.  Needs lock_options_.
+ */
+static const EndpointEstimate *GetRecentEstimate(
+  const map<string, EndpointEstimate> &estimates,
+  const string &endpoint,
+  const time_t now)
+{
+  map<string, EndpointEstimate>::const_iterator iter =
+    estimates.find(endpoint);
+  if ((iter == estimates.end()) || !iter->second.IsRecent(now))
+    return NULL;
+  return &(iter->second);
+}
+
+
+/**
+ * Cuts the path off a URL, leaving scheme://host[:port].
+ */
+static string StripUrlPath(const string &url) {
+  const size_t pos_scheme = url.find("://");
+  const size_t pos_path = url.find('/', (pos_scheme == string::npos) ?
+                                        0 : pos_scheme + 3);
+  if (pos_path == string::npos)
+    return url;
+  return url.substr(0, pos_path);
+}
+
+
+/**
+ * Returns the slot of endpoint or, if it is not on the scoreboard, the free
+ * slot where it would go.  NULL if the table is full.
+ */
+static ScoreboardSlot *ProbeScoreboard(const string &endpoint) {
+  const uint32_t hash =
+    MurmurHash2(endpoint.data(), endpoint.length(), 0x07387a4f);
+  for (uint32_t i = 0; i < kScoreboardNumSlots; ++i) {
+    ScoreboardSlot *slot = &scoreboard_slots_[(hash + i) % kScoreboardNumSlots];
+    if ((atomic_read32(&slot->in_use) == 0) ||
+        (strcmp(slot->endpoint, endpoint.c_str()) == 0))
+    {
+      return slot;
+    }
+  }
+  return NULL;
+}
+
+
+/**
+ * Finds the scoreboard slot of the endpoint of a proxy or host URL and claims
+ * a new one if create is set.  NULL if there is no scoreboard or no slot.
+ */
+static ScoreboardSlot *LookupScoreboard(const string &url, const bool create) {
+  if (!scoreboard_ || (url == "") || (url == "DIRECT"))
+    return NULL;
+  const string endpoint = StripUrlPath(url);
+  if (endpoint.length() >= kScoreboardMaxEndpoint)
+    return NULL;
+
+  ScoreboardSlot *slot = ProbeScoreboard(endpoint);
+  if (!slot || (atomic_read32(&slot->in_use) != 0))
+    return slot;
+  if (!create)
+    return NULL;
+
+  // Another thread or process might have claimed the slot meanwhile
+  pthread_mutex_lock(&lock_scoreboard_);
+  flock(scoreboard_fd_, LOCK_EX);
+  slot = ProbeScoreboard(endpoint);
+  if (slot && (atomic_read32(&slot->in_use) == 0)) {
+    strncpy(slot->endpoint, endpoint.c_str(), kScoreboardMaxEndpoint);
+    atomic_write32(&slot->cost_ms, 0);
+    atomic_write64(&slot->timestamp_cost, 0);
+    atomic_write64(&slot->timestamp_failure, 0);
+    atomic_write32(&slot->in_use, 1);
+  }
+  flock(scoreboard_fd_, LOCK_UN);
+  pthread_mutex_unlock(&lock_scoreboard_);
+  return slot;
+}
+
+
+/**
+ * Marks a proxy or host as failed for all processes of the node.
+ */
+static void MarkEndpointFailed(const string &url, const time_t now) {
+  ScoreboardSlot *slot = LookupScoreboard(url, true);
+  if (slot)
+    atomic_write64(&slot->timestamp_failure, now);
+}
+
+
+/**
+ * Clears the failure mark of a proxy or host and publishes its cost estimate.
+ */
+static void MarkEndpointHealthy(const string &url, const double cost_ms,
+                                const time_t now)
+{
+  ScoreboardSlot *slot = LookupScoreboard(url, true);
+  if (!slot)
+    return;
+  if (atomic_read64(&slot->timestamp_failure) != 0)
+    atomic_write64(&slot->timestamp_failure, 0);
+  atomic_write32(&slot->cost_ms, std::max(int32_t(cost_ms), 1));
+  if (atomic_read64(&slot->timestamp_cost) != now)
+    atomic_write64(&slot->timestamp_cost, now);
+}
+
+
+/**
+ * Reads the scoreboard entry of a proxy or host.  failed tells if a process
+ * marked it within kScoreboardFailureTtl seconds, cost_ms is 0 unless
+ * there is a recent cost estimate.
+ */
+static void ReadScoreboard(const string &url, const time_t now,
+                           bool *failed, double *cost_ms)
+{
+  *failed = false;
+  *cost_ms = 0.0;
+  ScoreboardSlot *slot = LookupScoreboard(url, false);
+  if (!slot)
+    return;
+  const int64_t timestamp_failure = atomic_read64(&slot->timestamp_failure);
+  *failed = (timestamp_failure != 0) &&
+            (now - timestamp_failure < kScoreboardFailureTtl);
+  if (now - atomic_read64(&slot->timestamp_cost) <= kEstimateMaxAge)
+    *cost_ms = atomic_read32(&slot->cost_ms);
+}
+
+
+static bool IsEndpointFailed(const string &url, const time_t now) {
+  bool failed;
+  double cost_ms;
+  ReadScoreboard(url, now, &failed, &cost_ms);
+  return failed;
+}
+
+
+/**
+ * Randomly selects one of endpoints[first..last), weighted by the inverse of
+ * the estimated cost.  Endpoints without an estimate get the cost that
+ * other processes published on the scoreboard or else the mean weight of the
+ * known ones, so that they are tried and get an estimate.  Endpoints marked
+ * as failed on the scoreboard are only selected if all of them are.  Needs
+ * lock_options_.
+ */
+static unsigned SelectWeighted(const vector<string> &endpoints,
+                               const unsigned first, const unsigned last,
+                               const map<string, EndpointEstimate> &estimates)
+{
+  assert(first < last);
+  const time_t now = time(NULL);
+  vector<double> weights(last - first, 0.0);
+  vector<bool> failed(last - first, false);
+  double sum_known = 0.0;
+  unsigned num_known = 0;
+  unsigned num_failed = 0;
+  for (unsigned i = first; i < last; ++i) {
+    bool is_failed;
+    double shared_cost_ms;
+    ReadScoreboard(endpoints[i], now, &is_failed, &shared_cost_ms);
+    const EndpointEstimate *estimate =
+      GetRecentEstimate(estimates, endpoints[i], now);
+    if (estimate)
+      weights[i - first] = 1.0 / std::max(estimate->GetCost(), 1.0);
+    else if (shared_cost_ms > 0.0)
+      weights[i - first] = 1.0 / std::max(shared_cost_ms, 1.0);
+    if (weights[i - first] > 0.0) {
+      sum_known += weights[i - first];
+      num_known++;
+    }
+    if (is_failed) {
+      failed[i - first] = true;
+      num_failed++;
+    }
+  }
+  const double weight_unknown = (num_known > 0) ? sum_known / num_known : 1.0;
+  double total = 0.0;
+  for (unsigned i = 0; i < weights.size(); ++i) {
+    if (weights[i] == 0.0)
+      weights[i] = weight_unknown;
+    if (failed[i] && (num_failed < weights.size()))
+      weights[i] = 0.0;
+    total += weights[i];
+  }
+
+  const uint64_t kResolution = 1 << 30;
+  double point = total * prng_.Next(kResolution) / double(kResolution);
+  for (unsigned i = 0; i < weights.size(); ++i) {
+    if (point < weights[i])
+      return first + i;
+    point -= weights[i];
+  }
+  return last - 1;
 }
 
 
@@ -195,7 +604,16 @@ void SwitchHost(JobInfo *info) {
     string old_host = (*opt_host_chain_)[opt_host_chain_current_];
     opt_host_chain_current_ = (opt_host_chain_current_+1) %
                               opt_host_chain_->size();
-    statistics_->num_host_failover++;
+    if (info)
+      info->io_context->statistics->num_host_failover++;
+    else
+      context_sync_->statistics->num_host_failover++;
+    // HTTP errors might concern only some repositories on the host
+    if (info && ((info->error_code == kFailHostConnection) ||
+                 (info->error_code == kFailHostResolve)))
+    {
+      MarkEndpointFailed(old_host, time(NULL));
+    }
     LogCvmfs(kLogDownload, kLogDebug | kLogSyslogWarn,
              "switching host from %s to %s", old_host.c_str(),
              (*opt_host_chain_)[opt_host_chain_current_].c_str());
@@ -240,8 +658,16 @@ static void SwitchProxy(JobInfo *info) {
     return;
   }
 
-  statistics_->num_proxy_failover++;
+  if (info)
+    info->io_context->statistics->num_proxy_failover++;
+  else
+    context_sync_->statistics->num_proxy_failover++;
   string old_proxy = (*opt_proxy_groups_)[opt_proxy_groups_current_][0];
+  if (info && ((info->error_code == kFailProxyConnection) ||
+               (info->error_code == kFailProxyResolve)))
+  {
+    MarkEndpointFailed(old_proxy, time(NULL));
+  }
 
   // If all proxies from the current load-balancing group are burned, switch to
   // another group
@@ -288,7 +714,9 @@ static void SwitchProxy(JobInfo *info) {
 
   // Select new one
   if ((group_size - opt_proxy_groups_current_burned_) > 0) {
-    int select = prng_.Next(group_size - opt_proxy_groups_current_burned_ + 1);
+    const unsigned num_candidates =
+      group_size - opt_proxy_groups_current_burned_ + 1;
+    int select = SelectWeighted(*group, 0, num_candidates, *proxy_estimates_);
 
     // Move selected proxy to front
     const string swap = (*group)[select];
@@ -307,8 +735,8 @@ static void SwitchProxy(JobInfo *info) {
 
 
 /**
- * Selects a new random proxy in the current load-balancing group.  Resets the
- * "burned" counter.
+ * Selects a new random proxy in the current load-balancing group, weighted by
+ * the estimates.  Resets the "burned" counter.
  */
 static void RebalanceProxiesUnlocked() {
   if (!opt_proxy_groups_)
@@ -317,7 +745,7 @@ static void RebalanceProxiesUnlocked() {
   opt_timestamp_failover_proxies_ = 0;
   opt_proxy_groups_current_burned_ = 1;
   vector<string> *group = &((*opt_proxy_groups_)[opt_proxy_groups_current_]);
-  int select = prng_.Next(group->size());
+  int select = SelectWeighted(*group, 0, group->size(), *proxy_estimates_);
   const string swap = (*group)[select];
   (*group)[select] = (*group)[0];
   (*group)[0] = swap;
@@ -382,6 +810,14 @@ static size_t CallbackCurlHeader(void *ptr, size_t size, size_t nmemb,
     for (i = 8; (i < header_line.length()) && (header_line[i] == ' '); ++i) {}
 
     if (header_line[i] == '2') {
+      info->got_status = true;
+      info->partial_content = (header_line.compare(i, 3, "206") == 0);
+      // The first successful response of a hedged pair wins
+      if (info->hedge) {
+        if (info->hedge_lost)
+          return 0;
+        info->hedge->hedge_lost = true;
+      }
       return num_bytes;
     } else {
       LogCvmfs(kLogDownload, kLogDebug, "http status error code: %s",
@@ -470,10 +906,10 @@ static size_t CallbackCurlData(void *ptr, size_t size, size_t nmemb,
  * Gets an idle CURL handle from the pool. Creates a new one and adds it to
  * the pool if necessary.
  */
-static CURL *AcquireCurlHandle() {
+static CURL *AcquireCurlHandle(IoContext *context) {
   CURL *handle;
 
-  if (pool_handles_idle_->empty()) {
+  if (context->pool_handles_idle->empty()) {
     // Create a new handle
     handle = curl_easy_init();
     assert(handle != NULL);
@@ -484,26 +920,26 @@ static CURL *AcquireCurlHandle() {
     curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, CallbackCurlHeader);
     curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, CallbackCurlData);
   } else {
-    handle = *(pool_handles_idle_->begin());
-    pool_handles_idle_->erase(pool_handles_idle_->begin());
+    handle = *(context->pool_handles_idle->begin());
+    context->pool_handles_idle->erase(context->pool_handles_idle->begin());
   }
 
-  pool_handles_inuse_->insert(handle);
+  context->pool_handles_inuse->insert(handle);
 
   return handle;
 }
 
 
-static void ReleaseCurlHandle(CURL *handle) {
-  set<CURL *>::iterator elem = pool_handles_inuse_->find(handle);
-  assert(elem != pool_handles_inuse_->end());
+static void ReleaseCurlHandle(IoContext *context, CURL *handle) {
+  set<CURL *>::iterator elem = context->pool_handles_inuse->find(handle);
+  assert(elem != context->pool_handles_inuse->end());
 
-  if (pool_handles_idle_->size() > pool_max_handles_)
+  if (context->pool_handles_idle->size() > context->pool_max_handles)
     curl_easy_cleanup(*elem);
   else
-    pool_handles_idle_->insert(*elem);
+    context->pool_handles_idle->insert(*elem);
 
-  pool_handles_inuse_->erase(elem);
+  context->pool_handles_inuse->erase(elem);
 }
 
 
@@ -520,6 +956,12 @@ static void InitializeRequest(JobInfo *info, CURL *handle) {
   info->num_used_hosts = 1;
   info->num_retries = 0;
   info->backoff_ms = 0;
+  info->start_ms = 0;
+  info->got_status = false;
+  info->partial_content = false;
+  info->hedge = NULL;
+  info->hedge_primary = NULL;
+  info->hedge_lost = false;
   if (info->compressed) {
     zlib::DecompressInit(&(info->zstream));
   }
@@ -545,11 +987,118 @@ static void InitializeRequest(JobInfo *info, CURL *handle) {
     curl_easy_setopt(handle, CURLOPT_NOBODY, 1);
   else
     curl_easy_setopt(handle, CURLOPT_HTTPGET, 1);
+  if (info->range_size > 0) {
+    assert(!info->compressed && !info->expected_hash);
+    char range[64];
+    snprintf(range, sizeof(range), "%"PRIu64"-%"PRIu64,
+             info->range_offset, info->range_offset + info->range_size - 1);
+    curl_easy_setopt(handle, CURLOPT_RANGE, range);
+  } else {
+    curl_easy_setopt(handle, CURLOPT_RANGE, NULL);
+  }
   if (opt_ipv4_only_)
     curl_easy_setopt(handle, CURLOPT_IPRESOLVE, CURL_IPRESOLVE_V4);
 }
 
 
+/**
+ * Moves the active proxy behind the remaining proxies of its group if another
+ * process marked it as failed and there is a remaining proxy without a mark.
+ * If all proxies of the group are marked, switches to the next group with an
+ * unmarked proxy.  Needs lock_options_.
+ */
+static void AvoidFailedProxyUnlocked(const time_t now) {
+  vector<string> *group = &((*opt_proxy_groups_)[opt_proxy_groups_current_]);
+  const string failed_proxy = (*group)[0];
+  if (!IsEndpointFailed(failed_proxy, now))
+    return;
+
+  const unsigned group_size = group->size();
+  if (opt_proxy_groups_current_burned_ < group_size) {
+    const unsigned last_candidate =
+      group_size - opt_proxy_groups_current_burned_;
+    const unsigned select =
+      SelectWeighted(*group, 1, last_candidate + 1, *proxy_estimates_);
+    if (!IsEndpointFailed((*group)[select], now)) {
+      (*group)[0] = (*group)[select];
+      (*group)[select] = (*group)[last_candidate];
+      (*group)[last_candidate] = failed_proxy;
+      opt_proxy_groups_current_burned_++;
+      if ((opt_proxy_groups_reset_after_ > 0) &&
+          (opt_timestamp_failover_proxies_ == 0))
+      {
+        opt_timestamp_failover_proxies_ = now;
+      }
+      LogCvmfs(kLogDownload, kLogDebug | kLogSyslogWarn,
+               "switching proxy from %s to %s (failed on this node)",
+               failed_proxy.c_str(), (*group)[0].c_str());
+      return;
+    }
+  }
+
+  const unsigned num_groups = opt_proxy_groups_->size();
+  for (unsigned i = 1; i < num_groups; ++i) {
+    const unsigned candidate = (opt_proxy_groups_current_ + i) % num_groups;
+    const vector<string> &candidate_group = (*opt_proxy_groups_)[candidate];
+    unsigned j;
+    for (j = 0; j < candidate_group.size(); ++j) {
+      if (!IsEndpointFailed(candidate_group[j], now))
+        break;
+    }
+    if (j == candidate_group.size())
+      continue;
+
+    opt_proxy_groups_current_ = candidate;
+    RebalanceProxiesUnlocked();
+    if (opt_proxy_groups_reset_after_ > 0) {
+      if (opt_proxy_groups_current_ > 0) {
+        if (opt_timestamp_backup_proxies_ == 0)
+          opt_timestamp_backup_proxies_ = now;
+      } else {
+        opt_timestamp_backup_proxies_ = 0;
+      }
+    }
+    LogCvmfs(kLogDownload, kLogDebug | kLogSyslogWarn,
+             "switching proxy from %s to %s (group failed on this node)",
+             failed_proxy.c_str(),
+             (*opt_proxy_groups_)[opt_proxy_groups_current_][0].c_str());
+    return;
+  }
+}
+
+
+/**
+ * Switches to the next host in the chain without a failure mark if another
+ * process marked the current host as failed.  Needs lock_options_.
+ */
+static void AvoidFailedHostUnlocked(const time_t now) {
+  const unsigned num_hosts = opt_host_chain_->size();
+  const string failed_host = (*opt_host_chain_)[opt_host_chain_current_];
+  if ((num_hosts < 2) || !IsEndpointFailed(failed_host, now))
+    return;
+
+  for (unsigned i = 1; i < num_hosts; ++i) {
+    const unsigned candidate = (opt_host_chain_current_ + i) % num_hosts;
+    if (IsEndpointFailed((*opt_host_chain_)[candidate], now))
+      continue;
+
+    opt_host_chain_current_ = candidate;
+    if (opt_host_reset_after_ > 0) {
+      if (opt_host_chain_current_ != 0) {
+        if (opt_timestamp_backup_host_ == 0)
+          opt_timestamp_backup_host_ = now;
+      } else {
+        opt_timestamp_backup_host_ = 0;
+      }
+    }
+    LogCvmfs(kLogDownload, kLogDebug | kLogSyslogWarn,
+             "switching host from %s to %s (failed on this node)",
+             failed_host.c_str(), (*opt_host_chain_)[candidate].c_str());
+    return;
+  }
+}
+
+
 /**
  * Sets the URL specific options such as host to use and timeout.
  */
@@ -613,6 +1162,14 @@ static void SetUrlOptions(JobInfo *info) {
       opt_timestamp_backup_host_ = 0;
     }
   }
+  // Skip proxies and hosts that other processes found to be broken
+  if (scoreboard_) {
+    const time_t now = time(NULL);
+    if (opt_proxy_groups_)
+      AvoidFailedProxyUnlocked(now);
+    if (opt_host_chain_)
+      AvoidFailedHostUnlocked(now);
+  }
 
   if (!opt_proxy_groups_ ||
       ((*opt_proxy_groups_)[opt_proxy_groups_current_][0] == "DIRECT"))
@@ -644,13 +1201,191 @@ static void SetUrlOptions(JobInfo *info) {
 
 
 /**
- * Adds transfer time and downloaded bytes to the global counters.
+ * Adds a first-byte latency to the ring of the I/O context and updates the
+ * delay of hedged requests every few samples.
+ */
+static void RecordFirstByte(IoContext *context, const double latency_ms) {
+  vector<double> *samples = context->first_byte_ms;
+  if (samples->size() < kHedgeNumSamples)
+    samples->push_back(latency_ms);
+  else
+    (*samples)[context->first_byte_next] = latency_ms;
+  context->first_byte_next = (context->first_byte_next + 1) % kHedgeNumSamples;
+  if ((samples->size() < kHedgeMinSamples) ||
+      (context->first_byte_next % (kHedgeMinSamples / 2) != 0))
+  {
+    return;
+  }
+
+  vector<double> sorted(*samples);
+  const unsigned percentile = (sorted.size() * 95) / 100;
+  nth_element(sorted.begin(), sorted.begin() + percentile, sorted.end());
+  context->hedge_delay_ms =
+    std::max(uint64_t(sorted[percentile]), kHedgeMinDelayMs);
+}
+
+
+/**
+ * Moves the active proxy behind the remaining proxies of its group, like a
+ * failed one, if another remaining proxy is kDemoteFactor times cheaper.
+ * Needs lock_options_.
+ */
+static void DemoteSlowProxyUnlocked(JobInfo *info, const time_t now) {
+  vector<string> *group = &((*opt_proxy_groups_)[opt_proxy_groups_current_]);
+  const unsigned group_size = group->size();
+  if (opt_proxy_groups_current_burned_ >= group_size)
+    return;
+  map<string, EndpointEstimate>::const_iterator iter_current =
+    proxy_estimates_->find((*group)[0]);
+  if ((iter_current == proxy_estimates_->end()) ||
+      (iter_current->second.num_samples < kEstimateMinSamples))
+  {
+    return;
+  }
+  const double cost_current = iter_current->second.GetCost();
+
+  const unsigned last_candidate = group_size - opt_proxy_groups_current_burned_;
+  unsigned best = 0;
+  double cost_best = cost_current;
+  for (unsigned i = 1; i <= last_candidate; ++i) {
+    const EndpointEstimate *estimate =
+      GetRecentEstimate(*proxy_estimates_, (*group)[i], now);
+    if (estimate && (estimate->GetCost() < cost_best)) {
+      best = i;
+      cost_best = estimate->GetCost();
+    }
+  }
+  if ((best == 0) || (cost_best * kDemoteFactor >= cost_current))
+    return;
+
+  const string slow_proxy = (*group)[0];
+  (*group)[0] = (*group)[best];
+  (*group)[best] = (*group)[last_candidate];
+  (*group)[last_candidate] = slow_proxy;
+  opt_proxy_groups_current_burned_++;
+  if ((opt_proxy_groups_reset_after_ > 0) &&
+      (opt_timestamp_failover_proxies_ == 0))
+  {
+    opt_timestamp_failover_proxies_ = now;
+  }
+  info->io_context->statistics->num_demotions++;
+  LogCvmfs(kLogDownload, kLogDebug | kLogSyslogWarn,
+           "demoting slow proxy %s (%.0fms per object), switching to %s "
+           "(%.0fms per object)", slow_proxy.c_str(), cost_current,
+           (*group)[0].c_str(), cost_best);
+}
+
+
+/**
+ * Switches from the current host to a host that is kDemoteFactor times
+ * cheaper, if there is one.  Needs lock_options_.
+ */
+static void DemoteSlowHostUnlocked(JobInfo *info, const time_t now) {
+  map<string, EndpointEstimate>::const_iterator iter_current =
+    host_estimates_->find((*opt_host_chain_)[opt_host_chain_current_]);
+  if ((iter_current == host_estimates_->end()) ||
+      (iter_current->second.num_samples < kEstimateMinSamples))
+  {
+    return;
+  }
+  const double cost_current = iter_current->second.GetCost();
+
+  unsigned best = opt_host_chain_current_;
+  double cost_best = cost_current;
+  for (unsigned i = 0; i < opt_host_chain_->size(); ++i) {
+    const EndpointEstimate *estimate =
+      GetRecentEstimate(*host_estimates_, (*opt_host_chain_)[i], now);
+    if (estimate && (estimate->GetCost() < cost_best)) {
+      best = i;
+      cost_best = estimate->GetCost();
+    }
+  }
+  if ((best == opt_host_chain_current_) ||
+      (cost_best * kDemoteFactor >= cost_current))
+  {
+    return;
+  }
+
+  const string slow_host = (*opt_host_chain_)[opt_host_chain_current_];
+  opt_host_chain_current_ = best;
+  if (opt_host_reset_after_ > 0) {
+    if (opt_host_chain_current_ != 0) {
+      if (opt_timestamp_backup_host_ == 0)
+        opt_timestamp_backup_host_ = now;
+    } else {
+      opt_timestamp_backup_host_ = 0;
+    }
+  }
+  info->io_context->statistics->num_demotions++;
+  LogCvmfs(kLogDownload, kLogDebug | kLogSyslogWarn,
+           "demoting slow host %s (%.0fms per object), switching to %s "
+           "(%.0fms per object)", slow_host.c_str(), cost_current,
+           (*opt_host_chain_)[best].c_str(), cost_best);
+}
+
+
+/**
+ * Adds transfer time and downloaded bytes to the global counters.  Successful
+ * transfers also update the estimates of the used proxy and host.
  */
-static void UpdateStatistics(CURL *handle) {
+static void UpdateStatistics(const int curl_error, JobInfo *info) {
   double val;
 
-  if (curl_easy_getinfo(handle, CURLINFO_SIZE_DOWNLOAD, &val) == CURLE_OK)
-    statistics_->transferred_bytes += val;
+  if (curl_easy_getinfo(info->curl_handle, CURLINFO_SIZE_DOWNLOAD, &val) ==
+      CURLE_OK)
+  {
+    info->io_context->statistics->transferred_bytes += val;
+  }
+  if (curl_error != CURLE_OK)
+    return;
+
+  double time_total;
+  double time_first_byte;
+  char *effective_url;
+  if ((curl_easy_getinfo(info->curl_handle, CURLINFO_TOTAL_TIME,
+                         &time_total) != CURLE_OK) ||
+      (curl_easy_getinfo(info->curl_handle, CURLINFO_STARTTRANSFER_TIME,
+                         &time_first_byte) != CURLE_OK) ||
+      (curl_easy_getinfo(info->curl_handle, CURLINFO_EFFECTIVE_URL,
+                         &effective_url) != CURLE_OK) ||
+      (effective_url == NULL))
+  {
+    return;
+  }
+  // file:// transfers and transfers answered from the cache of libcurl
+  if (!HasPrefix(effective_url, "http", true) || (time_first_byte <= 0.0))
+    return;
+  const double latency_ms = 1000.0 * time_first_byte;
+  RecordFirstByte(info->io_context, latency_ms);
+  double throughput = 0.0;
+  if ((val >= kMinThroughputBytes) && (time_total > time_first_byte))
+    throughput = val / (time_total - time_first_byte);
+
+  const time_t now = time(NULL);
+  pthread_mutex_lock(&lock_options_);
+  if (opt_proxy_groups_) {
+    const string proxy = (info->proxy == "") ? "DIRECT" : info->proxy;
+    EndpointEstimate *estimate = &((*proxy_estimates_)[proxy]);
+    estimate->AddSample(latency_ms, throughput, now);
+    MarkEndpointHealthy(proxy, estimate->GetCost(), now);
+    if ((*opt_proxy_groups_)[opt_proxy_groups_current_][0] == proxy)
+      DemoteSlowProxyUnlocked(info, now);
+  }
+  if (info->probe_hosts && opt_host_chain_) {
+    const string url = string(effective_url) + "/";
+    for (unsigned i = 0; i < opt_host_chain_->size(); ++i) {
+      const string &host = (*opt_host_chain_)[i];
+      if (HasPrefix(url, host + "/", true)) {
+        EndpointEstimate *estimate = &((*host_estimates_)[host]);
+        estimate->AddSample(latency_ms, throughput, now);
+        MarkEndpointHealthy(host, estimate->GetCost(), now);
+        if (i == opt_host_chain_current_)
+          DemoteSlowHostUnlocked(info, now);
+        break;
+      }
+    }
+  }
+  pthread_mutex_unlock(&lock_options_);
 }
 
 
@@ -682,9 +1417,10 @@ static void Backoff(JobInfo *info) {
   pthread_mutex_unlock(&lock_options_);
 
   info->num_retries++;
-  statistics_->num_retries++;
+  info->io_context->statistics->num_retries++;
   if (info->backoff_ms == 0) {
-    info->backoff_ms = prng_.Next(backoff_init_ms + 1);  // Must be != 0
+    // Must be != 0
+    info->backoff_ms = info->io_context->prng.Next(backoff_init_ms + 1);
   } else {
     info->backoff_ms *= 2;
   }
@@ -705,7 +1441,7 @@ static void Backoff(JobInfo *info) {
 static bool VerifyAndFinalize(const int curl_error, JobInfo *info) {
   //LogCvmfs(kLogDownload, kLogDebug, "Verify Download (curl error %d)",
   //         curl_error);
-  UpdateStatistics(info->curl_handle);
+  UpdateStatistics(curl_error, info);
 
   // Verification and error classification
   switch (curl_error) {
@@ -950,270 +1686,902 @@ static Failures PrepareDownloadDestination(JobInfo *info) {
 }
 
 
+static void MakeDoorbell(int doorbell[2]) {
+  const int fd = platform_eventfd();
+  if (fd >= 0) {
+    doorbell[0] = doorbell[1] = fd;
+  } else {
+    MakePipe(doorbell);
+  }
+  Block2Nonblock(doorbell[0]);
+}
+
+
+static void CloseDoorbell(int doorbell[2]) {
+  close(doorbell[0]);
+  if (doorbell[1] != doorbell[0])
+    close(doorbell[1]);
+}
+
+
+static void RingDoorbell(int doorbell[2]) {
+  const uint64_t value = 1;
+  WritePipe(doorbell[1], &value, sizeof(value));
+}
+
+
 /**
- * Downloads data from an unsecure outside channel (currently HTTP or file).
+ * Resets the eventfd counter or empties the pipe.
  */
-Failures Fetch(JobInfo *info) {
-  assert(info != NULL);
-  assert(info->url != NULL);
+static void ClearDoorbell(int doorbell[2]) {
+  uint64_t buf[8];
+  while (read(doorbell[0], buf, sizeof(buf)) > 0) { }
+}
 
-  Failures result;
-  result = PrepareDownloadDestination(info);
-  if (result != kFailOk)
-    return result;
 
-  if (info->expected_hash) {
-    const hash::Algorithms algorithm = info->expected_hash->algorithm;
-    info->hash_context.algorithm = algorithm;
-    info->hash_context.size = hash::GetContextSize(algorithm);
-    info->hash_context.buffer = alloca(info->hash_context.size);
+/**
+ * Hands a job over to an I/O thread.
+ */
+static void SubmitJob(IoContext *context, JobInfo *info) {
+  info->io_context = context;
+  atomic_inc32(&context->num_jobs);
+  JobInfo *head;
+  do {
+    head = context->jobs_head;
+    info->next_job = head;
+  } while (!atomic_cas_ptr(&context->jobs_head, head, info));
+  if (head == NULL)
+    RingDoorbell(context->doorbell_jobs);
+}
+
+
+/**
+ * Takes all submitted jobs from the queue, in submission order.  The doorbell
+ * is cleared first so that jobs pushed afterwards ring it again.
+ */
+static JobInfo *TakeJobs(IoContext *context) {
+  ClearDoorbell(context->doorbell_jobs);
+  JobInfo *reversed =
+    atomic_xchg_ptr(&context->jobs_head, static_cast<JobInfo *>(NULL));
+  JobInfo *jobs = NULL;
+  while (reversed != NULL) {
+    JobInfo *next = reversed->next_job;
+    reversed->next_job = jobs;
+    jobs = reversed;
+    reversed = next;
   }
+  return jobs;
+}
 
-  if (atomic_xadd32(&multi_threaded_, 0) == 1) {
-    if (info->wait_at[0] == -1) {
-      MakePipe(info->wait_at);
-    }
 
-    //LogCvmfs(kLogDownload, kLogDebug, "send job to thread, pipe %d %d",
-    //         info->wait_at[0], info->wait_at[1]);
-    WritePipe(pipe_jobs_[1], &info, sizeof(info));
-    ReadPipe(info->wait_at[0], &result, sizeof(result));
-    //LogCvmfs(kLogDownload, kLogDebug, "got result %d", result);
-  } else {
-    pthread_mutex_lock(&lock_synchronous_mode_);
-    CURL *handle = AcquireCurlHandle();
-    InitializeRequest(info, handle);
+/**
+ * Called by the I/O thread when a job is done.  Once completed is set, the
+ * JobInfo belongs to the fetching thread again, which may already have
+ * returned and reused the memory.  The wake-up therefore only uses the
+ * address, copied before.  Waking an address that is reused meanwhile is
+ * harmless: futex waiters check their value again after every wake-up, and
+ * an address that is unmapped meanwhile makes the system call fail.
+ */
+static void CompleteJob(JobInfo *info) {
+  info->io_context->hedge_candidates->erase(info);
+  if (info->priority == kPriorityLow)
+    info->io_context->num_active_low--;
+  atomic_dec32(&info->io_context->num_jobs);
+  atomic_int32 *completed = &info->completed;
+  atomic_cas32(completed, 0, 1);
+  // Do not touch info from here on
+  platform_futex_wake(completed);
+}
+
+
+/**
+ * The proxy or, for direct connections, the host a job connects to, in the
+ * form scheme://host[:port].
+ */
+static string GetEndpoint(const JobInfo *info) {
+  string endpoint;
+  pthread_mutex_lock(&lock_options_);
+  if (opt_proxy_groups_ &&
+      ((*opt_proxy_groups_)[opt_proxy_groups_current_][0] != "DIRECT"))
+  {
+    endpoint = (*opt_proxy_groups_)[opt_proxy_groups_current_][0];
+  } else if (info->probe_hosts && opt_host_chain_) {
+    endpoint = (*opt_host_chain_)[opt_host_chain_current_];
+  } else {
+    endpoint = *(info->url);
+  }
+  pthread_mutex_unlock(&lock_options_);
+
+  return StripUrlPath(endpoint);
+}
+
+
+/**
+ * Removes the partial result of a failed job.
+ */
+static void CleanupFailedJob(JobInfo *info) {
+  LogCvmfs(kLogDownload, kLogDebug, "download failed (error %d)",
+           info->error_code);
+
+  if (info->destination == kDestinationPath)
+    unlink(info->destination_path->c_str());
+
+  if (info->destination_mem.data) {
+    free(info->destination_mem.data);
+    info->destination_mem.data = NULL;
+    info->destination_mem.size = 0;
+  }
+}
+
+
+/**
+ * Jobs are sent to the I/O thread that the endpoint hashes to, so that the
+ * connections to a proxy or host are concentrated in few connection caches.
+ * Once this thread has as many jobs in flight as it has curl handles, the job
+ * goes to the least busy thread instead, which spreads a busy site proxy over
+ * all threads.
+ */
+static IoContext *SelectIoThread(const JobInfo *info) {
+  const unsigned num_threads = io_threads_->size();
+  if (num_threads == 1)
+    return (*io_threads_)[0];
+
+  const string endpoint = GetEndpoint(info);
+  IoContext *home = (*io_threads_)[
+    MurmurHash2(endpoint.data(), endpoint.length(), 0x3d8f9a41) % num_threads];
+  if (atomic_read32(&home->num_jobs) <
+      static_cast<int32_t>(home->pool_max_handles))
+  {
+    return home;
+  }
+
+  IoContext *result = home;
+  int32_t min_jobs = atomic_read32(&home->num_jobs);
+  for (unsigned i = 0; i < num_threads; ++i) {
+    const int32_t num_jobs = atomic_read32(&(*io_threads_)[i]->num_jobs);
+    if (num_jobs < min_jobs) {
+      result = (*io_threads_)[i];
+      min_jobs = num_jobs;
+    }
+  }
+  return result;
+}
+
+
+/**
+ * Downloads data from an unsecure outside channel (currently HTTP or file).
+ */
+Failures Fetch(JobInfo *info) {
+  assert(info != NULL);
+  assert(info->url != NULL);
+
+  Failures result;
+  result = PrepareDownloadDestination(info);
+  if (result != kFailOk)
+    return result;
+
+  if (info->expected_hash) {
+    const hash::Algorithms algorithm = info->expected_hash->algorithm;
+    info->hash_context.algorithm = algorithm;
+    info->hash_context.size = hash::GetContextSize(algorithm);
+    info->hash_context.buffer = alloca(info->hash_context.size);
+  }
+
+  if (atomic_xadd32(&multi_threaded_, 0) == 1) {
+    atomic_init32(&info->completed);
+    SubmitJob(SelectIoThread(info), info);
+    while (atomic_read32(&info->completed) == 0)
+      platform_futex_wait(&info->completed, 0, kCompletionTimeoutMs);
+    result = info->error_code;
+    //LogCvmfs(kLogDownload, kLogDebug, "got result %d", result);
+  } else {
+    pthread_mutex_lock(&lock_synchronous_mode_);
+    info->io_context = context_sync_;
+    CURL *handle = AcquireCurlHandle(context_sync_);
+    InitializeRequest(info, handle);
     SetUrlOptions(info);
     //curl_easy_setopt(handle, CURLOPT_VERBOSE, 1);
     int retval;
     do {
       retval = curl_easy_perform(handle);
-      statistics_->num_requests++;
+      context_sync_->statistics->num_requests++;
       double elapsed;
       if (curl_easy_getinfo(handle, CURLINFO_TOTAL_TIME, &elapsed) == CURLE_OK)
-        statistics_->transfer_time += elapsed;
+        context_sync_->statistics->transfer_time += elapsed;
     } while (VerifyAndFinalize(retval, info));
     result = info->error_code;
-    ReleaseCurlHandle(info->curl_handle);
+    ReleaseCurlHandle(context_sync_, info->curl_handle);
     pthread_mutex_unlock(&lock_synchronous_mode_);
   }
 
-  if (result != kFailOk) {
-    LogCvmfs(kLogDownload, kLogDebug, "download failed (error %d)", result);
+  if (result != kFailOk)
+    CleanupFailedJob(info);
 
-    if (info->destination == kDestinationPath)
-      unlink(info->destination_path->c_str());
+  return result;
+}
 
-    if (info->destination_mem.data) {
-      free(info->destination_mem.data);
-      info->destination_mem.data = NULL;
-      info->destination_mem.size = 0;
-    }
+
+static uint64_t GetMilliseconds() {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return uint64_t(now.tv_sec) * 1000 + now.tv_usec / 1000;
+}
+
+
+/**
+ * Socket activity as reported by WaitForEvents(), in libcurl's terms.
+ */
+struct SocketEvent {
+  int fd;
+  int ev_bitmask;  /**< CURL_CSELECT_... */
+};
+
+
+#ifdef __APPLE__
+
+static void WatchSocket(IoContext *context, const int fd,
+                        const int action)
+{
+  short events = 0;
+  if ((action == CURL_POLL_IN) || (action == CURL_POLL_INOUT))
+    events |= POLLIN | POLLPRI;
+  if ((action == CURL_POLL_OUT) || (action == CURL_POLL_INOUT))
+    events |= POLLOUT | POLLWRBAND;
+
+  map<int, unsigned>::const_iterator iter =
+    context->watch_fds_index->find(fd);
+  if (iter != context->watch_fds_index->end()) {
+    (*context->watch_fds)[iter->second].events = events;
+    return;
   }
+  struct pollfd watch_fd;
+  watch_fd.fd = fd;
+  watch_fd.events = events;
+  watch_fd.revents = 0;
+  (*context->watch_fds_index)[fd] = context->watch_fds->size();
+  context->watch_fds->push_back(watch_fd);
+}
 
-  return result;
+
+static void UnwatchSocket(IoContext *context, const int fd) {
+  map<int, unsigned>::iterator iter = context->watch_fds_index->find(fd);
+  if (iter == context->watch_fds_index->end())
+    return;
+  const unsigned index = iter->second;
+  context->watch_fds_index->erase(iter);
+  if (index < context->watch_fds->size() - 1) {
+    (*context->watch_fds)[index] = context->watch_fds->back();
+    (*context->watch_fds_index)[(*context->watch_fds)[index].fd] = index;
+  }
+  context->watch_fds->pop_back();
+}
+
+
+static void InitEvents(IoContext *context) {
+  context->watch_fds = new vector<struct pollfd>();
+  context->watch_fds_index = new map<int, unsigned>();
+  WatchSocket(context, context->pipe_terminate[0], CURL_POLL_IN);
+  WatchSocket(context, context->doorbell_jobs[0], CURL_POLL_IN);
+}
+
+
+static void FiniEvents(IoContext *context) {
+  delete context->watch_fds;
+  delete context->watch_fds_index;
+  context->watch_fds = NULL;
+  context->watch_fds_index = NULL;
+}
+
+
+static bool HasEvents(const IoContext *context) {
+  return context->watch_fds != NULL;
+}
+
+
+static int WaitForEvents(IoContext *context, const int timeout_ms,
+                         SocketEvent *events)
+{
+  int retval = poll(&(*context->watch_fds)[0], context->watch_fds->size(),
+                    timeout_ms);
+  if (retval <= 0)
+    return retval;
+
+  int num_events = 0;
+  for (unsigned i = 0; (i < context->watch_fds->size()) &&
+       (num_events < static_cast<int>(kMaxEvents)); ++i)
+  {
+    const short revents = (*context->watch_fds)[i].revents;
+    if (revents == 0)
+      continue;
+    (*context->watch_fds)[i].revents = 0;
+    events[num_events].fd = (*context->watch_fds)[i].fd;
+    events[num_events].ev_bitmask = 0;
+    if (revents & (POLLIN | POLLPRI))
+      events[num_events].ev_bitmask |= CURL_CSELECT_IN;
+    if (revents & (POLLOUT | POLLWRBAND))
+      events[num_events].ev_bitmask |= CURL_CSELECT_OUT;
+    if (revents & (POLLERR | POLLHUP | POLLNVAL))
+      events[num_events].ev_bitmask |= CURL_CSELECT_ERR;
+    num_events++;
+  }
+  return num_events;
 }
 
+#else
+
+static uint32_t GetEpollEvents(const int action) {
+  uint32_t events = 0;
+  if ((action == CURL_POLL_IN) || (action == CURL_POLL_INOUT))
+    events |= EPOLLIN | EPOLLPRI;
+  if ((action == CURL_POLL_OUT) || (action == CURL_POLL_INOUT))
+    events |= EPOLLOUT;
+  return events;
+}
+
+
+static void InitEvents(IoContext *context) {
+  context->epoll_fd = epoll_create(kMaxEvents);
+  assert(context->epoll_fd >= 0);
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN | EPOLLPRI;
+  event.data.fd = context->pipe_terminate[0];
+  int retval = epoll_ctl(context->epoll_fd, EPOLL_CTL_ADD,
+                         context->pipe_terminate[0], &event);
+  assert(retval == 0);
+  event.data.fd = context->doorbell_jobs[0];
+  retval = epoll_ctl(context->epoll_fd, EPOLL_CTL_ADD,
+                     context->doorbell_jobs[0], &event);
+  assert(retval == 0);
+}
+
+
+static void FiniEvents(IoContext *context) {
+  close(context->epoll_fd);
+  context->epoll_fd = -1;
+}
+
+
+static bool HasEvents(const IoContext *context) {
+  return context->epoll_fd >= 0;
+}
+
+
+static int WaitForEvents(IoContext *context, const int timeout_ms,
+                         SocketEvent *events)
+{
+  struct epoll_event epoll_events[kMaxEvents];
+  int retval = epoll_wait(context->epoll_fd, epoll_events, kMaxEvents,
+                          timeout_ms);
+  for (int i = 0; i < retval; ++i) {
+    const uint32_t revents = epoll_events[i].events;
+    events[i].fd = epoll_events[i].data.fd;
+    events[i].ev_bitmask = 0;
+    if (revents & (EPOLLIN | EPOLLPRI))
+      events[i].ev_bitmask |= CURL_CSELECT_IN;
+    if (revents & EPOLLOUT)
+      events[i].ev_bitmask |= CURL_CSELECT_OUT;
+    if (revents & (EPOLLERR | EPOLLHUP))
+      events[i].ev_bitmask |= CURL_CSELECT_ERR;
+  }
+  return retval;
+}
+
+#endif
+
 
 /**
  * Called when new curl sockets arrive or existing curl sockets depart.
+ * Registered sockets carry watch_marker_ as socketp, userp is the IoContext
+ * of the multi handle.
  */
 static int CallbackCurlSocket(CURL *easy, curl_socket_t s, int action,
                               void *userp, void *socketp)
 {
   //LogCvmfs(kLogDownload, kLogDebug, "CallbackCurlSocket called with easy "
   //         "handle %p, socket %d, action %d", easy, s, action);
-  if (action == CURL_POLL_NONE)
+  IoContext *context = static_cast<IoContext *>(userp);
+  // Sockets are released on Fini() after the I/O thread has terminated
+  if ((action == CURL_POLL_NONE) || !HasEvents(context))
     return 0;
 
-  // Find s in watch_fds_
-  unsigned index;
-  for (index = 0; index < watch_fds_inuse_; ++index) {
-    if (watch_fds_[index].fd == s)
-      break;
+  if (action == CURL_POLL_REMOVE) {
+#ifdef __APPLE__
+    UnwatchSocket(context, s);
+#else
+    // Fails if the socket is already closed, which removes it from the set
+    epoll_ctl(context->epoll_fd, EPOLL_CTL_DEL, s, NULL);
+#endif
+    curl_multi_assign(context->curl_multi, s, NULL);
+    return 0;
   }
-  // Or create newly
-  if (index == watch_fds_inuse_) {
-    // Extend array if necessary
-    if (watch_fds_inuse_ == watch_fds_size_) {
-      watch_fds_size_ *= 2;
-      //LogCvmfs(kLogDownload, kLogDebug, "extending watch_fds_ (%d)", watch_fds_size_);
-      watch_fds_ = static_cast<struct pollfd *>(
-                   srealloc(watch_fds_, watch_fds_size_*sizeof(struct pollfd)));
-      //LogCvmfs(kLogDownload, kLogDebug, "extending watch_fds_ done (%d)", watch_fds_size_);
+
+#ifdef __APPLE__
+  WatchSocket(context, s, action);
+#else
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = GetEpollEvents(action);
+  event.data.fd = s;
+  const int op = (socketp == NULL) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+  int retval = epoll_ctl(context->epoll_fd, op, s, &event);
+  if ((retval != 0) && (errno == ENOENT))
+    retval = epoll_ctl(context->epoll_fd, EPOLL_CTL_ADD, s, &event);
+  else if ((retval != 0) && (errno == EEXIST))
+    retval = epoll_ctl(context->epoll_fd, EPOLL_CTL_MOD, s, &event);
+  if (retval != 0) {
+    LogCvmfs(kLogDownload, kLogDebug | kLogSyslogErr,
+             "failed to watch socket %d (%d)", s, errno);
+  }
+#endif
+  if (socketp == NULL)
+    curl_multi_assign(context->curl_multi, s, &watch_marker_);
+
+  return 0;
+}
+
+
+/**
+ * libcurl asks to be called on timeout after timeout_ms milliseconds, or not
+ * at all for timeout_ms == -1.
+ */
+static int CallbackCurlTimer(CURLM *multi, long timeout_ms, void *userp) {
+  IoContext *context = static_cast<IoContext *>(userp);
+  if (timeout_ms < 0)
+    context->timer_deadline = 0;
+  else
+    context->timer_deadline = GetMilliseconds() + timeout_ms;
+  return 0;
+}
+
+
+/**
+ * Milliseconds until libcurl's timer expires, -1 if there is no timer.
+ */
+static int GetTimerTimeout(const IoContext *context) {
+  if (context->timer_deadline == 0)
+    return -1;
+  const uint64_t now = GetMilliseconds();
+  return (context->timer_deadline > now) ?
+         (context->timer_deadline - now) : 0;
+}
+
+
+/**
+ * Milliseconds until the next duplicate of a stalled job is due, -1 if there
+ * is none.
+ */
+static int GetHedgeTimeout(const IoContext *context) {
+  if ((context->hedge_delay_ms == 0) || context->hedge_candidates->empty())
+    return -1;
+  const uint64_t now = GetMilliseconds();
+  uint64_t timeout = context->hedge_delay_ms;
+  for (set<JobInfo *>::const_iterator i = context->hedge_candidates->begin(),
+       iEnd = context->hedge_candidates->end(); i != iEnd; ++i)
+  {
+    const uint64_t deadline = (*i)->start_ms + context->hedge_delay_ms;
+    if (deadline <= now)
+      return 0;
+    timeout = std::min(timeout, deadline - now);
+  }
+  return timeout;
+}
+
+
+/**
+ * Points a duplicate to the next proxy of the active load-balancing group or,
+ * for direct connections, to the next host.  If there is no alternative, the
+ * duplicate uses a fresh connection to the same endpoint.
+ */
+static void SetHedgeUrlOptions(JobInfo *hedge) {
+  SetUrlOptions(hedge);
+
+  pthread_mutex_lock(&lock_options_);
+  if (opt_proxy_groups_ &&
+      ((*opt_proxy_groups_)[opt_proxy_groups_current_].size() > 1))
+  {
+    const vector<string> &group =
+      (*opt_proxy_groups_)[opt_proxy_groups_current_];
+    const unsigned num_candidates = (group.size() >
+      opt_proxy_groups_current_burned_) ?
+      group.size() - opt_proxy_groups_current_burned_ : 1;
+    const string &proxy =
+      group[SelectWeighted(group, 1, num_candidates + 1, *proxy_estimates_)];
+    hedge->proxy = (proxy == "DIRECT") ? "" : proxy;
+    curl_easy_setopt(hedge->curl_handle, CURLOPT_PROXY, hedge->proxy.c_str());
+  } else if ((hedge->proxy == "") && hedge->probe_hosts && opt_host_chain_ &&
+             (opt_host_chain_->size() > 1))
+  {
+    const string &host = (*opt_host_chain_)[
+      (opt_host_chain_current_ + 1) % opt_host_chain_->size()];
+    curl_easy_setopt(hedge->curl_handle, CURLOPT_URL,
+                     EscapeUrl(host + *(hedge->url)).c_str());
+  }
+  pthread_mutex_unlock(&lock_options_);
+}
+
+
+/**
+ * Sends a duplicate of a stalled job.  The duplicate gets its own memory
+ * destination, decompression, and hash state; a file destination is shared,
+ * which is safe because only the winner of the race writes to it.
+ */
+static void StartHedge(IoContext *context, JobInfo *info) {
+  JobInfo *hedge = new JobInfo(*info);
+  hedge->destination_mem.size = 0;
+  hedge->destination_mem.pos = 0;
+  hedge->destination_mem.data = NULL;
+  if (info->expected_hash)
+    hedge->hash_context.buffer = smalloc(info->hash_context.size);
+  CURL *handle = AcquireCurlHandle(context);
+  InitializeRequest(hedge, handle);
+  SetHedgeUrlOptions(hedge);
+  hedge->start_ms = GetMilliseconds();
+  hedge->hedge = info;
+  hedge->hedge_primary = info;
+  info->hedge = hedge;
+  context->hedged_jobs->insert(info);
+  context->statistics->num_hedges++;
+  curl_multi_add_handle(context->curl_multi, handle);
+  LogCvmfs(kLogDownload, kLogDebug, "no response for %s after %"PRIu64"ms, "
+           "sending a duplicate request", info->url->c_str(),
+           context->hedge_delay_ms);
+}
+
+
+/**
+ * Sends duplicates of jobs without response within the hedge delay, as long
+ * as duplicates stay within opt_hedge_percent_ of the submitted jobs.
+ */
+static void StartHedges(IoContext *context) {
+  if ((context->hedge_delay_ms == 0) || context->hedge_candidates->empty())
+    return;
+  pthread_mutex_lock(&lock_options_);
+  const unsigned hedge_percent = opt_hedge_percent_;
+  pthread_mutex_unlock(&lock_options_);
+
+  const uint64_t now = GetMilliseconds();
+  vector<JobInfo *> due;
+  for (set<JobInfo *>::iterator i = context->hedge_candidates->begin(),
+       iEnd = context->hedge_candidates->end(); i != iEnd; ++i)
+  {
+    if ((*i)->got_status || ((*i)->start_ms + context->hedge_delay_ms <= now))
+      due.push_back(*i);
+  }
+  for (unsigned i = 0; i < due.size(); ++i) {
+    context->hedge_candidates->erase(due[i]);
+    if (due[i]->got_status)
+      continue;
+    if ((context->statistics->num_hedges + 1) * 100 >
+        hedge_percent * context->statistics->num_jobs_submitted)
+    {
+      continue;
     }
-    watch_fds_[watch_fds_inuse_].fd = s;
-    watch_fds_[watch_fds_inuse_].events = 0;
-    watch_fds_[watch_fds_inuse_].revents = 0;
-    watch_fds_inuse_++;
+    StartHedge(context, due[i]);
   }
+}
 
-  switch (action) {
-    case CURL_POLL_IN:
-      watch_fds_[index].events |= POLLIN | POLLPRI;
-      break;
-    case CURL_POLL_OUT:
-      watch_fds_[index].events |= POLLOUT | POLLWRBAND;
-      break;
-    case CURL_POLL_INOUT:
-      watch_fds_[index].events |= POLLIN | POLLPRI | POLLOUT | POLLWRBAND;
-      break;
-    case CURL_POLL_REMOVE:
-      if (index < watch_fds_inuse_-1)
-        watch_fds_[index] = watch_fds_[watch_fds_inuse_-1];
-      watch_fds_inuse_--;
-      // Shrink array if necessary
-      if ((watch_fds_inuse_ > watch_fds_max_) &&
-          (watch_fds_inuse_ < watch_fds_size_/2))
-      {
-        watch_fds_size_ /= 2;
-        //LogCvmfs(kLogDownload, kLogDebug, "shrinking watch_fds_ (%d)",
-        //         watch_fds_size_);
-        watch_fds_ = static_cast<struct pollfd *>(
-                   srealloc(watch_fds_, watch_fds_size_*sizeof(struct pollfd)));
-        //LogCvmfs(kLogDownload, kLogDebug, "shrinking watch_fds_ done",
-        //         watch_fds_size_);
-      }
+
+/**
+ * Cancels the losing job of a hedged pair.  A losing duplicate is deleted, a
+ * losing original job waits for the result of its duplicate.
+ */
+static void CancelHedge(IoContext *context, JobInfo *loser) {
+  JobInfo *winner = loser->hedge;
+  JobInfo *primary = loser->hedge_primary ? winner : loser;
+  context->hedged_jobs->erase(primary);
+  loser->hedge = NULL;
+  winner->hedge = NULL;
+
+  curl_multi_remove_handle(context->curl_multi, loser->curl_handle);
+  ReleaseCurlHandle(context, loser->curl_handle);
+  if (loser->compressed)
+    zlib::DecompressFini(&loser->zstream);
+  if (loser->hedge_primary) {
+    free(loser->destination_mem.data);
+    if (loser->expected_hash)
+      free(loser->hash_context.buffer);
+    delete loser;
+  } else {
+    context->statistics->num_hedges_won++;
+  }
+}
+
+
+/**
+ * Cancels the losers of decided races.
+ */
+static void CancelLostHedges(IoContext *context) {
+  vector<JobInfo *> losers;
+  for (set<JobInfo *>::iterator i = context->hedged_jobs->begin(),
+       iEnd = context->hedged_jobs->end(); i != iEnd; ++i)
+  {
+    if ((*i)->hedge_lost)
+      losers.push_back(*i);
+    else if ((*i)->hedge->hedge_lost)
+      losers.push_back((*i)->hedge);
+  }
+  for (unsigned i = 0; i < losers.size(); ++i)
+    CancelHedge(context, losers[i]);
+}
+
+
+/**
+ * A finished duplicate hands over its result to the original job.
+ */
+static void CompleteHedge(JobInfo *hedge) {
+  JobInfo *primary = hedge->hedge_primary;
+  primary->error_code = hedge->error_code;
+  primary->partial_content = hedge->partial_content;
+  primary->destination_mem = hedge->destination_mem;
+  primary->destination_file = hedge->destination_file;
+  if (hedge->expected_hash)
+    free(hedge->hash_context.buffer);
+  delete hedge;
+  CompleteJob(primary);
+}
+
+
+/**
+ * Hands waiting jobs to libcurl, highest priority first, as long as there are
+ * free connections.  Returns true if a job was started.
+ */
+static bool StartWaitingJobs(IoContext *context) {
+  pthread_mutex_lock(&lock_options_);
+  const bool hedging = opt_hedge_percent_ > 0;
+  pthread_mutex_unlock(&lock_options_);
+  const uint32_t max_active_low = (context->pool_max_handles + 1) / 2;
+
+  bool result = false;
+  while (context->pool_handles_inuse->size() < context->pool_max_handles) {
+    JobInfo *info = NULL;
+    for (unsigned p = 0; p < kNumPriorities; ++p) {
+      deque<JobInfo *> *queue = &(*context->jobs_waiting)[p];
+      if (queue->empty())
+        continue;
+      if ((p == kPriorityLow) && (context->num_active_low >= max_active_low))
+        break;
+      info = queue->front();
+      queue->pop_front();
       break;
-    default:
+    }
+    if (info == NULL)
       break;
-  }
 
-  return 0;
+    CURL *handle = AcquireCurlHandle(context);
+    InitializeRequest(info, handle);
+    SetUrlOptions(info);
+    if (info->priority == kPriorityLow) {
+      context->num_active_low++;
+    } else if (hedging && !info->head_request &&
+               HasPrefix(GetEndpoint(info), "http", true))
+    {
+      info->start_ms = GetMilliseconds();
+      context->hedge_candidates->insert(info);
+    }
+    curl_multi_add_handle(context->curl_multi, handle);
+    result = true;
+  }
+  return result;
 }
 
 
 /**
- * Worker thread event loop.  Waits on new JobInfo structs on a pipe.
+ * Worker thread event loop.  Waits on new JobInfo structs in the queue of its
+ * IoContext.
  */
-static void *MainDownload(void *data __attribute__((unused))) {
+static void *MainDownload(void *data) {
+  IoContext *context = static_cast<IoContext *>(data);
   LogCvmfs(kLogDownload, kLogDebug, "download I/O thread started");
 
-  watch_fds_ = static_cast<struct pollfd *>(smalloc(2 * sizeof(struct pollfd)));
-  watch_fds_size_ = 2;
-  watch_fds_[0].fd = pipe_terminate_[0];
-  watch_fds_[0].events = POLLIN | POLLPRI;
-  watch_fds_[0].revents = 0;
-  watch_fds_[1].fd = pipe_jobs_[0];
-  watch_fds_[1].events = POLLIN | POLLPRI;
-  watch_fds_[1].revents = 0;
-  watch_fds_inuse_ = 2;
+  InitEvents(context);
+  SocketEvent events[kMaxEvents];
 
   int still_running = 0;
   struct timeval timeval_start, timeval_stop;
   gettimeofday(&timeval_start, NULL);
   while (true) {
-    int timeout;
-    if (still_running) {
-      timeout = 1;
-    } else {
-      timeout = -1;
+    if (!still_running) {
       gettimeofday(&timeval_stop, NULL);
-      statistics_->transfer_time +=
+      context->statistics->transfer_time +=
         DiffTimeSeconds(timeval_start, timeval_stop);
     }
-    int retval = poll(watch_fds_, watch_fds_inuse_, timeout);
-    if (retval < 0) {
+    int timeout = GetTimerTimeout(context);
+    const int timeout_hedge = GetHedgeTimeout(context);
+    if ((timeout_hedge >= 0) && ((timeout < 0) || (timeout_hedge < timeout)))
+      timeout = timeout_hedge;
+    const int num_events = WaitForEvents(context, timeout, events);
+    if (num_events < 0) {
       continue;
     }
+    context->statistics->num_wakeups++;
 
-    // Handle timeout
-    if (retval == 0) {
-      retval = curl_multi_socket_action(curl_multi_, CURL_SOCKET_TIMEOUT, 0,
-                                        &still_running);
+    // Handle timeout, socket activity does not postpone libcurl's timer
+    if ((context->timer_deadline != 0) && (GetTimerTimeout(context) == 0)) {
+      context->timer_deadline = 0;
+      curl_multi_socket_action(context->curl_multi, CURL_SOCKET_TIMEOUT, 0,
+                               &still_running);
     }
 
-    // Terminate I/O thread
-    if (watch_fds_[0].revents)
-      break;
-
-    // New job arrives
-    if (watch_fds_[1].revents) {
-      watch_fds_[1].revents = 0;
-      JobInfo *info;
-      ReadPipe(pipe_jobs_[0], &info, sizeof(info));
-      //LogCvmfs(kLogDownload, kLogDebug, "IO thread, got job: url %s, compressed %d, nocache %d, destination %d, file %p, expected hash %p, wait at %d", info->url->c_str(), info->compressed, info->nocache,
-      //         info->destination, info->destination_file, info->expected_hash, info->wait_at[1]);
-
-      if (!still_running)
-        gettimeofday(&timeval_start, NULL);
-      CURL *handle = AcquireCurlHandle();
-      InitializeRequest(info, handle);
-      SetUrlOptions(info);
-      curl_multi_add_handle(curl_multi_, handle);
-      retval = curl_multi_socket_action(curl_multi_, CURL_SOCKET_TIMEOUT, 0,
-                                        &still_running);
-      //LogCvmfs(kLogDownload, kLogDebug, "socket action returned with %d, still_running %d", retval, still_running);
-    }
+    bool terminate = false;
+    for (int i = 0; i < num_events; ++i) {
+      // Terminate I/O thread
+      if (events[i].fd == context->pipe_terminate[0]) {
+        terminate = true;
+        break;
+      }
 
-    // Activity on curl sockets
-    for (unsigned i = 2; i < watch_fds_inuse_; ++i) {
-      if (watch_fds_[i].revents) {
-        int ev_bitmask = 0;
-        if (watch_fds_[i].revents & (POLLIN | POLLPRI))
-          ev_bitmask |= CURL_CSELECT_IN;
-        if (watch_fds_[i].revents & (POLLOUT | POLLWRBAND))
-          ev_bitmask |= CURL_CSELECT_IN;
-        if (watch_fds_[i].revents & (POLLERR | POLLHUP | POLLNVAL))
-          ev_bitmask |= CURL_CSELECT_ERR;
-        watch_fds_[i].revents = 0;
-
-        retval = curl_multi_socket_action(curl_multi_, watch_fds_[i].fd,
-                                          ev_bitmask, &still_running);
-        //LogCvmfs(kLogDownload, kLogDebug, "socket action on socket %d, returned with %d, still_running %d", watch_fds_[i].fd, retval, still_running);
+      // New jobs arrive, all of them are started at once
+      if (events[i].fd == context->doorbell_jobs[0]) {
+        JobInfo *info = TakeJobs(context);
+        if (info == NULL)
+          continue;
+        if (!still_running)
+          gettimeofday(&timeval_start, NULL);
+        while (info != NULL) {
+          //LogCvmfs(kLogDownload, kLogDebug, "IO thread, got job: url %s, compressed %d, nocache %d, destination %d, file %p, expected hash %p", info->url->c_str(), info->compressed, info->nocache,
+          //         info->destination, info->destination_file, info->expected_hash);
+          JobInfo *next = info->next_job;
+          (*context->jobs_waiting)[info->priority].push_back(info);
+          context->statistics->num_jobs_submitted++;
+          info = next;
+        }
+        context->statistics->num_job_batches++;
+        StartWaitingJobs(context);
+        curl_multi_socket_action(context->curl_multi, CURL_SOCKET_TIMEOUT,
+                                 0, &still_running);
+        //LogCvmfs(kLogDownload, kLogDebug, "socket action returned with %d, still_running %d", retval, still_running);
+        continue;
       }
+
+      // Activity on curl sockets
+      curl_multi_socket_action(context->curl_multi, events[i].fd,
+                               events[i].ev_bitmask, &still_running);
+      //LogCvmfs(kLogDownload, kLogDebug, "socket action on socket %d, returned with %d, still_running %d", events[i].fd, retval, still_running);
     }
+    if (terminate)
+      break;
+    CancelLostHedges(context);
+    StartHedges(context);
 
     // Check if transfers are completed
     CURLMsg *curl_msg;
     int msgs_in_queue;
-    while ((curl_msg = curl_multi_info_read(curl_multi_, &msgs_in_queue))) {
+    while (true) {
+      curl_msg = curl_multi_info_read(context->curl_multi, &msgs_in_queue);
+      if (curl_msg == NULL) {
+        // Completed transfers free connections for waiting jobs
+        if (!StartWaitingJobs(context))
+          break;
+        curl_multi_socket_action(context->curl_multi, CURL_SOCKET_TIMEOUT, 0,
+                                 &still_running);
+        continue;
+      }
       if (curl_msg->msg == CURLMSG_DONE) {
-        statistics_->num_requests++;
+        context->statistics->num_requests++;
         JobInfo *info;
         CURL *easy_handle = curl_msg->easy_handle;
         int curl_error = curl_msg->data.result;
         curl_easy_getinfo(easy_handle, CURLINFO_PRIVATE, &info);
         //LogCvmfs(kLogDownload, kLogDebug, "Done message for %s", info->url->c_str());
 
-        curl_multi_remove_handle(curl_multi_, easy_handle);
+        // A job that finishes while it races its duplicate without a
+        // successful response leaves the race to the other one
+        if (info->hedge && (info->hedge_lost || !info->hedge->hedge_lost)) {
+          CancelHedge(context, info);
+          continue;
+        }
+        if (info->hedge)
+          CancelHedge(context, info->hedge);
+
+        curl_multi_remove_handle(context->curl_multi, easy_handle);
         if (VerifyAndFinalize(curl_error, info)) {
-          curl_multi_add_handle(curl_multi_, easy_handle);
-          retval = curl_multi_socket_action(curl_multi_, CURL_SOCKET_TIMEOUT, 0,
-                                            &still_running);
+          curl_multi_add_handle(context->curl_multi, easy_handle);
+          curl_multi_socket_action(context->curl_multi, CURL_SOCKET_TIMEOUT,
+                                   0, &still_running);
         } else {
-          // Return easy handle into pool and write result back
-          ReleaseCurlHandle(easy_handle);
-
-          WritePipe(info->wait_at[1], &info->error_code,
-                    sizeof(info->error_code));
+          // Return easy handle into pool and wake up the fetching thread
+          ReleaseCurlHandle(context, easy_handle);
+          if (info->hedge_primary)
+            CompleteHedge(info);
+          else
+            CompleteJob(info);
         }
       }
     }
   }
 
-  for (set<CURL *>::iterator i = pool_handles_inuse_->begin(),
-       iEnd = pool_handles_inuse_->end(); i != iEnd; ++i)
+  for (set<CURL *>::iterator i = context->pool_handles_inuse->begin(),
+       iEnd = context->pool_handles_inuse->end(); i != iEnd; ++i)
   {
-    curl_multi_remove_handle(curl_multi_, *i);
+    curl_multi_remove_handle(context->curl_multi, *i);
     curl_easy_cleanup(*i);
   }
-  pool_handles_inuse_->clear();
-  free(watch_fds_);
+  context->pool_handles_inuse->clear();
+  FiniEvents(context);
 
   LogCvmfs(kLogDownload, kLogDebug, "download I/O thread terminated");
   return NULL;
 }
 
 
+static IoContext *CreateIoContext(const uint32_t pool_max_handles) {
+  IoContext *context = new IoContext();
+  context->curl_multi = NULL;
+  context->pool_handles_idle = new set<CURL *>;
+  context->pool_handles_inuse = new set<CURL *>;
+  context->pool_max_handles = pool_max_handles;
+  context->statistics = new Statistics();
+  context->jobs_head = NULL;
+  atomic_init32(&context->num_jobs);
+#ifdef __APPLE__
+  context->watch_fds = NULL;
+  context->watch_fds_index = NULL;
+#else
+  context->epoll_fd = -1;
+#endif
+  context->timer_deadline = 0;
+  context->jobs_waiting = new vector< deque<JobInfo *> >(kNumPriorities);
+  context->num_active_low = 0;
+  context->hedge_candidates = new set<JobInfo *>;
+  context->hedged_jobs = new set<JobInfo *>;
+  context->first_byte_ms = new vector<double>;
+  context->first_byte_next = 0;
+  context->hedge_delay_ms = 0;
+  pthread_mutex_lock(&lock_options_);
+  context->prng.InitSeed(prng_.Next(uint64_t(1) << 32));
+  pthread_mutex_unlock(&lock_options_);
+  return context;
+}
+
+
+/**
+ * The multi handle is only needed by I/O threads.
+ */
+static void InitCurlMulti(IoContext *context) {
+  CURLM *curl_multi = curl_multi_init();
+  assert(curl_multi != NULL);
+  curl_multi_setopt(curl_multi, CURLMOPT_SOCKETFUNCTION, CallbackCurlSocket);
+  curl_multi_setopt(curl_multi, CURLMOPT_SOCKETDATA, context);
+  curl_multi_setopt(curl_multi, CURLMOPT_TIMERFUNCTION, CallbackCurlTimer);
+  curl_multi_setopt(curl_multi, CURLMOPT_TIMERDATA, context);
+  curl_multi_setopt(curl_multi, CURLMOPT_MAXCONNECTS,
+                    4*context->pool_max_handles);
+  curl_multi_setopt(curl_multi, CURLMOPT_MAX_TOTAL_CONNECTIONS,
+                    context->pool_max_handles);
+  if (opt_pipelining_)
+    curl_multi_setopt(curl_multi, CURLMOPT_PIPELINING, 1);
+  context->curl_multi = curl_multi;
+}
+
+
+static void DestroyIoContext(IoContext *context) {
+  for (set<CURL *>::iterator i = context->pool_handles_idle->begin(),
+       iEnd = context->pool_handles_idle->end(); i != iEnd; ++i)
+  {
+    curl_easy_cleanup(*i);
+  }
+  if (context->curl_multi)
+    curl_multi_cleanup(context->curl_multi);
+  delete context->pool_handles_idle;
+  delete context->pool_handles_inuse;
+  delete context->statistics;
+  delete context->jobs_waiting;
+  delete context->hedge_candidates;
+  delete context->hedged_jobs;
+  delete context->first_byte_ms;
+  delete context;
+}
+
+
 void Init(const unsigned max_pool_handles, const bool use_system_proxy) {
   atomic_init32(&multi_threaded_);
   int retval = curl_global_init(CURL_GLOBAL_ALL);
   assert(retval == CURLE_OK);
-  pool_handles_idle_ = new set<CURL *>;
-  pool_handles_inuse_ = new set<CURL *>;
   pool_max_handles_ = max_pool_handles;
-  watch_fds_max_ = 4*pool_max_handles_;
+  prng_.InitLocaltime();
+  context_sync_ = CreateIoContext(pool_max_handles_);
+  io_threads_ = new vector<IoContext *>();
 
   opt_timeout_proxy_ = 5;
   opt_timeout_direct_ = 10;
@@ -1221,8 +2589,8 @@ void Init(const unsigned max_pool_handles, const bool use_system_proxy) {
   opt_proxy_groups_current_burned_ = 0;
   opt_num_proxies_ = 0;
   opt_host_chain_current_ = 0;
-
-  statistics_ = new Statistics();
+  proxy_estimates_ = new map<string, EndpointEstimate>();
+  host_estimates_ = new map<string, EndpointEstimate>();
 
   // Prepare HTTP headers
   string custom_header;
@@ -1242,16 +2610,6 @@ void Init(const unsigned max_pool_handles, const bool use_system_proxy) {
   http_headers_nocache_ = curl_slist_append(http_headers_nocache_,
                                             custom_header.c_str());
 
-  curl_multi_ = curl_multi_init();
-  assert(curl_multi_ != NULL);
-  curl_multi_setopt(curl_multi_, CURLMOPT_SOCKETFUNCTION, CallbackCurlSocket);
-  curl_multi_setopt(curl_multi_, CURLMOPT_MAXCONNECTS, watch_fds_max_);
-  curl_multi_setopt(curl_multi_, CURLMOPT_MAX_TOTAL_CONNECTIONS,
-                    pool_max_handles_);
-  //curl_multi_setopt(curl_multi_, CURLMOPT_PIPELINING, 1);
-
-  prng_.InitLocaltime();
-
   // Parsing environment variables
   if (use_system_proxy) {
     if (getenv("http_proxy") == NULL) {
@@ -1269,36 +2627,38 @@ void Init(const unsigned max_pool_handles, const bool use_system_proxy) {
 
 
 void Fini() {
+  pthread_mutex_lock(&lock_probe_);
+  const bool probe_thread_running = probe_thread_running_;
+  probe_thread_terminate_ = true;
+  probe_thread_running_ = false;
+  pthread_cond_signal(&cond_probe_);
+  pthread_mutex_unlock(&lock_probe_);
+  if (probe_thread_running)
+    pthread_join(thread_probe_, NULL);
+
   if (atomic_xadd32(&multi_threaded_, 0) == 1) {
-    // Shutdown I/O thread
-    char buf = 'T';
-    WritePipe(pipe_terminate_[1], &buf, 1);
-    pthread_join(thread_download_, NULL);
-    // All handles are removed from the multi stack
-    close(pipe_terminate_[1]);
-    close(pipe_terminate_[0]);
-    close(pipe_jobs_[1]);
-    close(pipe_jobs_[0]);
-  }
-
-  for (set<CURL *>::iterator i = pool_handles_idle_->begin(),
-       iEnd = pool_handles_idle_->end(); i != iEnd; ++i)
-  {
-    curl_easy_cleanup(*i);
+    // Shutdown I/O threads
+    for (unsigned i = 0; i < io_threads_->size(); ++i) {
+      IoContext *context = (*io_threads_)[i];
+      char buf = 'T';
+      WritePipe(context->pipe_terminate[1], &buf, 1);
+      pthread_join(context->thread, NULL);
+      // All handles are removed from the multi stack
+      close(context->pipe_terminate[1]);
+      close(context->pipe_terminate[0]);
+      CloseDoorbell(context->doorbell_jobs);
+      DestroyIoContext(context);
+    }
   }
-  delete pool_handles_idle_;
-  delete pool_handles_inuse_;
+  delete io_threads_;
+  io_threads_ = NULL;
+  DestroyIoContext(context_sync_);
+  context_sync_ = NULL;
+
   curl_slist_free_all(http_headers_);
   curl_slist_free_all(http_headers_nocache_);
-  curl_multi_cleanup(curl_multi_);
-  pool_handles_idle_ = NULL;
-  pool_handles_inuse_ = NULL;
   http_headers_ = NULL;
   http_headers_nocache_ = NULL;
-  curl_multi_ = NULL;
-
-  delete statistics_;
-  statistics_ = NULL;
 
   delete opt_host_chain_;
   delete opt_host_chain_rtt_;
@@ -1306,23 +2666,91 @@ void Fini() {
   opt_host_chain_ = NULL;
   opt_host_chain_rtt_ = NULL;
   opt_proxy_groups_ = NULL;
+  delete proxy_estimates_;
+  delete host_estimates_;
+  proxy_estimates_ = NULL;
+  host_estimates_ = NULL;
+  if (scoreboard_) {
+    munmap(scoreboard_, sizeof(ScoreboardHeader) +
+                        kScoreboardNumSlots * sizeof(ScoreboardSlot));
+    close(scoreboard_fd_);
+    scoreboard_ = NULL;
+    scoreboard_slots_ = NULL;
+    scoreboard_fd_ = -1;
+  }
 
   curl_global_cleanup();
 }
 
 
+static void ProbeHostChain(const bool keep_current);
+
+
+/**
+ * Re-probes the host chain in the background every opt_host_probe_interval_
+ * seconds until Fini().
+ */
+static void *MainProbeHosts(void *data __attribute__((unused))) {
+  LogCvmfs(kLogDownload, kLogDebug, "host probing thread started");
+  pthread_mutex_lock(&lock_probe_);
+  while (!probe_thread_terminate_) {
+    struct timespec deadline;
+    deadline.tv_sec = time(NULL) + opt_host_probe_interval_;
+    deadline.tv_nsec = 0;
+    while (!probe_thread_terminate_ && (time(NULL) < deadline.tv_sec))
+      pthread_cond_timedwait(&cond_probe_, &lock_probe_, &deadline);
+    if (probe_thread_terminate_)
+      break;
+    pthread_mutex_unlock(&lock_probe_);
+    ProbeHostChain(true);
+    pthread_mutex_lock(&lock_probe_);
+  }
+  pthread_mutex_unlock(&lock_probe_);
+  LogCvmfs(kLogDownload, kLogDebug, "host probing thread terminated");
+  return NULL;
+}
+
+
 /**
  * Spawns the I/O worker thread and switches the module in multi-threaded mode.
  * No way back except Fini(); Init();
  */
 void Spawn() {
-  MakePipe(pipe_terminate_);
-  MakePipe(pipe_jobs_);
+  Spawn(1);
+}
 
-  int retval = pthread_create(&thread_download_, NULL, MainDownload, NULL);
-  assert(retval == 0);
+
+/**
+ * Spawns num_threads I/O worker threads.  The curl handles given to Init() are
+ * split among them.
+ */
+void Spawn(const unsigned num_threads) {
+  assert(num_threads > 0);
+  const uint32_t pool_max_handles =
+    (pool_max_handles_ + num_threads - 1) / num_threads;
+  for (unsigned i = 0; i < num_threads; ++i) {
+    IoContext *context = CreateIoContext(pool_max_handles);
+    InitCurlMulti(context);
+    MakePipe(context->pipe_terminate);
+    MakeDoorbell(context->doorbell_jobs);
+
+    int retval = pthread_create(&context->thread, NULL, MainDownload, context);
+    assert(retval == 0);
+    io_threads_->push_back(context);
+  }
+  LogCvmfs(kLogDownload, kLogDebug, "spawned %u download I/O threads with %u "
+           "curl handles each", num_threads, pool_max_handles);
 
   atomic_inc32(&multi_threaded_);
+
+  pthread_mutex_lock(&lock_probe_);
+  if (opt_host_probe_interval_ > 0) {
+    probe_thread_terminate_ = false;
+    int retval = pthread_create(&thread_probe_, NULL, MainProbeHosts, NULL);
+    assert(retval == 0);
+    probe_thread_running_ = true;
+  }
+  pthread_mutex_unlock(&lock_probe_);
 }
 
 
@@ -1367,8 +2795,16 @@ void GetTimeout(unsigned *seconds_proxy, unsigned *seconds_direct) {
 }
 
 
-const Statistics &GetStatistics() {
-  return *statistics_;
+/**
+ * Sums up the counters of the synchronous mode and of all I/O threads.
+ */
+Statistics GetStatistics() {
+  Statistics result = *context_sync_->statistics;
+  if (atomic_xadd32(&multi_threaded_, 0) == 1) {
+    for (unsigned i = 0; i < io_threads_->size(); ++i)
+      result.Add(*(*io_threads_)[i]->statistics);
+  }
+  return result;
 }
 
 
@@ -1417,6 +2853,27 @@ void GetHostInfo(std::vector<std::string> *host_chain,
 }
 
 
+/**
+ * Like GetHostInfo() above, with the current latency and throughput estimate
+ * of every host.  Hosts without an estimate get an empty one.
+ */
+void GetHostInfo(std::vector<std::string> *host_chain,
+                 std::vector<int> *rtt, unsigned *current_host,
+                 std::vector<EndpointEstimate> *estimates)
+{
+  pthread_mutex_lock(&lock_options_);
+  estimates->clear();
+  if (opt_host_chain_) {
+    *current_host = opt_host_chain_current_;
+    *host_chain = *opt_host_chain_;
+    *rtt = *opt_host_chain_rtt_;
+    for (unsigned i = 0; i < opt_host_chain_->size(); ++i)
+      estimates->push_back((*host_estimates_)[(*opt_host_chain_)[i]]);
+  }
+  pthread_mutex_unlock(&lock_options_);
+}
+
+
 /**
  * Parses a list of ';'- and '|'-separated proxy servers for the proxy groups.
  * The empty string removes the proxy chain.
@@ -1448,7 +2905,9 @@ void SetProxyChain(const std::string &proxy_list) {
 
   /* Select random start proxy from the first group */
   if ((*opt_proxy_groups_)[0].size() > 1) {
-    int random_index = prng_.Next((*opt_proxy_groups_)[0].size());
+    int random_index = SelectWeighted((*opt_proxy_groups_)[0], 0,
+                                      (*opt_proxy_groups_)[0].size(),
+                                      *proxy_estimates_);
     string tmp = (*opt_proxy_groups_)[0][0];
     (*opt_proxy_groups_)[0][0] = (*opt_proxy_groups_)[0][random_index];
     (*opt_proxy_groups_)[0][random_index] = tmp;
@@ -1482,41 +2941,182 @@ void GetProxyInfo(vector< vector<string> > *proxy_chain,
 
 
 /**
- * Orders the hostlist according to RTT of downloading .cvmfschecksum.
- * Sets the current host to the best-responsive host.
- * If you change the host list in between by SetHostChain(), it will be
- * overwritten by this function.
+ * Like GetProxyInfo() above, with the current latency and throughput estimate
+ * of every proxy.  Proxies without an estimate get an empty one.
  */
-void ProbeHosts() {
+void GetProxyInfo(vector< vector<string> > *proxy_chain,
+                  unsigned *current_group,
+                  vector< vector<EndpointEstimate> > *estimates)
+{
+  pthread_mutex_lock(&lock_options_);
+  estimates->clear();
+  if (opt_proxy_groups_) {
+    *proxy_chain = *opt_proxy_groups_;
+    *current_group = opt_proxy_groups_current_;
+    for (unsigned i = 0; i < opt_proxy_groups_->size(); ++i) {
+      estimates->push_back(vector<EndpointEstimate>());
+      for (unsigned j = 0; j < (*opt_proxy_groups_)[i].size(); ++j) {
+        estimates->back().push_back(
+          (*proxy_estimates_)[(*opt_proxy_groups_)[i][j]]);
+      }
+    }
+  }
+  pthread_mutex_unlock(&lock_options_);
+}
+
+
+/**
+ * Performs the jobs at once on a private multi handle, using curl handles of
+ * the synchronous context.  Records for every job the seconds until it is
+ * completed.  The caller sets up the hash context of jobs that expect a hash.
+ */
+static void FetchConcurrently(const vector<JobInfo *> &jobs,
+                              vector<double> *seconds)
+{
+  seconds->assign(jobs.size(), 0.0);
+  pthread_mutex_lock(&lock_synchronous_mode_);
+  CURLM *curl_multi = curl_multi_init();
+  assert(curl_multi != NULL);
+  struct timeval tv_start;
+  gettimeofday(&tv_start, NULL);
+  unsigned num_pending = 0;
+  for (unsigned i = 0; i < jobs.size(); ++i) {
+    JobInfo *info = jobs[i];
+    info->error_code = PrepareDownloadDestination(info);
+    if (info->error_code != kFailOk)
+      continue;
+    info->io_context = context_sync_;
+    CURL *handle = AcquireCurlHandle(context_sync_);
+    InitializeRequest(info, handle);
+    SetUrlOptions(info);
+    curl_multi_add_handle(curl_multi, handle);
+    num_pending++;
+  }
+
+  int still_running = 0;
+  while (num_pending > 0) {
+    curl_multi_perform(curl_multi, &still_running);
+    CURLMsg *curl_msg;
+    int msgs_in_queue;
+    while ((curl_msg = curl_multi_info_read(curl_multi, &msgs_in_queue))) {
+      if (curl_msg->msg != CURLMSG_DONE)
+        continue;
+      context_sync_->statistics->num_requests++;
+      JobInfo *info;
+      CURL *easy_handle = curl_msg->easy_handle;
+      const int curl_error = curl_msg->data.result;
+      curl_easy_getinfo(easy_handle, CURLINFO_PRIVATE, &info);
+      curl_multi_remove_handle(curl_multi, easy_handle);
+      if (VerifyAndFinalize(curl_error, info)) {
+        curl_multi_add_handle(curl_multi, easy_handle);
+      } else {
+        ReleaseCurlHandle(context_sync_, easy_handle);
+        struct timeval tv_end;
+        gettimeofday(&tv_end, NULL);
+        for (unsigned i = 0; i < jobs.size(); ++i) {
+          if (jobs[i] == info)
+            (*seconds)[i] = DiffTimeSeconds(tv_start, tv_end);
+        }
+        num_pending--;
+      }
+    }
+    if (num_pending > 0)
+      curl_multi_wait(curl_multi, NULL, 0, kCompletionTimeoutMs, NULL);
+  }
+  curl_multi_cleanup(curl_multi);
+  struct timeval tv_end;
+  gettimeofday(&tv_end, NULL);
+  context_sync_->statistics->transfer_time += DiffTimeSeconds(tv_start, tv_end);
+  pthread_mutex_unlock(&lock_synchronous_mode_);
+}
+
+
+/**
+ * Downloads the jobs concurrently, in synchronous mode as well, and returns
+ * once all of them are done.  The result of every job is in its error_code.
+ */
+void FetchAll(const vector<JobInfo *> &jobs) {
+  for (unsigned i = 0; i < jobs.size(); ++i) {
+    JobInfo *info = jobs[i];
+    assert(info != NULL);
+    assert(info->url != NULL);
+    if (info->expected_hash) {
+      const hash::Algorithms algorithm = info->expected_hash->algorithm;
+      info->hash_context.algorithm = algorithm;
+      info->hash_context.size = hash::GetContextSize(algorithm);
+      info->hash_context.buffer = alloca(info->hash_context.size);
+    }
+  }
+
+  if (atomic_xadd32(&multi_threaded_, 0) == 1) {
+    vector<bool> submitted(jobs.size(), false);
+    for (unsigned i = 0; i < jobs.size(); ++i) {
+      JobInfo *info = jobs[i];
+      info->error_code = PrepareDownloadDestination(info);
+      if (info->error_code != kFailOk)
+        continue;
+      atomic_init32(&info->completed);
+      SubmitJob(SelectIoThread(info), info);
+      submitted[i] = true;
+    }
+    for (unsigned i = 0; i < jobs.size(); ++i) {
+      if (!submitted[i])
+        continue;
+      while (atomic_read32(&jobs[i]->completed) == 0)
+        platform_futex_wait(&jobs[i]->completed, 0, kCompletionTimeoutMs);
+    }
+  } else {
+    vector<double> seconds;
+    FetchConcurrently(jobs, &seconds);
+  }
+
+  for (unsigned i = 0; i < jobs.size(); ++i) {
+    if (jobs[i]->error_code != kFailOk)
+      CleanupFailedJob(jobs[i]);
+  }
+}
+
+
+/**
+ * Orders the hostlist according to RTT of a HEAD request for .cvmfspublished.
+ * All hosts are probed at once, so that unreachable hosts cost a single
+ * timeout.  The RTTs are merged into the host estimates.  Unless keep_current
+ * is set, the current host becomes the best-responsive host.  Otherwise the
+ * current host remains, unless it failed the probe.  If the host chain is
+ * changed by SetHostChain() in between, the result is dropped.
+ */
+static void ProbeHostChain(const bool keep_current) {
   vector<string> host_chain;
   vector<int> host_rtt;
   unsigned current_host;
 
   GetHostInfo(&host_chain, &host_rtt, &current_host);
+  if (host_chain.empty())
+    return;
+  const vector<string> probed_chain = host_chain;
 
   // Stopwatch, two times to fill caches first
   unsigned i, retries;
-  string url;
-  JobInfo info(&url, false, false, NULL);
+  vector<string> urls;
+  for (i = 0; i < host_chain.size(); ++i)
+    urls.push_back(host_chain[i] + "/.cvmfspublished");
   for (retries = 0; retries < 2; ++retries) {
+    vector<JobInfo *> jobs;
+    for (i = 0; i < host_chain.size(); ++i)
+      jobs.push_back(new JobInfo(&urls[i], false));
+    vector<double> seconds;
+    FetchConcurrently(jobs, &seconds);
     for (i = 0; i < host_chain.size(); ++i) {
-      url = host_chain[i] + "/.cvmfspublished";
-
-      struct timeval tv_start, tv_end;
-      gettimeofday(&tv_start, NULL);
-      Failures result = Fetch(&info);
-      gettimeofday(&tv_end, NULL);
-      if (info.destination_mem.data)
-        free(info.destination_mem.data);
-      if (result == kFailOk) {
-        host_rtt[i] = int(DiffTimeSeconds(tv_start, tv_end));
+      if (jobs[i]->error_code == kFailOk) {
+        host_rtt[i] = int(1000.0 * seconds[i]);
         LogCvmfs(kLogDownload, kLogDebug, "probing host %s had %dms rtt",
-                 url.c_str(), host_rtt[i]);
+                 urls[i].c_str(), host_rtt[i]);
       } else {
         LogCvmfs(kLogDownload, kLogDebug, "error while probing host %s: %d",
-                 url.c_str(), result);
+                 urls[i].c_str(), jobs[i]->error_code);
         host_rtt[i] = INT_MAX;
       }
+      delete jobs[i];
     }
   }
 
@@ -1537,15 +3137,63 @@ void ProbeHosts() {
   }
 
   pthread_mutex_lock(&lock_options_);
+  if (!opt_host_chain_ || (*opt_host_chain_ != probed_chain)) {
+    pthread_mutex_unlock(&lock_options_);
+    LogCvmfs(kLogDownload, kLogDebug, "host chain changed while probing");
+    return;
+  }
+  if (host_chain != probed_chain) {
+    LogCvmfs(kLogDownload, kLogDebug | kLogSyslog,
+             "reordering host chain by round trip time, best host %s (%dms)",
+             host_chain[0].c_str(), host_rtt[0]);
+  }
+  const time_t now = time(NULL);
+  const string current = (*opt_host_chain_)[opt_host_chain_current_];
   delete opt_host_chain_;
   delete opt_host_chain_rtt_;
   opt_host_chain_ = new vector<string>(host_chain);
   opt_host_chain_rtt_ = new vector<int>(host_rtt);
   opt_host_chain_current_ = 0;
+  if (keep_current) {
+    for (i = 0; i < host_chain.size(); ++i) {
+      if ((host_chain[i] == current) && (host_rtt[i] >= 0))
+        opt_host_chain_current_ = i;
+    }
+  }
+  if (opt_host_chain_current_ == 0)
+    opt_timestamp_backup_host_ = 0;
+  else if ((opt_host_reset_after_ > 0) && (opt_timestamp_backup_host_ == 0))
+    opt_timestamp_backup_host_ = now;
+  // Unreachable hosts lose their estimate, stale samples might favor them
+  for (i = 0; i < host_chain.size(); ++i) {
+    if (host_rtt[i] >= 0)
+      (*host_estimates_)[host_chain[i]].AddSample(host_rtt[i], 0.0, now);
+    else
+      host_estimates_->erase(host_chain[i]);
+  }
   pthread_mutex_unlock(&lock_options_);
 }
 
 
+/**
+ * Probes the host chain and switches to the best-responsive host.
+ */
+void ProbeHosts() {
+  ProbeHostChain(false);
+}
+
+
+/**
+ * Sets the interval of the background probing of the host chain, 0 turns it
+ * off.  Takes effect with Spawn().
+ */
+void SetHostProbeInterval(const unsigned seconds) {
+  pthread_mutex_lock(&lock_probe_);
+  opt_host_probe_interval_ = seconds;
+  pthread_mutex_unlock(&lock_probe_);
+}
+
+
 void SetProxyGroupResetDelay(const unsigned seconds) {
   pthread_mutex_lock(&lock_options_);
   opt_proxy_groups_reset_after_ = seconds;
@@ -1594,8 +3242,87 @@ void SetRetryParameters(const unsigned max_retries,
 }
 
 
+/**
+ * Applies to the I/O threads spawned afterwards.
+ */
 void ActivatePipelining() {
-  curl_multi_setopt(curl_multi_, CURLMOPT_PIPELINING, 1);
+  opt_pipelining_ = true;
+}
+
+
+/**
+ * Allows duplicates of stalled transfers for at most percent of the jobs, 0
+ * turns hedged requests off.
+ */
+void SetHedgeLimit(const unsigned percent) {
+  pthread_mutex_lock(&lock_options_);
+  opt_hedge_percent_ = percent;
+  pthread_mutex_unlock(&lock_options_);
+}
+
+
+/**
+ * Maps the node-wide health scoreboard at path and creates it if necessary.
+ * All processes using the same path share proxy and host failures.  Call
+ * before Spawn().  A file of the right size without a header was left by a
+ * process that died while creating it; it is initialized again.
+ */
+bool SetHealthScoreboard(const string &path) {
+  assert(scoreboard_ == NULL);
+  const size_t size = sizeof(ScoreboardHeader) +
+                      kScoreboardNumSlots * sizeof(ScoreboardSlot);
+  const int fd = open(path.c_str(), O_RDWR | O_CREAT, 0600);
+  if (fd < 0) {
+    LogCvmfs(kLogDownload, kLogDebug | kLogSyslogErr,
+             "failed to open health scoreboard %s (%d)", path.c_str(), errno);
+    return false;
+  }
+  flock(fd, LOCK_EX);
+  platform_stat64 info;
+  if ((platform_fstat(fd, &info) != 0) ||
+      ((info.st_size == 0) && (ftruncate(fd, size) != 0)))
+  {
+    LogCvmfs(kLogDownload, kLogDebug | kLogSyslogErr,
+             "failed to create health scoreboard %s (%d)", path.c_str(), errno);
+    close(fd);
+    return false;
+  }
+  const bool created = (info.st_size == 0);
+  if (!created && (static_cast<uint64_t>(info.st_size) != size)) {
+    LogCvmfs(kLogDownload, kLogDebug | kLogSyslogErr,
+             "incompatible health scoreboard %s", path.c_str());
+    close(fd);
+    return false;
+  }
+  void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapping == MAP_FAILED) {
+    LogCvmfs(kLogDownload, kLogDebug | kLogSyslogErr,
+             "failed to map health scoreboard %s (%d)", path.c_str(), errno);
+    close(fd);
+    return false;
+  }
+  ScoreboardHeader *header = static_cast<ScoreboardHeader *>(mapping);
+  if (created || ((header->magic == 0) && (header->num_slots == 0))) {
+    header->num_slots = kScoreboardNumSlots;
+    header->magic = kScoreboardMagic;
+  }
+  if ((header->magic != kScoreboardMagic) ||
+      (header->num_slots != kScoreboardNumSlots))
+  {
+    LogCvmfs(kLogDownload, kLogDebug | kLogSyslogErr,
+             "incompatible health scoreboard %s", path.c_str());
+    munmap(mapping, size);
+    close(fd);
+    return false;
+  }
+  flock(fd, LOCK_UN);
+
+  scoreboard_fd_ = fd;
+  scoreboard_slots_ = reinterpret_cast<ScoreboardSlot *>(header + 1);
+  scoreboard_ = header;
+  LogCvmfs(kLogDownload, kLogDebug, "using health scoreboard %s",
+           path.c_str());
+  return true;
 }
 
 
@@ -9,11 +9,13 @@
 #include <unistd.h>
 
 #include <cstdio>
+#include <ctime>
 
 #include <string>
 #include <vector>
 
 #include "duplex_curl.h"
+#include "atomic.h"
 #include "compression.h"
 #include "hash.h"
 
@@ -29,6 +31,18 @@ enum Destination {
   kDestinationNone
 };
 
+/**
+ * I/O threads start waiting jobs of higher priority first.  Metadata, such as
+ * catalogs and the manifest, is needed by interactive lookups.  Low priority
+ * jobs, such as prefetching, may only use part of the connections.
+ */
+enum Priorities {
+  kPriorityHigh = 0,
+  kPriorityNormal,
+  kPriorityLow,
+  kNumPriorities,  // Must be the last
+};
+
 /**
  * Possible return values.
  */
@@ -57,6 +71,12 @@ struct Statistics {
   uint64_t num_retries;
   uint64_t num_proxy_failover;
   uint64_t num_host_failover;
+  uint64_t num_wakeups;  /**< of the I/O threads in multi-threaded mode */
+  uint64_t num_jobs_submitted;
+  uint64_t num_job_batches;  /**< jobs taken from the queue at once */
+  uint64_t num_demotions;  /**< of slow proxies and hosts */
+  uint64_t num_hedges;  /**< duplicate requests for stalled transfers */
+  uint64_t num_hedges_won;  /**< duplicates that answered first */
 
   Statistics() {
     transferred_bytes = 0.0;
@@ -65,12 +85,47 @@ struct Statistics {
     num_retries = 0;
     num_proxy_failover = 0;
     num_host_failover = 0;
+    num_wakeups = 0;
+    num_jobs_submitted = 0;
+    num_job_batches = 0;
+    num_demotions = 0;
+    num_hedges = 0;
+    num_hedges_won = 0;
   }
 
   std::string Print() const;
+  void Add(const Statistics &other);
+};
+
+
+/**
+ * Decayed estimates of the latency and the throughput of a proxy or a host,
+ * gathered from completed transfers.  Every new sample moves the estimate by
+ * a fixed fraction towards the sample.
+ */
+struct EndpointEstimate {
+  EndpointEstimate() {
+    latency_ms = 0.0;
+    throughput = 0.0;
+    num_samples = 0;
+    timestamp = 0;
+  }
+
+  void AddSample(const double sample_latency_ms,
+                 const double sample_throughput, const time_t now);
+  double GetCost() const;
+  bool IsRecent(const time_t now) const;
+
+  double latency_ms;  /**< until the first byte */
+  double throughput;  /**< bytes per second after the first byte, 0: unknown */
+  uint64_t num_samples;
+  time_t timestamp;  /**< of the last sample */
 };
 
 
+struct IoContext;
+
+
 /**
  * Contains all the information to specify a download job.
  */
@@ -88,39 +143,50 @@ struct JobInfo {
   FILE *destination_file;
   const std::string *destination_path;
   const hash::Any *expected_hash;
+  /**
+   * If range_size is non-zero, only the bytes [range_offset,
+   * range_offset+range_size) are requested by an HTTP Range header.  Range
+   * requests cannot be verified or decompressed on the fly, so they require
+   * compressed = false and expected_hash = NULL.  Servers are free to ignore
+   * the Range header and to send the entire object instead, which is the case
+   * unless partial_content is set after the download.
+   */
+  uint64_t range_offset;
+  uint64_t range_size;
+  Priorities priority;
 
   // One constructor per destination + head request
-  JobInfo() { wait_at[0] = wait_at[1] = -1; head_request = false; }
+  JobInfo() {
+    head_request = false;
+    range_offset = range_size = 0;
+    priority = kPriorityNormal;
+  }
   JobInfo(const std::string *u, const bool c, const bool ph,
           const std::string *p, const hash::Any *h) : url(u), compressed(c),
           probe_hosts(ph), head_request(false),
-          destination(kDestinationPath), destination_path(p), expected_hash(h)
-          { wait_at[0] = wait_at[1] = -1; }
+          destination(kDestinationPath), destination_path(p), expected_hash(h),
+          range_offset(0), range_size(0), priority(kPriorityNormal) { }
   JobInfo(const std::string *u, const bool c, const bool ph, FILE *f,
           const hash::Any *h) : url(u), compressed(c), probe_hosts(ph),
           head_request(false),
-          destination(kDestinationFile), destination_file(f), expected_hash(h)
-          { wait_at[0] = wait_at[1] = -1; }
+          destination(kDestinationFile), destination_file(f), expected_hash(h),
+          range_offset(0), range_size(0), priority(kPriorityNormal) { }
   JobInfo(const std::string *u, const bool c, const bool ph,
           const hash::Any *h) : url(u), compressed(c), probe_hosts(ph),
-          head_request(false), destination(kDestinationMem), expected_hash(h)
-          { wait_at[0] = wait_at[1] = -1; }
+          head_request(false), destination(kDestinationMem), expected_hash(h),
+          range_offset(0), range_size(0), priority(kPriorityNormal) { }
   JobInfo(const std::string *u, const bool ph) :
           url(u), compressed(false), probe_hosts(ph), head_request(true),
-          destination(kDestinationNone), expected_hash(NULL)
-          { wait_at[0] = wait_at[1] = -1; }
-  ~JobInfo() {
-    if (wait_at[0] >= 0) {
-      close(wait_at[0]);
-      close(wait_at[1]);
-    }
-  }
+          destination(kDestinationNone), expected_hash(NULL),
+          range_offset(0), range_size(0), priority(kPriorityNormal) { }
 
   // Internal state, don't touch
   CURL *curl_handle;
   z_stream zstream;
   hash::ContextPtr hash_context;
-  int wait_at[2];  /**< Pipe used for the return value */
+  IoContext *io_context;  /**< Transfers the job, owns handle and statistics */
+  JobInfo *next_job;  /**< Link in the job submission queue */
+  atomic_int32 completed;  /**< Futex, set by the I/O thread when done */
   std::string proxy;
   bool nocache;
   Failures error_code;
@@ -128,27 +194,49 @@ struct JobInfo {
   unsigned char num_used_hosts;
   unsigned char num_retries;
   unsigned backoff_ms;
+  uint64_t start_ms;  /**< When the transfer was handed to curl */
+  bool got_status;  /**< Received a successful HTTP status line */
+  bool partial_content;  /**< The status was 206, the Range was honored */
+  /**
+   * Hedged requests: a stalled job gets a duplicate on another proxy or host.
+   * While both race, hedge links the two.  The first one with a successful
+   * status line wins, the other one gets hedge_lost and is cancelled.  A
+   * duplicate points to its original job by hedge_primary and hands over its
+   * result to it.
+   */
+  JobInfo *hedge;
+  JobInfo *hedge_primary;
+  bool hedge_lost;
 };
 
 
 void Init(const unsigned max_pool_handles, const bool use_system_proxy);
 void Fini();
 void Spawn();
+void Spawn(const unsigned num_threads);
 Failures Fetch(JobInfo *info);
+void FetchAll(const std::vector<JobInfo *> &jobs);
 Failures Head(const std::string *url);
 
 void SetDnsServer(const std::string &address);
 void SetTimeout(const unsigned seconds_proxy, const unsigned seconds_direct);
 void GetTimeout(unsigned *seconds_proxy, unsigned *seconds_direct);
-const Statistics &GetStatistics();
+Statistics GetStatistics();
 void SetHostChain(const std::string &host_list);
 void GetHostInfo(std::vector<std::string> *host_chain,
                  std::vector<int> *rtt, unsigned *current_host);
+void GetHostInfo(std::vector<std::string> *host_chain,
+                 std::vector<int> *rtt, unsigned *current_host,
+                 std::vector<EndpointEstimate> *estimates);
 void ProbeHosts();
+void SetHostProbeInterval(const unsigned seconds);
 void SwitchHost();
 void SetProxyChain(const std::string &proxy_list);
 void GetProxyInfo(std::vector< std::vector<std::string> > *proxy_chain,
                   unsigned *current_group);
+void GetProxyInfo(std::vector< std::vector<std::string> > *proxy_chain,
+                  unsigned *current_group,
+                  std::vector< std::vector<EndpointEstimate> > *estimates);
 void RebalanceProxies();
 void SwitchProxyGroup();
 void SetProxyGroupResetDelay(const unsigned seconds);
@@ -159,6 +247,8 @@ void SetRetryParameters(const unsigned max_retries,
                         const unsigned backoff_init_ms,
                         const unsigned backoff_max_ms);
 void ActivatePipelining();
+void SetHedgeLimit(const unsigned percent);
+bool SetHealthScoreboard(const std::string &path);
 void RestartNetwork();
 
 }  // namespace download
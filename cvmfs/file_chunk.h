@@ -17,6 +17,7 @@
 #include <string>
 
 #include "hash.h"
+#include "compression.h"
 #include "bigvector.h"
 #include "smallhash.h"
 #include "shortstring.h"
@@ -54,13 +55,16 @@ typedef BigVector<FileChunk> FileChunkList;
 struct FileChunkReflist {
   FileChunkReflist() {
     list = NULL;
+    compression_alg = zlib::kZlibDefault;
   }
-  FileChunkReflist(FileChunkList *l, PathString p) {
+  FileChunkReflist(FileChunkList *l, PathString p, zlib::Algorithms alg) {
     list = l;
     path = p;
+    compression_alg = alg;
   }
   FileChunkList *list;
   PathString path;
+  zlib::Algorithms compression_alg;
 };
 
 
@@ -616,7 +616,9 @@ int cvmfs_open(const char *c_path)
     return -ENOENT;
   }
 
-  fd = cache::FetchDirent(dirent, string(path.GetChars(), path.GetLength()));
+  // Users read the file descriptor directly, block files are not readable
+  fd = cache::ToPlainFd(
+    cache::FetchDirent(dirent, string(path.GetChars(), path.GetLength())));
   atomic_inc64(&num_fs_open_);
 
   if (fd >= 0) {
@@ -626,7 +628,7 @@ int cvmfs_open(const char *c_path)
                path.c_str(), fd);
       return fd;
     } else {
-      if (close(fd) == 0) atomic_dec32(&open_files_);
+      if (cache::Close(fd) == 0) atomic_dec32(&open_files_);
       LogCvmfs(kLogCvmfs, kLogSyslogErr, "open file descriptor limit exceeded");
       return -EMFILE;
     }
@@ -661,7 +663,7 @@ int cvmfs_close(int fd)
   LogCvmfs(kLogCvmfs, kLogDebug, "cvmfs_close on file number: %d",
            fd);
 
-  if (close(fd) == 0) atomic_dec32(&open_files_);
+  if (cache::Close(fd) == 0) atomic_dec32(&open_files_);
 
   return 0;
 }
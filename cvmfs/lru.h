@@ -671,6 +671,47 @@ class LruCache {
     return found;
   }
 
+  /**
+   * Walks through all cache entries and removes the ones for which the filter
+   * function returns true.  The filter may also update the value of entries
+   * that stay.  Unlike the other operations, this works on a paused cache, so
+   * that entries can be invalidated before the cache is resumed.
+   * @param filter called for every entry with the key, the value, and data
+   * @param data passed on to the filter
+   * @return the number of removed entries
+   */
+  unsigned Filter(bool (*filter)(const Key &key, Value *value, void *data),
+                  void *data)
+  {
+    unsigned num_removed = 0;
+    this->Lock();
+
+    ListEntry<Key> *list_entry = lru_list_->next;
+    while (!list_entry->IsListHead()) {
+      ConcreteListEntryContent *content =
+        static_cast<ConcreteListEntryContent *>(list_entry);
+      list_entry = list_entry->next;
+
+      const Key key = content->content();
+      CacheEntry entry;
+      bool retval = this->DoLookup(key, entry);
+      assert(retval);
+      if (filter(key, &entry.value, data)) {
+        content->RemoveFromList();
+        delete content;
+        cache_.Erase(key);
+        --cache_gauge_;
+        ++num_removed;
+      } else {
+        cache_.Insert(key, entry);
+      }
+    }
+    atomic_xadd64(&statistics_.num_forget, num_removed);
+
+    this->Unlock();
+    return num_removed;
+  }
+
   /**
    * Clears all elements from the cache.
    * All memory of internal data structures will be freed but data of
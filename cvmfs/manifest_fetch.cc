@@ -2,15 +2,23 @@
  * This file is part of the CernVM File System.
  */
 
+#define __STDC_FORMAT_MACROS
+
 #include "manifest_fetch.h"
 
+#include <inttypes.h>
+#include <unistd.h>
+
 #include <string>
 #include <vector>
 
 #include <cassert>
+#include <cerrno>
+#include <cstdio>
 
 #include "manifest.h"
 #include "download.h"
+#include "logging.h"
 #include "signature.h"
 #include "util.h"
 
@@ -18,15 +26,256 @@ using namespace std;  // NOLINT
 
 namespace manifest {
 
+/**
+ * The signature module holds a single certificate, concurrent fetches (e.g.
+ * by the catalog refresher and a remount) verify one after the other.
+ */
+pthread_mutex_t lock_verify_ = PTHREAD_MUTEX_INITIALIZER;
+
+
+static bool IsBlacklisted(const string &fingerprint,
+                          const vector<string> &blacklist)
+{
+  for (unsigned i = 0; i < blacklist.size(); ++i) {
+    if (blacklist[i].substr(0, 59) == fingerprint) {
+      LogCvmfs(kLogSignature, kLogDebug | kLogSyslogErr,
+               "blacklisted fingerprint (%s)", fingerprint.c_str());
+      return true;
+    }
+  }
+  return false;
+}
+
+
+SignatureCache::SignatureCache() {
+  atomic_init64(&num_hits_);
+  int retval = pthread_mutex_init(&lock_, NULL);
+  assert(retval == 0);
+}
+
+
+SignatureCache::~SignatureCache() {
+  pthread_mutex_destroy(&lock_);
+}
+
+
+/**
+ * Reads the entries persisted in path, if any, and persists new entries
+ * there.
+ */
+void SignatureCache::Load(const string &path) {
+  pthread_mutex_lock(&lock_);
+  path_ = path;
+  entries_.clear();
+  FILE *f = fopen(path.c_str(), "r");
+  if (f) {
+    string line;
+    while (GetLineFile(f, &line)) {
+      vector<string> tokens = SplitString(line, ' ');
+      if ((tokens.size() != 5) || (tokens[0].length() != 1))
+        continue;
+      Entry entry;
+      entry.letter = tokens[0][0];
+      entry.letter_hash = tokens[1];
+      entry.certificate_hash = tokens[2];
+      entry.expiry = String2Uint64(tokens[3]);
+      entry.fingerprint = tokens[4];
+      entries_.push_back(entry);
+    }
+    fclose(f);
+  }
+  if (entries_.size() > kMaxEntries)
+    entries_.erase(entries_.begin(), entries_.end() - kMaxEntries);
+  LogCvmfs(kLogSignature, kLogDebug, "loaded %u verified signatures from %s",
+           entries_.size(), path.c_str());
+  pthread_mutex_unlock(&lock_);
+}
+
+
+/**
+ * Writes the entries to a temporary file and renames it over the old one.
+ * Needs lock_.
+ */
+void SignatureCache::Store() {
+  if (path_ == "")
+    return;
+  const string path_tmp = path_ + ".txn";
+  FILE *f = fopen(path_tmp.c_str(), "w");
+  if (!f) {
+    LogCvmfs(kLogSignature, kLogDebug, "failed to store verified signatures "
+             "in %s (%d)", path_tmp.c_str(), errno);
+    return;
+  }
+  bool retval = true;
+  for (unsigned i = 0; i < entries_.size(); ++i) {
+    retval &= fprintf(f, "%c %s %s %"PRIu64" %s\n", entries_[i].letter,
+                      entries_[i].letter_hash.c_str(),
+                      entries_[i].certificate_hash.c_str(),
+                      uint64_t(entries_[i].expiry),
+                      entries_[i].fingerprint.c_str()) > 0;
+  }
+  retval &= (fclose(f) == 0);
+  if (!retval || (rename(path_tmp.c_str(), path_.c_str()) != 0))
+    unlink(path_tmp.c_str());
+}
+
+
+/**
+ * Returns the entry of a letter that was verified with the certificate and,
+ * for a whitelist, has not expired.  NULL if there is none.  Needs lock_.
+ */
+const SignatureCache::Entry *SignatureCache::Find(
+  const Letters letter,
+  const string &letter_hash,
+  const string &certificate_hash,
+  const time_t now)
+{
+  for (unsigned i = 0; i < entries_.size(); ++i) {
+    const Entry &entry = entries_[i];
+    if ((entry.letter == letter) && (entry.letter_hash == letter_hash) &&
+        (entry.certificate_hash == certificate_hash) &&
+        ((entry.expiry == 0) || (now <= entry.expiry)))
+    {
+      return &entry;
+    }
+  }
+  return NULL;
+}
+
+
+/**
+ * Tells which letters of a manifest ensemble were verified with the
+ * certificate before.  The manifest counts only if the whitelist does.  A hit
+ * on a whitelist that was verified with a blacklisted certificate is
+ * rejected.  Returns the fingerprint of the certificate on a hit.
+ */
+SignatureCache::Verdicts SignatureCache::Lookup(
+  const hash::Any &manifest_hash,
+  const hash::Any &whitelist_hash,
+  const hash::Any &certificate_hash,
+  const vector<string> &blacklist,
+  const time_t now,
+  string *fingerprint)
+{
+  const string certificate_str = certificate_hash.ToString();
+  Verdicts verdict = kVerdictUnknown;
+  pthread_mutex_lock(&lock_);
+  const Entry *whitelist = Find(kLetterWhitelist, whitelist_hash.ToString(),
+                                certificate_str, now);
+  if (whitelist) {
+    *fingerprint = whitelist->fingerprint;
+    const bool manifest = Find(kLetterManifest, manifest_hash.ToString(),
+                               certificate_str, now) != NULL;
+    verdict = manifest ? kVerdictVerified : kVerdictWhitelist;
+  }
+  pthread_mutex_unlock(&lock_);
+
+  if (verdict == kVerdictUnknown)
+    return verdict;
+  if (IsBlacklisted(*fingerprint, blacklist))
+    return kVerdictBlacklisted;
+  atomic_xadd64(&num_hits_, (verdict == kVerdictVerified) ? 2 : 1);
+  return verdict;
+}
+
+
+/**
+ * Remembers a verified letter.  An older entry of the same letter and
+ * certificate is replaced.
+ */
+void SignatureCache::Insert(const Letters letter, const hash::Any &letter_hash,
+                            const hash::Any &certificate_hash,
+                            const time_t expiry, const string &fingerprint)
+{
+  Entry entry;
+  entry.letter = letter;
+  entry.letter_hash = letter_hash.ToString();
+  entry.certificate_hash = certificate_hash.ToString();
+  entry.expiry = expiry;
+  entry.fingerprint = fingerprint;
+  pthread_mutex_lock(&lock_);
+  for (vector<Entry>::iterator i = entries_.begin(); i != entries_.end(); ) {
+    if ((i->letter == entry.letter) && (i->letter_hash == entry.letter_hash) &&
+        (i->certificate_hash == entry.certificate_hash))
+    {
+      i = entries_.erase(i);
+    } else {
+      ++i;
+    }
+  }
+  entries_.push_back(entry);
+  if (entries_.size() > kMaxEntries)
+    entries_.erase(entries_.begin());
+  Store();
+  pthread_mutex_unlock(&lock_);
+}
+
+
+PrefetchedManifest::PrefetchedManifest() : manifest_(NULL), expiry_(0) {
+  int retval = pthread_mutex_init(&lock_, NULL);
+  assert(retval == 0);
+}
+
+
+PrefetchedManifest::~PrefetchedManifest() {
+  delete manifest_;
+  pthread_mutex_destroy(&lock_);
+}
+
+
+/**
+ * Replaces the prefetched manifest by a copy of manifest.
+ */
+void PrefetchedManifest::Set(const Manifest &manifest, const time_t expiry) {
+  pthread_mutex_lock(&lock_);
+  delete manifest_;
+  manifest_ = new Manifest(manifest);
+  expiry_ = expiry;
+  pthread_mutex_unlock(&lock_);
+}
+
+
+/**
+ * Hands out a copy of the prefetched manifest if it has not expired and is at
+ * least as new as minimum_timestamp.  Unusable manifests are dropped.
+ *
+ * @param[in] consume  drops the prefetched manifest after use
+ */
+bool PrefetchedManifest::Get(const bool consume,
+                             const uint64_t minimum_timestamp,
+                             const time_t now, ManifestEnsemble *ensemble)
+{
+  bool result = false;
+  pthread_mutex_lock(&lock_);
+  if (manifest_) {
+    if ((now <= expiry_) &&
+        (manifest_->publish_timestamp() >= minimum_timestamp))
+    {
+      LogCvmfs(kLogCvmfs, kLogDebug, "using prefetched manifest (%s)",
+               manifest_->catalog_hash().ToString().c_str());
+      ensemble->manifest = new Manifest(*manifest_);
+      result = true;
+    }
+    if (!result || consume) {
+      delete manifest_;
+      manifest_ = NULL;
+    }
+  }
+  pthread_mutex_unlock(&lock_);
+  return result;
+}
+
+
 /**
  * Checks whether the fingerprint of the loaded PEM certificate is listed on the
- * whitelist stored in a memory chunk.
+ * whitelist stored in a memory chunk.  Returns the expiry of the whitelist.
  */
 static bool VerifyWhitelist(const unsigned char *whitelist,
                             const unsigned whitelist_size,
-                            const string &expected_repository)
+                            const string &expected_repository,
+                            const string &fingerprint,
+                            time_t *expiry)
 {
-  const string fingerprint = signature::FingerprintCertificate();
   if (fingerprint == "") {
     LogCvmfs(kLogSignature, kLogDebug, "invalid fingerprint");
     return false;
@@ -77,6 +326,7 @@ static bool VerifyWhitelist(const unsigned char *whitelist,
     return false;
   }
   payload_bytes += 16;
+  *expiry = timestamp;
 
   // Check repository name
   line = GetLineMem(reinterpret_cast<const char *>(whitelist)+payload_bytes,
@@ -109,23 +359,18 @@ static bool VerifyWhitelist(const unsigned char *whitelist,
   }
 
   // Check local blacklist
-  vector<string> blacklisted_certificates =
-    signature::GetBlacklistedCertificates();
-  for (unsigned i = 0; i < blacklisted_certificates.size(); ++i) {
-    if (blacklisted_certificates[i].substr(0, 59) == fingerprint) {
-      LogCvmfs(kLogSignature, kLogDebug | kLogSyslogErr,
-               "blacklisted fingerprint (%s)", fingerprint.c_str());
-      return false;
-    }
-  }
-
-  return true;
+  return !IsBlacklisted(fingerprint, signature::GetBlacklistedCertificates());
 }
 
 
 /**
  * Downloads and verifies the manifest, the certificate, and the whitelist.
  * If base_url is empty, uses the probe_hosts feature from download module.
+ *
+ * The manifest and the whitelist are downloaded concurrently.  So is the
+ * certificate if the ensemble has a hint on it that is not in the cache.  If
+ * the manifest refers to another certificate, that one is fetched afterwards.
+ * Letters found in the ensemble's signature cache are not verified again.
  */
 Failures Fetch(const std::string &base_url, const std::string &repository_name,
                const uint64_t minimum_timestamp, const hash::Any *base_catalog,
@@ -135,21 +380,57 @@ Failures Fetch(const std::string &base_url, const std::string &repository_name,
   const bool probe_hosts = base_url == "";
   Failures result = kFailUnknown;
   int retval;
+  hash::Any manifest_hash(hash::kSha1);
+  hash::Any whitelist_hash(hash::kSha1);
+  SignatureCache::Verdicts verdict = SignatureCache::kVerdictUnknown;
+  bool whitelist_cached = false;
+  bool verify_locked = false;
+  string fingerprint;
+  time_t whitelist_expiry = 0;
 
   const string manifest_url = base_url + string("/.cvmfspublished");
   download::JobInfo download_manifest(&manifest_url, false, probe_hosts, NULL);
   const string whitelist_url = base_url + string("/.cvmfswhitelist");
   download::JobInfo download_whitelist(&whitelist_url, false, probe_hosts, NULL);
-  hash::Any certificate_hash;
+  hash::Any certificate_hash = ensemble->certificate_hint;
   string certificate_url = base_url + "/data";  // rest is in manifest
   download::JobInfo download_certificate(&certificate_url, true, probe_hosts,
                                          &certificate_hash);
+  // Lookups wait for the manifest, it goes before bulk data
+  download_manifest.priority = download::kPriorityHigh;
+  download_whitelist.priority = download::kPriorityHigh;
+  download_certificate.priority = download::kPriorityHigh;
 
-  retval = download::Fetch(&download_manifest);
-  if (retval != download::kFailOk) {
+  vector<download::JobInfo *> jobs;
+  jobs.push_back(&download_manifest);
+  jobs.push_back(&download_whitelist);
+  if (!certificate_hash.IsNull()) {
+    ensemble->FetchCertificate(certificate_hash);
+    if (!ensemble->cert_buf) {
+      certificate_url += certificate_hash.MakePath(1, 2) + "X";
+      jobs.push_back(&download_certificate);
+    }
+  }
+  download::FetchAll(jobs);
+  if (download_whitelist.error_code == download::kFailOk) {
+    ensemble->whitelist_buf = reinterpret_cast<unsigned char *>(
+      download_whitelist.destination_mem.data);
+    ensemble->whitelist_size = download_whitelist.destination_mem.size;
+  }
+  if ((jobs.size() > 2) &&
+      (download_certificate.error_code == download::kFailOk))
+  {
+    ensemble->cert_buf = reinterpret_cast<unsigned char *>(
+      download_certificate.destination_mem.data);
+    ensemble->cert_size = download_certificate.destination_mem.size;
+  }
+
+  if (download_manifest.error_code != download::kFailOk) {
     LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslogWarn,
-             "failed to download repository manifest (%d)", retval);
-    return kFailLoad;
+             "failed to download repository manifest (%d)",
+             download_manifest.error_code);
+    result = kFailLoad;
+    goto cleanup;
   }
 
   // Load Manifest
@@ -159,8 +440,10 @@ Failures Fetch(const std::string &base_url, const std::string &repository_name,
   ensemble->manifest =
     manifest::Manifest::LoadMem(ensemble->raw_manifest_buf,
                                 ensemble->raw_manifest_size);
-  if (!ensemble->manifest)
-    return kFailIncomplete;
+  if (!ensemble->manifest) {
+    result = kFailIncomplete;
+    goto cleanup;
+  }
 
   // Basic manifest sanity check
   if (ensemble->manifest->repository_name() != repository_name) {
@@ -184,20 +467,59 @@ Failures Fetch(const std::string &base_url, const std::string &repository_name,
   if (base_catalog && (ensemble->manifest->catalog_hash() == *base_catalog))
     return kFailOk;
 
-  // Load certificate
-  certificate_hash = ensemble->manifest->certificate();
-  ensemble->FetchCertificate(certificate_hash);
+  // Load certificate, unless the hint was right
+  if (ensemble->cert_buf &&
+      (ensemble->manifest->certificate() != certificate_hash))
+  {
+    LogCvmfs(kLogCvmfs, kLogDebug, "certificate changed to %s",
+             ensemble->manifest->certificate().ToString().c_str());
+    free(ensemble->cert_buf);
+    ensemble->cert_buf = NULL;
+    ensemble->cert_size = 0;
+  }
+  if (!ensemble->cert_buf) {
+    certificate_hash = ensemble->manifest->certificate();
+    ensemble->FetchCertificate(certificate_hash);
+  }
   if (!ensemble->cert_buf) {
-    certificate_url += certificate_hash.MakePath(1, 2) + "X";
+    certificate_url = base_url + "/data" + certificate_hash.MakePath(1, 2) +
+                      "X";
     retval = download::Fetch(&download_certificate);
     if (retval != download::kFailOk) {
       result = kFailLoad;
-        goto cleanup;
+      goto cleanup;
     }
     ensemble->cert_buf =
       reinterpret_cast<unsigned char *>(download_certificate.destination_mem.data);
     ensemble->cert_size = download_certificate.destination_mem.size;
   }
+  if (!ensemble->whitelist_buf) {
+    result = kFailLoad;
+    goto cleanup;
+  }
+
+  // Skip the signature checks of letters that were verified before
+  if (ensemble->signature_cache) {
+    hash::HashMem(ensemble->raw_manifest_buf, ensemble->raw_manifest_size,
+                  &manifest_hash);
+    hash::HashMem(ensemble->whitelist_buf, ensemble->whitelist_size,
+                  &whitelist_hash);
+    verdict = ensemble->signature_cache->Lookup(manifest_hash, whitelist_hash,
+      certificate_hash, signature::GetBlacklistedCertificates(), time(NULL),
+      &fingerprint);
+    if (verdict == SignatureCache::kVerdictBlacklisted) {
+      result = kFailBadWhitelist;
+      goto cleanup;
+    }
+    if (verdict == SignatureCache::kVerdictVerified) {
+      LogCvmfs(kLogCvmfs, kLogDebug, "manifest and whitelist verified before");
+      return kFailOk;
+    }
+    whitelist_cached = (verdict == SignatureCache::kVerdictWhitelist);
+  }
+
+  pthread_mutex_lock(&lock_verify_);
+  verify_locked = true;
   retval = signature::LoadCertificateMem(ensemble->cert_buf,
                                          ensemble->cert_size);
   if (!retval) {
@@ -215,35 +537,42 @@ Failures Fetch(const std::string &base_url, const std::string &repository_name,
     goto cleanup;
   }
 
-  // Load whitelist and verify
-  retval = download::Fetch(&download_whitelist);
-  if (retval != download::kFailOk) {
-    result = kFailLoad;
-    goto cleanup;
-  }
-  ensemble->whitelist_buf =
-    reinterpret_cast<unsigned char *>(download_whitelist.destination_mem.data);
-  ensemble->whitelist_size = download_whitelist.destination_mem.size;
-  retval = signature::VerifyLetter(ensemble->whitelist_buf,
-                                   ensemble->whitelist_size, true);
-  if (!retval) {
-    LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslogErr,
-             "failed to verify repository whitelist");
-    result = kFailBadWhitelist;
-    goto cleanup;
+  // Verify whitelist
+  if (!whitelist_cached) {
+    retval = signature::VerifyLetter(ensemble->whitelist_buf,
+                                     ensemble->whitelist_size, true);
+    if (!retval) {
+      LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslogErr,
+               "failed to verify repository whitelist");
+      result = kFailBadWhitelist;
+      goto cleanup;
+    }
+    fingerprint = signature::FingerprintCertificate();
+    retval = VerifyWhitelist(ensemble->whitelist_buf, ensemble->whitelist_size,
+                             repository_name, fingerprint, &whitelist_expiry);
+    if (!retval) {
+      LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslogErr,
+               "failed to verify repository certificate against whitelist");
+      result = kFailBadWhitelist;
+      goto cleanup;
+    }
   }
-  retval = VerifyWhitelist(ensemble->whitelist_buf, ensemble->whitelist_size,
-                           repository_name);
-  if (!retval) {
-    LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslogErr,
-             "failed to verify repository certificate against whitelist");
-    result = kFailBadWhitelist;
-    goto cleanup;
+  pthread_mutex_unlock(&lock_verify_);
+
+  if (ensemble->signature_cache) {
+    if (!whitelist_cached) {
+      ensemble->signature_cache->Insert(SignatureCache::kLetterWhitelist,
+        whitelist_hash, certificate_hash, whitelist_expiry, fingerprint);
+    }
+    ensemble->signature_cache->Insert(SignatureCache::kLetterManifest,
+      manifest_hash, certificate_hash, 0, fingerprint);
   }
 
   return kFailOk;
 
  cleanup:
+  if (verify_locked)
+    pthread_mutex_unlock(&lock_verify_);
   delete ensemble->manifest;
   ensemble->manifest = NULL;
   if (ensemble->raw_manifest_buf) free(ensemble->raw_manifest_buf);
@@ -5,11 +5,17 @@
 #ifndef CVMFS_MANIFEST_FETCH_H_
 #define CVMFS_MANIFEST_FETCH_H_
 
+#include <pthread.h>
+
+#include <ctime>
 #include <string>
 #include <cstdlib>
+#include <vector>
 
+#include "atomic.h"
 #include "manifest.h"
 #include "hash.h"
+#include "util.h"
 
 namespace manifest {
 
@@ -27,6 +33,60 @@ enum Failures {
 };
 
 
+/**
+ * Remembers manifests and whitelists whose signatures were verified, so that
+ * byte-identical letters signed by the same certificate are not verified
+ * again.  A whitelist is remembered until it expires, a manifest only counts
+ * together with a remembered whitelist.  The blacklist is checked on every
+ * use.  Optionally, the entries are persisted in a file, which has to be as
+ * trustworthy as the cache directory.
+ */
+class SignatureCache : SingleCopy {
+ public:
+  static const unsigned kMaxEntries = 16;
+  enum Letters {
+    kLetterManifest = 'M',
+    kLetterWhitelist = 'W',
+  };
+  enum Verdicts {
+    kVerdictUnknown = 0,  /**< verify both letters */
+    kVerdictWhitelist,    /**< verify the manifest */
+    kVerdictVerified,     /**< both letters were verified before */
+    kVerdictBlacklisted,  /**< certificate of the whitelist is blacklisted */
+  };
+
+  SignatureCache();
+  ~SignatureCache();
+  void Load(const std::string &path);
+  Verdicts Lookup(const hash::Any &manifest_hash,
+                  const hash::Any &whitelist_hash,
+                  const hash::Any &certificate_hash,
+                  const std::vector<std::string> &blacklist,
+                  const time_t now, std::string *fingerprint);
+  void Insert(const Letters letter, const hash::Any &letter_hash,
+              const hash::Any &certificate_hash, const time_t expiry,
+              const std::string &fingerprint);
+  uint64_t num_hits() { return atomic_read64(&num_hits_); }
+
+ private:
+  struct Entry {
+    char letter;
+    std::string letter_hash;
+    std::string certificate_hash;
+    time_t expiry;  /**< 0 for manifests, they expire with the whitelist */
+    std::string fingerprint;
+  };
+  void Store();
+  const Entry *Find(const Letters letter, const std::string &letter_hash,
+                    const std::string &certificate_hash, const time_t now);
+
+  std::string path_;
+  std::vector<Entry> entries_;  /**< oldest first */
+  atomic_int64 num_hits_;  /**< reused verifications, one per letter */
+  pthread_mutex_t lock_;
+};
+
+
 /**
  * A manifest requires the certificate and the whitelist to be verified.
  * All three are an ensemble.
@@ -34,6 +94,7 @@ enum Failures {
 struct ManifestEnsemble {
   ManifestEnsemble() {
     manifest = NULL;
+    signature_cache = NULL;
     raw_manifest_buf = cert_buf = whitelist_buf = NULL;
     raw_manifest_size = cert_size = whitelist_size = 0;
   }
@@ -46,6 +107,12 @@ struct ManifestEnsemble {
   // Can be overwritte to fetch certificate from cache
   virtual void FetchCertificate(const hash::Any &hash) { }
 
+  /**
+   * Certificate of a previous manifest, if known.  It is fetched along with
+   * the manifest and used if the manifest still refers to it.
+   */
+  hash::Any certificate_hint;
+  SignatureCache *signature_cache;  /**< optional, not owned */
   Manifest *manifest;
   unsigned char *raw_manifest_buf;
   unsigned char *cert_buf;
@@ -56,6 +123,26 @@ struct ManifestEnsemble {
 };
 
 
+/**
+ * A manifest that was verified ahead of time, e.g. by the catalog refresher.
+ * Until it expires, it stands in for fetching and verifying the manifest
+ * again.
+ */
+class PrefetchedManifest : SingleCopy {
+ public:
+  PrefetchedManifest();
+  ~PrefetchedManifest();
+  void Set(const Manifest &manifest, const time_t expiry);
+  bool Get(const bool consume, const uint64_t minimum_timestamp,
+           const time_t now, ManifestEnsemble *ensemble);
+
+ private:
+  Manifest *manifest_;  /**< NULL if there is none */
+  time_t expiry_;
+  pthread_mutex_t lock_;
+};
+
+
 Failures Fetch(const std::string &base_url, const std::string &repository_name,
                const uint64_t minimum_timestamp, const hash::Any *base_catalog,
                ManifestEnsemble *ensemble);
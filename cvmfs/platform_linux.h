@@ -13,10 +13,15 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <attr/xattr.h>
 #include <signal.h>
+#include <errno.h>
 #include <limits.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <time.h>
 
 #include <cassert>
 
@@ -48,6 +53,39 @@ inline int platform_spinlock_trylock(platform_spinlock *lock) {
 }
 
 
+/**
+ * Futexes on memory shared between processes.  The waiter sleeps as long as
+ * *addr equals value, at most timeout_ms milliseconds.  Spurious wake-ups
+ * are possible, the caller has to check the value again.
+ */
+inline void platform_futex_wait(int32_t *addr, const int32_t value,
+                                const unsigned timeout_ms)
+{
+  struct timespec timeout;
+  timeout.tv_sec = timeout_ms / 1000;
+  timeout.tv_nsec = (timeout_ms % 1000) * 1000000;
+  syscall(SYS_futex, addr, FUTEX_WAIT, value, &timeout, NULL, 0);
+}
+
+inline void platform_futex_wake(int32_t *addr) {
+  syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+
+/**
+ * An eventfd counter, used as a doorbell between threads.  -1 if the kernel
+ * does not support it.
+ */
+inline int platform_eventfd() {
+#ifdef SYS_eventfd
+  return syscall(SYS_eventfd, 0);
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+
 /**
  * pthread_self() is not necessarily an unsigned long.
  */
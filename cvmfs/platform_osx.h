@@ -15,7 +15,10 @@
 #include <sys/xattr.h>
 #include <alloca.h>
 #include <signal.h>
+#include <errno.h>
 #include <mach-o/dyld.h>
+#include <stdint.h>
+#include <unistd.h>
 
 #include <cstring>
 #include <cassert>
@@ -60,6 +63,26 @@ inline int platform_spinlock_trylock(platform_spinlock *lock) {
 }
 
 
+/**
+ * There are no futexes on OS X, the waiter polls instead.
+ */
+inline void platform_futex_wait(int32_t *addr, const int32_t value,
+                                const unsigned timeout_ms)
+{
+  const unsigned poll_ms = (timeout_ms < 1) ? timeout_ms : 1;
+  if (*const_cast<volatile int32_t *>(addr) == value)
+    usleep(poll_ms * 1000);
+}
+
+inline void platform_futex_wake(int32_t *addr) { }
+
+
+inline int platform_eventfd() {
+  errno = ENOSYS;
+  return -1;
+}
+
+
 /**
  * pthread_self() is not necessarily an unsigned long.
  */
@@ -0,0 +1,351 @@
+/**
+ * This file is part of the CernVM File System.
+ *
+ * Warms the cache with the files given in a list, e.g. before a campaign.
+ * The list contains one path per line, either relative to the repository root
+ * or including the mount point.  A csv file written by the tracer works as
+ * well, the path is then taken from the third column.
+ *
+ * A prefetch run is started by the talk thread and runs in its own thread.
+ * It first resolves the paths through the catalogs and collects the distinct
+ * content hashes, including the hashes of file chunks.  A small pool of worker
+ * threads then fetches the objects through the cache module, so that the
+ * transfers run in parallel in the download thread.  Optionally, the workers
+ * pace the downloads to a maximum rate.
+ */
+
+#define __STDC_FORMAT_MACROS
+
+#include "cvmfs_config.h"
+#include "prefetch.h"
+
+#include <pthread.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdio>
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "atomic.h"
+#include "cache.h"
+#include "compression.h"
+#include "cvmfs.h"
+#include "download.h"
+#include "file_chunk.h"
+#include "hash.h"
+#include "logging.h"
+#include "prefetch_list.h"
+#include "quota.h"
+#include "util.h"
+
+using namespace std;  // NOLINT
+
+namespace prefetch {
+
+const unsigned kMaxConcurrency = 64;
+
+/**
+ * A content-addressed object to fetch, either an entire file or a chunk.
+ */
+struct Object {
+  Object() : size(0), is_chunk(false), compression_alg(zlib::kZlibDefault) { }
+  Object(const hash::Any &c, const uint64_t s, const bool i,
+         const zlib::Algorithms a, const string &p)
+    : checksum(c), size(s), is_chunk(i), compression_alg(a), path(p) { }
+
+  hash::Any checksum;
+  uint64_t size;
+  bool is_chunk;
+  zlib::Algorithms compression_alg;
+  string path;
+};
+
+pthread_mutex_t lock_progress_ = PTHREAD_MUTEX_INITIALIZER;
+Progress progress_;  /**< protected by lock_progress_ */
+bool joinable_ = false;  /**< protected by lock_progress_ */
+pthread_t thread_prefetch_;
+atomic_int32 cancel_;
+struct timeval start_;
+
+vector<string> *paths_ = NULL;
+vector<Object> *objects_ = NULL;
+atomic_int64 next_object_;
+unsigned concurrency_ = 1;
+
+uint64_t max_rate_ = 0;  /**< bytes per second, 0 means unlimited */
+double next_slot_ = 0.0;  /**< seconds since start_ */
+pthread_mutex_t lock_rate_ = PTHREAD_MUTEX_INITIALIZER;
+
+
+string Progress::Print() const {
+  if (list_path.empty())
+    return "No prefetch run\n";
+
+  string result = "Prefetch of " + list_path + " ";
+  if (running)
+    result += resolving ? "running (resolving paths)\n" : "running\n";
+  else
+    result += "finished\n";
+  result += "paths: " + StringifyInt(num_paths) +
+            " (unresolved: " + StringifyInt(num_unresolved) + ")\n";
+  result += "objects: " + StringifyInt(num_done) + "/" +
+            StringifyInt(num_objects) +
+            " (already cached: " + StringifyInt(num_cached) +
+            ", failed: " + StringifyInt(num_failed) + ")\n";
+  const uint64_t rate = (elapsed > 0.0) ?
+    static_cast<uint64_t>(static_cast<double>(bytes_uncompressed) / elapsed) :
+    0;
+  result += "fetched: " + StringifyInt(bytes_uncompressed / (1024*1024)) +
+            "MB uncompressed (" + StringifyInt(bytes_uncompressed) +
+            " Bytes) in " +
+            StringifyInt(static_cast<int64_t>(elapsed)) + "s, " +
+            StringifyInt(rate / 1024) + "kB/s\n";
+  return result;
+}
+
+
+static double GetElapsed() {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return DiffTimeSeconds(start_, now);
+}
+
+
+/**
+ * Delays the download of size bytes until it fits into the bandwidth budget.
+ */
+static void Throttle(const uint64_t size) {
+  if (max_rate_ == 0)
+    return;
+
+  pthread_mutex_lock(&lock_rate_);
+  const double now = GetElapsed();
+  const double slot = (next_slot_ > now) ? next_slot_ : now;
+  next_slot_ = slot +
+    static_cast<double>(size) / static_cast<double>(max_rate_);
+  pthread_mutex_unlock(&lock_rate_);
+
+  double wait = slot - now;
+  while ((wait > 0.0) && (atomic_read32(&cancel_) == 0)) {
+    const unsigned wait_ms = (wait > 0.1) ? 100 : unsigned(wait * 1000.0);
+    SafeSleepMs(wait_ms);
+    wait -= 0.1;
+  }
+}
+
+
+static void *MainWorker(void *data __attribute__((unused))) {
+  cache::SetFetchPriority(download::kPriorityLow);
+  while (atomic_read32(&cancel_) == 0) {
+    const int64_t idx = atomic_xadd64(&next_object_, 1);
+    if (idx >= static_cast<int64_t>(objects_->size()))
+      break;
+    const Object &object = (*objects_)[idx];
+
+    bool cached = false;
+    bool failed = false;
+    int fd = cache::Open(object.checksum);
+    if (fd >= 0) {
+      cached = true;
+      if (cache::GetCacheMode() == cache::kCacheReadWrite)
+        quota::Touch(object.checksum);
+    } else {
+      Throttle(object.size);
+      if (object.is_chunk) {
+        fd = cache::FetchChunk(FileChunk(object.checksum, 0, object.size),
+                               object.compression_alg,
+                               "Part of " + object.path);
+      } else {
+        fd = cache::FetchFile(object.checksum, object.size,
+                              object.compression_alg, object.path);
+      }
+      if (fd < 0) {
+        failed = true;
+        LogCvmfs(kLogCvmfs, kLogDebug, "prefetch: failed to fetch %s (%d)",
+                 object.path.c_str(), fd);
+      }
+    }
+    if (fd >= 0)
+      cache::Close(fd);
+
+    pthread_mutex_lock(&lock_progress_);
+    progress_.num_done++;
+    if (cached) progress_.num_cached++;
+    if (failed) progress_.num_failed++;
+    if (!cached && !failed) progress_.bytes_uncompressed += object.size;
+    pthread_mutex_unlock(&lock_progress_);
+  }
+  return NULL;
+}
+
+
+static void *MainPrefetch(void *data __attribute__((unused))) {
+  LogCvmfs(kLogCvmfs, kLogDebug, "prefetch thread started (%u paths)",
+           static_cast<unsigned>(paths_->size()));
+
+  // Resolve paths and collect distinct content hashes
+  set<hash::Any> seen;
+  uint64_t num_unresolved = 0;
+  for (unsigned i = 0; i < paths_->size(); ++i) {
+    if (atomic_read32(&cancel_) != 0)
+      break;
+    const string &path = (*paths_)[i];
+    vector<FileChunk> content;
+    bool chunked;
+    zlib::Algorithms compression_alg;
+    if (!cvmfs::ListContent(path, &content, &chunked, &compression_alg)) {
+      LogCvmfs(kLogCvmfs, kLogDebug, "prefetch: cannot resolve %s",
+               path.c_str());
+      num_unresolved++;
+      continue;
+    }
+    for (unsigned j = 0; j < content.size(); ++j) {
+      if (!seen.insert(content[j].content_hash()).second)
+        continue;
+      objects_->push_back(Object(content[j].content_hash(), content[j].size(),
+                                 chunked, compression_alg, path));
+    }
+  }
+
+  pthread_mutex_lock(&lock_progress_);
+  progress_.resolving = false;
+  progress_.num_unresolved = num_unresolved;
+  progress_.num_objects = objects_->size();
+  pthread_mutex_unlock(&lock_progress_);
+
+  // Fetch in parallel
+  unsigned num_workers = concurrency_;
+  if (num_workers > objects_->size())
+    num_workers = objects_->size();
+  vector<pthread_t> workers(num_workers);
+  for (unsigned i = 0; i < num_workers; ++i) {
+    int retval = pthread_create(&workers[i], NULL, MainWorker, NULL);
+    assert(retval == 0);
+  }
+  for (unsigned i = 0; i < num_workers; ++i)
+    pthread_join(workers[i], NULL);
+
+  pthread_mutex_lock(&lock_progress_);
+  progress_.running = false;
+  progress_.elapsed = GetElapsed();
+  const Progress summary = progress_;
+  pthread_mutex_unlock(&lock_progress_);
+
+  LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslog,
+           "prefetch of %s %s: %"PRIu64" objects, %"PRIu64" already cached, "
+           "%"PRIu64" failed, %"PRIu64" bytes fetched (uncompressed)",
+           summary.list_path.c_str(),
+           (atomic_read32(&cancel_) != 0) ? "canceled" : "finished",
+           summary.num_done, summary.num_cached, summary.num_failed,
+           summary.bytes_uncompressed);
+
+  delete paths_;
+  delete objects_;
+  paths_ = NULL;
+  objects_ = NULL;
+  return NULL;
+}
+
+
+/**
+ * Reads the list and starts a prefetch run in the background.  Only one run
+ * can be active at a time.
+ *
+ * @param[in] list_path File with one path per line or a tracer csv file
+ * @param[in] concurrency Number of parallel downloads
+ * @param[in] max_rate Bandwidth cap in bytes per second, 0 for unlimited
+ */
+bool Start(const string &list_path, const unsigned concurrency,
+           const uint64_t max_rate, string *error)
+{
+  pthread_mutex_lock(&lock_progress_);
+  if (progress_.running) {
+    pthread_mutex_unlock(&lock_progress_);
+    *error = "prefetch already running";
+    return false;
+  }
+  if (joinable_) {
+    pthread_join(thread_prefetch_, NULL);
+    joinable_ = false;
+  }
+
+  FILE *f = fopen(list_path.c_str(), "r");
+  if (f == NULL) {
+    pthread_mutex_unlock(&lock_progress_);
+    *error = "cannot open " + list_path;
+    return false;
+  }
+  paths_ = new vector<string>();
+  string line;
+  while (GetLineFile(f, &line)) {
+    const string path = ParseListLine(line, *cvmfs::mountpoint_);
+    if (!path.empty())
+      paths_->push_back(path);
+  }
+  fclose(f);
+
+  objects_ = new vector<Object>();
+  atomic_init64(&next_object_);
+  atomic_init32(&cancel_);
+  concurrency_ = (concurrency == 0) ? 1 : concurrency;
+  if (concurrency_ > kMaxConcurrency)
+    concurrency_ = kMaxConcurrency;
+  max_rate_ = max_rate;
+  next_slot_ = 0.0;
+  gettimeofday(&start_, NULL);
+
+  progress_ = Progress();
+  progress_.running = true;
+  progress_.resolving = true;
+  progress_.list_path = list_path;
+  progress_.num_paths = paths_->size();
+  progress_.start_time = time(NULL);
+  const uint64_t num_paths = progress_.num_paths;
+
+  int retval = pthread_create(&thread_prefetch_, NULL, MainPrefetch, NULL);
+  assert(retval == 0);
+  joinable_ = true;
+  pthread_mutex_unlock(&lock_progress_);
+
+  LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslog,
+           "starting prefetch of %"PRIu64" paths from %s (%u parallel, %"PRIu64
+           " bytes/s max)", num_paths, list_path.c_str(),
+           concurrency_, max_rate_);
+  return true;
+}
+
+
+void Cancel() {
+  atomic_cas32(&cancel_, 0, 1);
+}
+
+
+Progress GetProgress() {
+  pthread_mutex_lock(&lock_progress_);
+  Progress result = progress_;
+  if (result.running)
+    result.elapsed = GetElapsed();
+  pthread_mutex_unlock(&lock_progress_);
+  return result;
+}
+
+
+/**
+ * Stops a running prefetch.  Has to be called before the cache and download
+ * modules are torn down.
+ */
+void Fini() {
+  Cancel();
+  pthread_mutex_lock(&lock_progress_);
+  const bool joinable = joinable_;
+  joinable_ = false;
+  pthread_mutex_unlock(&lock_progress_);
+  if (joinable)
+    pthread_join(thread_prefetch_, NULL);
+}
+
+}  // namespace prefetch
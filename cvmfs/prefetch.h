@@ -0,0 +1,61 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#ifndef CVMFS_PREFETCH_H_
+#define CVMFS_PREFETCH_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include <string>
+
+namespace prefetch {
+
+/**
+ * Snapshot of the counters of the current (or last) prefetch run.
+ */
+struct Progress {
+  Progress() {
+    running = false;
+    resolving = false;
+    num_paths = 0;
+    num_unresolved = 0;
+    num_objects = 0;
+    num_done = 0;
+    num_cached = 0;
+    num_failed = 0;
+    bytes_uncompressed = 0;
+    start_time = 0;
+    elapsed = 0.0;
+  }
+
+  std::string Print() const;
+
+  bool running;
+  bool resolving;  /**< still looking up paths in the catalogs */
+  std::string list_path;
+  uint64_t num_paths;
+  uint64_t num_unresolved;  /**< not found or not a regular file */
+  uint64_t num_objects;  /**< distinct content hashes, including chunks */
+  uint64_t num_done;
+  uint64_t num_cached;  /**< objects that were already in the cache */
+  uint64_t num_failed;
+  /**
+   * Size of the downloaded objects as stored in the catalogs.  The actual
+   * transfer is usually smaller because objects are compressed on the server.
+   */
+  uint64_t bytes_uncompressed;
+  time_t start_time;
+  double elapsed;  /**< seconds */
+};
+
+bool Start(const std::string &list_path, const unsigned concurrency,
+           const uint64_t max_rate, std::string *error);
+void Cancel();
+Progress GetProgress();
+void Fini();
+
+}  // namespace prefetch
+
+#endif  // CVMFS_PREFETCH_H_
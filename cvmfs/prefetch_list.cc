@@ -0,0 +1,50 @@
+/**
+ * This file is part of the CernVM File System.
+ *
+ * Parses the lines of a prefetch list.  Kept apart from the prefetch thread
+ * so that it does not depend on the cache and catalog modules.
+ */
+
+#include "cvmfs_config.h"
+#include "prefetch_list.h"
+
+#include <string>
+#include <vector>
+
+#include "util.h"
+
+using namespace std;  // NOLINT
+
+namespace prefetch {
+
+/**
+ * Extracts the path (third field) of a tracer csv line.
+ */
+string ParseTraceLine(const string &line) {
+  const vector<string> fields = SplitCsvLine(line);
+  return (fields.size() >= 3) ? fields[2] : "";
+}
+
+
+/**
+ * Normalizes a line from the prefetch list into a repository path.  Paths
+ * below the mount point are made relative to the repository root.  Returns
+ * an empty string for lines that do not contain a path.
+ */
+string ParseListLine(const string &raw_line, const string &mountpoint) {
+  string line = Trim(raw_line);
+  if (!line.empty() && (line[line.length()-1] == '\r'))
+    line = Trim(line.substr(0, line.length()-1));
+  if (line.empty())
+    return "";
+
+  string path = (line[0] == '"') ? ParseTraceLine(line) : line;
+  const string prefix = mountpoint + "/";
+  if (HasPrefix(path, prefix, false))
+    path = path.substr(prefix.length()-1);
+  if (path.empty() || (path[0] != '/'))
+    return "";
+  return path;
+}
+
+}  // namespace prefetch
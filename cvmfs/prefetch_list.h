@@ -0,0 +1,18 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#ifndef CVMFS_PREFETCH_LIST_H_
+#define CVMFS_PREFETCH_LIST_H_
+
+#include <string>
+
+namespace prefetch {
+
+std::string ParseTraceLine(const std::string &line);
+std::string ParseListLine(const std::string &raw_line,
+                          const std::string &mountpoint);
+
+}  // namespace prefetch
+
+#endif  // CVMFS_PREFETCH_LIST_H_
@@ -10,6 +10,10 @@
  *
  * We might choose to not manage the local cache.  This is indicated
  * by limit == 0 and everything succeeds in that case.
+ *
+ * Alternatively, the cache catalog can be kept in memory and persisted by a
+ * snapshot and a journal (see quota_memory.h).  In this case, the SQLite
+ * database is not used at all.
  */
 
 #define __STDC_LIMIT_MACROS
@@ -21,7 +25,8 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/dir.h>
-#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/time.h>
 #include <stdint.h>
 #include <pthread.h>
 #include <unistd.h>
@@ -29,7 +34,10 @@
 #include <inttypes.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <limits.h>
+#include <poll.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cstdlib>
 #include <cstdio>
@@ -41,6 +49,7 @@
 #include <set>
 
 #include "platform.h"
+#include "atomic.h"
 #include "logging.h"
 #include "duplex_sqlite3.h"
 #include "hash.h"
@@ -48,12 +57,20 @@
 #include "smalloc.h"
 #include "cvmfs.h"
 #include "monitor.h"
+#include "quota_memory.h"
 
 using namespace std;  // NOLINT
 
 namespace quota {
 
-const uint32_t kProtocolRevision = 1;  // Start of keeping revisions
+/**
+ * 1: start of keeping revisions
+ * 2: kListLru
+ * 3: kStatistics
+ * 4: eviction counters in the kStatistics reply
+ * 5: reply slots in cachemgr.replies
+ */
+const uint32_t kProtocolRevision = 5;
 
 static void GetLimits(uint64_t *limit, uint64_t *cleanup_threshold);
 
@@ -83,12 +100,14 @@ enum CommandType {
   kRegisterBackChannel,
   kUnregisterBackChannel,
   kGetProtocolRevision,
+  kListLru,
+  kStatistics,
 };
 
 struct LruCommand {
   CommandType command_type;
   uint64_t size;
-  int return_pipe;  // For cleanup, listing, and reservations
+  int return_pipe;  // For cleanup, listing, and reservations; or a reply slot
   unsigned char digest[hash::kMaxDigestSize];
   uint16_t path_length;  // Maximum 512-sizeof(LruCommand) in order to guarantee
                          // atomic pipe operations
@@ -105,6 +124,137 @@ const unsigned kMaxCvmfsPath = 512-sizeof(LruCommand);
 // is filled with pinned files
 const unsigned kHighPinWatermark = 75;
 
+/**
+ * Touches are collected per process and forwarded in batches of distinct
+ * hashes.  A batch is written at once and has to fit into PIPE_BUF in order
+ * to remain atomic with respect to other writers.  PIPE_BUF is only 512 bytes
+ * on some platforms.
+ */
+const unsigned kTouchBufferSize = PIPE_BUF / sizeof(LruCommand);
+const unsigned kTouchFlushInterval = 2;  // seconds
+
+/**
+ * The eviction thread starts when the cache is filled above kHighWatermark
+ * percent of the limit and cleans up until cleanup_threshold.  It removes at
+ * most kEvictBatchSize files from the cache catalog at a time, so that the
+ * command server is not blocked for long.
+ */
+const unsigned kHighWatermark = 90;
+const unsigned kEvictBatchSize = 128;
+
+/**
+ * The cache database is rebuilt by kRebuildThreads workers, each of which
+ * scans whole cache subdirectories.  The cache catalog is filled in
+ * transactions of kRebuildTransactionSize files.
+ */
+const unsigned kRebuildThreads = 8;
+const unsigned kRebuildTransactionSize = 50000;
+
+/**
+ * Small replies of the shared cache manager are written into slots of a
+ * shared memory segment instead of a FIFO created per request.  A client
+ * claims a free slot and puts kReplySlotBase + generation * kNumReplySlots +
+ * slot number into the return pipe field of the command.  The cache manager
+ * marks the slot as replied and wakes the client by a futex.  Listings are
+ * streamed and keep using FIFOs, as do all replies when no slot is free.
+ *
+ * Every claim increases the generation of the slot, so that the cache manager
+ * drops late replies to a slot that was taken over from a dead client.
+ */
+const unsigned kNumReplySlots = 64;
+const unsigned kReplySlotSize = 64;
+const int kReplySlotBase = 1 << 30;
+const unsigned kReplyGenerations = 1 << 23;
+const unsigned kReplyTimeoutMs = 1000;
+
+enum ReplySlotState {
+  kSlotFree = 0,
+  kSlotClaimed,
+  kSlotReplied,
+};
+
+/**
+ * The state word carries the generation in the upper bits.  The owner is 0
+ * while the slot is being claimed or released.
+ */
+struct ReplySlot {
+  atomic_int32 state;
+  atomic_int32 owner;
+  uint32_t size;
+  char data[kReplySlotSize];
+};
+
+static inline int32_t SlotWord(const uint32_t generation,
+                               const ReplySlotState state)
+{
+  return (generation << 2) | state;
+}
+static inline uint32_t SlotGeneration(const int32_t word) { return word >> 2; }
+static inline ReplySlotState SlotState(const int32_t word) {
+  return static_cast<ReplySlotState>(word & 0x3);
+}
+
+/**
+ * A file found in the cache directory while rebuilding the cache database.
+ */
+struct CachedFile {
+  bool operator <(const CachedFile &other) const {
+    if (atime != other.atime)
+      return atime < other.atime;
+    return sha1 < other.sha1;
+  }
+  time_t atime;
+  string sha1;
+  uint64_t size;
+};
+
+/**
+ * Files scanned by the background rebuild that are not yet in the cache
+ * catalog.  They count for the gauge and are evicted first, oldest first.
+ */
+class PendingFiles {
+ public:
+  void Add(const CachedFile &file) {
+    if (atimes_.insert(make_pair(file.sha1, file.atime)).second)
+      lru_.insert(file);
+  }
+  bool Take(const string &sha1, CachedFile *file) {
+    map<string, time_t>::iterator iter = atimes_.find(sha1);
+    if (iter == atimes_.end())
+      return false;
+    CachedFile key;
+    key.atime = iter->second;
+    key.sha1 = sha1;
+    set<CachedFile>::iterator pending = lru_.find(key);
+    *file = *pending;
+    lru_.erase(pending);
+    atimes_.erase(iter);
+    return true;
+  }
+  bool TakeOldest(CachedFile *file) {
+    if (lru_.empty())
+      return false;
+    *file = *lru_.begin();
+    atimes_.erase(file->sha1);
+    lru_.erase(lru_.begin());
+    return true;
+  }
+
+ private:
+  set<CachedFile> lru_;
+  map<string, time_t> atimes_;
+};
+
+/**
+ * Return channel of a synchronous command on the client side.
+ */
+struct ReplyChannel {
+  int pipe[2];
+  int slot;  /**< -1 if the reply comes through pipe */
+  uint32_t generation;  /**< of the claimed slot */
+  unsigned offset;  /**< read position in the reply slot */
+};
+
 pthread_t thread_lru_;
 int pipe_lru_[2];
 bool shared_;
@@ -136,6 +286,50 @@ sqlite3_stmt *stmt_rm_ = NULL;
 sqlite3_stmt *stmt_list_ = NULL;
 sqlite3_stmt *stmt_list_pinned_ = NULL;  /**< Loaded catalogs are pinned. */
 sqlite3_stmt *stmt_list_catalogs_ = NULL;
+sqlite3_stmt *stmt_list_lru_ = NULL;
+
+bool in_memory_ = false;
+MemoryCacheCatalog *memory_catalog_ = NULL;  /**< Replaces the SQLite db */
+PolicyType policy_type_ = kPolicyLru;
+/**
+ * Chooses the files to evict.  NULL for plain LRU, which is given by the
+ * access sequence numbers of the cache catalog.
+ */
+ReplacementPolicy *policy_ = NULL;
+
+pthread_mutex_t lock_touch_buffer_ = PTHREAD_MUTEX_INITIALIZER;
+LruCommand touch_buffer_[kTouchBufferSize];
+unsigned num_touch_buffer_ = 0;
+time_t touch_timestamp_ = 0;  /**< Last time the touch buffer was flushed */
+pthread_t thread_touch_flusher_;
+pthread_cond_t cond_touch_flusher_ = PTHREAD_COND_INITIALIZER;
+bool touch_flusher_running_ = false;  /**< protected by lock_touch_buffer_ */
+bool touch_flusher_terminate_ = false;  /**< protected by lock_touch_buffer_ */
+Statistics statistics_;  /**< Client and command server counters */
+
+int fd_cache_dir_ = -1;  /**< Files are unlinked relative to this fd */
+pthread_t thread_eviction_;
+/**
+ * Protects the cache catalog, the gauges and the pinned chunks against
+ * concurrent access by the command server and the eviction thread.
+ */
+pthread_mutex_t lock_catalog_ = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t cond_eviction_ = PTHREAD_COND_INITIALIZER;
+bool eviction_requested_ = false;
+bool eviction_terminate_ = false;
+
+bool rebuild_background_ = false;
+/**
+ * Set while the cache catalog is rebuilt in the background, protected by
+ * lock_catalog_.
+ */
+bool rebuilding_ = false;
+PendingFiles *rebuild_pending_ = NULL;  /**< protected by lock_catalog_ */
+atomic_int32 rebuild_abort_;
+pthread_t thread_rebuild_;
+
+ReplySlot *reply_slots_ = NULL;  /**< Mapped cachemgr.replies, if shared */
+atomic_int32 next_reply_slot_ = 0;
 
 
 static void MakeReturnPipe(int pipe[2]) {
@@ -162,9 +356,38 @@ static void MakeReturnPipe(int pipe[2]) {
 }
 
 
+/**
+ * Finds the reply slot of a return pipe field and checks that it is still
+ * claimed by the client that sent the command.
+ */
+static ReplySlot *GetReplySlot(int pipe_wronly, int32_t *word) {
+  const unsigned target = pipe_wronly - kReplySlotBase;
+  ReplySlot *slot = &reply_slots_[target % kNumReplySlots];
+  *word = SlotWord(target / kNumReplySlots, kSlotClaimed);
+  return (atomic_read32(&slot->state) == *word) ? slot : NULL;
+}
+
+
 static int BindReturnPipe(int pipe_wronly) {
   if (!shared_)
     return pipe_wronly;
+  if (pipe_wronly >= kReplySlotBase) {
+    if (reply_slots_ == NULL) {
+      LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
+               "invalid reply slot %d", pipe_wronly - kReplySlotBase);
+      return -1;
+    }
+    int32_t word;
+    ReplySlot *slot = GetReplySlot(pipe_wronly, &word);
+    if (slot == NULL) {
+      LogCvmfs(kLogQuota, kLogDebug, "reply slot %d taken over, dropping",
+               pipe_wronly - kReplySlotBase);
+      return -1;
+    }
+    // Late replies of a previous generation might have left data behind
+    slot->size = 0;
+    return pipe_wronly;
+  }
 
   // Connect writer's end
   int result = open((*cache_dir_ + "/pipe" + StringifyInt(pipe_wronly)).c_str(),
@@ -180,8 +403,41 @@ static int BindReturnPipe(int pipe_wronly) {
 
 
 static void UnbindReturnPipe(int pipe_wronly) {
-  if (shared_)
+  if (!shared_)
+    return;
+  if (pipe_wronly < kReplySlotBase) {
     close(pipe_wronly);
+    return;
+  }
+
+  // Publish the reply, the data is written before the state changes
+  int32_t word;
+  ReplySlot *slot = GetReplySlot(pipe_wronly, &word);
+  if (slot == NULL)
+    return;
+  atomic_cas32(&slot->state, word,
+               SlotWord(SlotGeneration(word), kSlotReplied));
+  platform_futex_wake(&slot->state);
+}
+
+
+/**
+ * Writes (part of) the reply to a synchronous command, either into a reply
+ * slot or into a return pipe.
+ */
+static void WriteReply(int return_pipe, const void *buf, const size_t nbyte) {
+  if (!shared_ || (return_pipe < kReplySlotBase)) {
+    WritePipe(return_pipe, buf, nbyte);
+    return;
+  }
+
+  int32_t word;
+  ReplySlot *slot = GetReplySlot(return_pipe, &word);
+  if (slot == NULL)
+    return;
+  assert(slot->size + nbyte <= kReplySlotSize);
+  memcpy(slot->data + slot->size, buf, nbyte);
+  slot->size += nbyte;
 }
 
 
@@ -201,6 +457,189 @@ static void CloseReturnPipe(int pipe[2]) {
 }
 
 
+/**
+ * Claims a free reply slot.  Slots that were never released because their
+ * owner died are taken over, whether or not they have been replied to.  The
+ * owner field decides which client gets such a slot.
+ *
+ * \return the slot number or -1 if all slots are in use
+ */
+static int ClaimReplySlot(uint32_t *generation) {
+  const pid_t pid = getpid();
+  const unsigned start = atomic_xadd32(&next_reply_slot_, 1);
+  for (unsigned i = 0; i < kNumReplySlots; ++i) {
+    const unsigned idx = (start + i) % kNumReplySlots;
+    ReplySlot *slot = &reply_slots_[idx];
+    int32_t word = atomic_read32(&slot->state);
+    *generation = (SlotGeneration(word) + 1) % kReplyGenerations;
+    if (SlotState(word) == kSlotFree) {
+      if (atomic_cas32(&slot->state, word,
+                       SlotWord(*generation, kSlotClaimed)))
+      {
+        atomic_write32(&slot->owner, pid);
+        return idx;
+      }
+      continue;
+    }
+
+    const pid_t owner = atomic_read32(&slot->owner);
+    if ((owner <= 0) || (owner == pid) || (kill(owner, 0) == 0) ||
+        (errno != ESRCH) || !atomic_cas32(&slot->owner, owner, pid))
+    {
+      continue;
+    }
+    // The cache manager might still turn a claimed slot into a replied one
+    do {
+      word = atomic_read32(&slot->state);
+      *generation = (SlotGeneration(word) + 1) % kReplyGenerations;
+    } while (!atomic_cas32(&slot->state, word,
+                           SlotWord(*generation, kSlotClaimed)));
+    return idx;
+  }
+  return -1;
+}
+
+
+/**
+ * The cache manager is the only reader of the command FIFO.  Once it is gone,
+ * the write end reports an error.
+ */
+static bool IsManagerAlive() {
+  struct pollfd watch;
+  watch.fd = pipe_lru_[1];
+  watch.events = POLLOUT;
+  watch.revents = 0;
+  if (poll(&watch, 1, 0) < 0)
+    return true;
+  return (watch.revents & (POLLERR | POLLHUP | POLLNVAL)) == 0;
+}
+
+
+static void MakeReplyChannel(ReplyChannel *channel) {
+  channel->slot = (reply_slots_ != NULL) ?
+                  ClaimReplySlot(&channel->generation) : -1;
+  channel->offset = 0;
+  if (shared_) {
+    pthread_mutex_lock(&lock_touch_buffer_);
+    if (channel->slot >= 0)
+      statistics_.num_reply_slots++;
+    else
+      statistics_.num_reply_pipes++;
+    pthread_mutex_unlock(&lock_touch_buffer_);
+  }
+  if (channel->slot < 0)
+    MakeReturnPipe(channel->pipe);
+}
+
+
+/**
+ * Value of the return pipe field of the command.
+ */
+static int GetReplyTarget(const ReplyChannel &channel) {
+  if (channel.slot >= 0) {
+    return kReplySlotBase + channel.generation*kNumReplySlots +
+           channel.slot;
+  }
+  return channel.pipe[1];
+}
+
+
+/**
+ * Reads the next part of the reply.  Blocks until the cache manager has
+ * replied.  Aborts if the cache manager is gone.
+ */
+static void ReadReply(ReplyChannel *channel, void *buf, const size_t nbyte) {
+  if (channel->slot < 0) {
+    if (channel->offset == 0)
+      ReadHalfPipe(channel->pipe[0], buf, nbyte);
+    else
+      ReadPipe(channel->pipe[0], buf, nbyte);
+    channel->offset += nbyte;
+    return;
+  }
+
+  ReplySlot *slot = &reply_slots_[channel->slot];
+  const int32_t claimed = SlotWord(channel->generation, kSlotClaimed);
+  const int32_t replied = SlotWord(channel->generation, kSlotReplied);
+  while (atomic_read32(&slot->state) != replied) {
+    platform_futex_wait(&slot->state, claimed, kReplyTimeoutMs);
+    const int32_t word = atomic_read32(&slot->state);
+    if ((word != replied) && ((word != claimed) || !IsManagerAlive())) {
+      LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
+               "cache manager did not reply (slot %d, state %d)",
+               channel->slot, word);
+      abort();
+    }
+  }
+  assert(channel->offset + nbyte <= slot->size);
+  memcpy(buf, slot->data + channel->offset, nbyte);
+  channel->offset += nbyte;
+}
+
+
+static void CloseReplyChannel(ReplyChannel *channel) {
+  if (channel->slot < 0) {
+    CloseReturnPipe(channel->pipe);
+    return;
+  }
+  ReplySlot *slot = &reply_slots_[channel->slot];
+  atomic_write32(&slot->owner, 0);
+  atomic_cas32(&slot->state, SlotWord(channel->generation, kSlotReplied),
+               SlotWord(channel->generation, kSlotFree));
+}
+
+
+/**
+ * Maps the reply slots of the shared cache manager.  The cache manager
+ * creates the segment, clients attach to it.
+ */
+static bool MapReplySlots(const bool create) {
+  const string path = *cache_dir_ + "/cachemgr.replies";
+  const size_t size = kNumReplySlots * sizeof(ReplySlot);
+  if (create)
+    unlink(path.c_str());
+  const int fd = open(path.c_str(), create ? (O_RDWR | O_CREAT) : O_RDWR,
+                      0600);
+  if (fd < 0) {
+    LogCvmfs(kLogQuota, kLogDebug, "failed to open %s (%d)",
+             path.c_str(), errno);
+    return false;
+  }
+  if (create && (ftruncate(fd, size) != 0)) {
+    LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
+             "failed to size reply slots (%d)", errno);
+    close(fd);
+    return false;
+  }
+  platform_stat64 info;
+  if ((platform_fstat(fd, &info) != 0) ||
+      (static_cast<uint64_t>(info.st_size) < size))
+  {
+    LogCvmfs(kLogQuota, kLogDebug, "invalid reply slots file %s",
+             path.c_str());
+    close(fd);
+    return false;
+  }
+  void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
+             "failed to map reply slots (%d)", errno);
+    return false;
+  }
+  reply_slots_ = static_cast<ReplySlot *>(mapping);
+  return true;
+}
+
+
+static void UnmapReplySlots() {
+  if (reply_slots_ == NULL)
+    return;
+  munmap(reply_slots_, kNumReplySlots * sizeof(ReplySlot));
+  reply_slots_ = NULL;
+}
+
+
 static void BroadcastBackchannels(const string &message) {
   assert(message.length() > 0);
 
@@ -232,92 +671,382 @@ static void BroadcastBackchannels(const string &message) {
 }
 
 
-static bool DoCleanup(const uint64_t leave_size) {
-  if ((limit_ == 0) || (gauge_ <= leave_size))
+/**
+ * Writes the collected touches into the command pipe in a single write.
+ * Has to be called with lock_touch_buffer_ held.
+ */
+static void DoFlushTouches(const time_t now) {
+  touch_timestamp_ = now;
+  if (num_touch_buffer_ == 0)
+    return;
+  WritePipe(pipe_lru_[1], touch_buffer_,
+            num_touch_buffer_ * sizeof(LruCommand));
+  statistics_.num_touches_forwarded += num_touch_buffer_;
+  statistics_.num_touch_writes++;
+  num_touch_buffer_ = 0;
+}
+
+
+/**
+ * Forwards pending touches before commands whose result depends on the LRU
+ * order.
+ */
+static void FlushTouches() {
+  if (limit_ == 0) return;
+  pthread_mutex_lock(&lock_touch_buffer_);
+  DoFlushTouches(time(NULL));
+  pthread_mutex_unlock(&lock_touch_buffer_);
+}
+
+
+/**
+ * Forwards buffered touches once they are kTouchFlushInterval seconds old.
+ * Touch() flushes only when it is called, so without this thread the last
+ * touches before a quiet period would wait for the next file access.
+ */
+static void *MainTouchFlusher(void *data __attribute__((unused))) {
+  LogCvmfs(kLogQuota, kLogDebug, "starting touch flusher");
+  pthread_mutex_lock(&lock_touch_buffer_);
+  while (!touch_flusher_terminate_) {
+    const time_t now = time(NULL);
+    if ((num_touch_buffer_ > 0) &&
+        (now >= touch_timestamp_ + static_cast<time_t>(kTouchFlushInterval)))
+    {
+      DoFlushTouches(now);
+    }
+    struct timespec deadline;
+    deadline.tv_sec = ((num_touch_buffer_ > 0) ? touch_timestamp_ : now) +
+                      kTouchFlushInterval;
+    deadline.tv_nsec = 0;
+    pthread_cond_timedwait(&cond_touch_flusher_, &lock_touch_buffer_,
+                           &deadline);
+  }
+  pthread_mutex_unlock(&lock_touch_buffer_);
+  LogCvmfs(kLogQuota, kLogDebug, "stopping touch flusher");
+  return NULL;
+}
+
+
+static void StopTouchFlusher() {
+  pthread_mutex_lock(&lock_touch_buffer_);
+  const bool running = touch_flusher_running_;
+  touch_flusher_terminate_ = true;
+  touch_flusher_running_ = false;
+  pthread_cond_signal(&cond_touch_flusher_);
+  pthread_mutex_unlock(&lock_touch_buffer_);
+  if (running)
+    pthread_join(thread_touch_flusher_, NULL);
+}
+
+
+string Statistics::Print() const {
+  const uint64_t saved = num_touches - num_touch_writes;
+  return "touches: " + StringifyInt(num_touches) +
+    "  forwarded: " + StringifyInt(num_touches_forwarded) +
+    "  pipe writes: " + StringifyInt(num_touch_writes) +
+    " (saved " + StringifyInt(num_touches ? saved * 100 / num_touches : 0) +
+    "%)\n  cache manager commands: " + StringifyInt(num_processed) +
+    "  busy: " + StringifyDouble(busy_time) + "s\n" +
+    "  evicted in background: " + StringifyInt(num_evicted) +
+    "  synchronous cleanups: " + StringifyInt(num_sync_cleanups) + "\n" +
+    "  replies through shared memory: " + StringifyInt(num_reply_slots) +
+    "  through FIFOs: " + StringifyInt(num_reply_pipes) + "\n";
+}
+
+
+static uint64_t GetHighWatermark() {
+  return max(cleanup_threshold_, limit_ / 100 * kHighWatermark);
+}
+
+
+/**
+ * Size of an entry as accounted in the cache catalog.
+ */
+static bool LookupSize(const hash::Any &hash, uint64_t *size) {
+  if (memory_catalog_) {
+    const MemoryCacheCatalog::Entry *entry = memory_catalog_->Lookup(hash);
+    if (entry == NULL)
+      return false;
+    *size = entry->size;
     return true;
+  }
+
+  const string hash_str = hash.ToString();
+  sqlite3_bind_text(stmt_size_, 1, &hash_str[0], hash_str.length(),
+                    SQLITE_STATIC);
+  const bool result = (sqlite3_step(stmt_size_) == SQLITE_ROW);
+  if (result)
+    *size = sqlite3_column_int64(stmt_size_, 0);
+  sqlite3_reset(stmt_size_);
+  return result;
+}
+
+
+/**
+ * Pinned files are hidden from the replacement policy, so that they are
+ * never chosen as victims.
+ */
+static void PolicyInsert(const hash::Any &hash, const uint64_t size,
+                         const bool pinned)
+{
+  if (!policy_)
+    return;
+  if (pinned)
+    policy_->Remove(hash);
+  else
+    policy_->Insert(hash, size);
+}
 
-  // TODO transaction
-  LogCvmfs(kLogQuota, kLogSyslog,
-           "cleanup cache until %lu KB are free", leave_size/1024);
-  LogCvmfs(kLogQuota, kLogDebug, "gauge %"PRIu64, gauge_);
 
+static void PolicyUnpin(const hash::Any &hash) {
+  uint64_t size;
+  if (policy_ && LookupSize(hash, &size))
+    policy_->Insert(hash, size);
+}
+
+
+static bool Contains(const hash::Any &hash) {
+  const string hash_str = hash.ToString();
+  bool result = false;
+
+  if (memory_catalog_) {
+    result = (memory_catalog_->Lookup(hash) != NULL);
+    LogCvmfs(kLogQuota, kLogDebug, "contains %s returns %d",
+             hash_str.c_str(), result);
+    return result;
+  }
+
+  sqlite3_bind_text(stmt_size_, 1, &hash_str[0], hash_str.length(),
+                    SQLITE_STATIC);
+  if (sqlite3_step(stmt_size_) == SQLITE_ROW)
+    result = true;
+  sqlite3_reset(stmt_size_);
+  LogCvmfs(kLogQuota, kLogDebug, "contains %s returns %d",
+           hash_str.c_str(), result);
+
+  return result;
+}
+
+
+/**
+ * Removes up to max_entries least recently used entries from the cache
+ * catalog until the gauge is below leave_size.  The files to be unlinked are
+ * appended to trash as paths relative to the cache directory.
+ *
+ * @param[out] num_removed  Number of entries taken from the cache catalog
+ * \return False if the cache catalog could not be updated
+ */
+static bool EvictLru(const uint64_t leave_size, const unsigned max_entries,
+                     vector<string> *trash, unsigned *num_removed)
+{
   bool result;
   string hash_str;
-  vector<string> trash;
 
-  do {
-    sqlite3_reset(stmt_lru_);
-    if (sqlite3_step(stmt_lru_) != SQLITE_ROW) {
-      LogCvmfs(kLogQuota, kLogDebug, "could not get lru-entry");
-      break;
+  *num_removed = 0;
+  while ((gauge_ > leave_size) && (*num_removed < max_entries)) {
+    hash::Any hash(hash::kSha1);
+    uint64_t size;
+    CachedFile pending;
+    if (rebuild_pending_ && rebuild_pending_->TakeOldest(&pending)) {
+      // Found by the background rebuild.  The file was inserted again or is
+      // about to be inserted as pinned if its hash is known already.
+      gauge_ -= pending.size;
+      bool known = false;
+      if (pending.sha1.length() == 2*hash::kDigestSizes[hash::kSha1]) {
+        hash = hash::Any(hash::kSha1, hash::HexPtr(pending.sha1));
+        known = Contains(hash) ||
+                (pinned_chunks_->find(hash) != pinned_chunks_->end());
+      }
+      if (!known)
+        trash->push_back(pending.sha1.substr(0, 2) + "/" +
+                         pending.sha1.substr(2));
+      LogCvmfs(kLogQuota, kLogDebug, "rebuild cleanup %s, new gauge %"PRIu64,
+               pending.sha1.c_str(), gauge_);
+      (*num_removed)++;
+      continue;
     }
+    if (policy_) {
+      if (!policy_->GetVictim(&hash)) {
+        LogCvmfs(kLogQuota, kLogDebug, "could not get victim");
+        break;
+      }
+      hash_str = hash.ToString();
+      if (!LookupSize(hash, &size)) {
+        // Not in the cache catalog (anymore)
+        policy_->Remove(hash);
+        continue;
+      }
+    } else if (memory_catalog_) {
+      const MemoryCacheCatalog::Entry *lru = memory_catalog_->GetLru();
+      if (lru == NULL) {
+        LogCvmfs(kLogQuota, kLogDebug, "could not get lru-entry");
+        break;
+      }
+      hash = lru->hash;
+      size = lru->size;
+      hash_str = hash.ToString();
+    } else {
+      sqlite3_reset(stmt_lru_);
+      if (sqlite3_step(stmt_lru_) != SQLITE_ROW) {
+        LogCvmfs(kLogQuota, kLogDebug, "could not get lru-entry");
+        break;
+      }
 
-    hash_str = string(reinterpret_cast<const char *>(
-                      sqlite3_column_text(stmt_lru_, 0)));
+      hash_str = string(reinterpret_cast<const char *>(
+                        sqlite3_column_text(stmt_lru_, 0)));
+      hash = hash::Any(hash::kSha1, hash::HexPtr(
+        hash_str.substr(0, 2*hash::kDigestSizes[hash::kSha1])));
+      size = sqlite3_column_int64(stmt_lru_, 1);
+    }
     LogCvmfs(kLogQuota, kLogDebug, "removing %s", hash_str.c_str());
-    hash::Any hash(hash::kSha1, hash::HexPtr(
-      hash_str.substr(0, 2*hash::kDigestSizes[hash::kSha1])));
 
     // That's a critical condition.  We must not delete a not yet inserted
     // pinned file as it is already reserved (but will be inserted later).
     // However, we must remove it temporarily from the cache database in order
     // to not run into an endless loop
-    if (pinned_chunks_->find(hash) == pinned_chunks_->end()) {
-      trash.push_back((*cache_dir_) + hash.MakePath(1, 2));
-      gauge_ -= sqlite3_column_int64(stmt_lru_, 1);
+    const bool evicted = (pinned_chunks_->find(hash) == pinned_chunks_->end());
+    if (evicted) {
+      trash->push_back(hash.MakePath(1, 2).substr(1));
+      gauge_ -= size;
       LogCvmfs(kLogQuota, kLogDebug, "lru cleanup %s, new gauge %"PRIu64,
                hash_str.c_str(), gauge_);
     }
 
-    sqlite3_bind_text(stmt_rm_, 1, &hash_str[0], hash_str.length(),
-                      SQLITE_STATIC);
-    result = (sqlite3_step(stmt_rm_) == SQLITE_DONE);
-    sqlite3_reset(stmt_rm_);
+    if (memory_catalog_) {
+      result = memory_catalog_->Remove(hash);
+    } else {
+      sqlite3_bind_text(stmt_rm_, 1, &hash_str[0], hash_str.length(),
+                        SQLITE_STATIC);
+      result = (sqlite3_step(stmt_rm_) == SQLITE_DONE);
+      sqlite3_reset(stmt_rm_);
+    }
 
     if (!result) {
       LogCvmfs(kLogQuota, kLogDebug, "could not remove lru-entry");
       return false;
     }
-  } while (gauge_ > leave_size);
-
-  // Double fork avoids zombie, forked removal process must not flush file
-  // buffers
-  if (!trash.empty()) {
-    pid_t pid;
-    int statloc;
-    if ((pid = fork()) == 0) {
-      if (fork() == 0) {
-        for (unsigned i = 0, iEnd = trash.size(); i < iEnd; ++i) {
-          LogCvmfs(kLogQuota, kLogDebug, "unlink %s", trash[i].c_str());
-          unlink(trash[i].c_str());
-        }
-        _exit(0);
-      }
-      _exit(0);
-    } else {
-      if (pid > 0)
-        waitpid(pid, &statloc, 0);
+    if (policy_) {
+      if (evicted)
+        policy_->Evict(hash);
       else
-        return false;
+        policy_->Remove(hash);
     }
+    (*num_removed)++;
   }
+  if (memory_catalog_)
+    memory_catalog_->Sync();
+
+  return true;
+}
+
+
+static void UnlinkTrash(const vector<string> &trash) {
+  for (unsigned i = 0, iEnd = trash.size(); i < iEnd; ++i) {
+    LogCvmfs(kLogQuota, kLogDebug, "unlink %s", trash[i].c_str());
+    if ((unlinkat(fd_cache_dir_, trash[i].c_str(), 0) != 0) &&
+        (errno != ENOENT))
+    {
+      LogCvmfs(kLogQuota, kLogDebug, "failed to unlink %s (%d)",
+               trash[i].c_str(), errno);
+    }
+  }
+}
+
+
+/**
+ * Synchronous cleanup, used for explicit cleanup requests and when an insert
+ * would exceed the hard limit.
+ */
+static bool DoCleanup(const uint64_t leave_size) {
+  if ((limit_ == 0) || (gauge_ <= leave_size))
+    return true;
+
+  LogCvmfs(kLogQuota, kLogSyslog,
+           "cleanup cache until %lu KB are free", leave_size/1024);
+  LogCvmfs(kLogQuota, kLogDebug, "gauge %"PRIu64, gauge_);
+
+  vector<string> trash;
+  unsigned num_removed;
+  if (!memory_catalog_)
+    sqlite3_exec(db_, "SAVEPOINT cleanup", NULL, NULL, NULL);
+  const bool result = EvictLru(leave_size, UINT_MAX, &trash, &num_removed);
+  if (!memory_catalog_)
+    sqlite3_exec(db_, "RELEASE cleanup", NULL, NULL, NULL);
+  if (!result)
+    return false;
+  UnlinkTrash(trash);
 
   return gauge_ <= leave_size;
 }
 
 
-static bool Contains(const string &hash_str) {
-  bool result = false;
+/**
+ * Called before inserting a file that would exceed the hard limit.  Only
+ * makes room for the new file, the eviction thread takes care of the rest.
+ */
+static bool MakeRoom(const uint64_t size) {
+  statistics_.num_sync_cleanups++;
+  return DoCleanup((limit_ > size) ? limit_ - size : 0);
+}
 
-  sqlite3_bind_text(stmt_size_, 1, &hash_str[0], hash_str.length(),
-                    SQLITE_STATIC);
-  if (sqlite3_step(stmt_size_) == SQLITE_ROW)
-    result = true;
-  sqlite3_reset(stmt_size_);
-  LogCvmfs(kLogQuota, kLogDebug, "contains %s returns %d",
-           hash_str.c_str(), result);
 
-  return result;
+/**
+ * Wakes up the eviction thread once the high watermark is exceeded.  Has to
+ * be called with lock_catalog_ held.
+ */
+static void CheckHighWatermark() {
+  if ((limit_ == 0) || eviction_requested_ ||
+      (gauge_ <= GetHighWatermark()))
+  {
+    return;
+  }
+  LogCvmfs(kLogQuota, kLogDebug, "high watermark reached, gauge %"PRIu64,
+           gauge_);
+  eviction_requested_ = true;
+  pthread_cond_signal(&cond_eviction_);
+}
+
+
+/**
+ * Evicts files in batches until the cache is below the cleanup threshold.
+ * The cache catalog is only locked while a batch is selected; files are
+ * unlinked without holding the lock.
+ */
+static void *MainEviction(void *data __attribute__((unused))) {
+  LogCvmfs(kLogQuota, kLogDebug, "starting eviction thread");
+
+  pthread_mutex_lock(&lock_catalog_);
+  while (true) {
+    while (!eviction_requested_ && !eviction_terminate_)
+      pthread_cond_wait(&cond_eviction_, &lock_catalog_);
+    if (eviction_terminate_)
+      break;
+
+    LogCvmfs(kLogQuota, kLogSyslog,
+             "cleanup cache until %lu KB are free", cleanup_threshold_/1024);
+    while (!eviction_terminate_ && (gauge_ > cleanup_threshold_)) {
+      vector<string> trash;
+      unsigned num_removed;
+      if (!memory_catalog_)
+        sqlite3_exec(db_, "BEGIN", NULL, NULL, NULL);
+      const bool result = EvictLru(cleanup_threshold_, kEvictBatchSize,
+                                   &trash, &num_removed);
+      if (!memory_catalog_)
+        sqlite3_exec(db_, "COMMIT", NULL, NULL, NULL);
+      statistics_.num_evicted += trash.size();
+      if (!result || (num_removed == 0))
+        break;
+
+      pthread_mutex_unlock(&lock_catalog_);
+      UnlinkTrash(trash);
+      pthread_mutex_lock(&lock_catalog_);
+    }
+    eviction_requested_ = false;
+  }
+  pthread_mutex_unlock(&lock_catalog_);
+
+  LogCvmfs(kLogQuota, kLogDebug, "stopping eviction thread");
+  return NULL;
 }
 
 
@@ -332,9 +1061,67 @@ static void CheckHighPinWatermark() {
 }
 
 
+/**
+ * Counterpart of ProcessCommandBunch() for the in-memory cache catalog.  The
+ * journal is flushed once per bunch.
+ */
+static void ProcessMemoryBunch(const unsigned num,
+                               const LruCommand *commands, const char *paths)
+{
+  for (unsigned i = 0; i < num; ++i) {
+    const hash::Any hash(hash::kSha1, commands[i].digest,
+                         hash::kDigestSizes[hash::kSha1]);
+    const unsigned size = commands[i].size;
+    LogCvmfs(kLogQuota, kLogDebug, "processing %s (%d)",
+             hash.ToString().c_str(), commands[i].command_type);
+
+    bool exists;
+    switch (commands[i].command_type) {
+      case kTouch:
+        memory_catalog_->Touch(hash, seq_++);
+        if (policy_) policy_->Touch(hash);
+        break;
+      case kUnpin:
+        memory_catalog_->Unpin(hash);
+        PolicyUnpin(hash);
+        break;
+      case kPin:
+      case kPinRegular:
+      case kInsert:
+        exists = Contains(hash);
+        if (!exists && (gauge_ + size > limit_)) {
+          LogCvmfs(kLogQuota, kLogDebug, "over limit, gauge %lu, file size %lu",
+                   gauge_, size);
+          const bool retval = MakeRoom(size);
+          assert(retval);
+        }
+
+        memory_catalog_->Insert(hash, size, seq_++,
+          string(&paths[i*kMaxCvmfsPath], commands[i].path_length),
+          (commands[i].command_type == kPin) ? kFileCatalog : kFileRegular,
+          (commands[i].command_type == kPin) ||
+          (commands[i].command_type == kPinRegular));
+        PolicyInsert(hash, size, (commands[i].command_type == kPin) ||
+                                 (commands[i].command_type == kPinRegular));
+        if (!exists) gauge_ += size;
+        break;
+      default:
+        abort();  // other types should have been taken care of by event loop
+    }
+  }
+
+  memory_catalog_->Sync();
+}
+
+
 static void ProcessCommandBunch(const unsigned num,
                                 const LruCommand *commands, const char *paths)
 {
+  if (memory_catalog_) {
+    ProcessMemoryBunch(num, commands, paths);
+    return;
+  }
+
   int retval = sqlite3_exec(db_, "BEGIN", NULL, NULL, NULL);
   assert(retval == SQLITE_OK);
 
@@ -362,6 +1149,7 @@ static void ProcessCommandBunch(const unsigned num,
           abort();
         }
         sqlite3_reset(stmt_touch_);
+        if (policy_) policy_->Touch(hash);
         break;
       case kUnpin:
         sqlite3_bind_text(stmt_unpin_, 1, &hash_str[0], hash_str.length(),
@@ -376,18 +1164,19 @@ static void ProcessCommandBunch(const unsigned num,
           abort();
         }
         sqlite3_reset(stmt_unpin_);
+        PolicyUnpin(hash);
         break;
       case kPin:
       case kPinRegular:
       case kInsert:
         // It could already be in, check
-        exists = Contains(hash_str);
+        exists = Contains(hash);
 
-        // Cleanup, move to trash and unlink
+        // Hard limit reached, make room right away
         if (!exists && (gauge_ + size > limit_)) {
           LogCvmfs(kLogQuota, kLogDebug, "over limit, gauge %lu, file size %lu",
                    gauge_, size);
-          retval = DoCleanup(cleanup_threshold_);
+          retval = MakeRoom(size);
           assert(retval != 0);
         }
 
@@ -413,6 +1202,8 @@ static void ProcessCommandBunch(const unsigned num,
           abort();
         }
         sqlite3_reset(stmt_new_);
+        PolicyInsert(hash, size, (commands[i].command_type == kPin) ||
+                                 (commands[i].command_type == kPinRegular));
 
         if (!exists) gauge_ += size;
         break;
@@ -426,6 +1217,42 @@ static void ProcessCommandBunch(const unsigned num,
 }
 
 
+/**
+ * Pipes back the paths of the in-memory cache catalog that match the listing
+ * command, in the same format as the SQL listings.
+ */
+static void WriteMemoryListing(const CommandType list_command,
+                               const int return_pipe)
+{
+  int length;
+  const MemoryCacheCatalog::Entry *lists[] =
+    { memory_catalog_->head(), memory_catalog_->pinned_head() };
+  for (unsigned i = 0; i < 2; ++i) {
+    // The first list has the entries that are not pinned
+    if ((list_command == kListPinned) && (i == 0))
+      continue;
+    for (const MemoryCacheCatalog::Entry *entry = lists[i]; entry;
+         entry = entry->next)
+    {
+      if (((list_command == kList) && (entry->type != kFileRegular)) ||
+          ((list_command == kListCatalogs) && (entry->type != kFileCatalog)))
+      {
+        continue;
+      }
+      length = entry->path.length();
+      WritePipe(return_pipe, &length, sizeof(length));
+      if (length > 0)
+        WritePipe(return_pipe, entry->path.data(), length);
+    }
+  }
+  length = -1;
+  WritePipe(return_pipe, &length, sizeof(length));
+}
+
+
+static void *MainRebuild(void *data);
+
+
 /**
  * Event loop for processing commands.  Most of them are queued, some have
  * to be executed immediately.
@@ -439,6 +1266,23 @@ static void *MainCommandServer(void *data __attribute__((unused))) {
   char path_buffer[kCommandBufferSize*kMaxCvmfsPath];
   unsigned num_commands = 0;
 
+  eviction_requested_ = false;
+  eviction_terminate_ = false;
+  if (pthread_create(&thread_eviction_, NULL, MainEviction, NULL) != 0) {
+    LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
+             "could not create eviction thread");
+    abort();
+  }
+  const bool rebuild = rebuilding_;
+  if (rebuild) {
+    atomic_init32(&rebuild_abort_);
+    if (pthread_create(&thread_rebuild_, NULL, MainRebuild, NULL) != 0) {
+      LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
+               "could not create rebuild thread");
+      abort();
+    }
+  }
+
   while (read(pipe_lru_[0], &command_buffer[num_commands],
               sizeof(command_buffer[0])) == sizeof(command_buffer[0]))
   {
@@ -461,7 +1305,7 @@ static void *MainCommandServer(void *data __attribute__((unused))) {
       BindReturnPipe(command_buffer[num_commands].return_pipe);
       if (return_pipe < 0)
         continue;
-      WritePipe(return_pipe, &kProtocolRevision, sizeof(kProtocolRevision));
+      WriteReply(return_pipe, &kProtocolRevision, sizeof(kProtocolRevision));
       UnbindReturnPipe(return_pipe);
       continue;
     }
@@ -480,6 +1324,7 @@ static void *MainCommandServer(void *data __attribute__((unused))) {
       LogCvmfs(kLogQuota, kLogDebug, "reserve %d bytes for %s",
                size, hash_str.c_str());
 
+      pthread_mutex_lock(&lock_catalog_);
       if (pinned_chunks_->find(hash) == pinned_chunks_->end()) {
         if ((cleanup_threshold_ > 0) && (pinned_ + size > cleanup_threshold_)) {
           LogCvmfs(kLogQuota, kLogDebug,
@@ -491,8 +1336,9 @@ static void *MainCommandServer(void *data __attribute__((unused))) {
           CheckHighPinWatermark();
         }
       }
+      pthread_mutex_unlock(&lock_catalog_);
 
-      WritePipe(return_pipe, &success, sizeof(success));
+      WriteReply(return_pipe, &success, sizeof(success));
       UnbindReturnPipe(return_pipe);
       continue;
     }
@@ -547,6 +1393,7 @@ static void *MainCommandServer(void *data __attribute__((unused))) {
                            sizeof(command_buffer[num_commands].digest));
       const string hash_str(hash.ToString());
 
+      pthread_mutex_lock(&lock_catalog_);
       map<hash::Any, uint64_t>::iterator iter = pinned_chunks_->find(hash);
       if (iter != pinned_chunks_->end()) {
         pinned_ -= iter->second;
@@ -554,6 +1401,7 @@ static void *MainCommandServer(void *data __attribute__((unused))) {
       } else {
         LogCvmfs(kLogQuota, kLogDebug, "this chunk was not pinned");
       }
+      pthread_mutex_unlock(&lock_catalog_);
     }
 
     // Immediate commands trigger flushing of the buffer
@@ -561,12 +1409,21 @@ static void *MainCommandServer(void *data __attribute__((unused))) {
       (command_type == kList) || (command_type == kListPinned) ||
       (command_type == kListCatalogs) || (command_type == kRemove) ||
       (command_type == kStatus) || (command_type == kLimits) ||
-      (command_type == kPid);
+      (command_type == kPid) || (command_type == kListLru) ||
+      (command_type == kStatistics);
     if (!immediate_command) num_commands++;
 
     if ((num_commands == kCommandBufferSize) || immediate_command)
     {
+      struct timeval start, end;
+      pthread_mutex_lock(&lock_catalog_);
+      gettimeofday(&start, NULL);
       ProcessCommandBunch(num_commands, command_buffer, path_buffer);
+      gettimeofday(&end, NULL);
+      statistics_.num_processed += num_commands + immediate_command;
+      statistics_.busy_time += DiffTimeSeconds(start, end);
+      CheckHighWatermark();
+      pthread_mutex_unlock(&lock_catalog_);
       if (!immediate_command) num_commands = 0;
     }
 
@@ -581,6 +1438,7 @@ static void *MainCommandServer(void *data __attribute__((unused))) {
 
       int retval;
       sqlite3_stmt *this_stmt_list = NULL;
+      pthread_mutex_lock(&lock_catalog_);
       switch (command_type) {
         case kRemove: {
           const hash::Any hash(hash::kSha1, command_buffer[num_commands].digest,
@@ -589,6 +1447,25 @@ static void *MainCommandServer(void *data __attribute__((unused))) {
           LogCvmfs(kLogQuota, kLogDebug, "manually removing %s",
                    hash_str.c_str());
           bool success = false;
+          if (policy_)
+            policy_->Remove(hash);
+
+          if (memory_catalog_) {
+            const MemoryCacheCatalog::Entry *entry =
+              memory_catalog_->Lookup(hash);
+            if (entry != NULL) {
+              gauge_ -= entry->size;
+              if (entry->pinned) {
+                pinned_chunks_->erase(hash);
+                pinned_ -= entry->size;
+              }
+              memory_catalog_->Remove(hash);
+              memory_catalog_->Sync();
+            }
+            success = true;
+            WriteReply(return_pipe, &success, sizeof(success));
+            break;
+          }
 
           sqlite3_bind_text(stmt_size_, 1, &hash_str[0], hash_str.length(),
                             SQLITE_STATIC);
@@ -617,12 +1494,16 @@ static void *MainCommandServer(void *data __attribute__((unused))) {
             success = true;
           }
           sqlite3_reset(stmt_size_);
+          // Keeps the background rebuild from inserting it again
+          CachedFile pending;
+          if (rebuild_pending_ && rebuild_pending_->Take(hash_str, &pending))
+            gauge_ -= pending.size;
 
-          WritePipe(return_pipe, &success, sizeof(success));
+          WriteReply(return_pipe, &success, sizeof(success));
           break; }
         case kCleanup:
           retval = DoCleanup(size);
-          WritePipe(return_pipe, &retval, sizeof(retval));
+          WriteReply(return_pipe, &retval, sizeof(retval));
           break;
         case kList:
           if (!this_stmt_list) this_stmt_list = stmt_list_;
@@ -631,6 +1512,11 @@ static void *MainCommandServer(void *data __attribute__((unused))) {
         case kListCatalogs:
           if (!this_stmt_list) this_stmt_list = stmt_list_catalogs_;
 
+          if (memory_catalog_) {
+            WriteMemoryListing(command_type, return_pipe);
+            break;
+          }
+
           // Pipe back the list, one by one
           int length;
           while (sqlite3_step(this_stmt_list) == SQLITE_ROW) {
@@ -649,23 +1535,81 @@ static void *MainCommandServer(void *data __attribute__((unused))) {
           WritePipe(return_pipe, &length, sizeof(length));
           sqlite3_reset(this_stmt_list);
           break;
+        case kListLru: {
+          // The size field carries the access sequence number to start after
+          vector<LruEntry> entries;
+          vector<string> paths;
+          if (memory_catalog_) {
+            vector<const MemoryCacheCatalog::Entry *> list;
+            memory_catalog_->ListAfter(size, kFileRegular, kMaxLruListing,
+                                       &list);
+            for (unsigned i = 0; i < list.size(); ++i) {
+              LruEntry entry;
+              entry.hash = list[i]->hash;
+              entry.size = list[i]->size;
+              entry.acseq = list[i]->acseq;
+              entries.push_back(entry);
+              paths.push_back(list[i]->path.substr(0, kMaxCvmfsPath));
+            }
+          } else {
+            sqlite3_bind_int64(stmt_list_lru_, 1, size);
+            sqlite3_bind_int64(stmt_list_lru_, 2, kMaxLruListing);
+            while (sqlite3_step(stmt_list_lru_) == SQLITE_ROW) {
+              const string hash_str(reinterpret_cast<const char *>(
+                sqlite3_column_text(stmt_list_lru_, 0)));
+              string path;
+              if (sqlite3_column_type(stmt_list_lru_, 3) != SQLITE_NULL) {
+                path = string(reinterpret_cast<const char *>(
+                  sqlite3_column_text(stmt_list_lru_, 3)));
+              }
+              LruEntry entry;
+              entry.hash = hash::Any(hash::kSha1, hash::HexPtr(hash_str));
+              entry.size = sqlite3_column_int64(stmt_list_lru_, 1);
+              entry.acseq = sqlite3_column_int64(stmt_list_lru_, 2);
+              entries.push_back(entry);
+              paths.push_back(path.substr(0, kMaxCvmfsPath));
+            }
+            sqlite3_reset(stmt_list_lru_);
+          }
+
+          const uint32_t num_entries = entries.size();
+          WritePipe(return_pipe, &num_entries, sizeof(num_entries));
+          for (unsigned i = 0; i < num_entries; ++i) {
+            WritePipe(return_pipe, &entries[i], sizeof(entries[i]));
+            const uint16_t length = paths[i].length();
+            WritePipe(return_pipe, &length, sizeof(length));
+            if (length > 0)
+              WritePipe(return_pipe, paths[i].data(), length);
+          }
+          break; }
         case kStatus:
-          WritePipe(return_pipe, &gauge_, sizeof(gauge_));
-          WritePipe(return_pipe, &pinned_, sizeof(pinned_));
+          WriteReply(return_pipe, &gauge_, sizeof(gauge_));
+          WriteReply(return_pipe, &pinned_, sizeof(pinned_));
           break;
         case kLimits:
-          WritePipe(return_pipe, &limit_, sizeof(limit_));
-          WritePipe(return_pipe, &cleanup_threshold_,
-                    sizeof(cleanup_threshold_));
+          WriteReply(return_pipe, &limit_, sizeof(limit_));
+          WriteReply(return_pipe, &cleanup_threshold_,
+                     sizeof(cleanup_threshold_));
           break;
         case kPid: {
           pid_t pid = getpid();
-          WritePipe(return_pipe, &pid, sizeof(pid));
+          WriteReply(return_pipe, &pid, sizeof(pid));
           break;
         }
+        case kStatistics:
+          WriteReply(return_pipe, &statistics_.num_processed,
+                     sizeof(statistics_.num_processed));
+          WriteReply(return_pipe, &statistics_.busy_time,
+                     sizeof(statistics_.busy_time));
+          WriteReply(return_pipe, &statistics_.num_evicted,
+                     sizeof(statistics_.num_evicted));
+          WriteReply(return_pipe, &statistics_.num_sync_cleanups,
+                     sizeof(statistics_.num_sync_cleanups));
+          break;
         default:
           abort();  // other types are handled by the bunch processor
       }
+      pthread_mutex_unlock(&lock_catalog_);
       UnbindReturnPipe(return_pipe);
       num_commands = 0;
     }
@@ -673,6 +1617,17 @@ static void *MainCommandServer(void *data __attribute__((unused))) {
 
   LogCvmfs(kLogQuota, kLogDebug, "stopping cache manager (%d)", errno);
   close(pipe_lru_[0]);
+  if (rebuild) {
+    atomic_cas32(&rebuild_abort_, 0, 1);
+    pthread_join(thread_rebuild_, NULL);
+    // A later RebuildDatabase() scans with the same workers
+    atomic_init32(&rebuild_abort_);
+  }
+  pthread_mutex_lock(&lock_catalog_);
+  eviction_terminate_ = true;
+  pthread_cond_signal(&cond_eviction_);
+  pthread_mutex_unlock(&lock_catalog_);
+  pthread_join(thread_eviction_, NULL);
   ProcessCommandBunch(num_commands, command_buffer, path_buffer);
 
   // Unpin
@@ -757,50 +1712,27 @@ static uint32_t GetProtocolRevision() {
 
     uint32_t revision;
     ReadHalfPipe(pipe_revision[0], &revision, sizeof(revision));
+    CloseReturnPipe(pipe_revision);
     return revision;
   } else {
-    return 0;
-  }
-}
-
-
-/**
- * Rebuilds the SQLite cache catalog based on the stat-information of files
- * in the cache directory.
- *
- * \return True on success, false otherwise
- */
-bool RebuildDatabase() {
-  bool result = false;
-  string sql;
-  sqlite3_stmt *stmt_select = NULL;
-  sqlite3_stmt *stmt_insert = NULL;
-  int sqlerr;
-  int seq = 0;
-  char hex[3];
-  struct stat info;
-  platform_dirent64 *d;
-  DIR *dirp = NULL;
-  string path;
-  set<string> catalogs;
-
-  LogCvmfs(kLogQuota, kLogSyslog | kLogDebug, "re-building cache-database");
-
-  // Empty cache catalog and fscache
-  sql = "DELETE FROM cache_catalog; DELETE FROM fscache;";
-  sqlerr = sqlite3_exec(db_, sql.c_str(), NULL, NULL, NULL);
-  if (sqlerr != SQLITE_OK) {
-    LogCvmfs(kLogQuota, kLogDebug, "could not clear cache database");
-    goto build_return;
+    return 0;
   }
+}
 
-  gauge_ = 0;
 
-  // Gather file catalog hash values
+/**
+ * Collects the hashes of the file catalogs in the cache directory from the
+ * cvmfs.checksum files.
+ */
+static bool GatherCatalogs(set<string> *catalogs) {
+  platform_dirent64 *d;
+  DIR *dirp;
+
   // TODO: distiction does not exist anymore
   if ((dirp = opendir(cache_dir_->c_str())) == NULL) {
-    LogCvmfs(kLogQuota, kLogDebug, "failed to open directory %s", path.c_str());
-    goto build_return;
+    LogCvmfs(kLogQuota, kLogDebug, "failed to open directory %s",
+             cache_dir_->c_str());
+    return false;
   }
   while ((d = platform_readdir(dirp)) != NULL) {
     if (d->d_type != DT_REG) continue;
@@ -813,67 +1745,206 @@ bool RebuildDatabase() {
         if (fread(sha1, 1, 40, f) == 40) {
           LogCvmfs(kLogQuota, kLogDebug, "added %s to catalog list",
                    string(sha1, 40).c_str());
-          catalogs.insert(string(sha1, 40).c_str());
+          catalogs->insert(string(sha1, 40).c_str());
         }
         fclose(f);
       }
     }
   }
   closedir(dirp);
+  return true;
+}
+
+
+namespace {
+
+/**
+ * Shared by the workers that scan the cache directory.  Each worker takes the
+ * next of the 256 cache subdirectories until all are done.
+ */
+struct RebuildScan {
+  atomic_int32 next_dir;
+  atomic_int32 num_failures;
+  pthread_mutex_t lock;  /**< Protects files */
+  vector<CachedFile> files;
+  /**
+   * Add the files to the gauge and to rebuild_pending_ as directories are
+   * done
+   */
+  bool account;
+};
+
+}  // anonymous namespace
+
+
+static void *MainRebuildWorker(void *data) {
+  RebuildScan *scan = reinterpret_cast<RebuildScan *>(data);
+  vector<CachedFile> files;
+  char hex[3];
+  platform_dirent64 *d;
+  struct stat info;
 
-  // Insert files from cache sub-directories 00 - ff
-  sqlite3_prepare_v2(db_, "INSERT INTO fscache (sha1, size, actime) "
-                     "VALUES (:sha1, :s, :t);", -1, &stmt_insert, NULL);
+  int i;
+  while ((i = atomic_xadd32(&scan->next_dir, 1)) <= 0xff) {
+    if (atomic_read32(&rebuild_abort_)) {
+      atomic_inc32(&scan->num_failures);
+      break;
+    }
 
-  for (int i = 0; i <= 0xff; i++) {
     snprintf(hex, sizeof(hex), "%02x", i);
-    path = (*cache_dir_) + "/" + string(hex);
-    if ((dirp = opendir(path.c_str())) == NULL) {
+    const string path = (*cache_dir_) + "/" + string(hex);
+    DIR *dirp = opendir(path.c_str());
+    if (dirp == NULL) {
       LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
                "failed to open directory %s (tmpwatch interfering?)",
                path.c_str());
-      goto build_return;
+      atomic_inc32(&scan->num_failures);
+      continue;
     }
+    const unsigned dir_begin = files.size();
     while ((d = platform_readdir(dirp)) != NULL) {
       if (d->d_type != DT_REG) continue;
 
-      if (stat((path + "/" + string(d->d_name)).c_str(), &info) == 0) {
-        string sha1 = string(hex) + string(d->d_name);
-        sqlite3_bind_text(stmt_insert, 1, sha1.c_str(), sha1.length(),
-                          SQLITE_STATIC);
-        sqlite3_bind_int64(stmt_insert, 2, info.st_size);
-        sqlite3_bind_int64(stmt_insert, 3, info.st_atime);
-        if (sqlite3_step(stmt_insert) != SQLITE_DONE) {
-          LogCvmfs(kLogQuota, kLogDebug, "could not insert into temp table");
-          goto build_return;
-        }
-        sqlite3_reset(stmt_insert);
-
-        gauge_ += info.st_size;
+      if (fstatat(dirfd(dirp), d->d_name, &info, 0) == 0) {
+        CachedFile file;
+        file.atime = info.st_atime;
+        file.sha1 = string(hex) + string(d->d_name);
+        file.size = info.st_size;
+        files.push_back(file);
       } else {
         LogCvmfs(kLogQuota, kLogDebug, "could not stat %s/%s",
                  path.c_str(), d->d_name);
       }
     }
     closedir(dirp);
-    dirp = NULL;
+
+    if (scan->account) {
+      pthread_mutex_lock(&lock_catalog_);
+      for (unsigned j = dir_begin; j < files.size(); ++j) {
+        gauge_ += files[j].size;
+        rebuild_pending_->Add(files[j]);
+      }
+      CheckHighWatermark();
+      pthread_mutex_unlock(&lock_catalog_);
+    }
   }
-  sqlite3_finalize(stmt_insert);
-  stmt_insert = NULL;
 
-  // Transfer from temp table in cache catalog
-  sqlite3_prepare_v2(db_, "SELECT sha1, size FROM fscache ORDER BY actime;",
-                     -1, &stmt_select, NULL);
+  pthread_mutex_lock(&scan->lock);
+  scan->files.insert(scan->files.end(), files.begin(), files.end());
+  pthread_mutex_unlock(&scan->lock);
+  return NULL;
+}
+
+
+/**
+ * Stats the files of the cache subdirectories with kRebuildThreads workers.
+ * The result is sorted by access time.
+ *
+ * @param[in] account  Add the files to the gauge and to rebuild_pending_
+ *                     while scanning
+ */
+static bool ScanCacheDirectory(const bool account, vector<CachedFile> *files) {
+  RebuildScan scan;
+  atomic_init32(&scan.next_dir);
+  atomic_init32(&scan.num_failures);
+  pthread_mutex_init(&scan.lock, NULL);
+  scan.account = account;
+
+  pthread_t workers[kRebuildThreads];
+  unsigned num_workers = 0;
+  for (; num_workers < kRebuildThreads; ++num_workers) {
+    if (pthread_create(&workers[num_workers], NULL, MainRebuildWorker,
+                       &scan) != 0)
+    {
+      break;
+    }
+  }
+  // Without any worker, do the scan in this thread
+  if (num_workers == 0)
+    MainRebuildWorker(&scan);
+  for (unsigned i = 0; i < num_workers; ++i)
+    pthread_join(workers[i], NULL);
+  pthread_mutex_destroy(&scan.lock);
+
+  if (atomic_read32(&scan.num_failures) > 0)
+    return false;
+  files->swap(scan.files);
+  sort(files->begin(), files->end());
+  LogCvmfs(kLogQuota, kLogDebug, "scanned %u files with %u workers",
+           static_cast<unsigned>(files->size()), num_workers);
+  return true;
+}
+
+
+/**
+ * Like RebuildDatabase() but fills the in-memory cache catalog and writes a
+ * fresh snapshot.
+ */
+static bool RebuildMemoryCatalog() {
+  set<string> catalogs;
+  vector<CachedFile> files;
+
+  LogCvmfs(kLogQuota, kLogSyslog | kLogDebug, "re-building cache-database");
+
+  if (!GatherCatalogs(&catalogs))
+    return false;
+  if (!ScanCacheDirectory(false, &files))
+    return false;
+
+  memory_catalog_->Clear();
+  uint64_t seq = 0;
+  for (unsigned i = 0; i < files.size(); ++i) {
+    if (files[i].sha1.length() != 2*hash::kDigestSizes[hash::kSha1]) {
+      LogCvmfs(kLogQuota, kLogDebug, "ignoring %s", files[i].sha1.c_str());
+      continue;
+    }
+    const int type = (catalogs.find(files[i].sha1) != catalogs.end()) ?
+                     kFileCatalog : kFileRegular;
+    memory_catalog_->Insert(hash::Any(hash::kSha1, hash::HexPtr(files[i].sha1)),
+                            files[i].size, seq++,
+                            "unknown (automatic rebuild)", type, false);
+  }
+  if (!memory_catalog_->WriteSnapshot())
+    return false;
+
+  gauge_ = memory_catalog_->size();
+  seq_ = seq;
+  LogCvmfs(kLogQuota, kLogDebug,
+           "rebuilding finished, seqence %"PRIu64 ", gauge %"PRIu64,
+           seq_, gauge_);
+  return true;
+}
+
+
+/**
+ * Inserts files[begin, end) into the SQLite cache catalog in one transaction.
+ * Files that are already in the cache catalog are skipped; their sizes are
+ * added to duplicate_size.  During a background rebuild, only files that are
+ * still in rebuild_pending_ are inserted; the others have been evicted or
+ * removed meanwhile.
+ */
+static bool InsertRebuilt(const vector<CachedFile> &files,
+                          const unsigned begin, const unsigned end,
+                          const set<string> &catalogs,
+                          uint64_t *duplicate_size)
+{
+  sqlite3_stmt *stmt_insert = NULL;
   sqlite3_prepare_v2(db_,
-    "INSERT INTO cache_catalog (sha1, size, acseq, path, type, pinned) "
+    "INSERT OR IGNORE INTO cache_catalog "
+    "(sha1, size, acseq, path, type, pinned) "
     "VALUES (:sha1, :s, :seq, 'unknown (automatic rebuild)', :t, 0);",
     -1, &stmt_insert, NULL);
-  while (sqlite3_step(stmt_select) == SQLITE_ROW) {
-    const string sha1 = string(
-      reinterpret_cast<const char *>(sqlite3_column_text(stmt_select, 0)));
+
+  bool result = true;
+  sqlite3_exec(db_, "BEGIN", NULL, NULL, NULL);
+  for (unsigned i = begin; i < end; ++i) {
+    const string &sha1 = files[i].sha1;
+    CachedFile pending;
+    if (rebuild_pending_ && !rebuild_pending_->Take(sha1, &pending))
+      continue;
     sqlite3_bind_text(stmt_insert, 1, &sha1[0], sha1.length(), SQLITE_STATIC);
-    sqlite3_bind_int64(stmt_insert, 2, sqlite3_column_int64(stmt_select, 1));
-    sqlite3_bind_int64(stmt_insert, 3, seq++);
+    sqlite3_bind_int64(stmt_insert, 2, files[i].size);
+    sqlite3_bind_int64(stmt_insert, 3, i);
     if (catalogs.find(sha1) != catalogs.end())
       sqlite3_bind_int64(stmt_insert, 4, kFileCatalog);
     else
@@ -881,31 +1952,183 @@ bool RebuildDatabase() {
 
     if (sqlite3_step(stmt_insert) != SQLITE_DONE) {
       LogCvmfs(kLogQuota, kLogDebug, "could not insert into cache catalog");
-      goto build_return;
+      result = false;
+      break;
+    }
+    if (sqlite3_changes(db_) == 0) {
+      *duplicate_size += files[i].size;
+    } else if (policy_) {
+      policy_->Insert(hash::Any(hash::kSha1, hash::HexPtr(sha1)),
+                      files[i].size);
     }
     sqlite3_reset(stmt_insert);
   }
+  sqlite3_exec(db_, result ? "COMMIT" : "ROLLBACK", NULL, NULL, NULL);
+  sqlite3_finalize(stmt_insert);
+  return result;
+}
+
+
+/**
+ * Rebuilds the SQLite cache catalog based on the stat-information of files
+ * in the cache directory.
+ *
+ * \return True on success, false otherwise
+ */
+bool RebuildDatabase() {
+  if (memory_catalog_)
+    return RebuildMemoryCatalog();
+
+  set<string> catalogs;
+  vector<CachedFile> files;
+
+  LogCvmfs(kLogQuota, kLogSyslog | kLogDebug, "re-building cache-database");
 
-  // Delete temporary table
-  sql = "DELETE FROM fscache;";
-  sqlerr = sqlite3_exec(db_, sql.c_str(), NULL, NULL, NULL);
+  // Empty cache catalog and fscache
+  const string sql = "DELETE FROM cache_catalog; DELETE FROM fscache;";
+  int sqlerr = sqlite3_exec(db_, sql.c_str(), NULL, NULL, NULL);
   if (sqlerr != SQLITE_OK) {
-    LogCvmfs(kLogQuota, kLogDebug, "could not clear temporary table (%d)",
-             sqlerr);
-    goto build_return;
+    LogCvmfs(kLogQuota, kLogDebug, "could not clear cache database");
+    return false;
   }
 
-  seq_ = seq;
-  result = true;
+  gauge_ = 0;
+
+  // Gather file catalog hash values
+  if (!GatherCatalogs(&catalogs))
+    return false;
+  if (!ScanCacheDirectory(false, &files))
+    return false;
+
+  uint64_t duplicate_size = 0;
+  for (unsigned i = 0; i < files.size(); i += kRebuildTransactionSize) {
+    const unsigned end = min(unsigned(files.size()),
+                             i + kRebuildTransactionSize);
+    if (!InsertRebuilt(files, i, end, catalogs, &duplicate_size))
+      return false;
+  }
+  for (unsigned i = 0; i < files.size(); ++i)
+    gauge_ += files[i].size;
+  gauge_ -= duplicate_size;
+
+  seq_ = files.size();
   LogCvmfs(kLogQuota, kLogDebug,
            "rebuilding finished, seqence %"PRIu64 ", gauge %"PRIu64,
            seq_, gauge_);
+  return true;
+}
 
- build_return:
-  if (stmt_insert) sqlite3_finalize(stmt_insert);
-  if (stmt_select) sqlite3_finalize(stmt_select);
-  if (dirp) closedir(dirp);
-  return result;
+
+/**
+ * Background counterpart of RebuildDatabase(), started by the command server.
+ * Scanned files count for the gauge as soon as their directory is done, even
+ * though they are not yet in the cache catalog.  Until they are inserted,
+ * they are kept in rebuild_pending_ and the cache manager evicts them before
+ * any file of the cache catalog.  The scanned files are older than the files
+ * inserted meanwhile, so that they are placed at the head of the LRU order.
+ */
+static void *MainRebuild(void *data __attribute__((unused))) {
+  LogCvmfs(kLogQuota, kLogSyslog | kLogDebug,
+           "re-building cache-database in the background");
+
+  pthread_mutex_lock(&lock_catalog_);
+  rebuild_pending_ = new PendingFiles();
+  pthread_mutex_unlock(&lock_catalog_);
+
+  set<string> catalogs;
+  vector<CachedFile> files;
+  bool result = GatherCatalogs(&catalogs) && ScanCacheDirectory(true, &files);
+
+  if (result) {
+    // Shift the access sequence numbers of the files inserted meanwhile.  The
+    // detour over negative numbers keeps the acseq index unique.
+    pthread_mutex_lock(&lock_catalog_);
+    const string n = StringifyInt(files.size());
+    const string sql = "UPDATE cache_catalog SET acseq=-acseq-1; "
+      "UPDATE cache_catalog SET acseq=-acseq-1+" + n + ";";
+    result = (sqlite3_exec(db_, sql.c_str(), NULL, NULL, NULL) == SQLITE_OK);
+    if (result)
+      seq_ += files.size();
+    pthread_mutex_unlock(&lock_catalog_);
+  }
+
+  uint64_t duplicate_size = 0;
+  for (unsigned i = 0; result && (i < files.size());
+       i += kRebuildTransactionSize)
+  {
+    if (atomic_read32(&rebuild_abort_)) {
+      result = false;
+      break;
+    }
+    const unsigned end = min(unsigned(files.size()),
+                             i + kRebuildTransactionSize);
+    pthread_mutex_lock(&lock_catalog_);
+    result = InsertRebuilt(files, i, end, catalogs, &duplicate_size);
+    pthread_mutex_unlock(&lock_catalog_);
+  }
+
+  pthread_mutex_lock(&lock_catalog_);
+  gauge_ -= duplicate_size;
+  rebuilding_ = false;
+  delete rebuild_pending_;
+  rebuild_pending_ = NULL;
+  if (result) {
+    unlink((*cache_dir_ + "/cachedb.rebuilding").c_str());
+    LogCvmfs(kLogQuota, kLogDebug,
+             "background rebuilding finished, %u files, gauge %"PRIu64,
+             static_cast<unsigned>(files.size()), gauge_);
+  } else {
+    LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
+             "background rebuild of the cache database failed, "
+             "rebuilding again on next start");
+  }
+  CheckHighWatermark();
+  pthread_mutex_unlock(&lock_catalog_);
+  return NULL;
+}
+
+
+/**
+ * Loads the in-memory cache catalog from snapshot and journal.  The journal
+ * is buffered and flushed after every bunch of commands.  After a crash, the
+ * last inserts can be missing, their files would be neither counted nor
+ * evicted.  Like the SQLite database, the catalog is then rebuilt from the
+ * cache directory.
+ */
+static bool InitMemoryCatalog(const bool rebuild_database) {
+  // The SQLite database would be stale when switching back
+  const string db_file = (*cache_dir_) + "/cachedb";
+  unlink(db_file.c_str());
+  unlink((db_file + "-journal").c_str());
+  unlink((db_file + ".rebuilding").c_str());
+
+  memory_catalog_ = new MemoryCacheCatalog(db_file);
+  if (limit_ == 0) {
+    gauge_ = 0;
+    return true;
+  }
+
+  if (rebuild_database || !memory_catalog_->Load()) {
+    LogCvmfs(kLogCvmfs, kLogDebug,
+             "CernVM-FS: building lru cache database...");
+    if (!RebuildDatabase()) {
+      LogCvmfs(kLogQuota, kLogDebug,
+               "could not build cache database from file system");
+      delete memory_catalog_;
+      memory_catalog_ = NULL;
+      close(fd_cache_dir_);
+      fd_cache_dir_ = -1;
+      UnlockFile(fd_lock_cachedb_);
+      return false;
+    }
+  }
+
+  gauge_ = memory_catalog_->size();
+  seq_ = memory_catalog_->max_acseq() + 1;
+  LogCvmfs(kLogQuota, kLogDebug,
+           "in-memory cache catalog: %u entries, gauge %"PRIu64,
+           memory_catalog_->num_entries(), gauge_);
+  return true;
 }
 
 
@@ -918,9 +2141,21 @@ static bool InitDatabase(const bool rebuild_database) {
     LogCvmfs(kLogCvmfs, kLogDebug, "failed to create cachedb lock");
     return false;
   }
+  fd_cache_dir_ = open(cache_dir_->c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd_cache_dir_ < 0) {
+    LogCvmfs(kLogQuota, kLogDebug, "failed to open cache directory (%d)",
+             errno);
+    UnlockFile(fd_lock_cachedb_);
+    return false;
+  }
+
+  if (in_memory_)
+    return InitMemoryCatalog(rebuild_database);
 
   bool retry = false;
   const string db_file = (*cache_dir_) + "/cachedb";
+  // Snapshot and journal of a previous in-memory cache catalog are stale now
+  MemoryCacheCatalog::Unlink(db_file);
   if (rebuild_database) {
     LogCvmfs(kLogQuota, kLogDebug, "rebuild database, unlinking existing (%s)",
              db_file.c_str());
@@ -1006,13 +2241,35 @@ init_recover:
   sql = "SELECT count(*) FROM cache_catalog;";
   sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt, NULL);
   if (sqlite3_step(stmt) == SQLITE_ROW) {
-    if ((sqlite3_column_int64(stmt, 0)) == 0 || rebuild_database) {
-      LogCvmfs(kLogCvmfs, kLogDebug,
-               "CernVM-FS: building lru cache database...");
-      if (!RebuildDatabase()) {
-        LogCvmfs(kLogQuota, kLogDebug,
-                 "could not build cache database from file system");
-        goto init_database_fail;
+    // A marker is left behind by an unfinished background rebuild
+    const string marker = (*cache_dir_) + "/cachedb.rebuilding";
+    if ((sqlite3_column_int64(stmt, 0)) == 0 || rebuild_database ||
+        FileExists(marker))
+    {
+      if (rebuild_background_) {
+        LogCvmfs(kLogCvmfs, kLogDebug,
+                 "CernVM-FS: building lru cache database in the background");
+        const int fd_marker = open(marker.c_str(), O_RDONLY | O_CREAT, 0600);
+        if (fd_marker >= 0)
+          close(fd_marker);
+        if (sqlite3_exec(db_, "DELETE FROM cache_catalog;",
+                         NULL, NULL, NULL) != SQLITE_OK)
+        {
+          LogCvmfs(kLogQuota, kLogDebug, "could not clear cache database");
+          sqlite3_finalize(stmt);
+          goto init_database_fail;
+        }
+        rebuilding_ = true;
+      } else {
+        LogCvmfs(kLogCvmfs, kLogDebug,
+                 "CernVM-FS: building lru cache database...");
+        if (!RebuildDatabase()) {
+          LogCvmfs(kLogQuota, kLogDebug,
+                   "could not build cache database from file system");
+          sqlite3_finalize(stmt);
+          goto init_database_fail;
+        }
+        unlink(marker.c_str());
       }
     }
   } else {
@@ -1071,16 +2328,68 @@ init_recover:
   sqlite3_prepare_v2(db_,
                      ("SELECT path FROM cache_catalog WHERE type=" + StringifyInt(kFileCatalog) +
                       ";").c_str(), -1, &stmt_list_catalogs_, NULL);
+  sqlite3_prepare_v2(db_,
+                     ("SELECT sha1, size, acseq, path FROM cache_catalog "
+                      "WHERE (acseq > :seq) AND (type=" +
+                      StringifyInt(kFileRegular) + ") "
+                      "ORDER BY acseq LIMIT :n;").c_str(),
+                     -1, &stmt_list_lru_, NULL);
   return true;
 
  init_database_fail:
+  close(fd_cache_dir_);
+  fd_cache_dir_ = -1;
   UnlockFile(fd_lock_cachedb_);
   sqlite3_close(db_);
   return false;
 }
 
 
+/**
+ * Fills the replacement policy with the unpinned files of the cache catalog
+ * in LRU order.
+ */
+static void InitPolicy() {
+  if ((limit_ == 0) || (policy_type_ == kPolicyLru))
+    return;
+  LogCvmfs(kLogQuota, kLogDebug, "using %s replacement policy",
+           ReplacementPolicy::GetName(policy_type_).c_str());
+  policy_ = ReplacementPolicy::Create(policy_type_, limit_);
+
+  if (memory_catalog_) {
+    for (const MemoryCacheCatalog::Entry *entry = memory_catalog_->head();
+         entry; entry = entry->next)
+    {
+      if (!entry->pinned)
+        policy_->Insert(entry->hash, entry->size);
+    }
+    return;
+  }
+
+  sqlite3_stmt *stmt;
+  sqlite3_prepare_v2(db_, "SELECT sha1, size FROM cache_catalog "
+                     "WHERE pinned=0 ORDER BY acseq;", -1, &stmt, NULL);
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    const string hash_str(reinterpret_cast<const char *>(
+      sqlite3_column_text(stmt, 0)));
+    policy_->Insert(hash::Any(hash::kSha1, hash::HexPtr(
+                      hash_str.substr(0, 2*hash::kDigestSizes[hash::kSha1]))),
+                    sqlite3_column_int64(stmt, 1));
+  }
+  sqlite3_finalize(stmt);
+}
+
+
 static void CloseDatabase() {
+  delete policy_;
+  policy_ = NULL;
+  if (memory_catalog_) {
+    if (limit_ > 0)
+      memory_catalog_->WriteSnapshot();
+    delete memory_catalog_;
+    memory_catalog_ = NULL;
+  }
+  if (stmt_list_lru_) sqlite3_finalize(stmt_list_lru_);
   if (stmt_list_catalogs_) sqlite3_finalize(stmt_list_catalogs_);
   if (stmt_list_pinned_) sqlite3_finalize(stmt_list_pinned_);
   if (stmt_list_) sqlite3_finalize(stmt_list_);
@@ -1091,16 +2400,21 @@ static void CloseDatabase() {
   if (stmt_unpin_) sqlite3_finalize(stmt_unpin_);
   if (stmt_new_) sqlite3_finalize(stmt_new_);
   if (db_) sqlite3_close(db_);
+  if (fd_cache_dir_ >= 0) close(fd_cache_dir_);
   UnlockFile(fd_lock_cachedb_);
 
+  stmt_list_lru_ = NULL;
   stmt_list_catalogs_ = NULL;
   stmt_list_pinned_ = NULL;
   stmt_list_ = NULL;
+  stmt_lru_ = NULL;
   stmt_rm_ = NULL;
   stmt_size_ = NULL;
   stmt_touch_ = NULL;
+  stmt_unpin_ = NULL;
   stmt_new_ = NULL;
   db_ = NULL;
+  fd_cache_dir_ = -1;
 
   delete pinned_chunks_;
   pinned_chunks_ = NULL;
@@ -1116,6 +2430,8 @@ bool InitShared(const std::string &exe_path, const std::string &cache_dir,
   shared_ = true;
   spawned_ = true;
   cache_dir_ = new string(cache_dir);
+  statistics_ = Statistics();
+  touch_timestamp_ = 0;
 
   // Create lock file: only one fuse client at a time
   const int fd_lockfile = LockFile(*cache_dir_ + "/lock_cachemgr");
@@ -1141,6 +2457,8 @@ bool InitShared(const std::string &exe_path, const std::string &cache_dir,
       protocol_revision_ = GetProtocolRevision();
       LogCvmfs(kLogQuota, kLogDebug, "connected protocol revision %u",
                protocol_revision_);
+      if (protocol_revision_ >= 5)
+        MapReplySlots(false);
     } else {
       LogCvmfs(kLogQuota, kLogDebug, "connected to ancient cache manager");
     }
@@ -1190,6 +2508,9 @@ bool InitShared(const std::string &exe_path, const std::string &cache_dir,
   command_line.push_back(StringifyInt(GetLogSyslogLevel()));
   command_line.push_back(StringifyInt(GetLogSyslogFacility()));
   command_line.push_back(GetLogDebugFile() + ":" + GetLogMicroSyslog());
+  command_line.push_back(StringifyInt(in_memory_));
+  command_line.push_back(StringifyInt(policy_type_));
+  command_line.push_back(StringifyInt(rebuild_background_));
 
   set<int> preserve_filedes;
   preserve_filedes.insert(0);
@@ -1244,6 +2565,7 @@ bool InitShared(const std::string &exe_path, const std::string &cache_dir,
   Nonblock2Block(pipe_lru_[1]);
   LogCvmfs(kLogQuota, kLogDebug, "connected to a new cache manager");
   protocol_revision_ = kProtocolRevision;
+  MapReplySlots(false);
 
   UnlockFile(fd_lockfile);
 
@@ -1281,6 +2603,10 @@ int MainCacheManager(int argc, char **argv) {
   int syslog_level = String2Int64(argv[8]);
   int syslog_facility = String2Int64(argv[9]);
   vector<string> logfiles = SplitString(argv[10], ':');
+  in_memory_ = (argc > 11) && (String2Int64(argv[11]) != 0);
+  rebuild_background_ = (argc > 13) && (String2Int64(argv[13]) != 0);
+  policy_type_ = (argc > 12) ?
+    static_cast<PolicyType>(String2Int64(argv[12])) : kPolicyLru;
 
   SetLogSyslogLevel(syslog_level);
   SetLogSyslogFacility(syslog_facility);
@@ -1313,6 +2639,14 @@ int MainCacheManager(int argc, char **argv) {
     UnlockFile(fd_lockfile_fifo);
     return 1;
   }
+  InitPolicy();
+  const string reply_slots_path = *cache_dir_ + "/cachemgr.replies";
+  if (!MapReplySlots(true)) {
+    // Clients fall back to FIFOs if they cannot attach
+    unlink(reply_slots_path.c_str());
+    LogCvmfs(kLogQuota, kLogDebug | kLogSyslogWarn,
+             "reply slots unavailable, replying through FIFOs");
+  }
 
   // Save protocol revision to file.  If the file is not found, it indicates
   // to the client that the cache manager is from times before the protocol
@@ -1360,6 +2694,8 @@ int MainCacheManager(int argc, char **argv) {
   MainCommandServer(NULL);
   unlink(fifo_path.c_str());
   unlink(protocol_revision_path.c_str());
+  UnmapReplySlots();
+  unlink(reply_slots_path.c_str());
   CloseDatabase();
   unlink(crash_guard.c_str());
   UnlockFile(fd_lockfile_fifo);
@@ -1391,6 +2727,8 @@ bool Init(const string &cache_dir, const uint64_t limit,
 
   shared_ = false;
   spawned_ = false;
+  statistics_ = Statistics();
+  touch_timestamp_ = 0;
 
   limit_ = limit;
   pinned_ = 0;
@@ -1401,6 +2739,7 @@ bool Init(const string &cache_dir, const uint64_t limit,
   // Initialize cache catalog
   if (!InitDatabase(rebuild_database))
     return false;
+  InitPolicy();
 
   MakePipe(pipe_lru_);
   initialized_ = true;
@@ -1410,12 +2749,57 @@ bool Init(const string &cache_dir, const uint64_t limit,
 
 
 /**
- * Spawns the LRU thread
+ * Keep the cache catalog in memory instead of in SQLite.  Has to be called
+ * before Init() or InitShared().  An already running shared cache manager
+ * keeps its mode.
+ */
+void SetInMemory(const bool value) {
+  in_memory_ = value;
+}
+
+
+/**
+ * Selects the replacement policy.  Has to be called before Init() or
+ * InitShared().  An already running shared cache manager keeps its policy.
+ */
+void SetPolicy(const PolicyType type) {
+  policy_type_ = type;
+}
+
+
+/**
+ * Lets the mount proceed while a missing or corrupted SQLite cache catalog is
+ * rebuilt in the background.  Has to be called before Init() or InitShared().
+ */
+void SetRebuildInBackground(const bool value) {
+  rebuild_background_ = value;
+}
+
+
+/**
+ * Spawns the touch flusher and, unless the cache manager is shared, the LRU
+ * thread
  */
 void Spawn() {
-  if (spawned_ || (limit_ == 0))
+  if (limit_ == 0)
     return;
 
+  pthread_mutex_lock(&lock_touch_buffer_);
+  if (!touch_flusher_running_) {
+    touch_flusher_terminate_ = false;
+    if (pthread_create(&thread_touch_flusher_, NULL, MainTouchFlusher, NULL)
+        != 0)
+    {
+      LogCvmfs(kLogQuota, kLogDebug, "could not create touch flusher");
+      abort();
+    }
+    touch_flusher_running_ = true;
+  }
+  pthread_mutex_unlock(&lock_touch_buffer_);
+
+  // A shared cache manager runs in its own process
+  if (spawned_)
+    return;
   if (pthread_create(&thread_lru_, NULL, MainCommandServer, NULL) != 0) {
     LogCvmfs(kLogQuota, kLogDebug, "could not create lru thread");
     abort();
@@ -1431,12 +2815,16 @@ void Spawn() {
 void Fini() {
   if (!initialized_) return;
 
+  StopTouchFlusher();
+  if (spawned_)
+    FlushTouches();
   delete cache_dir_;
   cache_dir_ = NULL;
 
   if (shared_) {
     // Most of cleanup is done elsewhen by shared cache manager
     close(pipe_lru_[1]);
+    UnmapReplySlots();
     initialized_ = false;
     return;
   }
@@ -1469,18 +2857,19 @@ bool Cleanup(const uint64_t leave_size) {
   if (!spawned_) {
     return DoCleanup(leave_size);
   }
+  FlushTouches();
 
-  int pipe_cleanup[2];
-  MakeReturnPipe(pipe_cleanup);
+  ReplyChannel channel;
+  MakeReplyChannel(&channel);
 
   LruCommand cmd;
   cmd.command_type = kCleanup;
   cmd.size = leave_size;
-  cmd.return_pipe = pipe_cleanup[1];
+  cmd.return_pipe = GetReplyTarget(channel);
 
   WritePipe(pipe_lru_[1], &cmd, sizeof(cmd));
-  ReadHalfPipe(pipe_cleanup[0], &result, sizeof(result));
-  CloseReturnPipe(pipe_cleanup);
+  ReadReply(&channel, &result, sizeof(result));
+  CloseReplyChannel(&channel);
 
   return result;
 }
@@ -1550,13 +2939,21 @@ bool Pin(const hash::Any &hash, const uint64_t size,
         CheckHighPinWatermark();
       }
     }
-    bool exists = Contains(hash_str);
+    bool exists = Contains(hash);
     if (!exists && (gauge_ + size > limit_)) {
       LogCvmfs(kLogQuota, kLogDebug, "over limit, gauge %lu, file size %lu",
                gauge_, size);
-      int retval = DoCleanup(cleanup_threshold_);
+      int retval = MakeRoom(size);
       assert(retval != 0);
     }
+    PolicyInsert(hash, size, true);
+    if (memory_catalog_) {
+      memory_catalog_->Insert(hash, size, seq_++, cvmfs_path, kFileCatalog,
+                              true);
+      memory_catalog_->Sync();
+      if (!exists) gauge_ += size;
+      return true;
+    }
     sqlite3_bind_text(stmt_new_, 1, &hash_str[0], hash_str.length(),
                       SQLITE_STATIC);
     sqlite3_bind_int64(stmt_new_, 2, size);
@@ -1572,18 +2969,18 @@ bool Pin(const hash::Any &hash, const uint64_t size,
     return true;
   }
 
-  int pipe_reserve[2];
-  MakeReturnPipe(pipe_reserve);
+  ReplyChannel channel;
+  MakeReplyChannel(&channel);
 
   LruCommand cmd;
   cmd.command_type = kReserve;
   cmd.size = size;
   memcpy(cmd.digest, hash.digest, hash.GetDigestSize());
-  cmd.return_pipe = pipe_reserve[1];
+  cmd.return_pipe = GetReplyTarget(channel);
   WritePipe(pipe_lru_[1], &cmd, sizeof(cmd));
   bool result;
-  ReadHalfPipe(pipe_reserve[0], &result, sizeof(result));
-  CloseReturnPipe(pipe_reserve);
+  ReadReply(&channel, &result, sizeof(result));
+  CloseReplyChannel(&channel);
 
   if (!result) return false;
   DoInsert(hash, size, cvmfs_path, is_catalog ? kPin : kPinRegular);
@@ -1604,16 +3001,39 @@ void Unpin(const hash::Any &hash) {
 
 
 /**
- * Updates the sequence number of the file specified by the hash.
+ * Updates the sequence number of the file specified by the hash.  Touches are
+ * collected and forwarded to the cache manager after kTouchFlushInterval
+ * seconds, by the next Touch() or by the touch flusher, or when the buffer is
+ * full.  Repeated touches of the same file within a batch are merged.
  */
 void Touch(const hash::Any &hash) {
   assert(initialized_);
   if (limit_ == 0) return;
 
-  LruCommand cmd;
-  cmd.command_type = kTouch;
-  memcpy(cmd.digest, hash.digest, hash.GetDigestSize());
-  WritePipe(pipe_lru_[1], &cmd, sizeof(cmd));
+  const time_t now = time(NULL);
+  const unsigned digest_size = hash.GetDigestSize();
+  pthread_mutex_lock(&lock_touch_buffer_);
+  statistics_.num_touches++;
+  // The buffer is small, a linear search is cheaper than a hash table
+  bool found = false;
+  for (unsigned i = 0; i < num_touch_buffer_; ++i) {
+    if (memcmp(touch_buffer_[i].digest, hash.digest, digest_size) == 0) {
+      found = true;
+      break;
+    }
+  }
+  if (!found) {
+    LruCommand *cmd = &touch_buffer_[num_touch_buffer_++];
+    memset(cmd, 0, sizeof(LruCommand));
+    cmd->command_type = kTouch;
+    memcpy(cmd->digest, hash.digest, digest_size);
+  }
+  if ((num_touch_buffer_ == kTouchBufferSize) ||
+      (now >= touch_timestamp_ + kTouchFlushInterval))
+  {
+    DoFlushTouches(now);
+  }
+  pthread_mutex_unlock(&lock_touch_buffer_);
 }
 
 
@@ -1625,18 +3045,18 @@ void Remove(const hash::Any &hash) {
   string hash_str = hash.ToString();
 
   if (limit_ != 0) {
-    int pipe_remove[2];
-    MakeReturnPipe(pipe_remove);
+    ReplyChannel channel;
+    MakeReplyChannel(&channel);
 
     LruCommand cmd;
     cmd.command_type = kRemove;
-    cmd.return_pipe = pipe_remove[1];
+    cmd.return_pipe = GetReplyTarget(channel);
     memcpy(cmd.digest, hash.digest, hash.GetDigestSize());
     WritePipe(pipe_lru_[1], &cmd, sizeof(cmd));
 
     bool success;
-    ReadHalfPipe(pipe_remove[0], &success, sizeof(success));
-    CloseReturnPipe(pipe_remove);
+    ReadReply(&channel, &success, sizeof(success));
+    CloseReplyChannel(&channel);
   }
 
   unlink(((*cache_dir_) + hash.MakePath(1, 2)).c_str());
@@ -1673,6 +3093,51 @@ static vector<string> DoList(const CommandType list_command) {
 }
 
 
+/**
+ * Lists regular files in least recently used order, starting after the access
+ * sequence number after_acseq.  At most kMaxLruListing entries are returned
+ * per call.
+ *
+ * \return False if the cache is unmanaged or the shared cache manager is too
+ *         old to support the listing
+ */
+bool ListLru(const uint64_t after_acseq, vector<LruEntry> *entries,
+             vector<string> *paths)
+{
+  entries->clear();
+  paths->clear();
+  if (!initialized_ || (limit_ == 0) || (shared_ && (protocol_revision_ < 2)))
+    return false;
+  FlushTouches();
+
+  int pipe_list[2];
+  MakeReturnPipe(pipe_list);
+  char path_buffer[kMaxCvmfsPath];
+
+  LruCommand cmd;
+  cmd.command_type = kListLru;
+  cmd.size = after_acseq;
+  cmd.return_pipe = pipe_list[1];
+  WritePipe(pipe_lru_[1], &cmd, sizeof(cmd));
+
+  uint32_t num_entries;
+  ReadHalfPipe(pipe_list[0], &num_entries, sizeof(num_entries));
+  for (unsigned i = 0; i < num_entries; ++i) {
+    LruEntry entry;
+    uint16_t length;
+    ReadPipe(pipe_list[0], &entry, sizeof(entry));
+    ReadPipe(pipe_list[0], &length, sizeof(length));
+    if (length > 0)
+      ReadPipe(pipe_list[0], path_buffer, length);
+    entries->push_back(entry);
+    paths->push_back(string(path_buffer, length));
+  }
+
+  CloseReturnPipe(pipe_list);
+  return true;
+}
+
+
 /**
  * Lists all path names from the cache db.
  */
@@ -1720,16 +3185,16 @@ static void GetStatus(uint64_t *gauge, uint64_t *pinned) {
     *pinned = 0;
     return;
   }
-  int pipe_status[2];
-  MakeReturnPipe(pipe_status);
+  ReplyChannel channel;
+  MakeReplyChannel(&channel);
 
   LruCommand cmd;
   cmd.command_type = kStatus;
-  cmd.return_pipe = pipe_status[1];
+  cmd.return_pipe = GetReplyTarget(channel);
   WritePipe(pipe_lru_[1], &cmd, sizeof(cmd));
-  ReadHalfPipe(pipe_status[0], gauge, sizeof(*gauge));
-  ReadPipe(pipe_status[0], pinned, sizeof(*pinned));
-  CloseReturnPipe(pipe_status);
+  ReadReply(&channel, gauge, sizeof(*gauge));
+  ReadReply(&channel, pinned, sizeof(*pinned));
+  CloseReplyChannel(&channel);
 }
 
 
@@ -1757,37 +3222,103 @@ static void GetLimits(uint64_t *limit, uint64_t *cleanup_threshold) {
     *cleanup_threshold = 0;
     return;
   }
-  int pipe_limits[2];
-  MakeReturnPipe(pipe_limits);
+  ReplyChannel channel;
+  MakeReplyChannel(&channel);
 
   LruCommand cmd;
   cmd.command_type = kLimits;
-  cmd.return_pipe = pipe_limits[1];
+  cmd.return_pipe = GetReplyTarget(channel);
+  WritePipe(pipe_lru_[1], &cmd, sizeof(cmd));
+  ReadReply(&channel, limit, sizeof(*limit));
+  ReadReply(&channel, cleanup_threshold, sizeof(*cleanup_threshold));
+  CloseReplyChannel(&channel);
+}
+
+/**
+ * Touch counters of this process plus the command counters of the cache
+ * manager.  The latter are unavailable from an old shared cache manager.
+ */
+Statistics GetStatistics() {
+  Statistics result;
+  if (!initialized_ || (limit_ == 0))
+    return result;
+
+  pthread_mutex_lock(&lock_touch_buffer_);
+  result = statistics_;
+  pthread_mutex_unlock(&lock_touch_buffer_);
+  if (!spawned_ || (shared_ && (protocol_revision_ < 3))) {
+    if (shared_) {
+      result.num_processed = 0;
+      result.busy_time = 0.0;
+      result.num_evicted = 0;
+      result.num_sync_cleanups = 0;
+    }
+    return result;
+  }
+
+  ReplyChannel channel;
+  MakeReplyChannel(&channel);
+
+  LruCommand cmd;
+  cmd.command_type = kStatistics;
+  cmd.return_pipe = GetReplyTarget(channel);
   WritePipe(pipe_lru_[1], &cmd, sizeof(cmd));
-  ReadHalfPipe(pipe_limits[0], limit, sizeof(*limit));
-  ReadPipe(pipe_limits[0], cleanup_threshold, sizeof(*cleanup_threshold));
-  CloseReturnPipe(pipe_limits);
+  ReadReply(&channel, &result.num_processed, sizeof(result.num_processed));
+  ReadReply(&channel, &result.busy_time, sizeof(result.busy_time));
+  if (shared_ && (protocol_revision_ < 4)) {
+    result.num_evicted = 0;
+    result.num_sync_cleanups = 0;
+  } else {
+    ReadReply(&channel, &result.num_evicted, sizeof(result.num_evicted));
+    ReadReply(&channel, &result.num_sync_cleanups,
+              sizeof(result.num_sync_cleanups));
+  }
+  CloseReplyChannel(&channel);
+  return result;
 }
 
+
 pid_t GetPid() {
   if (!initialized_ || !shared_ || !spawned_) {
     return cvmfs::pid_;
   }
 
   pid_t result;
-  int pipe_pid[2];
-  MakeReturnPipe(pipe_pid);
+  ReplyChannel channel;
+  MakeReplyChannel(&channel);
 
   LruCommand cmd;
   cmd.command_type = kPid;
-  cmd.return_pipe = pipe_pid[1];
+  cmd.return_pipe = GetReplyTarget(channel);
   WritePipe(pipe_lru_[1], &cmd, sizeof(cmd));
-  ReadHalfPipe(pipe_pid[0], &result, sizeof(result));
-  CloseReturnPipe(pipe_pid);
+  ReadReply(&channel, &result, sizeof(result));
+  CloseReplyChannel(&channel);
   return result;
 }
 
 
+/**
+ * Sends num_commands status requests to the cache manager, one after another.
+ * Running it in several mounted repositories concurrently measures the
+ * command throughput of the shared cache manager.
+ *
+ * \return round trips per second, 0 if the cache is unmanaged
+ */
+double Benchmark(const unsigned num_commands) {
+  if (!initialized_ || !spawned_ || (limit_ == 0) || (num_commands == 0))
+    return 0.0;
+
+  struct timeval start, end;
+  uint64_t gauge, size_pinned;
+  gettimeofday(&start, NULL);
+  for (unsigned i = 0; i < num_commands; ++i)
+    GetStatus(&gauge, &size_pinned);
+  gettimeofday(&end, NULL);
+  const double seconds = DiffTimeSeconds(start, end);
+  return (seconds > 0.0) ? double(num_commands) / seconds : 0.0;
+}
+
+
 string GetMemoryUsage() {
   return "TBD\n";
 /*  if (limit == 0)
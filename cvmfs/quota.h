@@ -12,16 +12,60 @@
 #include <string>
 #include <vector>
 
-namespace hash {
-struct Any;
-}
+#include "hash.h"
+#include "quota_policy.h"
 
 namespace quota {
 
+const unsigned kMaxLruListing = 256;
+
+/**
+ * A cache entry as returned by ListLru().
+ */
+struct LruEntry {
+  hash::Any hash;
+  uint64_t size;  /**< as accounted in the cache database */
+  uint64_t acseq;  /**< access sequence number */
+};
+
+/**
+ * Effect of the touch coalescing: touches issued by this process versus the
+ * touches and pipe writes that reached the cache manager, and the work done
+ * by the cache manager and its eviction thread.
+ */
+struct Statistics {
+  Statistics() {
+    num_touches = 0;
+    num_touches_forwarded = 0;
+    num_touch_writes = 0;
+    num_processed = 0;
+    busy_time = 0.0;
+    num_evicted = 0;
+    num_sync_cleanups = 0;
+    num_reply_slots = 0;
+    num_reply_pipes = 0;
+  }
+
+  std::string Print() const;
+
+  uint64_t num_touches;  /**< calls to Touch() */
+  uint64_t num_touches_forwarded;  /**< distinct touches per batch */
+  uint64_t num_touch_writes;  /**< batches written into the command pipe */
+  uint64_t num_processed;  /**< commands processed by the cache manager */
+  double busy_time;  /**< seconds the cache manager spent processing */
+  uint64_t num_evicted;  /**< files removed by the eviction thread */
+  uint64_t num_sync_cleanups;  /**< inserts that had to wait at the limit */
+  uint64_t num_reply_slots;  /**< synchronous replies through shared memory */
+  uint64_t num_reply_pipes;  /**< synchronous replies through FIFOs */
+};
+
 bool Init(const std::string &cache_dir, const uint64_t limit,
           const uint64_t cleanup_threshold, const bool rebuild_database);
 bool InitShared(const std::string &exe_path, const std::string &cache_dir,
                 const uint64_t limit, const uint64_t cleanup_threshold);
+void SetInMemory(const bool value);
+void SetPolicy(const PolicyType type);
+void SetRebuildInBackground(const bool value);
 void Spawn();
 void Fini();
 int MainCacheManager(int argc, char **argv);
@@ -40,6 +84,8 @@ void Remove(const hash::Any &file);
 std::vector<std::string> List();
 std::vector<std::string> ListPinned();
 std::vector<std::string> ListCatalogs();
+bool ListLru(const uint64_t after_acseq, std::vector<LruEntry> *entries,
+             std::vector<std::string> *paths);
 
 void RegisterBackChannel(int back_channel[2], const std::string &channel_id);
 void UnregisterBackChannel(int back_channel[2], const std::string &channel_id);
@@ -49,6 +95,8 @@ uint64_t GetCapacity();
 uint64_t GetSize();
 uint64_t GetSizePinned();
 pid_t GetPid();
+Statistics GetStatistics();
+double Benchmark(const unsigned num_commands);
 std::string GetMemoryUsage();
 
 }  // namespace quota
@@ -0,0 +1,629 @@
+/**
+ * This file is part of the CernVM File System.
+ *
+ * Snapshot and journal are only ever read by the machine that wrote them, so
+ * numbers are stored in host byte order.  Both files consist of a header
+ * followed by records:
+ *   'I' digest size acseq type path_length path  (insert or replace)
+ *   'T' digest acseq                             (touch)
+ *   'R' digest                                   (remove)
+ * The snapshot contains only 'I' records in LRU order and ends with an
+ * 'E' num_entries trailer.  A torn record at the end of the journal, left
+ * behind by a crash, is cut off on the next load.
+ */
+
+#define __STDC_LIMIT_MACROS
+#define __STDC_FORMAT_MACROS
+
+#include "cvmfs_config.h"
+#include "quota_memory.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstring>
+
+#include "logging.h"
+
+using namespace std;  // NOLINT
+
+namespace quota {
+
+const unsigned MemoryCacheCatalog::kJournalFactor;
+const uint64_t MemoryCacheCatalog::kMinJournalRecords;
+
+static const uint32_t kVersion = 1;
+static const char kMagicSnapshot[4] = {'C', 'V', 'L', 'S'};
+static const char kMagicJournal[4] = {'C', 'V', 'L', 'J'};
+static const unsigned kJournalBufferSize = 64*1024;
+
+static inline uint32_t hasher_any(const hash::Any &key) {
+  // Don't start with the first bytes, because == is using them as well
+  return (uint32_t) *(reinterpret_cast<const uint32_t *>(key.digest) + 1);
+}
+
+
+namespace {
+
+struct Record {
+  Record() : op(0), size(0), acseq(0), type(0) { }
+  char op;
+  hash::Any hash;
+  uint64_t size;
+  uint64_t acseq;
+  uint8_t type;
+  string path;
+};
+
+}  // anonymous namespace
+
+
+static void WriteHeader(const char magic[4], const uint64_t generation,
+                        FILE *f)
+{
+  fwrite(magic, 1, 4, f);
+  fwrite(&kVersion, sizeof(kVersion), 1, f);
+  fwrite(&generation, sizeof(generation), 1, f);
+}
+
+
+static bool ReadHeader(const char magic[4], FILE *f, uint64_t *generation) {
+  char buf[4];
+  uint32_t version;
+  if ((fread(buf, 1, 4, f) != 4) || (memcmp(buf, magic, 4) != 0) ||
+      (fread(&version, sizeof(version), 1, f) != 1) || (version != kVersion) ||
+      (fread(generation, sizeof(*generation), 1, f) != 1))
+  {
+    return false;
+  }
+  return true;
+}
+
+
+static void WriteInsert(const hash::Any &hash, const uint64_t size,
+                        const uint64_t acseq, const int type,
+                        const string &path, FILE *f)
+{
+  const char op = 'I';
+  const uint8_t type_byte = type;
+  const uint16_t path_length = path.length();
+  fwrite(&op, 1, 1, f);
+  fwrite(hash.digest, 1, hash::kDigestSizes[hash::kSha1], f);
+  fwrite(&size, sizeof(size), 1, f);
+  fwrite(&acseq, sizeof(acseq), 1, f);
+  fwrite(&type_byte, sizeof(type_byte), 1, f);
+  fwrite(&path_length, sizeof(path_length), 1, f);
+  fwrite(path.data(), 1, path_length, f);
+}
+
+
+/**
+ * \return False on end of file or on a truncated or unknown record
+ */
+static bool ReadRecord(FILE *f, Record *record) {
+  if (fread(&record->op, 1, 1, f) != 1)
+    return false;
+  if (record->op == 'E')
+    return fread(&record->size, sizeof(record->size), 1, f) == 1;
+
+  const unsigned digest_size = hash::kDigestSizes[hash::kSha1];
+  record->hash = hash::Any(hash::kSha1);
+  if (fread(record->hash.digest, 1, digest_size, f) != digest_size)
+    return false;
+  switch (record->op) {
+    case 'R':
+      return true;
+    case 'T':
+      return fread(&record->acseq, sizeof(record->acseq), 1, f) == 1;
+    case 'I': {
+      uint16_t path_length;
+      if ((fread(&record->size, sizeof(record->size), 1, f) != 1) ||
+          (fread(&record->acseq, sizeof(record->acseq), 1, f) != 1) ||
+          (fread(&record->type, sizeof(record->type), 1, f) != 1) ||
+          (fread(&path_length, sizeof(path_length), 1, f) != 1))
+      {
+        return false;
+      }
+      record->path.resize(path_length);
+      return (path_length == 0) ||
+             (fread(&record->path[0], 1, path_length, f) == path_length);
+    }
+    default:
+      return false;
+  }
+}
+
+
+/**
+ * @param[in] path_prefix  Snapshot and journal are path_prefix.snapshot and
+ *                         path_prefix.journal
+ */
+MemoryCacheCatalog::MemoryCacheCatalog(const string &path_prefix) {
+  path_snapshot_ = path_prefix + ".snapshot";
+  path_journal_ = path_prefix + ".journal";
+  journal_ = NULL;
+  generation_ = 0;
+  head_ = tail_ = NULL;
+  pinned_head_ = pinned_tail_ = NULL;
+  size_ = 0;
+  cursor_ = NULL;
+  index_.Init(1024, hash::Any(), hasher_any);
+}
+
+
+MemoryCacheCatalog::~MemoryCacheCatalog() {
+  if (journal_)
+    fclose(journal_);
+  Clear();
+}
+
+
+/**
+ * Removes snapshot and journal, used when the cache catalog is taken over by
+ * the SQLite database.
+ */
+void MemoryCacheCatalog::Unlink(const string &path_prefix) {
+  unlink((path_prefix + ".snapshot").c_str());
+  unlink((path_prefix + ".journal").c_str());
+}
+
+
+void MemoryCacheCatalog::Clear() {
+  Entry *lists[] = { head_, pinned_head_ };
+  for (unsigned i = 0; i < 2; ++i) {
+    Entry *entry = lists[i];
+    while (entry) {
+      Entry *next = entry->next;
+      delete entry;
+      entry = next;
+    }
+  }
+  head_ = tail_ = NULL;
+  pinned_head_ = pinned_tail_ = NULL;
+  cursor_ = NULL;
+  size_ = 0;
+  index_.Clear();
+}
+
+
+/**
+ * Appends to the LRU list or, if the entry is pinned, to the pinned list.
+ */
+void MemoryCacheCatalog::Append(Entry *entry) {
+  InsertAfter(entry->pinned ? pinned_tail_ : tail_, entry);
+}
+
+
+/**
+ * Links entry behind pred in the list given by entry->pinned; a NULL pred
+ * makes entry the new head.
+ */
+void MemoryCacheCatalog::InsertAfter(Entry *pred, Entry *entry) {
+  Entry **head = entry->pinned ? &pinned_head_ : &head_;
+  Entry **tail = entry->pinned ? &pinned_tail_ : &tail_;
+  entry->prev = pred;
+  entry->next = pred ? pred->next : *head;
+  if (entry->prev)
+    entry->prev->next = entry;
+  else
+    *head = entry;
+  if (entry->next)
+    entry->next->prev = entry;
+  else
+    *tail = entry;
+}
+
+
+void MemoryCacheCatalog::Detach(Entry *entry) {
+  Entry **head = entry->pinned ? &pinned_head_ : &head_;
+  Entry **tail = entry->pinned ? &pinned_tail_ : &tail_;
+  if (entry == cursor_)
+    cursor_ = NULL;
+  if (entry->prev)
+    entry->prev->next = entry->next;
+  else
+    *head = entry->next;
+  if (entry->next)
+    entry->next->prev = entry->prev;
+  else
+    *tail = entry->prev;
+}
+
+
+/**
+ * Merges the LRU list and the pinned list in access sequence order.  Returns
+ * the entry with the smaller acseq of *a and *b and advances that pointer.
+ */
+const MemoryCacheCatalog::Entry *MemoryCacheCatalog::NextInOrder(
+  const Entry **a, const Entry **b)
+{
+  const Entry **next;
+  if (*a == NULL)
+    next = b;
+  else if (*b == NULL)
+    next = a;
+  else
+    next = ((*a)->acseq <= (*b)->acseq) ? a : b;
+  const Entry *result = *next;
+  if (result)
+    *next = result->next;
+  return result;
+}
+
+
+const MemoryCacheCatalog::Entry *MemoryCacheCatalog::Lookup(
+  const hash::Any &hash) const
+{
+  Entry *entry;
+  if (index_.Lookup(hash, &entry))
+    return entry;
+  return NULL;
+}
+
+
+/**
+ * Access sequence numbers are handed out in increasing order, so the new or
+ * touched entry always goes to the tail of its list.
+ */
+void MemoryCacheCatalog::DoInsert(const hash::Any &hash, const uint64_t size,
+                                  const uint64_t acseq, const string &path,
+                                  const int type, const bool pinned)
+{
+  Entry *entry;
+  if (index_.Lookup(hash, &entry)) {
+    Detach(entry);
+    size_ -= entry->size;
+  } else {
+    entry = new Entry();
+    entry->hash = hash;
+    index_.Insert(hash, entry);
+  }
+  entry->size = size;
+  entry->acseq = acseq;
+  entry->path = path;
+  entry->type = type;
+  entry->pinned = pinned;
+  size_ += size;
+  Append(entry);
+}
+
+
+bool MemoryCacheCatalog::DoTouch(const hash::Any &hash, const uint64_t acseq) {
+  Entry *entry;
+  if (!index_.Lookup(hash, &entry))
+    return false;
+  Detach(entry);
+  entry->acseq = acseq;
+  Append(entry);
+  return true;
+}
+
+
+bool MemoryCacheCatalog::DoRemove(const hash::Any &hash) {
+  Entry *entry;
+  if (!index_.Lookup(hash, &entry))
+    return false;
+  Detach(entry);
+  index_.Erase(hash);
+  size_ -= entry->size;
+  delete entry;
+  return true;
+}
+
+
+void MemoryCacheCatalog::Insert(const hash::Any &hash, const uint64_t size,
+                                const uint64_t acseq, const string &path,
+                                const int type, const bool pinned)
+{
+  const string journal_path = path.substr(0, UINT16_MAX);
+  DoInsert(hash, size, acseq, journal_path, type, pinned);
+  if (journal_) {
+    WriteInsert(hash, size, acseq, type, journal_path, journal_);
+    statistics_.num_journal_records++;
+  }
+}
+
+
+bool MemoryCacheCatalog::Touch(const hash::Any &hash, const uint64_t acseq) {
+  if (!DoTouch(hash, acseq))
+    return false;
+  if (journal_) {
+    const char op = 'T';
+    fwrite(&op, 1, 1, journal_);
+    fwrite(hash.digest, 1, hash::kDigestSizes[hash::kSha1], journal_);
+    fwrite(&acseq, sizeof(acseq), 1, journal_);
+    statistics_.num_journal_records++;
+  }
+  return true;
+}
+
+
+/**
+ * Moves the entry back into the LRU list at the position of its access
+ * sequence number.  Pinned entries are usually in use, so the search from the
+ * tail is short.
+ */
+bool MemoryCacheCatalog::Unpin(const hash::Any &hash) {
+  Entry *entry;
+  if (!index_.Lookup(hash, &entry))
+    return false;
+  if (!entry->pinned)
+    return true;
+  Detach(entry);
+  entry->pinned = false;
+  Entry *pred = tail_;
+  while (pred && (pred->acseq > entry->acseq))
+    pred = pred->prev;
+  InsertAfter(pred, entry);
+  return true;
+}
+
+
+bool MemoryCacheCatalog::Remove(const hash::Any &hash) {
+  if (!DoRemove(hash))
+    return false;
+  if (journal_) {
+    const char op = 'R';
+    fwrite(&op, 1, 1, journal_);
+    fwrite(hash.digest, 1, hash::kDigestSizes[hash::kSha1], journal_);
+    statistics_.num_journal_records++;
+  }
+  return true;
+}
+
+
+/**
+ * The least recently used entry that is not pinned, NULL if there is none.
+ * Pinned entries are kept in a separate list, so this is the head of the LRU
+ * list.
+ */
+const MemoryCacheCatalog::Entry *MemoryCacheCatalog::GetLru() const {
+  return head_;
+}
+
+
+/**
+ * Collects up to max_entries entries of the given type with an access
+ * sequence number larger than after_acseq, in LRU order.  Pinned entries are
+ * included.
+ */
+void MemoryCacheCatalog::ListAfter(const uint64_t after_acseq, const int type,
+                                   const unsigned max_entries,
+                                   vector<const Entry *> *entries)
+{
+  const Entry *entry = head_;
+  if (cursor_ && (cursor_->acseq <= after_acseq))
+    entry = cursor_;
+  while (entry && (entry->acseq <= after_acseq))
+    entry = entry->next;
+  const Entry *pinned = pinned_head_;
+  while (pinned && (pinned->acseq <= after_acseq))
+    pinned = pinned->next;
+
+  while (entries->size() < max_entries) {
+    const Entry *next = NextInOrder(&entry, &pinned);
+    if (next == NULL)
+      break;
+    if (next->type != type)
+      continue;
+    entries->push_back(next);
+    if (!next->pinned)
+      cursor_ = next;
+  }
+}
+
+
+/**
+ * Flushes the journal.  Folds the journal into a new snapshot if it became
+ * too long.
+ */
+void MemoryCacheCatalog::Sync() {
+  if (!journal_)
+    return;
+  const uint64_t threshold = static_cast<uint64_t>(kJournalFactor) *
+                             num_entries();
+  if ((statistics_.num_journal_records > kMinJournalRecords) &&
+      (statistics_.num_journal_records > threshold))
+  {
+    WriteSnapshot();
+    return;
+  }
+  if (fflush(journal_) != 0) {
+    LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
+             "failed to write LRU journal %s (%d)", path_journal_.c_str(),
+             errno);
+  }
+}
+
+
+/**
+ * Writes the current state to a new snapshot and starts an empty journal.
+ * Both files are first written to a temporary file and then renamed.
+ */
+bool MemoryCacheCatalog::WriteSnapshot() {
+  const string path_tmp = path_snapshot_ + ".tmp";
+  FILE *f = fopen(path_tmp.c_str(), "w");
+  if (f == NULL) {
+    LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
+             "failed to create LRU snapshot %s (%d)", path_tmp.c_str(), errno);
+    return false;
+  }
+  const uint64_t generation = generation_ + 1;
+  WriteHeader(kMagicSnapshot, generation, f);
+  const Entry *lru = head_;
+  const Entry *pinned = pinned_head_;
+  const Entry *entry;
+  while ((entry = NextInOrder(&lru, &pinned)) != NULL) {
+    WriteInsert(entry->hash, entry->size, entry->acseq, entry->type,
+                entry->path, f);
+  }
+  const char op = 'E';
+  const uint64_t num = num_entries();
+  fwrite(&op, 1, 1, f);
+  fwrite(&num, sizeof(num), 1, f);
+  if ((fflush(f) != 0) || (ferror(f) != 0) || (fsync(fileno(f)) != 0)) {
+    LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
+             "failed to write LRU snapshot %s (%d)", path_tmp.c_str(), errno);
+    fclose(f);
+    unlink(path_tmp.c_str());
+    return false;
+  }
+  fclose(f);
+  if (rename(path_tmp.c_str(), path_snapshot_.c_str()) != 0) {
+    unlink(path_tmp.c_str());
+    return false;
+  }
+
+  // From here on, the old journal does not match the snapshot anymore
+  generation_ = generation;
+  statistics_.num_snapshots++;
+  LogCvmfs(kLogQuota, kLogDebug,
+           "wrote LRU snapshot generation %"PRIu64" with %u entries",
+           generation_, num_entries());
+  return StartJournal();
+}
+
+
+bool MemoryCacheCatalog::StartJournal() {
+  if (journal_) {
+    fclose(journal_);
+    journal_ = NULL;
+  }
+  statistics_.num_journal_records = 0;
+
+  const string path_tmp = path_journal_ + ".tmp";
+  FILE *f = fopen(path_tmp.c_str(), "w");
+  if (f == NULL) {
+    LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
+             "failed to create LRU journal %s (%d)", path_tmp.c_str(), errno);
+    return false;
+  }
+  WriteHeader(kMagicJournal, generation_, f);
+  if ((fflush(f) != 0) || (rename(path_tmp.c_str(),
+                                  path_journal_.c_str()) != 0))
+  {
+    fclose(f);
+    unlink(path_tmp.c_str());
+    return false;
+  }
+  journal_ = f;
+  setvbuf(journal_, NULL, _IOFBF, kJournalBufferSize);
+  return true;
+}
+
+
+bool MemoryCacheCatalog::ReadSnapshot() {
+  FILE *f = fopen(path_snapshot_.c_str(), "r");
+  if (f == NULL)
+    return false;
+  if (!ReadHeader(kMagicSnapshot, f, &generation_)) {
+    fclose(f);
+    return false;
+  }
+
+  Record record;
+  bool complete = false;
+  while (ReadRecord(f, &record)) {
+    if (record.op == 'E') {
+      complete = (record.size == num_entries());
+      break;
+    }
+    if (record.op != 'I')
+      break;
+    DoInsert(record.hash, record.size, record.acseq, record.path, record.type,
+             false);
+  }
+  fclose(f);
+  return complete;
+}
+
+
+/**
+ * Applies the journal records on top of the loaded snapshot.  Stops at the
+ * first incomplete record.
+ *
+ * @param[out] valid_size  Length of the journal up to the last full record
+ * \return False if the journal does not belong to the snapshot
+ */
+bool MemoryCacheCatalog::Replay(uint64_t *valid_size) {
+  FILE *f = fopen(path_journal_.c_str(), "r");
+  if (f == NULL)
+    return false;
+  uint64_t generation;
+  if (!ReadHeader(kMagicJournal, f, &generation) ||
+      (generation != generation_))
+  {
+    fclose(f);
+    return false;
+  }
+  setvbuf(f, NULL, _IOFBF, kJournalBufferSize);
+
+  Record record;
+  *valid_size = ftell(f);
+  while (ReadRecord(f, &record)) {
+    switch (record.op) {
+      case 'I':
+        DoInsert(record.hash, record.size, record.acseq, record.path,
+                 record.type, false);
+        break;
+      case 'T':
+        DoTouch(record.hash, record.acseq);
+        break;
+      case 'R':
+        DoRemove(record.hash);
+        break;
+      default:
+        // An 'E' trailer is not valid in the journal
+        fclose(f);
+        return true;
+    }
+    statistics_.num_replayed++;
+    *valid_size = ftell(f);
+  }
+  fclose(f);
+  return true;
+}
+
+
+/**
+ * Loads snapshot and journal and opens the journal for appending.
+ *
+ * \return False if there is no usable snapshot, in which case the catalog has
+ * to be rebuilt
+ */
+bool MemoryCacheCatalog::Load() {
+  Clear();
+  statistics_ = Statistics();
+  if (!ReadSnapshot()) {
+    LogCvmfs(kLogQuota, kLogDebug, "no valid LRU snapshot in %s",
+             path_snapshot_.c_str());
+    Clear();
+    return false;
+  }
+
+  uint64_t valid_size = 0;
+  if (!Replay(&valid_size)) {
+    LogCvmfs(kLogQuota, kLogDebug, "no LRU journal for generation %"PRIu64,
+             generation_);
+    return StartJournal();
+  }
+  LogCvmfs(kLogQuota, kLogDebug,
+           "loaded LRU snapshot generation %"PRIu64", %u entries, "
+           "%"PRIu64" journal records", generation_, num_entries(),
+           statistics_.num_replayed);
+
+  // Cut off a torn record and continue the journal
+  if (truncate(path_journal_.c_str(), valid_size) != 0)
+    return StartJournal();
+  journal_ = fopen(path_journal_.c_str(), "a");
+  if (journal_ == NULL)
+    return StartJournal();
+  setvbuf(journal_, NULL, _IOFBF, kJournalBufferSize);
+  statistics_.num_journal_records = statistics_.num_replayed;
+  return true;
+}
+
+}  // namespace quota
@@ -0,0 +1,133 @@
+/**
+ * This file is part of the CernVM File System.
+ *
+ * An alternative to the SQLite cache catalog of the quota manager.  The LRU
+ * order is kept in memory as an intrusive doubly linked list sorted by access
+ * sequence number; a hash table maps content hashes to list entries.  Touching
+ * an entry moves it to the tail of the list, the cleanup takes entries from
+ * the head.  Pinned entries are kept in a second list of the same kind, so
+ * that the cleanup does not have to skip them.
+ *
+ * Persistence is by a compact snapshot of the list plus an append-only
+ * journal of all inserts, touches, and removals since the snapshot.  On
+ * restart, the snapshot is loaded and the journal is replayed.  Once the
+ * journal grows large compared to the number of entries, a new snapshot is
+ * written and the journal starts over.
+ *
+ * Pin flags are not persisted; they are reset on every start of the quota
+ * manager anyway.
+ */
+
+#ifndef CVMFS_QUOTA_MEMORY_H_
+#define CVMFS_QUOTA_MEMORY_H_
+
+#include <stdint.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "hash.h"
+#include "smallhash.h"
+#include "util.h"
+
+namespace quota {
+
+class MemoryCacheCatalog : SingleCopy {
+ public:
+  struct Entry {
+    hash::Any hash;
+    uint64_t size;
+    uint64_t acseq;
+    std::string path;
+    int type;
+    bool pinned;
+    Entry *prev;
+    Entry *next;
+  };
+
+  struct Statistics {
+    Statistics() {
+      num_journal_records = 0;
+      num_snapshots = 0;
+      num_replayed = 0;
+    }
+    uint64_t num_journal_records;  /**< since the last snapshot */
+    uint64_t num_snapshots;
+    uint64_t num_replayed;  /**< journal records applied by the last Load() */
+  };
+
+  /**
+   * Journal records are replayed on restart.  Once there are more records
+   * than kJournalFactor times the number of entries (but at least
+   * kMinJournalRecords), the journal is folded into a new snapshot.
+   */
+  static const unsigned kJournalFactor = 2;
+  static const uint64_t kMinJournalRecords = 100000;
+
+  explicit MemoryCacheCatalog(const std::string &path_prefix);
+  ~MemoryCacheCatalog();
+
+  bool Load();
+  bool WriteSnapshot();
+  void Sync();
+  void Clear();
+  static void Unlink(const std::string &path_prefix);
+
+  const Entry *Lookup(const hash::Any &hash) const;
+  void Insert(const hash::Any &hash, const uint64_t size, const uint64_t acseq,
+              const std::string &path, const int type, const bool pinned);
+  bool Touch(const hash::Any &hash, const uint64_t acseq);
+  bool Unpin(const hash::Any &hash);
+  bool Remove(const hash::Any &hash);
+  const Entry *GetLru() const;
+  void ListAfter(const uint64_t after_acseq, const int type,
+                 const unsigned max_entries,
+                 std::vector<const Entry *> *entries);
+
+  const Entry *head() const { return head_; }
+  const Entry *pinned_head() const { return pinned_head_; }
+  uint64_t size() const { return size_; }
+  uint64_t max_acseq() const {
+    const uint64_t lru = (tail_ == NULL) ? 0 : tail_->acseq;
+    const uint64_t pinned = (pinned_tail_ == NULL) ? 0 : pinned_tail_->acseq;
+    return (lru > pinned) ? lru : pinned;
+  }
+  uint32_t num_entries() const { return index_.size(); }
+  Statistics statistics() const { return statistics_; }
+
+ private:
+  void Append(Entry *entry);
+  void InsertAfter(Entry *pred, Entry *entry);
+  void Detach(Entry *entry);
+  static const Entry *NextInOrder(const Entry **a, const Entry **b);
+  void DoInsert(const hash::Any &hash, const uint64_t size,
+                const uint64_t acseq, const std::string &path, const int type,
+                const bool pinned);
+  bool DoTouch(const hash::Any &hash, const uint64_t acseq);
+  bool DoRemove(const hash::Any &hash);
+  bool ReadSnapshot();
+  bool Replay(uint64_t *valid_size);
+  bool StartJournal();
+
+  std::string path_snapshot_;
+  std::string path_journal_;
+  FILE *journal_;
+  uint64_t generation_;
+  SmallHashDynamic<hash::Any, Entry *> index_;
+  Entry *head_;  /**< LRU list of the entries that are not pinned */
+  Entry *tail_;
+  Entry *pinned_head_;
+  Entry *pinned_tail_;
+  uint64_t size_;
+  /**
+   * Last entry returned by ListAfter().  Listings usually continue where the
+   * previous one stopped, which saves a scan from the head of the list.
+   */
+  const Entry *cursor_;
+  Statistics statistics_;
+};
+
+}  // namespace quota
+
+#endif  // CVMFS_QUOTA_MEMORY_H_
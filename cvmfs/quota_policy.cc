@@ -0,0 +1,324 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include "cvmfs_config.h"
+#include "quota_policy.h"
+
+#include <cassert>
+#include <cstdlib>
+
+using namespace std;  // NOLINT
+
+namespace quota {
+
+const unsigned TwoQueuePolicy::kInPercent;
+const unsigned TwoQueuePolicy::kOutPercent;
+
+
+ReplacementPolicy *ReplacementPolicy::Create(const PolicyType type,
+                                             const uint64_t capacity)
+{
+  switch (type) {
+    case kPolicyLru:
+      return new LruPolicy();
+    case kPolicy2Q:
+      return new TwoQueuePolicy(capacity);
+    case kPolicyGdsf:
+      return new GdsfPolicy();
+    default:
+      abort();
+  }
+}
+
+
+bool ReplacementPolicy::ParseType(const string &name, PolicyType *type) {
+  const string upper = ToUpper(name);
+  if (upper == "LRU")
+    *type = kPolicyLru;
+  else if (upper == "2Q")
+    *type = kPolicy2Q;
+  else if (upper == "GDSF")
+    *type = kPolicyGdsf;
+  else
+    return false;
+  return true;
+}
+
+
+string ReplacementPolicy::GetName(const PolicyType type) {
+  switch (type) {
+    case kPolicyLru:
+      return "lru";
+    case kPolicy2Q:
+      return "2q";
+    case kPolicyGdsf:
+      return "gdsf";
+    default:
+      return "unknown";
+  }
+}
+
+
+//------------------------------------------------------------------------------
+
+
+void LruPolicy::Insert(const hash::Any &hash,
+                       const uint64_t size __attribute__((unused)))
+{
+  if (index_.find(hash) != index_.end()) {
+    Touch(hash);
+    return;
+  }
+  index_[hash] = queue_.insert(queue_.end(), hash);
+}
+
+
+void LruPolicy::Touch(const hash::Any &hash) {
+  map<hash::Any, Queue::iterator>::iterator iter = index_.find(hash);
+  if (iter == index_.end())
+    return;
+  queue_.splice(queue_.end(), queue_, iter->second);
+}
+
+
+void LruPolicy::Remove(const hash::Any &hash) {
+  map<hash::Any, Queue::iterator>::iterator iter = index_.find(hash);
+  if (iter == index_.end())
+    return;
+  queue_.erase(iter->second);
+  index_.erase(iter);
+}
+
+
+bool LruPolicy::GetVictim(hash::Any *hash) const {
+  if (queue_.empty())
+    return false;
+  *hash = queue_.front();
+  return true;
+}
+
+
+//------------------------------------------------------------------------------
+
+
+TwoQueuePolicy::TwoQueuePolicy(const uint64_t capacity) {
+  max_in_size_ = capacity / 100 * kInPercent;
+  max_out_size_ = capacity / 100 * kOutPercent;
+  in_size_ = 0;
+  out_size_ = 0;
+}
+
+
+void TwoQueuePolicy::Insert(const hash::Any &hash, const uint64_t size) {
+  if (index_.find(hash) != index_.end()) {
+    Touch(hash);
+    return;
+  }
+
+  Entry entry;
+  entry.size = size;
+  map<hash::Any, Ghost>::iterator ghost = ghosts_.find(hash);
+  if (ghost != ghosts_.end()) {
+    // Seen before, promote to the main queue
+    out_size_ -= ghost->second.size;
+    out_.erase(ghost->second.position);
+    ghosts_.erase(ghost);
+    entry.in_main = true;
+    entry.position = main_.insert(main_.end(), hash);
+  } else {
+    entry.in_main = false;
+    entry.position = in_.insert(in_.end(), hash);
+    in_size_ += size;
+  }
+  index_[hash] = entry;
+}
+
+
+/**
+ * Hits in the FIFO queue are considered correlated references and do not
+ * change the order.
+ */
+void TwoQueuePolicy::Touch(const hash::Any &hash) {
+  map<hash::Any, Entry>::iterator iter = index_.find(hash);
+  if ((iter == index_.end()) || !iter->second.in_main)
+    return;
+  main_.splice(main_.end(), main_, iter->second.position);
+}
+
+
+void TwoQueuePolicy::Remove(const hash::Any &hash) {
+  map<hash::Any, Entry>::iterator iter = index_.find(hash);
+  if (iter == index_.end())
+    return;
+
+  if (iter->second.in_main) {
+    main_.erase(iter->second.position);
+  } else {
+    in_.erase(iter->second.position);
+    in_size_ -= iter->second.size;
+  }
+  index_.erase(iter);
+}
+
+
+/**
+ * Files evicted from the FIFO queue are remembered as ghosts.  Removed or
+ * pinned files are not, they have not been pushed out by other files.
+ */
+void TwoQueuePolicy::Evict(const hash::Any &hash) {
+  map<hash::Any, Entry>::iterator iter = index_.find(hash);
+  if (iter == index_.end())
+    return;
+
+  if (!iter->second.in_main) {
+    Ghost ghost;
+    ghost.size = iter->second.size;
+    ghost.position = out_.insert(out_.end(), hash);
+    ghosts_[hash] = ghost;
+    out_size_ += ghost.size;
+  }
+  Remove(hash);
+  TrimGhosts();
+}
+
+
+void TwoQueuePolicy::TrimGhosts() {
+  while ((out_size_ > max_out_size_) && !out_.empty()) {
+    map<hash::Any, Ghost>::iterator ghost = ghosts_.find(out_.front());
+    assert(ghost != ghosts_.end());
+    out_size_ -= ghost->second.size;
+    ghosts_.erase(ghost);
+    out_.pop_front();
+  }
+}
+
+
+bool TwoQueuePolicy::GetVictim(hash::Any *hash) const {
+  if (!in_.empty() && ((in_size_ > max_in_size_) || main_.empty())) {
+    *hash = in_.front();
+    return true;
+  }
+  if (!main_.empty()) {
+    *hash = main_.front();
+    return true;
+  }
+  return false;
+}
+
+
+//------------------------------------------------------------------------------
+
+
+void GdsfPolicy::Prioritize(const hash::Any &hash, Entry *entry) {
+  queue_.erase(Key(entry->priority, hash));
+  const uint64_t size = (entry->size > 0) ? entry->size : 1;
+  entry->priority = inflation_ + double(entry->frequency) / double(size);
+  queue_.insert(Key(entry->priority, hash));
+}
+
+
+void GdsfPolicy::Insert(const hash::Any &hash, const uint64_t size) {
+  map<hash::Any, Entry>::iterator iter = index_.find(hash);
+  if (iter != index_.end()) {
+    Touch(hash);
+    return;
+  }
+
+  Entry entry;
+  entry.size = size;
+  entry.frequency = 1;
+  entry.priority = -1.0;
+  Prioritize(hash, &entry);
+  index_[hash] = entry;
+}
+
+
+void GdsfPolicy::Touch(const hash::Any &hash) {
+  map<hash::Any, Entry>::iterator iter = index_.find(hash);
+  if (iter == index_.end())
+    return;
+  iter->second.frequency++;
+  Prioritize(hash, &iter->second);
+}
+
+
+void GdsfPolicy::Remove(const hash::Any &hash) {
+  map<hash::Any, Entry>::iterator iter = index_.find(hash);
+  if (iter == index_.end())
+    return;
+
+  queue_.erase(Key(iter->second.priority, hash));
+  index_.erase(iter);
+}
+
+
+/**
+ * Only evictions age the other files.
+ */
+void GdsfPolicy::Evict(const hash::Any &hash) {
+  map<hash::Any, Entry>::iterator iter = index_.find(hash);
+  if (iter == index_.end())
+    return;
+  inflation_ = iter->second.priority;
+  Remove(hash);
+}
+
+
+bool GdsfPolicy::GetVictim(hash::Any *hash) const {
+  if (queue_.empty())
+    return false;
+  *hash = queue_.begin()->second;
+  return true;
+}
+
+
+//------------------------------------------------------------------------------
+
+
+CacheSimulator::CacheSimulator(const PolicyType type, const uint64_t capacity) {
+  policy_ = ReplacementPolicy::Create(type, capacity);
+  capacity_ = capacity;
+  size_ = 0;
+  num_accesses_ = 0;
+  num_hits_ = 0;
+  bytes_accessed_ = 0;
+  bytes_hit_ = 0;
+  num_evictions_ = 0;
+}
+
+
+CacheSimulator::~CacheSimulator() {
+  delete policy_;
+}
+
+
+void CacheSimulator::Access(const hash::Any &hash, const uint64_t size) {
+  num_accesses_++;
+  bytes_accessed_ += size;
+  if (cached_.find(hash) != cached_.end()) {
+    num_hits_++;
+    bytes_hit_ += size;
+    policy_->Touch(hash);
+    return;
+  }
+
+  if (size > capacity_)
+    return;
+  while (size_ + size > capacity_) {
+    hash::Any victim;
+    const bool retval = policy_->GetVictim(&victim);
+    assert(retval);
+    map<hash::Any, uint64_t>::iterator iter = cached_.find(victim);
+    assert(iter != cached_.end());
+    size_ -= iter->second;
+    cached_.erase(iter);
+    policy_->Evict(victim);
+    num_evictions_++;
+  }
+  cached_[hash] = size;
+  size_ += size;
+  policy_->Insert(hash, size);
+}
+
+}  // namespace quota
@@ -0,0 +1,202 @@
+/**
+ * This file is part of the CernVM File System.
+ *
+ * Replacement policies for the quota manager.  By default, the quota manager
+ * evicts the least recently used files as given by the access sequence
+ * numbers in the cache catalog.  A replacement policy can take over the
+ * choice of the victim; it is fed with all inserts, hits, and removals of
+ * unpinned files.
+ *
+ *  - 2Q keeps files that are accessed only once in a small FIFO queue.  Only
+ *    files that are accessed again after they have been evicted from the
+ *    FIFO queue are promoted to the main LRU queue.  A one-off scan of a large
+ *    data set thus cannot flush the frequently used files.
+ *  - GDSF (GreedyDual-Size-Frequency) evicts the file with the smallest
+ *    frequency / size ratio, aged by an inflation value.  It favors many
+ *    small, frequently used files over a few large ones.
+ *
+ * The policy state is not persisted.  On start, it is filled from the cache
+ * catalog in LRU order with all frequencies set to one.
+ *
+ * The CacheSimulator replays a sequence of accesses against a policy; it is
+ * used by cvmfs_cachesim to compare the policies on tracer logs.
+ */
+
+#ifndef CVMFS_QUOTA_POLICY_H_
+#define CVMFS_QUOTA_POLICY_H_
+
+#include <stdint.h>
+
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+
+#include "hash.h"
+#include "util.h"
+
+namespace quota {
+
+enum PolicyType {
+  kPolicyLru = 0,
+  kPolicy2Q,
+  kPolicyGdsf,
+};
+
+
+class ReplacementPolicy : SingleCopy {
+ public:
+  static ReplacementPolicy *Create(const PolicyType type,
+                                   const uint64_t capacity);
+  static bool ParseType(const std::string &name, PolicyType *type);
+  static std::string GetName(const PolicyType type);
+
+  virtual ~ReplacementPolicy() { }
+  virtual PolicyType type() const = 0;
+  /**
+   * Adds a file that is not yet known.  For a known file, this is a hit.
+   */
+  virtual void Insert(const hash::Any &hash, const uint64_t size) = 0;
+  virtual void Touch(const hash::Any &hash) = 0;
+  /**
+   * Called for files that are removed or pinned.  Unknown files are ignored.
+   */
+  virtual void Remove(const hash::Any &hash) = 0;
+  /**
+   * Called for the victims that are actually evicted.  Only evictions feed
+   * the policy's history.
+   */
+  virtual void Evict(const hash::Any &hash) { Remove(hash); }
+  /**
+   * The file that should be evicted next.  It stays known to the policy
+   * until it is removed.
+   */
+  virtual bool GetVictim(hash::Any *hash) const = 0;
+  virtual uint64_t num_entries() const = 0;
+};
+
+
+class LruPolicy : public ReplacementPolicy {
+ public:
+  PolicyType type() const { return kPolicyLru; }
+  void Insert(const hash::Any &hash, const uint64_t size);
+  void Touch(const hash::Any &hash);
+  void Remove(const hash::Any &hash);
+  bool GetVictim(hash::Any *hash) const;
+  uint64_t num_entries() const { return index_.size(); }
+
+ private:
+  typedef std::list<hash::Any> Queue;
+  Queue queue_;
+  std::map<hash::Any, Queue::iterator> index_;
+};
+
+
+class TwoQueuePolicy : public ReplacementPolicy {
+ public:
+  /**
+   * The FIFO queue for new files may take kInPercent of the capacity.  Hashes
+   * of files evicted from it are remembered as long as their sizes add up to
+   * less than kOutPercent of the capacity.
+   */
+  static const unsigned kInPercent = 25;
+  static const unsigned kOutPercent = 50;
+
+  explicit TwoQueuePolicy(const uint64_t capacity);
+  PolicyType type() const { return kPolicy2Q; }
+  void Insert(const hash::Any &hash, const uint64_t size);
+  void Touch(const hash::Any &hash);
+  void Remove(const hash::Any &hash);
+  void Evict(const hash::Any &hash);
+  bool GetVictim(hash::Any *hash) const;
+  uint64_t num_entries() const { return index_.size(); }
+
+ private:
+  typedef std::list<hash::Any> Queue;
+  struct Entry {
+    Queue::iterator position;
+    uint64_t size;
+    bool in_main;  /**< in the main LRU queue, otherwise in the FIFO queue */
+  };
+  struct Ghost {
+    Queue::iterator position;
+    uint64_t size;
+  };
+
+  void TrimGhosts();
+
+  uint64_t max_in_size_;
+  uint64_t max_out_size_;
+  uint64_t in_size_;
+  uint64_t out_size_;
+  Queue in_;
+  Queue main_;
+  Queue out_;
+  std::map<hash::Any, Entry> index_;
+  std::map<hash::Any, Ghost> ghosts_;
+};
+
+
+class GdsfPolicy : public ReplacementPolicy {
+ public:
+  GdsfPolicy() : inflation_(0.0) { }
+  PolicyType type() const { return kPolicyGdsf; }
+  void Insert(const hash::Any &hash, const uint64_t size);
+  void Touch(const hash::Any &hash);
+  void Remove(const hash::Any &hash);
+  void Evict(const hash::Any &hash);
+  bool GetVictim(hash::Any *hash) const;
+  uint64_t num_entries() const { return index_.size(); }
+
+ private:
+  typedef std::pair<double, hash::Any> Key;
+  struct Entry {
+    uint64_t size;
+    uint64_t frequency;
+    double priority;
+  };
+
+  void Prioritize(const hash::Any &hash, Entry *entry);
+
+  /**
+   * Priority of the last evicted file, added to the priority of touched
+   * files.  Files that are not touched anymore eventually become victims.
+   */
+  double inflation_;
+  std::map<hash::Any, Entry> index_;
+  std::set<Key> queue_;
+};
+
+
+/**
+ * Replays accesses to files against a replacement policy with a fixed cache
+ * capacity.  Files larger than the capacity are never cached.
+ */
+class CacheSimulator : SingleCopy {
+ public:
+  CacheSimulator(const PolicyType type, const uint64_t capacity);
+  ~CacheSimulator();
+  void Access(const hash::Any &hash, const uint64_t size);
+
+  uint64_t num_accesses() const { return num_accesses_; }
+  uint64_t num_hits() const { return num_hits_; }
+  uint64_t bytes_accessed() const { return bytes_accessed_; }
+  uint64_t bytes_hit() const { return bytes_hit_; }
+  uint64_t num_evictions() const { return num_evictions_; }
+
+ private:
+  ReplacementPolicy *policy_;
+  uint64_t capacity_;
+  uint64_t size_;
+  std::map<hash::Any, uint64_t> cached_;
+  uint64_t num_accesses_;
+  uint64_t num_hits_;
+  uint64_t bytes_accessed_;
+  uint64_t bytes_hit_;
+  uint64_t num_evictions_;
+};
+
+}  // namespace quota
+
+#endif  // CVMFS_QUOTA_POLICY_H_
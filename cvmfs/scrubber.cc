@@ -0,0 +1,504 @@
+/**
+ * This file is part of the CernVM File System.
+ *
+ * The scrubber verifies the content hashes of the files in the local cache
+ * while the file system is mounted.  It walks through the cache in least
+ * recently used order, as given by the cache database, so that files that
+ * are about to be evicted anyway are checked last.  Each file is read and
+ * recompressed in small steps; between the steps, the scrubber sleeps long
+ * enough to stay below the configured I/O rate and CPU share.
+ *
+ * Corrupted files are moved into the quarantaine directory and removed from
+ * the cache database, so that they are downloaded again on the next access.
+ * The position of the walk is stored in the cache directory and survives
+ * remounts.  In case of a shared cache, only one instance scrubs.
+ */
+
+#define __STDC_FORMAT_MACROS
+
+#include "cvmfs_config.h"
+#include "scrubber.h"
+
+#include <alloca.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "atomic.h"
+#include "blockfile.h"
+#include "compression.h"
+#include "hash.h"
+#include "logging.h"
+#include "platform.h"
+#include "quota.h"
+#include "smalloc.h"
+#include "util.h"
+
+using namespace std;  // NOLINT
+
+namespace scrubber {
+
+const unsigned kReadSize = 64*1024;
+const unsigned kZChunk = 16384;
+const unsigned kMaxFindings = 32;
+const unsigned kSaveInterval = 30;  /**< seconds between progress updates */
+
+/**
+ * Outcome of the verification of a single file.
+ */
+enum Verdict {
+  kVerdictOk = 0,
+  kVerdictCorrupted,
+  kVerdictVanished,
+  kVerdictIoError,
+  kVerdictTerminated,
+};
+
+string *cache_path_ = NULL;
+uint64_t max_rate_ = 0;  /**< bytes per second, 0 means unlimited */
+unsigned max_cpu_ = 100;  /**< percent of the time spent verifying */
+unsigned pass_interval_ = 0;  /**< seconds between two walks */
+int fd_lockfile_ = -1;
+bool spawned_ = false;
+pthread_t thread_scrubber_;
+atomic_int32 terminate_;
+
+pthread_mutex_t lock_statistics_ = PTHREAD_MUTEX_INITIALIZER;
+Statistics statistics_;  /**< protected by lock_statistics_ */
+deque<string> *findings_ = NULL;  /**< protected by lock_statistics_ */
+
+
+string Statistics::Print() const {
+  string result = string("Scrubber ") + (running ? "running" : "stopped") +
+    ", pass " + StringifyInt(pass) + ", position " + StringifyInt(position) +
+    "\n";
+  result += "verified: " + StringifyInt(num_verified) + " files, " +
+            StringifyInt(bytes_verified / (1024*1024)) + "MB\n";
+  const uint64_t rate = (elapsed > 0.0) ?
+    static_cast<uint64_t>(static_cast<double>(bytes_verified) / elapsed) : 0;
+  const double file_rate = (elapsed > 0.0) ?
+    static_cast<double>(num_verified) / elapsed : 0.0;
+  result += "rate: " + StringifyInt(rate / 1024) + "kB/s, " +
+            StringifyDouble(file_rate) + " files/s\n";
+  result += "corrupted: " + StringifyInt(num_corrupted) +
+            " (quarantined: " + StringifyInt(num_quarantined) + ")  " +
+            "read errors: " + StringifyInt(num_errors) + "  " +
+            "evicted before check: " + StringifyInt(num_vanished) + "\n";
+  return result;
+}
+
+
+static string GetProgressPath() {
+  return *cache_path_ + "/scrubber.progress";
+}
+
+
+static void LoadProgress(uint64_t *position, uint64_t *pass) {
+  *position = 0;
+  *pass = 0;
+  FILE *f = fopen(GetProgressPath().c_str(), "r");
+  if (!f)
+    return;
+  string line;
+  if (GetLineFile(f, &line)) {
+    vector<string> fields = SplitString(line, ' ');
+    if (fields.size() == 2) {
+      *position = String2Uint64(fields[0]);
+      *pass = String2Uint64(fields[1]);
+    }
+  }
+  fclose(f);
+  LogCvmfs(kLogCache, kLogDebug, "scrubber resumes at %"PRIu64" (pass %"
+           PRIu64")", *position, *pass);
+}
+
+
+static void SaveProgress(const uint64_t position, const uint64_t pass) {
+  const string path = GetProgressPath();
+  const string tmp_path = path + ".tmp";
+  FILE *f = fopen(tmp_path.c_str(), "w");
+  if (!f)
+    return;
+  const string line = StringifyInt(position) + " " + StringifyInt(pass) + "\n";
+  const bool written = (fwrite(line.data(), 1, line.length(), f) ==
+                        line.length());
+  fclose(f);
+  if (!written || (rename(tmp_path.c_str(), path.c_str()) != 0))
+    unlink(tmp_path.c_str());
+}
+
+
+static void AddFinding(const quota::LruEntry &entry, const string &path,
+                       const string &what)
+{
+  const string finding = StringifyTime(time(NULL), false) + "  " +
+    entry.hash.ToString() + "  " + (path.empty() ? "(unknown)" : path) +
+    ": " + what;
+  pthread_mutex_lock(&lock_statistics_);
+  findings_->push_back(finding);
+  if (findings_->size() > kMaxFindings)
+    findings_->pop_front();
+  pthread_mutex_unlock(&lock_statistics_);
+}
+
+
+/**
+ * Sleeps in small steps so that Fini() does not have to wait long.
+ *
+ * \return False if the scrubber is asked to terminate
+ */
+static bool Pause(const double seconds) {
+  uint64_t ms = static_cast<uint64_t>(seconds * 1000.0);
+  while (ms > 0) {
+    if (atomic_read32(&terminate_))
+      return false;
+    const unsigned step = std::min(ms, static_cast<uint64_t>(100));
+    SafeSleepMs(step);
+    ms -= step;
+  }
+  return atomic_read32(&terminate_) == 0;
+}
+
+
+/**
+ * Called after nbytes were read and processed in work seconds.  Delays the
+ * thread such that neither the I/O rate nor the CPU share exceed their
+ * limits.  Short delays are accumulated in debt.
+ *
+ * \return False if the scrubber is asked to terminate
+ */
+static bool Throttle(const uint64_t nbytes, const double work, double *debt) {
+  double budget = work;
+  if (max_rate_ > 0)
+    budget = std::max(budget, static_cast<double>(nbytes) / max_rate_);
+  if (max_cpu_ < 100)
+    budget = std::max(budget, work * 100.0 / max_cpu_);
+  *debt += budget - work;
+  if (*debt < 0.01)
+    return atomic_read32(&terminate_) == 0;
+  const double delay = *debt;
+  *debt = 0.0;
+  return Pause(delay);
+}
+
+
+/**
+ * Recompresses a cached file, plain or block file, and compares the hash of
+ * the compressed stream with the content hash.  Objects that are stored
+ * uncompressed on the server match the hash of the plain data, which is
+ * computed in the same pass.
+ *
+ * @param[out] bytes  Number of bytes read from disk
+ */
+static Verdict Verify(const quota::LruEntry &entry, uint64_t *bytes,
+                      double *debt)
+{
+  *bytes = 0;
+  const string path = *cache_path_ + entry.hash.MakePath(1, 2);
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return (errno == ENOENT) ? kVerdictVanished : kVerdictIoError;
+  // Don't thrash kernel buffers
+  platform_disable_kcache(fd);
+
+  platform_stat64 info;
+  if (platform_fstat(fd, &info) != 0) {
+    close(fd);
+    return kVerdictIoError;
+  }
+  blockfile::Index index;
+  const bool is_block_file = blockfile::ReadIndex(fd, info.st_size, &index);
+  const uint64_t num_steps = is_block_file ? index.num_blocks() :
+    (info.st_size + kReadSize - 1) / kReadSize;
+
+  z_stream strm;
+  unsigned char out[kZChunk];
+  unsigned char *buffer = static_cast<unsigned char *>(smalloc(kReadSize));
+  hash::ContextPtr hash_context(entry.hash.algorithm);
+  hash_context.buffer = alloca(hash_context.size);
+  hash::Init(hash_context);
+  hash::ContextPtr plain_context(entry.hash.algorithm);
+  plain_context.buffer = alloca(plain_context.size);
+  hash::Init(plain_context);
+  zlib::CompressInit(&strm);
+
+  Verdict verdict = kVerdictOk;
+  int z_ret = Z_OK;
+  for (uint64_t i = 0; i <= num_steps; ++i) {
+    struct timeval start, stop;
+    gettimeofday(&start, NULL);
+    const bool last = (i == num_steps);
+    void *block = NULL;
+    unsigned char *data = NULL;
+    uint64_t nbytes = 0;
+    uint64_t nbytes_disk = 0;
+    if (!last && is_block_file) {
+      if (!blockfile::ReadBlock(fd, index, i, &block, &nbytes)) {
+        verdict = kVerdictCorrupted;
+        break;
+      }
+      data = static_cast<unsigned char *>(block);
+      nbytes_disk = index.offsets[i + 1] - index.offsets[i];
+    } else if (!last) {
+      const ssize_t retval = pread(fd, buffer, kReadSize, i * kReadSize);
+      if (retval < 0) {
+        verdict = kVerdictIoError;
+        break;
+      }
+      data = buffer;
+      nbytes = nbytes_disk = retval;
+    }
+
+    hash::Update(data, nbytes, plain_context);
+    strm.next_in = data;
+    strm.avail_in = nbytes;
+    do {
+      strm.avail_out = kZChunk;
+      strm.next_out = out;
+      z_ret = deflate(&strm, last ? Z_FINISH : Z_NO_FLUSH);
+      assert(z_ret != Z_STREAM_ERROR);
+      hash::Update(out, kZChunk - strm.avail_out, hash_context);
+    } while (strm.avail_out == 0);
+    free(block);
+    *bytes += nbytes_disk;
+
+    gettimeofday(&stop, NULL);
+    if (!last && !Throttle(nbytes_disk, DiffTimeSeconds(start, stop), debt)) {
+      verdict = kVerdictTerminated;
+      break;
+    }
+  }
+
+  if (verdict == kVerdictOk) {
+    hash::Any compressed_hash(entry.hash.algorithm);
+    hash::Final(hash_context, &compressed_hash);
+    hash::Any plain_hash(entry.hash.algorithm);
+    hash::Final(plain_context, &plain_hash);
+    if (((z_ret != Z_STREAM_END) || (compressed_hash != entry.hash)) &&
+        (plain_hash != entry.hash))
+    {
+      verdict = kVerdictCorrupted;
+    }
+  }
+
+  zlib::CompressFini(&strm);
+  free(buffer);
+  close(fd);
+  return verdict;
+}
+
+
+/**
+ * Moves a corrupted file out of the way and forgets about it in the cache
+ * database.
+ */
+static bool Quarantine(const quota::LruEntry &entry) {
+  const string path = *cache_path_ + entry.hash.MakePath(1, 2);
+  const string quarantaine_path =
+    *cache_path_ + "/quarantaine/" + entry.hash.ToString();
+  bool result = true;
+  if (rename(path.c_str(), quarantaine_path.c_str()) != 0) {
+    LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
+             "failed to move %s to quarantaine", path.c_str());
+    result = false;
+  }
+  quota::Remove(entry.hash);
+  return result;
+}
+
+
+static void *MainScrubber(void *data __attribute__((unused))) {
+  LogCvmfs(kLogCache, kLogDebug, "starting cache scrubber");
+  uint64_t position;
+  uint64_t pass;
+  LoadProgress(&position, &pass);
+  pthread_mutex_lock(&lock_statistics_);
+  statistics_.running = true;
+  statistics_.pass = pass;
+  statistics_.position = position;
+  pthread_mutex_unlock(&lock_statistics_);
+
+  vector<quota::LruEntry> entries;
+  vector<string> paths;
+  double debt = 0.0;
+  time_t last_save = time(NULL);
+  while (atomic_read32(&terminate_) == 0) {
+    // Fails as well once the cache switched to read-only mode
+    if (!quota::ListLru(position, &entries, &paths)) {
+      LogCvmfs(kLogCache, kLogDebug | kLogSyslogWarn,
+               "cache scrubber requires a managed, writable cache, stopping");
+      break;
+    }
+
+    if (entries.empty()) {
+      pass++;
+      position = 0;
+      SaveProgress(position, pass);
+      last_save = time(NULL);
+      pthread_mutex_lock(&lock_statistics_);
+      statistics_.pass = pass;
+      statistics_.position = position;
+      pthread_mutex_unlock(&lock_statistics_);
+      LogCvmfs(kLogCache, kLogDebug | kLogSyslog,
+               "cache scrubber finished pass %"PRIu64, pass);
+      if (!Pause(pass_interval_))
+        break;
+      continue;
+    }
+
+    for (unsigned i = 0; i < entries.size(); ++i) {
+      uint64_t bytes;
+      struct timeval start, stop;
+      gettimeofday(&start, NULL);
+      const Verdict verdict = Verify(entries[i], &bytes, &debt);
+      gettimeofday(&stop, NULL);
+      if (verdict == kVerdictTerminated)
+        break;
+
+      bool quarantined = false;
+      if (verdict == kVerdictCorrupted) {
+        LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
+                 "cache scrubber: %s (%s) is corrupted",
+                 entries[i].hash.ToString().c_str(), paths[i].c_str());
+        quarantined = Quarantine(entries[i]);
+        AddFinding(entries[i], paths[i], quarantined ?
+                   "corrupted, quarantined" : "corrupted, removed");
+      } else if (verdict == kVerdictIoError) {
+        LogCvmfs(kLogCache, kLogDebug, "cache scrubber: failed to read %s",
+                 entries[i].hash.ToString().c_str());
+        AddFinding(entries[i], paths[i], "read error");
+      }
+      position = entries[i].acseq;
+
+      pthread_mutex_lock(&lock_statistics_);
+      statistics_.position = position;
+      statistics_.elapsed += DiffTimeSeconds(start, stop);
+      statistics_.bytes_verified += bytes;
+      switch (verdict) {
+        case kVerdictOk:
+          statistics_.num_verified++;
+          break;
+        case kVerdictCorrupted:
+          statistics_.num_verified++;
+          statistics_.num_corrupted++;
+          if (quarantined) statistics_.num_quarantined++;
+          break;
+        case kVerdictVanished:
+          statistics_.num_vanished++;
+          break;
+        default:
+          statistics_.num_errors++;
+      }
+      pthread_mutex_unlock(&lock_statistics_);
+
+      if (time(NULL) - last_save >= static_cast<time_t>(kSaveInterval)) {
+        SaveProgress(position, pass);
+        last_save = time(NULL);
+      }
+      if (atomic_read32(&terminate_))
+        break;
+    }
+  }
+
+  SaveProgress(position, pass);
+  pthread_mutex_lock(&lock_statistics_);
+  statistics_.running = false;
+  pthread_mutex_unlock(&lock_statistics_);
+  LogCvmfs(kLogCache, kLogDebug, "stopping cache scrubber");
+  return NULL;
+}
+
+
+/**
+ * Prepares the scrubber.  In case of a shared cache, the scrubber only runs
+ * in the instance that holds the scrubber lock.
+ *
+ * @param[in] max_rate       Bytes per second, 0 means unlimited
+ * @param[in] max_cpu        Percent of the time spent on verification
+ * @param[in] pass_interval  Seconds between two walks through the cache
+ * \return False if another instance is already scrubbing the cache
+ */
+bool Init(const string &cache_path, const uint64_t max_rate,
+          const unsigned max_cpu, const unsigned pass_interval)
+{
+  fd_lockfile_ = TryLockFile(cache_path + "/lock_scrubber");
+  if (fd_lockfile_ < 0) {
+    LogCvmfs(kLogCache, kLogDebug,
+             "cache scrubber not started, cache is scrubbed elsewhere");
+    return false;
+  }
+
+  cache_path_ = new string(cache_path);
+  findings_ = new deque<string>();
+  max_rate_ = max_rate;
+  max_cpu_ = ((max_cpu == 0) || (max_cpu > 100)) ? 100 : max_cpu;
+  pass_interval_ = pass_interval;
+  atomic_init32(&terminate_);
+  statistics_ = Statistics();
+  return true;
+}
+
+
+/**
+ * Starts the scrubber thread (after fork).
+ */
+void Spawn() {
+  if (!cache_path_ || spawned_)
+    return;
+  int retval = pthread_create(&thread_scrubber_, NULL, MainScrubber, NULL);
+  assert(retval == 0);
+  spawned_ = true;
+}
+
+
+void Fini() {
+  if (!cache_path_)
+    return;
+  if (spawned_) {
+    atomic_cas32(&terminate_, 0, 1);
+    pthread_join(thread_scrubber_, NULL);
+    spawned_ = false;
+  }
+  UnlockFile(fd_lockfile_);
+  fd_lockfile_ = -1;
+  delete findings_;
+  delete cache_path_;
+  findings_ = NULL;
+  cache_path_ = NULL;
+}
+
+
+Statistics GetStatistics() {
+  pthread_mutex_lock(&lock_statistics_);
+  Statistics result = statistics_;
+  pthread_mutex_unlock(&lock_statistics_);
+  return result;
+}
+
+
+/**
+ * The most recent corrupted or unreadable files, one per line.
+ */
+string GetFindings() {
+  string result;
+  pthread_mutex_lock(&lock_statistics_);
+  if (findings_) {
+    for (unsigned i = 0; i < findings_->size(); ++i)
+      result += (*findings_)[i] + "\n";
+  }
+  pthread_mutex_unlock(&lock_statistics_);
+  return result;
+}
+
+}  // namespace scrubber
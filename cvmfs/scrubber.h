@@ -0,0 +1,54 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#ifndef CVMFS_SCRUBBER_H_
+#define CVMFS_SCRUBBER_H_
+
+#include <stdint.h>
+
+#include <string>
+
+namespace scrubber {
+
+/**
+ * Counters of the scrubber since the file system was mounted.
+ */
+struct Statistics {
+  Statistics() {
+    running = false;
+    pass = 0;
+    position = 0;
+    num_verified = 0;
+    bytes_verified = 0;
+    num_corrupted = 0;
+    num_quarantined = 0;
+    num_vanished = 0;
+    num_errors = 0;
+    elapsed = 0.0;
+  }
+
+  std::string Print() const;
+
+  bool running;
+  uint64_t pass;  /**< number of completed walks through the cache */
+  uint64_t position;  /**< access sequence number of the last checked file */
+  uint64_t num_verified;
+  uint64_t bytes_verified;  /**< bytes on disk */
+  uint64_t num_corrupted;
+  uint64_t num_quarantined;
+  uint64_t num_vanished;  /**< evicted before they could be checked */
+  uint64_t num_errors;  /**< files that could not be read */
+  double elapsed;  /**< seconds spent on verification, excluding pauses */
+};
+
+bool Init(const std::string &cache_path, const uint64_t max_rate,
+          const unsigned max_cpu, const unsigned pass_interval);
+void Spawn();
+void Fini();
+Statistics GetStatistics();
+std::string GetFindings();
+
+}  // namespace scrubber
+
+#endif  // CVMFS_SCRUBBER_H_
@@ -656,9 +656,9 @@ bool CommandMigrate::MigrationWorker_20x::CheckDatabaseSchemaCompatibility(
   const catalog::Database &new_catalog = data->new_catalog->database();
 
   if (!new_catalog.ready()                                                  ||
-      (new_catalog.schema_version() < Database::kLatestSupportedSchema -
+      (new_catalog.schema_version() < Database::kLatestSchema -
                                       Database::kSchemaEpsilon         ||
-       new_catalog.schema_version() > Database::kLatestSupportedSchema +
+       new_catalog.schema_version() > Database::kLatestSchema +
                                       Database::kSchemaEpsilon)             ||
       (old_catalog.schema_version() > 2.1 + Database::kSchemaEpsilon))
   {
@@ -243,6 +243,15 @@ int swissknife::CommandSync::Main(const swissknife::ArgumentList &args) {
     SetLogVerbosity(static_cast<LogLevels>(log_level));
   }
 
+  if (args.find('Z') != args.end()) {
+    if (!zlib::ParseCompressionAlgorithm(*args.find('Z')->second,
+                                         &params.compression_alg))
+    {
+      PrintError("unknown compression algorithm");
+      return 2;
+    }
+  }
+
   if (args.find('p') != args.end()) {
     params.use_file_chunking = true;
     if (!ReadFileChunkingArgs(args, params)) {
@@ -259,7 +268,8 @@ int swissknife::CommandSync::Main(const swissknife::ArgumentList &args) {
     params.use_file_chunking,
     params.min_file_chunk_size,
     params.avg_file_chunk_size,
-    params.max_file_chunk_size);
+    params.max_file_chunk_size,
+    params.compression_alg);
   params.spooler = upload::Spooler::Construct(spooler_definition);
   if (NULL == params.spooler)
     return 3;
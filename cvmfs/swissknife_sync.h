@@ -21,7 +21,8 @@ struct SyncParameters {
     stop_for_catalog_tweaks(false),
     min_file_chunk_size(4*1024*1024),
     avg_file_chunk_size(8*1024*1024),
-    max_file_chunk_size(16*1024*1024) {}
+    max_file_chunk_size(16*1024*1024),
+    compression_alg(zlib::kZlibDefault) {}
 
   upload::Spooler *spooler;
   std::string      dir_union;
@@ -42,6 +43,7 @@ struct SyncParameters {
   size_t           min_file_chunk_size;
   size_t           avg_file_chunk_size;
   size_t           max_file_chunk_size;
+  zlib::Algorithms compression_alg;
 };
 
 
@@ -158,6 +160,8 @@ class CommandSync : public Command {
     result.push_back(Parameter('h', "maximal file chunk size in bytes", true,
                                false));
     result.push_back(Parameter('f', "union filesystem type", true, false));
+    result.push_back(Parameter('Z', "compression algorithm of new files "
+                               "(zlib, none)", true, false));
     return result;
   }
   int Main(const ArgumentList &args);
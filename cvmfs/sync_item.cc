@@ -20,6 +20,7 @@ SyncItem::SyncItem(const string &relative_parent_path,
   whiteout_(false),
   relative_parent_path_(relative_parent_path),
   filename_(filename),
+  compression_algorithm_(zlib::kZlibDefault),
   union_engine_(union_engine)
 {
   content_hash_.algorithm = hash::kSha1;
@@ -106,6 +107,7 @@ catalog::DirectoryEntryBase SyncItem::CreateBasicCatalogDirent() const {
   dirent.size_           = this->GetUnionStat().st_size;
   dirent.mtime_          = this->GetUnionStat().st_mtime;
   dirent.checksum_       = this->GetContentHash();
+  dirent.compression_algorithm_ = this->GetCompressionAlgorithm();
 
   dirent.name_.Assign(filename_.data(), filename_.length());
 
@@ -59,6 +59,12 @@ class SyncItem {
   inline hash::Any GetContentHash() const { return content_hash_; }
   inline void SetContentHash(const hash::Any &hash) { content_hash_ = hash; }
   inline bool HasContentHash() const { return !content_hash_.IsNull(); }
+  inline zlib::Algorithms GetCompressionAlgorithm() const {
+    return compression_algorithm_;
+  }
+  inline void SetCompressionAlgorithm(const zlib::Algorithms algorithm) {
+    compression_algorithm_ = algorithm;
+  }
 
   catalog::DirectoryEntryBase CreateBasicCatalogDirent() const;
 
@@ -111,6 +117,8 @@ class SyncItem {
   std::string filename_;
   // The hash of regular file's content
   hash::Any content_hash_;
+  // The algorithm the content was compressed with in the spooler
+  zlib::Algorithms compression_algorithm_;
   const SyncUnion *union_engine_;
 
   mutable EntryStat rdonly_stat_;
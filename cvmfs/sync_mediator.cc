@@ -440,6 +440,7 @@ void SyncMediator::PublishFilesCallback(const upload::SpoolerResult &result) {
 
   SyncItem &item = itr->second;
   item.SetContentHash(result.content_hash);
+  item.SetCompressionAlgorithm(result.compression_alg);
 
   if (result.IsChunked()) {
     catalog_manager_->AddChunkedFile(item.CreateBasicCatalogDirent(),
@@ -469,12 +470,14 @@ void SyncMediator::PublishHardlinksCallback(const upload::SpoolerResult &result)
     if (hardlink_queue_[i].master.GetUnionPath() == result.local_path) {
       found = true;
       hardlink_queue_[i].master.SetContentHash(result.content_hash);
+      hardlink_queue_[i].master.SetCompressionAlgorithm(result.compression_alg);
       SyncItemList::iterator j,jend;
       for (j = hardlink_queue_[i].hardlinks.begin(),
            jend = hardlink_queue_[i].hardlinks.end();
            j != jend; ++j)
       {
         j->second.SetContentHash(result.content_hash);
+        j->second.SetCompressionAlgorithm(result.compression_alg);
       }
 
       break;
@@ -45,6 +45,8 @@
 #include "options.h"
 #include "cache.h"
 #include "monitor.h"
+#include "prefetch.h"
+#include "scrubber.h"
 
 using namespace std;  // NOLINT
 
@@ -75,6 +77,21 @@ static void AnswerStringList(const int con_fd, const vector<string> &list) {
 }
 
 
+/**
+ * Describes the latency and throughput estimate of a proxy or a host.
+ */
+static string FormatEstimate(const download::EndpointEstimate &estimate) {
+  if (estimate.num_samples == 0)
+    return "no estimate";
+  string result = StringifyInt(uint64_t(estimate.latency_ms)) + " ms";
+  if (estimate.throughput > 0.0)
+    result += ", " + StringifyInt(uint64_t(estimate.throughput / 1024)) +
+              " KB/s";
+  result += ", " + StringifyInt(estimate.num_samples) + " samples";
+  return result;
+}
+
+
 static void *MainTalk(void *data __attribute__((unused))) {
   LogCvmfs(kLogTalk, kLogDebug, "talk thread started");
 
@@ -142,6 +159,16 @@ static void *MainTalk(void *data __attribute__((unused))) {
           vector<string> ls_catalogs = quota::ListCatalogs();
           AnswerStringList(con_fd, ls_catalogs);
         }
+      } else if (line.substr(0, 15) == "cache benchmark") {
+        if (quota::GetCapacity() == 0) {
+          Answer(con_fd, "Cache is unmanaged\n");
+        } else if (line.length() < 17) {
+          Answer(con_fd, "Usage: cache benchmark <number of commands>\n");
+        } else {
+          const unsigned num_commands = String2Uint64(line.substr(16));
+          Answer(con_fd, StringifyDouble(quota::Benchmark(num_commands)) +
+                 " commands/s\n");
+        }
       } else if (line.substr(0, 7) == "cleanup") {
         if (quota::GetCapacity() == 0) {
           Answer(con_fd, "Cache is unmanaged\n");
@@ -180,6 +207,37 @@ static void *MainTalk(void *data __attribute__((unused))) {
           else
             Answer(con_fd, "No such regular file or pinning failed\n");
         }
+      } else if (line == "prefetch status") {
+        Answer(con_fd, prefetch::GetProgress().Print());
+      } else if (line == "prefetch cancel") {
+        prefetch::Cancel();
+        Answer(con_fd, "OK\n");
+      } else if (line.substr(0, 8) == "prefetch") {
+        if (line.length() < 10) {
+          Answer(con_fd, "Usage: prefetch <list file> "
+                 "[<parallel downloads> [<max kB/s>]]\n");
+        } else {
+          vector<string> tokens = SplitString(line.substr(9), ' ');
+          const string list_path = tokens[0];
+          unsigned concurrency = 8;
+          uint64_t max_rate = 0;
+          if (tokens.size() > 1)
+            concurrency = String2Uint64(tokens[1]);
+          if (tokens.size() > 2)
+            max_rate = String2Uint64(tokens[2]) * 1024;
+          string error;
+          if (prefetch::Start(list_path, concurrency, max_rate, &error)) {
+            Answer(con_fd, "Started prefetch of " +
+                   StringifyInt(prefetch::GetProgress().num_paths) +
+                   " paths\n");
+          } else {
+            Answer(con_fd, "Failed: " + error + "\n");
+          }
+        }
+      } else if (line == "scrubber status") {
+        const string findings = scrubber::GetFindings();
+        Answer(con_fd, scrubber::GetStatistics().Print() +
+               (findings.empty() ? "" : "Recent findings:\n" + findings));
       } else if (line == "mountpoint") {
         Answer(con_fd, *cvmfs::mountpoint_ + "\n");
       } else if (line == "remount") {
@@ -230,8 +288,9 @@ static void *MainTalk(void *data __attribute__((unused))) {
         vector<string> host_chain;
         vector<int> rtt;
         unsigned active_host;
+        vector<download::EndpointEstimate> estimates;
 
-        download::GetHostInfo(&host_chain, &rtt, &active_host);
+        download::GetHostInfo(&host_chain, &rtt, &active_host, &estimates);
         string host_str;
         for (unsigned i = 0; i < host_chain.size(); ++i) {
           host_str += "  [" + StringifyInt(i) + "] " + host_chain[i] + " (";
@@ -241,7 +300,7 @@ static void *MainTalk(void *data __attribute__((unused))) {
             host_str += "host down";
           else
             host_str += StringifyInt(rtt[i]) + " ms";
-          host_str += ")\n";
+          host_str += "; " + FormatEstimate(estimates[i]) + ")\n";
         }
         host_str += "Active host " + StringifyInt(active_host) + ": " +
                     host_chain[active_host] + "\n";
@@ -263,7 +322,8 @@ static void *MainTalk(void *data __attribute__((unused))) {
       } else if (line == "proxy info") {
         vector< vector<string> > proxy_chain;
         unsigned active_group;
-        download::GetProxyInfo(&proxy_chain, &active_group);
+        vector< vector<download::EndpointEstimate> > estimates;
+        download::GetProxyInfo(&proxy_chain, &active_group, &estimates);
 
         string proxy_str;
         if (proxy_chain.size()) {
@@ -274,6 +334,13 @@ static void *MainTalk(void *data __attribute__((unused))) {
           }
           proxy_str += "Active proxy: [" + StringifyInt(active_group) + "] " +
                        proxy_chain[active_group][0] + "\n";
+          proxy_str += "Estimates:\n";
+          for (unsigned i = 0; i < proxy_chain.size(); ++i) {
+            for (unsigned j = 0; j < proxy_chain[i].size(); ++j) {
+              proxy_str += "  [" + StringifyInt(i) + "] " + proxy_chain[i][j] +
+                           " (" + FormatEstimate(estimates[i][j]) + ")\n";
+            }
+          }
         } else {
           proxy_str = "No proxies defined\n";
         }
@@ -342,6 +409,13 @@ static void *MainTalk(void *data __attribute__((unused))) {
 
         result += "File Catalogs:\n  " + cvmfs::GetCatalogStatistics().Print();
         result += "Certificate cache:\n  " + cvmfs::GetCertificateStats();
+        result += "Decompressed block cache:\n  " +
+                  cache::GetBlockCacheStats();
+        result += "Cache manager:\n  " + quota::GetStatistics().Print();
+        result += "Downloads:\n  fetched: " +
+          StringifyInt(cache::GetNumDownloads()) + "  taken from other "
+          "processes: " + StringifyInt(cache::GetNumDeduplicatedDownloads()) +
+          "\n";
 
         result += "Path Strings:\n  instances: " +
           StringifyInt(PathString::num_instances()) + "  overflows: " +
@@ -22,6 +22,7 @@ FileProcessor::FileProcessor(const SpoolerDefinition  &spooler_definition,
   worker_context_ = new FileProcessorWorker::worker_context(
                                       spooler_definition.temporary_path,
                                       spooler_definition.use_file_chunking,
+                                      spooler_definition.compression_alg,
                                       uploader);
 
   const unsigned int number_of_cpus = GetNumberOfCpuCores();
@@ -42,7 +43,8 @@ void FileProcessor::ProcessingCallback(const FileProcessorWorker::Results  &data
   NotifyListeners(SpoolerResult(data.return_code,
                                 data.local_path,
                                 data.bulk_file.content_hash(),
-                                data.file_chunks));
+                                data.file_chunks,
+                                worker_context_->compression_alg));
 }
 
 
@@ -66,6 +68,7 @@ FileProcessor::FileProcessorWorker::FileProcessorWorker(
                                                 const worker_context *context) :
   temporary_path_(context->temporary_path),
   use_file_chunking_(context->use_file_chunking),
+  compression_alg_(context->compression_alg),
   uploader_(context->uploader) {}
 
 
@@ -197,7 +200,8 @@ bool FileProcessor::FileProcessorWorker::ProcessFileChunk(
 
   // compress the chunk and compute the content hash simultaneously
   hash::Any content_hash(hash::kSha1);
-  if (! zlib::CompressMem2File(mmf.buffer() + chunk.offset(),
+  if (! zlib::CompressMem2File(compression_alg_,
+                               mmf.buffer() + chunk.offset(),
                                chunk.size(),
                                fcas,
                                &content_hash)) {
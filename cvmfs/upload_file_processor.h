@@ -163,15 +163,18 @@ class FileProcessor : public Observable<SpoolerResult> {
      * ConcurrentWorkers implementation
      */
     struct worker_context {
-      worker_context(const std::string &temporary_path,
-                     const bool         use_file_chunking,
-                     AbstractUploader  *uploader) :
+      worker_context(const std::string      &temporary_path,
+                     const bool              use_file_chunking,
+                     const zlib::Algorithms  compression_alg,
+                     AbstractUploader       *uploader) :
         temporary_path(temporary_path),
         use_file_chunking(use_file_chunking),
+        compression_alg(compression_alg),
         uploader(uploader) {}
       const std::string temporary_path; //!< base path to store processing
                                         //!< results in temporary files
       const bool        use_file_chunking;
+      const zlib::Algorithms compression_alg;
       AbstractUploader *uploader;
     };
 
@@ -260,6 +263,7 @@ class FileProcessor : public Observable<SpoolerResult> {
    private:
     const std::string          temporary_path_;
     const bool                 use_file_chunking_;
+    const zlib::Algorithms     compression_alg_;
     mutable AbstractUploader  *uploader_;
 
     PendingFilesMap            pending_files_;
@@ -16,12 +16,14 @@ SpoolerDefinition::SpoolerDefinition(
                       const bool         use_file_chunking,
                       const size_t       min_file_chunk_size,
                       const size_t       avg_file_chunk_size,
-                      const size_t       max_file_chunk_size) :
+                      const size_t       max_file_chunk_size,
+                      const zlib::Algorithms compression_alg) :
   driver_type(Unknown),
   use_file_chunking(use_file_chunking),
   min_file_chunk_size(min_file_chunk_size),
   avg_file_chunk_size(avg_file_chunk_size),
   max_file_chunk_size(max_file_chunk_size),
+  compression_alg(compression_alg),
   valid_(false)
 {
   // check if given file chunking values are sane
@@ -7,6 +7,8 @@
 
 #include <string>
 
+#include "compression.h"
+
 namespace upload {
 
 /**
@@ -36,7 +38,9 @@ struct SpoolerDefinition {
                              const bool          use_file_chunking   = false,
                              const size_t        min_file_chunk_size = 0,
                              const size_t        avg_file_chunk_size = 0,
-                             const size_t        max_file_chunk_size = 0);
+                             const size_t        max_file_chunk_size = 0,
+                             const zlib::Algorithms compression_alg =
+                               zlib::kZlibDefault);
   bool IsValid() const { return valid_; }
 
   DriverType  driver_type;           //!< the type of the spooler driver
@@ -48,6 +52,7 @@ struct SpoolerDefinition {
   size_t      min_file_chunk_size;
   size_t      avg_file_chunk_size;
   size_t      max_file_chunk_size;
+  zlib::Algorithms compression_alg;  //!< compression of new objects
 
   bool valid_;
 };
@@ -21,14 +21,16 @@ namespace upload
    *       likely undefined, Null or rubbish.
    */
   struct SpoolerResult {
-    SpoolerResult(const int             return_code = -1,
-                  const std::string     &local_path  = "",
-                  const hash::Any       &digest      = hash::Any(),
-                  const FileChunkList   &file_chunks = FileChunkList()) :
+    SpoolerResult(const int              return_code = -1,
+                  const std::string      &local_path  = "",
+                  const hash::Any        &digest      = hash::Any(),
+                  const FileChunkList    &file_chunks = FileChunkList(),
+                  const zlib::Algorithms  compression_alg = zlib::kZlibDefault) :
       return_code(return_code),
       local_path(local_path),
       content_hash(digest),
-      file_chunks(file_chunks) {}
+      file_chunks(file_chunks),
+      compression_alg(compression_alg) {}
 
     inline bool IsChunked() const { return !file_chunks.IsEmpty(); }
 
@@ -37,6 +39,7 @@ namespace upload
     hash::Any     content_hash; //!< the content_hash of the bulk file derived
                                 //!< during processing
     FileChunkList file_chunks;  //!< the file chunks generated during processing
+    zlib::Algorithms compression_alg;  //!< applies to the bulk file and chunks
   };
 }
 
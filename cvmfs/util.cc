@@ -731,6 +731,41 @@ vector<string> SplitString(const string &str,
 }
 
 
+/**
+ * Splits a line of a csv file, such as written by the tracer, into its
+ * fields.  Fields can be quoted; quotes within quoted fields are doubled.
+ */
+vector<string> SplitCsvLine(const string &line) {
+  vector<string> fields;
+  string field;
+  bool quoted = false;
+  for (unsigned i = 0; i < line.length(); ++i) {
+    const char c = line[i];
+    if (quoted) {
+      if (c == '"') {
+        if ((i+1 < line.length()) && (line[i+1] == '"')) {
+          field.push_back('"');
+          ++i;
+        } else {
+          quoted = false;
+        }
+      } else {
+        field.push_back(c);
+      }
+    } else if (c == '"') {
+      quoted = true;
+    } else if (c == ',') {
+      fields.push_back(field);
+      field.clear();
+    } else if ((c != '\r') && (c != '\n')) {
+      field.push_back(c);
+    }
+  }
+  fields.push_back(field);
+  return fields;
+}
+
+
 string JoinStrings(const vector<string> &strings, const string &joint) {
   string result = "";
   const unsigned size = strings.size();
@@ -161,6 +161,7 @@ std::vector<std::string> SplitString(const std::string &str,
                                      const unsigned max_chunks = 0);
 std::string JoinStrings(const std::vector<std::string> &strings,
                         const std::string &joint);
+std::vector<std::string> SplitCsvLine(const std::string &line);
 
 double DiffTimeSeconds(struct timeval start, struct timeval end);
 
@@ -268,6 +268,7 @@ fi
 %{_libdir}/libcvmfs_fuse_debug.so.%{version}
 %{_bindir}/cvmfs_talk
 %{_bindir}/cvmfs_fsck
+%{_bindir}/cvmfs_cachesim
 %{_bindir}/cvmfs_config
 %{_sysconfdir}/auto.cvmfs
 %{_sysconfdir}/cvmfs/config.sh
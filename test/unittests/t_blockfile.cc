@@ -0,0 +1,122 @@
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "../../cvmfs/blockfile.h"
+#include "../../cvmfs/compression.h"
+#include "../../cvmfs/hash.h"
+
+class T_Blockfile : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    fsrc_ = tmpfile();
+    fblock_ = tmpfile();
+    ASSERT_TRUE(fsrc_ != NULL);
+    ASSERT_TRUE(fblock_ != NULL);
+  }
+
+  virtual void TearDown() {
+    fclose(fsrc_);
+    fclose(fblock_);
+  }
+
+  // Compressible but not trivial content
+  void WriteSource(const uint64_t size) {
+    content_.resize(size);
+    for (uint64_t i = 0; i < size; ++i)
+      content_[i] = 'a' + ((i * 7) % 13) + ((i / 1000) % 3);
+    ASSERT_EQ(size, fwrite(content_.data(), 1, size, fsrc_));
+    ASSERT_EQ(0, fflush(fsrc_));
+  }
+
+  void Convert(const unsigned block_size, blockfile::Index *index) {
+    uint64_t size_on_disk = 0;
+    ASSERT_TRUE(blockfile::Write(fileno(fsrc_), content_.size(), block_size,
+                                 fblock_, &size_on_disk));
+    ASSERT_TRUE(blockfile::ReadIndex(fileno(fblock_), size_on_disk, index));
+    EXPECT_EQ(content_.size(), index->size);
+    EXPECT_EQ(block_size, index->block_size);
+  }
+
+ protected:
+  FILE *fsrc_;
+  FILE *fblock_;
+  std::string content_;
+};
+
+
+TEST_F(T_Blockfile, RoundTrip) {
+  WriteSource(100000);
+  blockfile::Index index;
+  Convert(4096, &index);
+  ASSERT_EQ(25u, index.num_blocks());
+  EXPECT_EQ(4096u, index.BlockLength(0));
+  EXPECT_EQ(100000u - 24*4096, index.BlockLength(24));
+  EXPECT_LT(index.offsets[index.num_blocks()], content_.size());
+
+  std::string decoded;
+  for (unsigned i = 0; i < index.num_blocks(); ++i) {
+    void *block;
+    uint64_t size;
+    ASSERT_TRUE(blockfile::ReadBlock(fileno(fblock_), index, i, &block, &size));
+    EXPECT_EQ(index.BlockLength(i), size);
+    decoded.append(static_cast<char *>(block), size);
+    free(block);
+  }
+  EXPECT_EQ(content_, decoded);
+}
+
+
+TEST_F(T_Blockfile, EmptyFile) {
+  WriteSource(0);
+  blockfile::Index index;
+  Convert(4096, &index);
+  EXPECT_EQ(0u, index.num_blocks());
+}
+
+
+TEST_F(T_Blockfile, CompressedHash) {
+  WriteSource(50000);
+  blockfile::Index index;
+  Convert(1000, &index);
+
+  hash::Any hash_plain(hash::kSha1);
+  hash::Any hash_block(hash::kSha1);
+  ASSERT_EQ(0, lseek(fileno(fsrc_), 0, SEEK_SET));
+  ASSERT_TRUE(zlib::CompressFd2Null(fileno(fsrc_), &hash_plain));
+  ASSERT_TRUE(blockfile::CompressFd2Null(fileno(fblock_), &hash_block));
+  EXPECT_EQ(hash_plain, hash_block);
+
+  // Objects that are stored uncompressed on the server
+  hash::HashMem(reinterpret_cast<const unsigned char *>(content_.data()),
+                content_.size(), &hash_plain);
+  ASSERT_TRUE(blockfile::CompressFd2Null(fileno(fblock_), zlib::kNoCompression,
+                                         &hash_block));
+  EXPECT_EQ(hash_plain, hash_block);
+}
+
+
+TEST_F(T_Blockfile, RejectPlainFile) {
+  WriteSource(10000);
+  blockfile::Index index;
+  EXPECT_FALSE(blockfile::ReadIndex(fileno(fsrc_), content_.size(), &index));
+
+  hash::Any hash(hash::kSha1);
+  EXPECT_FALSE(blockfile::CompressFd2Null(fileno(fsrc_), &hash));
+}
+
+
+TEST_F(T_Blockfile, RejectTruncated) {
+  WriteSource(10000);
+  blockfile::Index index;
+  Convert(1000, &index);
+  const uint64_t size_on_disk = index.offsets[index.num_blocks()];
+  ASSERT_EQ(0, ftruncate(fileno(fblock_), size_on_disk - 1));
+  EXPECT_FALSE(blockfile::ReadIndex(fileno(fblock_), size_on_disk - 1,
+                                    &index));
+}
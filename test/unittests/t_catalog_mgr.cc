@@ -0,0 +1,356 @@
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../../cvmfs/catalog.h"
+#include "../../cvmfs/catalog_mgr.h"
+#include "../../cvmfs/catalog_sql.h"
+#include "../../cvmfs/hash.h"
+#include "../../cvmfs/shortstring.h"
+#include "../../cvmfs/util.h"
+
+using namespace std;  // NOLINT
+
+namespace catalog {
+
+/**
+ * Serves catalog files from a temporary directory.  The root catalog is the
+ * one set by SetRoot().
+ */
+class TestCatalogManager : public AbstractCatalogManager {
+ public:
+  explicit TestCatalogManager(const map<string, string> *files) :
+    files_(files), num_unloaded_(0) { }
+
+  void SetRoot(const hash::Any &hash) { root_hash_ = hash; }
+  void SetUncached(const hash::Any &hash) { uncached_.insert(hash); }
+  unsigned num_unloaded() const { return num_unloaded_; }
+
+  Catalog *Find(const string &path) {
+    Catalog *result = NULL;
+    ReadLock();
+    IsAttached(PathString(path), &result);
+    Unlock();
+    return result;
+  }
+
+  bool Mount(const string &path) {
+    Catalog *leaf;
+    WriteLock();
+    const bool result = MountSubtree(PathString(path), NULL, &leaf);
+    Unlock();
+    return result;
+  }
+
+ protected:
+  LoadError LoadCatalog(const PathString &mountpoint, const hash::Any &hash,
+                        string *catalog_path, hash::Any *catalog_hash)
+  {
+    const hash::Any effective_hash = hash.IsNull() ? root_hash_ : hash;
+    if (catalog_path)
+      *catalog_path = files_->find(effective_hash.ToString())->second;
+    if (catalog_hash)
+      *catalog_hash = effective_hash;
+    return kLoadNew;
+  }
+
+  void UnloadCatalog(const Catalog *catalog) { num_unloaded_++; }
+
+  bool IsCatalogCached(const hash::Any &hash) {
+    return uncached_.find(hash) == uncached_.end();
+  }
+
+  Catalog *CreateCatalog(const PathString &mountpoint,
+                         const hash::Any &catalog_hash,
+                         Catalog *parent_catalog)
+  {
+    return new Catalog(mountpoint, catalog_hash, parent_catalog);
+  }
+
+ private:
+  const map<string, string> *files_;
+  hash::Any root_hash_;
+  set<hash::Any> uncached_;
+  unsigned num_unloaded_;
+};
+
+
+class T_CatalogManager : public ::testing::Test {
+ protected:
+  typedef vector<pair<string, hash::Any> > NestedList;
+
+  virtual void SetUp() {
+    char path[] = "/tmp/cvmfs_ut_catalog_mgr.XXXXXX";
+    ASSERT_TRUE(mkdtemp(path) != NULL);
+    dir_ = path;
+  }
+
+  virtual void TearDown() {
+    for (map<string, string>::const_iterator i = files_.begin(),
+         iEnd = files_.end(); i != iEnd; ++i)
+    {
+      unlink(i->second.c_str());
+    }
+    rmdir(dir_.c_str());
+  }
+
+  // Creates a catalog with nested catalog references and regular files of
+  // the given sizes, the name makes up the content hash
+  hash::Any MakeCatalog(const string &mountpoint, const string &name,
+                        const NestedList &nested,
+                        const map<string, int> &files = map<string, int>())
+  {
+    const string path = dir_ + "/" + name;
+    EXPECT_TRUE(Database::Create(path, mountpoint));
+    {
+      Database database(path, sqlite::kDbOpenReadWrite);
+      for (unsigned i = 0; i < nested.size(); ++i) {
+        Sql insert(database, "INSERT INTO nested_catalogs VALUES ('" +
+                   nested[i].first + "', '" + nested[i].second.ToString() +
+                   "');");
+        EXPECT_TRUE(insert.Execute());
+      }
+      for (map<string, int>::const_iterator i = files.begin(),
+           iEnd = files.end(); i != iEnd; ++i)
+      {
+        const string file_name = GetFileName(i->first);
+        Sql insert(database, "INSERT INTO catalog (md5path_1, md5path_2, "
+                   "parent_1, parent_2, hardlinks, size, mode, mtime, flags, "
+                   "name, symlink, uid, gid) "
+                   "VALUES (:md5_1, :md5_2, 0, 0, 0, :size, 420, 0, 4, "
+                   ":name, '', 0, 0);");
+        EXPECT_TRUE(insert.BindMd5(1, 2, Md5(i->first)));
+        EXPECT_TRUE(insert.BindInt64(3, i->second));
+        EXPECT_TRUE(insert.BindText(4, file_name));
+        EXPECT_TRUE(insert.Execute());
+      }
+    }
+    hash::Any hash(hash::kSha1);
+    hash::HashMem(reinterpret_cast<const unsigned char *>(name.data()),
+                  name.length(), &hash);
+    files_[hash.ToString()] = path;
+    return hash;
+  }
+
+  static hash::Md5 Md5(const string &path) {
+    return hash::Md5(path.data(), path.length());
+  }
+
+  string dir_;
+  map<string, string> files_;
+};
+
+
+TEST_F(T_CatalogManager, RemountKeepsUnchangedNested) {
+  NestedList nested;
+  const hash::Any b1 = MakeCatalog("/a/b", "b1", NestedList());
+  const hash::Any c1 = MakeCatalog("/a/c", "c1", NestedList());
+  nested.push_back(make_pair("/a/b", b1));
+  nested.push_back(make_pair("/a/c", c1));
+  const hash::Any a1 = MakeCatalog("/a", "a1", nested);
+  const hash::Any d1 = MakeCatalog("/d", "d1", NestedList());
+  const hash::Any e1 = MakeCatalog("/e", "e1", NestedList());
+  nested.clear();
+  nested.push_back(make_pair("/a", a1));
+  nested.push_back(make_pair("/d", d1));
+  nested.push_back(make_pair("/e", e1));
+  const hash::Any r1 = MakeCatalog("", "r1", nested);
+
+  TestCatalogManager catalog_mgr(&files_);
+  catalog_mgr.SetRoot(r1);
+  ASSERT_TRUE(catalog_mgr.Init());
+  ASSERT_TRUE(catalog_mgr.Mount("/a/b/x"));
+  ASSERT_TRUE(catalog_mgr.Mount("/a/c/x"));
+  ASSERT_TRUE(catalog_mgr.Mount("/d/x"));
+  ASSERT_TRUE(catalog_mgr.Mount("/e/x"));
+  EXPECT_EQ(6, catalog_mgr.GetNumCatalogs());
+  Catalog *old_b = catalog_mgr.Find("/a/b");
+  Catalog *old_c = catalog_mgr.Find("/a/c");
+  Catalog *old_d = catalog_mgr.Find("/d");
+
+  // A publish below /a/c, which changes /a and the root, and removes /e
+  const hash::Any c2 = MakeCatalog("/a/c", "c2", NestedList());
+  nested.clear();
+  nested.push_back(make_pair("/a/b", b1));
+  nested.push_back(make_pair("/a/c", c2));
+  const hash::Any a2 = MakeCatalog("/a", "a2", nested);
+  nested.clear();
+  nested.push_back(make_pair("/a", a2));
+  nested.push_back(make_pair("/d", d1));
+  const hash::Any r2 = MakeCatalog("", "r2", nested);
+  catalog_mgr.SetRoot(r2);
+  EXPECT_EQ(kLoadNew, catalog_mgr.Remount(false));
+
+  // Old root, /a, /a/c, and /e are gone
+  EXPECT_EQ(4U, catalog_mgr.num_unloaded());
+  EXPECT_EQ(5, catalog_mgr.GetNumCatalogs());
+  EXPECT_EQ(r2, catalog_mgr.Find("")->hash());
+  Catalog *new_a = catalog_mgr.Find("/a");
+  ASSERT_TRUE(new_a != NULL);
+  EXPECT_EQ(a2, new_a->hash());
+  EXPECT_EQ(old_b, catalog_mgr.Find("/a/b"));
+  EXPECT_EQ(new_a, old_b->parent());
+  EXPECT_EQ(old_d, catalog_mgr.Find("/d"));
+  EXPECT_EQ(catalog_mgr.Find(""), old_d->parent());
+  Catalog *new_c = catalog_mgr.Find("/a/c");
+  EXPECT_NE(old_c, new_c);
+  EXPECT_EQ(c2, new_c->hash());
+  EXPECT_TRUE(catalog_mgr.Find("/e") == NULL);
+  // The root catalog keeps the fixed root inode
+  EXPECT_EQ(uint64_t(AbstractCatalogManager::kInodeOffset),
+            catalog_mgr.Find("")->inode_range().offset);
+}
+
+
+TEST_F(T_CatalogManager, RemountDropsUncachedNested) {
+  NestedList nested;
+  const hash::Any c1 = MakeCatalog("/a/c", "c1", NestedList());
+  nested.push_back(make_pair("/a/c", c1));
+  const hash::Any a1 = MakeCatalog("/a", "a1", nested);
+  nested.clear();
+  nested.push_back(make_pair("/a", a1));
+  const hash::Any r1 = MakeCatalog("", "r1", nested);
+
+  TestCatalogManager catalog_mgr(&files_);
+  catalog_mgr.SetRoot(r1);
+  ASSERT_TRUE(catalog_mgr.Init());
+  ASSERT_TRUE(catalog_mgr.Mount("/a/c/x"));
+  EXPECT_EQ(3, catalog_mgr.GetNumCatalogs());
+
+  // The new /a is in the cache, the new /a/c is not
+  const hash::Any c2 = MakeCatalog("/a/c", "c2", NestedList());
+  nested.clear();
+  nested.push_back(make_pair("/a/c", c2));
+  const hash::Any a2 = MakeCatalog("/a", "a2", nested);
+  nested.clear();
+  nested.push_back(make_pair("/a", a2));
+  const hash::Any r2 = MakeCatalog("", "r2", nested);
+  catalog_mgr.SetRoot(r2);
+  catalog_mgr.SetUncached(c2);
+  RemountDiff diff;
+  EXPECT_EQ(kLoadNew, catalog_mgr.Remount(false, &diff));
+
+  EXPECT_FALSE(diff.complete);
+  EXPECT_EQ(2, catalog_mgr.GetNumCatalogs());
+  ASSERT_TRUE(catalog_mgr.Find("/a") != NULL);
+  EXPECT_EQ(a2, catalog_mgr.Find("/a")->hash());
+  EXPECT_TRUE(catalog_mgr.Find("/a/c") == NULL);
+
+  // Loaded on demand
+  ASSERT_TRUE(catalog_mgr.Mount("/a/c/x"));
+  ASSERT_TRUE(catalog_mgr.Find("/a/c") != NULL);
+  EXPECT_EQ(c2, catalog_mgr.Find("/a/c")->hash());
+}
+
+
+TEST_F(T_CatalogManager, RemountDiff) {
+  map<string, int> files;
+  files["/d/x"] = 1;
+  const hash::Any d1 = MakeCatalog("/d", "d1", NestedList(), files);
+  files.clear();
+  files["/a"] = 1;
+  files["/b"] = 1;
+  files["/c"] = 1;
+  NestedList nested;
+  nested.push_back(make_pair("/d", d1));
+  const hash::Any r1 = MakeCatalog("", "r1", nested, files);
+
+  TestCatalogManager catalog_mgr(&files_);
+  catalog_mgr.SetRoot(r1);
+  ASSERT_TRUE(catalog_mgr.Init());
+  ASSERT_TRUE(catalog_mgr.Mount("/d/x"));
+  const Catalog *old_root = catalog_mgr.Find("");
+  Catalog *old_d = catalog_mgr.Find("/d");
+
+  // /b is modified, /c removed, and /e added
+  files.clear();
+  files["/a"] = 1;
+  files["/b"] = 2;
+  files["/e"] = 1;
+  const hash::Any r2 = MakeCatalog("", "r2", nested, files);
+  catalog_mgr.SetRoot(r2);
+  RemountDiff diff;
+  EXPECT_EQ(kLoadNew, catalog_mgr.Remount(false, &diff));
+
+  EXPECT_TRUE(diff.complete);
+  EXPECT_FALSE(diff.new_nested);
+  set<hash::Md5> changed(diff.md5paths.begin(), diff.md5paths.end());
+  EXPECT_EQ(3U, changed.size());
+  EXPECT_EQ(1U, changed.count(Md5("/b")));
+  EXPECT_EQ(1U, changed.count(Md5("/c")));
+  EXPECT_EQ(1U, changed.count(Md5("/e")));
+  EXPECT_EQ(2U, diff.successors.size());
+  EXPECT_EQ(catalog_mgr.Find(""), diff.successors[old_root]);
+  EXPECT_EQ(old_d, diff.successors[old_d]);
+
+  // A new nested catalog hides entries that used to be missing
+  nested.push_back(make_pair("/f", MakeCatalog("/f", "f1", NestedList())));
+  const hash::Any r3 = MakeCatalog("", "r3", nested, files);
+  catalog_mgr.SetRoot(r3);
+  RemountDiff diff_nested;
+  EXPECT_EQ(kLoadNew, catalog_mgr.Remount(false, &diff_nested));
+  EXPECT_TRUE(diff_nested.complete);
+  EXPECT_TRUE(diff_nested.new_nested);
+  EXPECT_TRUE(diff_nested.md5paths.empty());
+}
+
+
+
+TEST_F(T_CatalogManager, RemountRemapsCachedInodes) {
+  map<string, int> files;
+  files["/d/x"] = 1;
+  const hash::Any d1 = MakeCatalog("/d", "d1", NestedList(), files);
+  files.clear();
+  files["/a"] = 1;
+  files["/b"] = 1;
+  NestedList nested;
+  nested.push_back(make_pair("/d", d1));
+  const hash::Any r1 = MakeCatalog("", "r1", nested, files);
+
+  InodeGenerationAnnotation annotation;
+  TestCatalogManager catalog_mgr(&files_);
+  catalog_mgr.SetInodeAnnotation(&annotation);
+  catalog_mgr.SetRoot(r1);
+  ASSERT_TRUE(catalog_mgr.Init());
+  vector<string> paths;
+  paths.push_back("/a");
+  paths.push_back("/d/x");
+  map<string, DirectoryEntry> cached;
+  for (unsigned i = 0; i < paths.size(); ++i) {
+    ASSERT_TRUE(catalog_mgr.LookupPath(paths[i], kLookupSole,
+                                       &cached[paths[i]]));
+  }
+
+  // The new /0 shifts the row ids of the root catalog, /d is unchanged
+  files["/0"] = 1;
+  const hash::Any r2 = MakeCatalog("", "r2", nested, files);
+  catalog_mgr.SetRoot(r2);
+  RemountDiff diff;
+  EXPECT_EQ(kLoadNew, catalog_mgr.Remount(false, &diff));
+  ASSERT_TRUE(diff.complete);
+  sort(diff.md5paths.begin(), diff.md5paths.end());
+
+  for (unsigned i = 0; i < paths.size(); ++i) {
+    DirectoryEntry dirent = cached[paths[i]];
+    EXPECT_FALSE(diff.IsStale(Md5(paths[i]), &dirent, true));
+    DirectoryEntry fresh;
+    ASSERT_TRUE(catalog_mgr.LookupPath(paths[i], kLookupSole, &fresh));
+    EXPECT_NE(cached[paths[i]].inode(), fresh.inode());
+    EXPECT_EQ(fresh.inode(), dirent.inode());
+    EXPECT_EQ(fresh.catalog(), dirent.catalog());
+
+    // Cached by inode, the entry keeps its inode
+    dirent = cached[paths[i]];
+    EXPECT_FALSE(diff.IsStale(Md5(paths[i]), &dirent, false));
+    EXPECT_EQ(cached[paths[i]].inode(), dirent.inode());
+  }
+}
+
+}  // namespace catalog
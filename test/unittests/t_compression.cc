@@ -0,0 +1,169 @@
+#include <gtest/gtest.h>
+
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "../../cvmfs/compression.h"
+#include "../../cvmfs/hash.h"
+#include "../../cvmfs/util.h"
+
+using namespace std;  // NOLINT
+
+class T_Compression : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    fdest_ = tmpfile();
+    ASSERT_TRUE(fdest_ != NULL);
+  }
+
+  virtual void TearDown() {
+    fclose(fdest_);
+  }
+
+  // Compressible but not trivial content
+  static string MakeContent(const size_t size) {
+    string content(size, '\0');
+    for (size_t i = 0; i < size; ++i)
+      content[i] = 'a' + ((i * 7) % 13) + ((i / 1000) % 3);
+    return content;
+  }
+
+  static const unsigned char *Bytes(const string &content) {
+    return reinterpret_cast<const unsigned char *>(content.data());
+  }
+
+  // Reads the stored object back from fdest_
+  string ReadBack() {
+    string result;
+    char buf[4096];
+    rewind(fdest_);
+    size_t nbytes;
+    while ((nbytes = fread(buf, 1, sizeof(buf), fdest_)) > 0)
+      result.append(buf, nbytes);
+    return result;
+  }
+
+  FILE *fdest_;
+};
+
+
+TEST_F(T_Compression, ParseAlgorithm) {
+  zlib::Algorithms algorithm;
+  EXPECT_TRUE(zlib::ParseCompressionAlgorithm("none", &algorithm));
+  EXPECT_EQ(zlib::kNoCompression, algorithm);
+  EXPECT_TRUE(zlib::ParseCompressionAlgorithm("ZLIB", &algorithm));
+  EXPECT_EQ(zlib::kZlibDefault, algorithm);
+  EXPECT_FALSE(zlib::ParseCompressionAlgorithm("lzma", &algorithm));
+  EXPECT_EQ("none", zlib::AlgorithmName(zlib::kNoCompression));
+  EXPECT_TRUE(zlib::Compressor::Construct(zlib::kNumAlgorithms) == NULL);
+}
+
+
+TEST_F(T_Compression, ZlibMatchesLegacy) {
+  // Objects of the new code path must keep the content hashes of the old one,
+  // including sizes at the boundary of the compression buffer
+  const size_t sizes[] = {0, 1, 16384, 3*16384, 100000};
+  for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+    const string content = MakeContent(sizes[i]);
+    hash::Any hash_legacy(hash::kSha1);
+    hash::Any hash_new(hash::kSha1);
+    ASSERT_TRUE(zlib::CompressMem2File(Bytes(content), content.size(),
+                                       fdest_, &hash_legacy));
+    ASSERT_TRUE(zlib::CompressMem2File(zlib::kZlibDefault, Bytes(content),
+                                       content.size(), fdest_, &hash_new));
+    EXPECT_EQ(hash_legacy, hash_new) << "size " << sizes[i];
+  }
+}
+
+
+TEST_F(T_Compression, RoundTrip) {
+  const string content = MakeContent(100000);
+  FILE *fplain = tmpfile();
+  ASSERT_TRUE(fplain != NULL);
+  ASSERT_EQ(content.size(), fwrite(content.data(), 1, content.size(), fplain));
+  ASSERT_EQ(0, fflush(fplain));
+
+  for (int i = 0; i < zlib::kNumAlgorithms; ++i) {
+    const zlib::Algorithms algorithm = static_cast<zlib::Algorithms>(i);
+    ASSERT_EQ(0, ftruncate(fileno(fdest_), 0));
+    rewind(fdest_);
+    hash::Any hash(hash::kSha1);
+    ASSERT_TRUE(zlib::CompressMem2File(algorithm, Bytes(content),
+                                       content.size(), fdest_, &hash));
+    ASSERT_EQ(0, fflush(fdest_));
+    const string stored = ReadBack();
+
+    hash::Any hash_stored(hash::kSha1);
+    hash::HashMem(Bytes(stored), stored.size(), &hash_stored);
+    EXPECT_EQ(hash_stored, hash);
+    // Local verification reproduces the content hash from the plain file
+    hash::Any hash_verify(hash::kSha1);
+    ASSERT_TRUE(zlib::CompressFd2Null(fileno(fplain), algorithm,
+                                      &hash_verify));
+    EXPECT_EQ(hash, hash_verify);
+
+    if (algorithm == zlib::kNoCompression) {
+      EXPECT_EQ(content, stored);
+    } else {
+      EXPECT_LT(stored.size(), content.size());
+      void *plain;
+      uint64_t plain_size;
+      ASSERT_TRUE(zlib::DecompressMem2Mem(stored.data(), stored.size(),
+                                          &plain, &plain_size));
+      EXPECT_EQ(content, string(static_cast<char *>(plain), plain_size));
+      free(plain);
+    }
+  }
+  fclose(fplain);
+}
+
+
+/**
+ * Compresses a few megabytes of generated content with every algorithm.  The
+ * ratio and the throughput of publishing and of reading the object back on a
+ * client are recorded as test properties.
+ */
+TEST_F(T_Compression, BenchmarkCodecs) {
+  const string content = MakeContent(8 * 1024 * 1024);
+
+  for (int i = 0; i < zlib::kNumAlgorithms; ++i) {
+    const zlib::Algorithms algorithm = static_cast<zlib::Algorithms>(i);
+    ASSERT_EQ(0, ftruncate(fileno(fdest_), 0));
+    rewind(fdest_);
+    struct timeval start, middle, end;
+    gettimeofday(&start, NULL);
+    hash::Any hash(hash::kSha1);
+    ASSERT_TRUE(zlib::CompressMem2File(algorithm, Bytes(content),
+                                       content.size(), fdest_, &hash));
+    ASSERT_EQ(0, fflush(fdest_));
+    gettimeofday(&middle, NULL);
+
+    const string stored = ReadBack();
+    if (algorithm == zlib::kNoCompression) {
+      void *plain = malloc(stored.size());
+      memcpy(plain, stored.data(), stored.size());
+      free(plain);
+    } else {
+      void *plain;
+      uint64_t plain_size;
+      ASSERT_TRUE(zlib::DecompressMem2Mem(stored.data(), stored.size(),
+                                          &plain, &plain_size));
+      free(plain);
+    }
+    gettimeofday(&end, NULL);
+
+    const string name = zlib::AlgorithmName(algorithm);
+    const double mb = double(content.size()) / (1024 * 1024);
+    RecordProperty((name + "_permille").c_str(), static_cast<int>(
+      1000.0 * double(stored.size()) / double(content.size())));
+    RecordProperty((name + "_compress_mbps").c_str(),
+                   static_cast<int>(mb / DiffTimeSeconds(start, middle)));
+    RecordProperty((name + "_decompress_mbps").c_str(),
+                   static_cast<int>(mb / DiffTimeSeconds(middle, end)));
+  }
+}
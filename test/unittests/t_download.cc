@@ -0,0 +1,581 @@
+#include <gtest/gtest.h>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../../cvmfs/download.h"
+#include "../../cvmfs/hash.h"
+#include "../../cvmfs/util.h"
+
+using namespace std;  // NOLINT
+
+/**
+ * Local HTTP server stand-in.  Serves every path with a small body that
+ * contains the path.  Paths starting with /slow/ are answered after
+ * kSlowDelayMs.  Range headers are honored only for paths starting with
+ * /range/.  Connections are kept alive.
+ */
+class HttpStandIn {
+ public:
+  static const unsigned kSlowDelayMs = 300;
+
+  HttpStandIn() {
+    fd_listen_ = socket(AF_INET, SOCK_STREAM, 0);
+    assert(fd_listen_ >= 0);
+    const int on = 1;
+    setsockopt(fd_listen_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    int retval = bind(fd_listen_, reinterpret_cast<struct sockaddr *>(&addr),
+                      sizeof(addr));
+    assert(retval == 0);
+    socklen_t addr_len = sizeof(addr);
+    retval = getsockname(fd_listen_, reinterpret_cast<struct sockaddr *>(&addr),
+                         &addr_len);
+    assert(retval == 0);
+    port_ = ntohs(addr.sin_port);
+    retval = listen(fd_listen_, 128);
+    assert(retval == 0);
+    retval = pthread_create(&thread_accept_, NULL, MainAccept, this);
+    assert(retval == 0);
+  }
+
+  ~HttpStandIn() {
+    shutdown(fd_listen_, SHUT_RDWR);
+    pthread_join(thread_accept_, NULL);
+    close(fd_listen_);
+  }
+
+  string GetUrl(const string &path) const {
+    return "http://127.0.0.1:" + StringifyInt(port_) + path;
+  }
+
+  static string GetBody(const string &path) {
+    return "content of " + path + "\n";
+  }
+
+ private:
+  static void *MainAccept(void *data) {
+    HttpStandIn *stand_in = static_cast<HttpStandIn *>(data);
+    while (true) {
+      const int fd = accept(stand_in->fd_listen_, NULL, NULL);
+      if (fd < 0)
+        break;
+      pthread_t thread_connection;
+      int *fd_connection = new int(fd);
+      int retval = pthread_create(&thread_connection, NULL, MainConnection,
+                                  fd_connection);
+      assert(retval == 0);
+      pthread_detach(thread_connection);
+    }
+    return NULL;
+  }
+
+  static void *MainConnection(void *data) {
+    const int fd = *static_cast<int *>(data);
+    delete static_cast<int *>(data);
+    string buffer;
+    char chunk[4096];
+    while (true) {
+      size_t end_header;
+      while ((end_header = buffer.find("\r\n\r\n")) == string::npos) {
+        const int num_bytes = recv(fd, chunk, sizeof(chunk), 0);
+        if (num_bytes <= 0) {
+          close(fd);
+          return NULL;
+        }
+        buffer.append(chunk, num_bytes);
+      }
+      const string request = buffer.substr(0, end_header);
+      buffer = buffer.substr(end_header + 4);
+
+      const size_t start_path = request.find(' ') + 1;
+      const string path =
+        request.substr(start_path, request.find(' ', start_path) - start_path);
+      if (HasPrefix(path, "/slow/", false))
+        SafeSleepMs(kSlowDelayMs);
+      const bool head = HasPrefix(request, "HEAD ", false);
+      string body = GetBody(path);
+      string status = "200 OK";
+      const size_t pos_range = request.find("\r\nRange: bytes=");
+      if (HasPrefix(path, "/range/", false) && (pos_range != string::npos)) {
+        unsigned first, last;
+        if ((sscanf(request.c_str() + pos_range, "\r\nRange: bytes=%u-%u",
+                    &first, &last) == 2) && (first <= last) &&
+            (last < body.length()))
+        {
+          body = body.substr(first, last - first + 1);
+          status = "206 Partial Content";
+        }
+      }
+      string reply = "HTTP/1.1 " + status + "\r\nContent-Length: " +
+        StringifyInt(body.length()) + "\r\n\r\n";
+      if (!head)
+        reply += body;
+      if (send(fd, reply.data(), reply.length(), MSG_NOSIGNAL) !=
+          static_cast<int>(reply.length()))
+      {
+        close(fd);
+        return NULL;
+      }
+    }
+  }
+
+  int fd_listen_;
+  int port_;
+  pthread_t thread_accept_;
+};
+
+
+class T_Download : public ::testing::Test {
+ protected:
+  static const unsigned kNumThreads = 16;
+  static const unsigned kNumObjects = 500;  // per thread
+
+  virtual void SetUp() {
+    download::Init(kNumThreads, false);
+    download::SetProxyChain("DIRECT");
+  }
+
+  virtual void TearDown() {
+    download::Fini();
+  }
+
+  static bool FetchMem(const string &url, string *content) {
+    download::JobInfo info(&url, false, false, NULL);
+    if (download::Fetch(&info) != download::kFailOk)
+      return false;
+    *content = string(info.destination_mem.data, info.destination_mem.size);
+    free(info.destination_mem.data);
+    return true;
+  }
+
+  struct FetchSeries {
+    const HttpStandIn *stand_in;
+    unsigned first;
+    unsigned num_failures;
+  };
+
+  static void *MainFetchSeries(void *data) {
+    FetchSeries *series = static_cast<FetchSeries *>(data);
+    for (unsigned i = series->first; i < series->first + kNumObjects; ++i) {
+      const string path = "/data/" + StringifyInt(i);
+      string content;
+      if (!FetchMem(series->stand_in->GetUrl(path), &content) ||
+          (content != HttpStandIn::GetBody(path)))
+      {
+        series->num_failures++;
+      }
+    }
+    return NULL;
+  }
+
+  void RunSmallObjects(const unsigned num_io_threads);
+
+  HttpStandIn stand_in_;
+};
+
+
+TEST_F(T_Download, SingleThreaded) {
+  string content;
+  ASSERT_TRUE(FetchMem(stand_in_.GetUrl("/data/0"), &content));
+  EXPECT_EQ(HttpStandIn::GetBody("/data/0"), content);
+  EXPECT_EQ(0u, download::GetStatistics().num_wakeups);
+}
+
+
+TEST_F(T_Download, RangeRequest) {
+  const string path = "/range/object";
+  const string url = stand_in_.GetUrl(path);
+  download::JobInfo info(&url, false, false, NULL);
+  info.range_offset = 3;
+  info.range_size = 4;
+  ASSERT_EQ(download::kFailOk, download::Fetch(&info));
+  EXPECT_TRUE(info.partial_content);
+  EXPECT_EQ(HttpStandIn::GetBody(path).substr(3, 4),
+            string(info.destination_mem.data, info.destination_mem.size));
+  free(info.destination_mem.data);
+
+  // The server ignores the Range header and sends a short object.  Its size
+  // alone does not tell that the range was not honored.
+  const string path_ignored = "/data/x";
+  const string url_ignored = stand_in_.GetUrl(path_ignored);
+  download::JobInfo info_ignored(&url_ignored, false, false, NULL);
+  info_ignored.range_offset = 3;
+  info_ignored.range_size = 4096;
+  ASSERT_EQ(download::kFailOk, download::Fetch(&info_ignored));
+  EXPECT_FALSE(info_ignored.partial_content);
+  EXPECT_EQ(HttpStandIn::GetBody(path_ignored),
+            string(info_ignored.destination_mem.data,
+                   info_ignored.destination_mem.size));
+  free(info_ignored.destination_mem.data);
+}
+
+
+TEST_F(T_Download, NoBusyWakeups) {
+  download::Spawn();
+  string content;
+  ASSERT_TRUE(FetchMem(stand_in_.GetUrl("/slow/0"), &content));
+  EXPECT_EQ(HttpStandIn::GetBody("/slow/0"), content);
+  // Polling every millisecond would wake up the I/O thread about
+  // kSlowDelayMs times
+  EXPECT_LT(download::GetStatistics().num_wakeups,
+            uint64_t(HttpStandIn::kSlowDelayMs / 10));
+}
+
+
+TEST_F(T_Download, FetchAllConcurrently) {
+  vector<string> urls;
+  for (unsigned i = 0; i < 3; ++i)
+    urls.push_back(stand_in_.GetUrl("/slow/" + StringifyInt(i)));
+  const string body = HttpStandIn::GetBody("/slow/2");
+  hash::Any expected_hash(hash::kSha1);
+  hash::HashMem(reinterpret_cast<const unsigned char *>(body.data()),
+                body.length(), &expected_hash);
+
+  // Before and after Spawn()
+  for (unsigned round = 0; round < 2; ++round) {
+    download::JobInfo info0(&urls[0], false, false, NULL);
+    download::JobInfo info1(&urls[1], false, false, NULL);
+    download::JobInfo info2(&urls[2], false, false, &expected_hash);
+    vector<download::JobInfo *> jobs;
+    jobs.push_back(&info0);
+    jobs.push_back(&info1);
+    jobs.push_back(&info2);
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+    download::FetchAll(jobs);
+    gettimeofday(&end, NULL);
+    EXPECT_LT(DiffTimeSeconds(start, end),
+              2 * HttpStandIn::kSlowDelayMs / 1000.0);
+    for (unsigned i = 0; i < jobs.size(); ++i) {
+      ASSERT_EQ(download::kFailOk, jobs[i]->error_code);
+      EXPECT_EQ(HttpStandIn::GetBody("/slow/" + StringifyInt(i)),
+                string(jobs[i]->destination_mem.data,
+                       jobs[i]->destination_mem.size));
+      free(jobs[i]->destination_mem.data);
+    }
+    download::Spawn();
+  }
+}
+
+
+TEST_F(T_Download, DemoteSlowHost) {
+  const string host_slow = stand_in_.GetUrl("/slow");
+  const string host_fast = stand_in_.GetUrl("/fast");
+  download::SetHostChain(host_slow + ";" + host_fast);
+  const string url = "/data/0";
+  string content;
+  download::SwitchHost();
+  download::JobInfo info_fast(&url, false, true, NULL);
+  ASSERT_EQ(download::kFailOk, download::Fetch(&info_fast));
+  free(info_fast.destination_mem.data);
+  download::SwitchHost();
+
+  // The slow host is demoted once it has enough samples, although it never
+  // fails
+  unsigned i;
+  for (i = 0; i < 20; ++i) {
+    download::JobInfo info(&url, false, true, NULL);
+    ASSERT_EQ(download::kFailOk, download::Fetch(&info));
+    free(info.destination_mem.data);
+    if (download::GetStatistics().num_demotions > 0)
+      break;
+  }
+  EXPECT_LT(i, 20u);
+
+  vector<string> host_chain;
+  vector<int> rtt;
+  unsigned current_host;
+  vector<download::EndpointEstimate> estimates;
+  download::GetHostInfo(&host_chain, &rtt, &current_host, &estimates);
+  EXPECT_EQ(1u, current_host);
+  ASSERT_EQ(2u, estimates.size());
+  EXPECT_GE(estimates[0].latency_ms, HttpStandIn::kSlowDelayMs * 0.9);
+  EXPECT_LT(estimates[1].latency_ms, estimates[0].latency_ms);
+  EXPECT_EQ(1u, estimates[1].num_samples);
+}
+
+
+TEST_F(T_Download, ProbeHostsConcurrently) {
+  const string host_unreachable = "http://127.0.0.1:1";
+  const string host_fast = stand_in_.GetUrl("/fast");
+  download::SetHostChain(host_unreachable + ";" +
+                         stand_in_.GetUrl("/slow/a") + ";" +
+                         stand_in_.GetUrl("/slow/b") + ";" +
+                         stand_in_.GetUrl("/slow/c") + ";" + host_fast);
+  struct timeval start, end;
+  gettimeofday(&start, NULL);
+  download::ProbeHosts();
+  gettimeofday(&end, NULL);
+  // One after another, the two rounds of probing take six slow replies
+  EXPECT_LT(DiffTimeSeconds(start, end),
+            4 * HttpStandIn::kSlowDelayMs / 1000.0);
+
+  vector<string> host_chain;
+  vector<int> rtt;
+  unsigned current_host;
+  download::GetHostInfo(&host_chain, &rtt, &current_host);
+  ASSERT_EQ(5u, host_chain.size());
+  EXPECT_EQ(0u, current_host);
+  EXPECT_EQ(host_fast, host_chain[0]);
+  EXPECT_LT(rtt[0], int(HttpStandIn::kSlowDelayMs));
+  EXPECT_GE(rtt[1], int(HttpStandIn::kSlowDelayMs * 0.9));
+  EXPECT_EQ(host_unreachable, host_chain[4]);
+  EXPECT_EQ(-2, rtt[4]);
+}
+
+
+TEST_F(T_Download, ReprobeHostsInBackground) {
+  const string host_fast = stand_in_.GetUrl("/fast");
+  download::SetHostChain(stand_in_.GetUrl("/slow") + ";" + host_fast);
+  download::SetHostProbeInterval(1);
+  download::Spawn();
+  vector<string> host_chain;
+  vector<int> rtt;
+  unsigned current_host;
+  for (unsigned i = 0; i < 50; ++i) {
+    download::GetHostInfo(&host_chain, &rtt, &current_host);
+    if (host_chain[0] == host_fast)
+      break;
+    SafeSleepMs(100);
+  }
+  EXPECT_EQ(host_fast, host_chain[0]);
+  EXPECT_GE(rtt[0], 0);
+  download::SetHostProbeInterval(0);
+}
+
+
+TEST_F(T_Download, ReprobeHostsKeepsCurrentHost) {
+  const string url = "/data/0";
+  download::SetHostChain(stand_in_.GetUrl("/fast") + ";" +
+                         stand_in_.GetUrl("/slow"));
+  download::SwitchHost();
+  for (unsigned i = 0; i < 2; ++i) {
+    download::JobInfo info(&url, false, true, NULL);
+    ASSERT_EQ(download::kFailOk, download::Fetch(&info));
+    free(info.destination_mem.data);
+  }
+  download::SetHostProbeInterval(1);
+  download::Spawn();
+  vector<string> host_chain;
+  vector<int> rtt;
+  unsigned current_host;
+  vector<download::EndpointEstimate> estimates;
+  for (unsigned i = 0; i < 50; ++i) {
+    download::GetHostInfo(&host_chain, &rtt, &current_host, &estimates);
+    if (rtt[1] >= 0)
+      break;
+    SafeSleepMs(100);
+  }
+  ASSERT_GE(rtt[1], 0);
+  // The probe sample is merged into the estimate of the current host
+  EXPECT_EQ(1u, current_host);
+  ASSERT_EQ(2u, estimates.size());
+  EXPECT_EQ(3u, estimates[1].num_samples);
+  download::SetHostProbeInterval(0);
+}
+
+
+TEST_F(T_Download, ShareFailuresThroughScoreboard) {
+  const string path = CreateTempPath("/tmp/cvmfs_test_scoreboard", 0600);
+  ASSERT_NE("", path);
+  const string hosts = "http://127.0.0.1:1;" + stand_in_.GetUrl("/fast");
+  const string url = "/data/0";
+  ASSERT_TRUE(download::SetHealthScoreboard(path));
+  download::SetHostChain(hosts);
+  download::JobInfo info_first(&url, false, true, NULL);
+  ASSERT_EQ(download::kFailOk, download::Fetch(&info_first));
+  free(info_first.destination_mem.data);
+  EXPECT_EQ(1u, download::GetStatistics().num_host_failover);
+
+  // Another process on the node skips the failed host without trying it
+  download::Fini();
+  download::Init(kNumThreads, false);
+  download::SetProxyChain("DIRECT");
+  ASSERT_TRUE(download::SetHealthScoreboard(path));
+  download::SetHostChain(hosts);
+  download::JobInfo info_second(&url, false, true, NULL);
+  ASSERT_EQ(download::kFailOk, download::Fetch(&info_second));
+  free(info_second.destination_mem.data);
+  EXPECT_EQ(0u, download::GetStatistics().num_host_failover);
+  vector<string> host_chain;
+  vector<int> rtt;
+  unsigned current_host;
+  download::GetHostInfo(&host_chain, &rtt, &current_host);
+  EXPECT_EQ(1u, current_host);
+  unlink(path.c_str());
+}
+
+
+TEST_F(T_Download, RecoverTornScoreboard) {
+  const string path = CreateTempPath("/tmp/cvmfs_test_scoreboard", 0600);
+  ASSERT_NE("", path);
+  ASSERT_TRUE(download::SetHealthScoreboard(path));
+  download::Fini();
+
+  // A process died after sizing the file but before writing the header
+  const int fd = open(path.c_str(), O_RDWR);
+  ASSERT_GE(fd, 0);
+  const uint64_t zero = 0;
+  EXPECT_EQ(ssize_t(sizeof(zero)), pwrite(fd, &zero, sizeof(zero), 0));
+  close(fd);
+  download::Init(kNumThreads, false);
+  download::SetProxyChain("DIRECT");
+  EXPECT_TRUE(download::SetHealthScoreboard(path));
+
+  // Files of other versions are still rejected
+  download::Fini();
+  ASSERT_EQ(0, truncate(path.c_str(), 1));
+  download::Init(kNumThreads, false);
+  download::SetProxyChain("DIRECT");
+  EXPECT_FALSE(download::SetHealthScoreboard(path));
+  unlink(path.c_str());
+}
+
+
+TEST_F(T_Download, HedgeStalledTransfer) {
+  download::SetHostChain(stand_in_.GetUrl("/slow") + ";" +
+                         stand_in_.GetUrl("/fast"));
+  download::SetHedgeLimit(50);
+  download::Spawn();
+  // The latency history comes from the fast host
+  download::SwitchHost();
+  for (unsigned i = 0; i < 40; ++i) {
+    const string url = "/data/" + StringifyInt(i);
+    download::JobInfo info(&url, false, true, NULL);
+    ASSERT_EQ(download::kFailOk, download::Fetch(&info));
+    free(info.destination_mem.data);
+  }
+  download::SwitchHost();
+
+  // The duplicate goes to the fast host and wins, its content is verified
+  const string url = "/data/stalled";
+  const string body = HttpStandIn::GetBody("/fast" + url);
+  hash::Any expected_hash(hash::kSha1);
+  hash::HashMem(reinterpret_cast<const unsigned char *>(body.data()),
+                body.length(), &expected_hash);
+  FILE *fdest = tmpfile();
+  ASSERT_TRUE(fdest != NULL);
+  download::JobInfo info(&url, false, true, fdest, &expected_hash);
+  struct timeval start, end;
+  gettimeofday(&start, NULL);
+  ASSERT_EQ(download::kFailOk, download::Fetch(&info));
+  gettimeofday(&end, NULL);
+  EXPECT_LT(DiffTimeSeconds(start, end), HttpStandIn::kSlowDelayMs / 1000.0);
+  rewind(fdest);
+  char buf[256];
+  const size_t nbytes = fread(buf, 1, sizeof(buf), fdest);
+  EXPECT_EQ(body, string(buf, nbytes));
+  fclose(fdest);
+
+  const download::Statistics statistics = download::GetStatistics();
+  EXPECT_EQ(1u, statistics.num_hedges);
+  EXPECT_EQ(1u, statistics.num_hedges_won);
+  download::SetHedgeLimit(0);
+}
+
+
+static void *MainFetchLowPriority(void *data) {
+  const string *url = static_cast<const string *>(data);
+  download::JobInfo info(url, false, false, NULL);
+  info.priority = download::kPriorityLow;
+  if (download::Fetch(&info) == download::kFailOk)
+    free(info.destination_mem.data);
+  return NULL;
+}
+
+
+TEST_F(T_Download, LowPriorityLeavesConnections) {
+  download::Spawn();
+  // As many slow low priority transfers as there are connections
+  vector<string> urls;
+  for (unsigned i = 0; i < kNumThreads; ++i)
+    urls.push_back(stand_in_.GetUrl("/slow/" + StringifyInt(i)));
+  pthread_t threads[kNumThreads];
+  for (unsigned i = 0; i < kNumThreads; ++i) {
+    ASSERT_EQ(0, pthread_create(&threads[i], NULL, MainFetchLowPriority,
+                                &urls[i]));
+  }
+  SafeSleepMs(HttpStandIn::kSlowDelayMs / 6);
+
+  struct timeval start, end;
+  gettimeofday(&start, NULL);
+  string content;
+  ASSERT_TRUE(FetchMem(stand_in_.GetUrl("/data/0"), &content));
+  gettimeofday(&end, NULL);
+  EXPECT_EQ(HttpStandIn::GetBody("/data/0"), content);
+  EXPECT_LT(DiffTimeSeconds(start, end),
+            HttpStandIn::kSlowDelayMs / 2000.0);
+  for (unsigned i = 0; i < kNumThreads; ++i)
+    pthread_join(threads[i], NULL);
+}
+
+
+/**
+ * Fetches many small objects from several threads through num_io_threads I/O
+ * threads.  The object rate and the CPU time of the process, which includes
+ * the stand-in, are recorded as test properties.
+ */
+void T_Download::RunSmallObjects(const unsigned num_io_threads) {
+  download::Spawn(num_io_threads);
+  FetchSeries series[kNumThreads];
+  pthread_t threads[kNumThreads];
+  struct timeval start, end;
+  struct rusage usage_start, usage_end;
+  gettimeofday(&start, NULL);
+  getrusage(RUSAGE_SELF, &usage_start);
+  for (unsigned i = 0; i < kNumThreads; ++i) {
+    series[i].stand_in = &stand_in_;
+    series[i].first = i * kNumObjects;
+    series[i].num_failures = 0;
+    ASSERT_EQ(0, pthread_create(&threads[i], NULL, MainFetchSeries,
+                                &series[i]));
+  }
+  for (unsigned i = 0; i < kNumThreads; ++i) {
+    pthread_join(threads[i], NULL);
+    EXPECT_EQ(0u, series[i].num_failures);
+  }
+  gettimeofday(&end, NULL);
+  getrusage(RUSAGE_SELF, &usage_end);
+
+  const unsigned num_objects = kNumThreads * kNumObjects;
+  const double seconds = DiffTimeSeconds(start, end);
+  const double cpu_seconds =
+    DiffTimeSeconds(usage_start.ru_utime, usage_end.ru_utime) +
+    DiffTimeSeconds(usage_start.ru_stime, usage_end.ru_stime);
+  const download::Statistics statistics = download::GetStatistics();
+  EXPECT_EQ(num_objects, statistics.num_requests);
+  EXPECT_EQ(uint64_t(num_objects), statistics.num_jobs_submitted);
+  EXPECT_LE(statistics.num_job_batches, statistics.num_jobs_submitted);
+  RecordProperty("objects_per_second", static_cast<int>(num_objects / seconds));
+  RecordProperty("cpu_ms", static_cast<int>(cpu_seconds * 1000));
+  RecordProperty("io_thread_wakeups", static_cast<int>(statistics.num_wakeups));
+  RecordProperty("job_batches", static_cast<int>(statistics.num_job_batches));
+}
+
+
+TEST_F(T_Download, BenchmarkSmallObjects) {
+  RunSmallObjects(1);
+}
+
+
+TEST_F(T_Download, BenchmarkSmallObjectsIoThreads) {
+  RunSmallObjects(4);
+}
@@ -0,0 +1,252 @@
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "../../cvmfs/hash.h"
+#include "../../cvmfs/manifest_fetch.h"
+#include "../../cvmfs/util.h"
+
+using namespace std;  // NOLINT
+
+using manifest::SignatureCache;
+
+static hash::Any HashOf(const string &content) {
+  hash::Any result(hash::kSha1);
+  hash::HashMem(reinterpret_cast<const unsigned char *>(content.data()),
+                content.length(), &result);
+  return result;
+}
+
+class T_SignatureCache : public ::testing::Test {
+ protected:
+  T_SignatureCache()
+    : now_(time(NULL))
+    , manifest_(HashOf("manifest"))
+    , whitelist_(HashOf("whitelist"))
+    , certificate_(HashOf("certificate"))
+    , fingerprint_("00:11:22:33:44:55:66:77:88:99:"
+                   "AA:BB:CC:DD:EE:FF:00:11:22:33")
+  { }
+
+  void InsertEnsemble(SignatureCache *cache, const time_t expiry) {
+    cache->Insert(SignatureCache::kLetterWhitelist, whitelist_, certificate_,
+                  expiry, fingerprint_);
+    cache->Insert(SignatureCache::kLetterManifest, manifest_, certificate_, 0,
+                  fingerprint_);
+  }
+
+  SignatureCache::Verdicts Lookup(SignatureCache *cache, const time_t now) {
+    string fingerprint;
+    return cache->Lookup(manifest_, whitelist_, certificate_, blacklist_, now,
+                         &fingerprint);
+  }
+
+  const time_t now_;
+  const hash::Any manifest_;
+  const hash::Any whitelist_;
+  const hash::Any certificate_;
+  const string fingerprint_;
+  vector<string> blacklist_;
+};
+
+
+TEST_F(T_SignatureCache, Hit) {
+  SignatureCache cache;
+  InsertEnsemble(&cache, now_ + 60);
+  string fingerprint;
+  EXPECT_EQ(SignatureCache::kVerdictVerified,
+            cache.Lookup(manifest_, whitelist_, certificate_, blacklist_, now_,
+                         &fingerprint));
+  EXPECT_EQ(fingerprint_, fingerprint);
+  EXPECT_EQ(2u, cache.num_hits());
+  // Another certificate signed other letters
+  EXPECT_EQ(SignatureCache::kVerdictUnknown,
+            cache.Lookup(manifest_, whitelist_, HashOf("other"), blacklist_,
+                         now_, &fingerprint));
+  EXPECT_EQ(2u, cache.num_hits());
+}
+
+
+TEST_F(T_SignatureCache, WhitelistExpiry) {
+  SignatureCache cache;
+  InsertEnsemble(&cache, now_ + 60);
+  EXPECT_EQ(SignatureCache::kVerdictVerified, Lookup(&cache, now_ + 60));
+  EXPECT_EQ(SignatureCache::kVerdictUnknown, Lookup(&cache, now_ + 61));
+
+  // A renewed whitelist replaces the expired entry
+  cache.Insert(SignatureCache::kLetterWhitelist, whitelist_, certificate_,
+               now_ + 120, fingerprint_);
+  EXPECT_EQ(SignatureCache::kVerdictVerified, Lookup(&cache, now_ + 61));
+}
+
+
+TEST_F(T_SignatureCache, BlacklistedHit) {
+  SignatureCache cache;
+  InsertEnsemble(&cache, now_ + 60);
+  blacklist_.push_back("01:02:03:04:05:06:07:08:09:0A:"
+                       "0B:0C:0D:0E:0F:10:11:12:13:14");
+  EXPECT_EQ(SignatureCache::kVerdictVerified, Lookup(&cache, now_));
+  blacklist_.push_back(fingerprint_ + " compromised");
+  EXPECT_EQ(SignatureCache::kVerdictBlacklisted, Lookup(&cache, now_));
+  EXPECT_EQ(2u, cache.num_hits());
+}
+
+
+TEST_F(T_SignatureCache, ManifestNeedsWhitelist) {
+  SignatureCache cache;
+  cache.Insert(SignatureCache::kLetterManifest, manifest_, certificate_, 0,
+               fingerprint_);
+  EXPECT_EQ(SignatureCache::kVerdictUnknown, Lookup(&cache, now_));
+  EXPECT_EQ(0u, cache.num_hits());
+
+  // A whitelist with other content does not help
+  cache.Insert(SignatureCache::kLetterWhitelist, HashOf("other"),
+               certificate_, now_ + 60, fingerprint_);
+  EXPECT_EQ(SignatureCache::kVerdictUnknown, Lookup(&cache, now_));
+  EXPECT_EQ(0u, cache.num_hits());
+
+  cache.Insert(SignatureCache::kLetterWhitelist, whitelist_, certificate_,
+               now_ + 60, fingerprint_);
+  EXPECT_EQ(SignatureCache::kVerdictVerified, Lookup(&cache, now_));
+  EXPECT_EQ(2u, cache.num_hits());
+}
+
+
+TEST_F(T_SignatureCache, WhitelistOnly) {
+  SignatureCache cache;
+  cache.Insert(SignatureCache::kLetterWhitelist, whitelist_, certificate_,
+               now_ + 60, fingerprint_);
+  EXPECT_EQ(SignatureCache::kVerdictWhitelist, Lookup(&cache, now_));
+  EXPECT_EQ(1u, cache.num_hits());
+}
+
+
+TEST_F(T_SignatureCache, LoadStore) {
+  const string path = CreateTempPath("/tmp/cvmfs_test_signatures", 0600);
+  ASSERT_NE("", path);
+  {
+    SignatureCache cache;
+    cache.Load(path);
+    InsertEnsemble(&cache, now_ + 60);
+  }
+
+  SignatureCache cache;
+  cache.Load(path);
+  string fingerprint;
+  EXPECT_EQ(SignatureCache::kVerdictVerified,
+            cache.Lookup(manifest_, whitelist_, certificate_, blacklist_, now_,
+                         &fingerprint));
+  EXPECT_EQ(fingerprint_, fingerprint);
+  EXPECT_EQ(SignatureCache::kVerdictUnknown, Lookup(&cache, now_ + 61));
+
+  // Unreadable lines are skipped
+  FILE *f = fopen(path.c_str(), "a");
+  ASSERT_TRUE(f != NULL);
+  fprintf(f, "garbage\n");
+  fclose(f);
+  SignatureCache reloaded;
+  reloaded.Load(path);
+  EXPECT_EQ(SignatureCache::kVerdictVerified, Lookup(&reloaded, now_));
+  unlink(path.c_str());
+}
+
+
+TEST_F(T_SignatureCache, TrimToMaxEntries) {
+  const string path = CreateTempPath("/tmp/cvmfs_test_signatures", 0600);
+  ASSERT_NE("", path);
+  SignatureCache cache;
+  cache.Load(path);
+  InsertEnsemble(&cache, now_ + 60);
+  // The manifest is the newest entry of the ensemble, the whitelist goes first
+  for (unsigned i = 0; i < SignatureCache::kMaxEntries - 2; ++i) {
+    cache.Insert(SignatureCache::kLetterManifest,
+                 HashOf("manifest " + StringifyInt(i)), certificate_, 0,
+                 fingerprint_);
+  }
+  EXPECT_EQ(SignatureCache::kVerdictVerified, Lookup(&cache, now_));
+  cache.Insert(SignatureCache::kLetterManifest, HashOf("one more"),
+               certificate_, 0, fingerprint_);
+  EXPECT_EQ(SignatureCache::kVerdictUnknown, Lookup(&cache, now_));
+
+  // The file holds the trimmed list, too
+  FILE *f = fopen(path.c_str(), "r");
+  ASSERT_TRUE(f != NULL);
+  unsigned num_lines = 0;
+  string line;
+  while (GetLineFile(f, &line))
+    num_lines++;
+  fclose(f);
+  EXPECT_EQ(unsigned(SignatureCache::kMaxEntries), num_lines);
+  unlink(path.c_str());
+}
+
+
+class T_PrefetchedManifest : public ::testing::Test {
+ protected:
+  T_PrefetchedManifest()
+    : now_(time(NULL))
+    , manifest_(HashOf("catalog"), "")
+  {
+    manifest_.set_publish_timestamp(1000);
+  }
+
+  const time_t now_;
+  manifest::Manifest manifest_;
+  manifest::PrefetchedManifest prefetched_;
+};
+
+
+TEST_F(T_PrefetchedManifest, Empty) {
+  manifest::ManifestEnsemble ensemble;
+  EXPECT_FALSE(prefetched_.Get(true, 0, now_, &ensemble));
+  EXPECT_TRUE(ensemble.manifest == NULL);
+}
+
+
+TEST_F(T_PrefetchedManifest, DryRunAndConsume) {
+  prefetched_.Set(manifest_, now_ + 60);
+  {
+    // The dry run of a remount leaves the manifest for the remount
+    manifest::ManifestEnsemble ensemble;
+    ASSERT_TRUE(prefetched_.Get(false, 1000, now_, &ensemble));
+    ASSERT_TRUE(ensemble.manifest != NULL);
+    EXPECT_EQ(manifest_.catalog_hash(), ensemble.manifest->catalog_hash());
+  }
+  {
+    manifest::ManifestEnsemble ensemble;
+    ASSERT_TRUE(prefetched_.Get(true, 1000, now_, &ensemble));
+    EXPECT_EQ(manifest_.catalog_hash(), ensemble.manifest->catalog_hash());
+  }
+  manifest::ManifestEnsemble ensemble;
+  EXPECT_FALSE(prefetched_.Get(true, 0, now_, &ensemble));
+}
+
+
+TEST_F(T_PrefetchedManifest, MinimumTimestamp) {
+  prefetched_.Set(manifest_, now_ + 60);
+  manifest::ManifestEnsemble ensemble;
+  // Older than the catalog in the cache, dropped even on a dry run
+  EXPECT_FALSE(prefetched_.Get(false, 1001, now_, &ensemble));
+  EXPECT_TRUE(ensemble.manifest == NULL);
+  EXPECT_FALSE(prefetched_.Get(false, 0, now_, &ensemble));
+}
+
+
+TEST_F(T_PrefetchedManifest, Expiry) {
+  prefetched_.Set(manifest_, now_ + 60);
+  manifest::ManifestEnsemble ensemble;
+  EXPECT_TRUE(prefetched_.Get(false, 0, now_ + 60, &ensemble));
+  delete ensemble.manifest;
+  ensemble.manifest = NULL;
+  EXPECT_FALSE(prefetched_.Get(false, 0, now_ + 61, &ensemble));
+  EXPECT_TRUE(ensemble.manifest == NULL);
+
+  // A newer prefetch replaces the expired one
+  prefetched_.Set(manifest_, now_ + 120);
+  EXPECT_TRUE(prefetched_.Get(true, 0, now_ + 61, &ensemble));
+}
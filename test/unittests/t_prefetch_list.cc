@@ -0,0 +1,38 @@
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "../../cvmfs/prefetch_list.h"
+
+using namespace std;  // NOLINT
+
+TEST(T_PrefetchList, TraceLine) {
+  EXPECT_EQ("/sw/lib/libfoo.so",
+    prefetch::ParseTraceLine("\"1383214143.123\",\"3\",\"/sw/lib/libfoo.so\","
+                             "\"open()\""));
+  EXPECT_EQ("/a,b", prefetch::ParseTraceLine("\"1\",\"2\",\"/a,b\""));
+  EXPECT_EQ("", prefetch::ParseTraceLine("\"1\",\"2\""));
+  EXPECT_EQ("", prefetch::ParseTraceLine(""));
+}
+
+
+TEST(T_PrefetchList, ListLine) {
+  const string mountpoint = "/cvmfs/test.cern.ch";
+  EXPECT_EQ("/sw/bin/app", prefetch::ParseListLine("/sw/bin/app", mountpoint));
+  EXPECT_EQ("/sw/bin/app",
+            prefetch::ParseListLine("  /sw/bin/app \r", mountpoint));
+  EXPECT_EQ("/sw/bin/app",
+            prefetch::ParseListLine("/cvmfs/test.cern.ch/sw/bin/app",
+                                    mountpoint));
+  // Only the mount point itself is stripped, not a sibling repository
+  EXPECT_EQ("/cvmfs/test.cern.ch.other/x",
+            prefetch::ParseListLine("/cvmfs/test.cern.ch.other/x",
+                                    mountpoint));
+  EXPECT_EQ("/sw/lib/libfoo.so",
+            prefetch::ParseListLine("\"1.5\",\"3\",\"/cvmfs/test.cern.ch/sw/"
+                                    "lib/libfoo.so\",\"open()\"", mountpoint));
+  EXPECT_EQ("", prefetch::ParseListLine("", mountpoint));
+  EXPECT_EQ("", prefetch::ParseListLine(" \r", mountpoint));
+  EXPECT_EQ("", prefetch::ParseListLine("relative/path", mountpoint));
+  EXPECT_EQ("", prefetch::ParseListLine("\"1\",\"2\"", mountpoint));
+}
@@ -0,0 +1,262 @@
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "../../cvmfs/hash.h"
+#include "../../cvmfs/quota.h"
+#include "../../cvmfs/util.h"
+
+using namespace std;  // NOLINT
+
+/**
+ * The cache manager runs in-process, in a scratch cache directory.
+ */
+class T_Quota : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    char path[] = "/tmp/cvmfs_ut_quota.XXXXXX";
+    ASSERT_TRUE(mkdtemp(path) != NULL);
+    cache_dir_ = path;
+    ASSERT_TRUE(MakeCacheDirectories(cache_dir_, 0700));
+  }
+
+  virtual void TearDown() {
+    quota::Fini();
+    quota::SetRebuildInBackground(false);
+    quota::SetInMemory(false);
+    RemoveTree(cache_dir_);
+  }
+
+  static hash::Any MakeHash(const unsigned i) {
+    const string content = StringifyInt(i);
+    hash::Any hash(hash::kSha1);
+    hash::HashMem(reinterpret_cast<const unsigned char *>(content.data()),
+                  content.length(), &hash);
+    return hash;
+  }
+
+  // Creates the cache file and registers it with the cache manager
+  void Insert(const unsigned i, const uint64_t size) {
+    const int fd = open((cache_dir_ + MakeHash(i).MakePath(1, 2)).c_str(),
+                        O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    EXPECT_GE(fd, 0);
+    close(fd);
+    quota::Insert(MakeHash(i), size, "/file" + StringifyInt(i));
+  }
+
+  // Creates a cache file unknown to the cache manager, as found by a rebuild
+  void CreateFile(const unsigned i, const uint64_t size, const time_t atime) {
+    const string path = cache_dir_ + MakeHash(i).MakePath(1, 2);
+    const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    ASSERT_GE(fd, 0);
+    EXPECT_EQ(0, ftruncate(fd, size));
+    close(fd);
+    struct timeval times[2];
+    times[0].tv_sec = times[1].tv_sec = atime;
+    times[0].tv_usec = times[1].tv_usec = 0;
+    EXPECT_EQ(0, utimes(path.c_str(), times));
+  }
+
+  bool WaitForRebuild() {
+    for (unsigned i = 0; i < 100; ++i) {
+      if (!FileExists(cache_dir_ + "/cachedb.rebuilding"))
+        return true;
+      SafeSleepMs(50);
+    }
+    return false;
+  }
+
+  // The listing comes in pages and starts after acseq 0
+  static vector<quota::LruEntry> ListLru() {
+    vector<quota::LruEntry> result;
+    vector<quota::LruEntry> entries;
+    vector<string> paths;
+    uint64_t position = 0;
+    while (quota::ListLru(position, &entries, &paths) && !entries.empty()) {
+      result.insert(result.end(), entries.begin(), entries.end());
+      position = entries.back().acseq;
+    }
+    return result;
+  }
+
+  bool IsCached(const unsigned i) {
+    return FileExists(cache_dir_ + MakeHash(i).MakePath(1, 2));
+  }
+
+  // Polls until the eviction thread brought the cache below size
+  static bool WaitForSize(const uint64_t size) {
+    for (unsigned i = 0; i < 100; ++i) {
+      if (quota::GetSize() <= size)
+        return true;
+      SafeSleepMs(50);
+    }
+    return false;
+  }
+
+  string cache_dir_;
+};
+
+
+TEST_F(T_Quota, EvictBetweenWatermarks) {
+  const uint64_t kFileSize = 100*1024;
+  ASSERT_TRUE(quota::Init(cache_dir_, 10*kFileSize, 5*kFileSize, false));
+  quota::Spawn();
+
+  // Up to the high watermark at 90% of the limit, nothing is evicted
+  for (unsigned i = 0; i < 9; ++i)
+    Insert(i, kFileSize);
+  EXPECT_EQ(9*kFileSize, quota::GetSize());
+  SafeSleepMs(100);
+  EXPECT_EQ(9*kFileSize, quota::GetSize());
+  EXPECT_EQ(0U, quota::GetStatistics().num_evicted);
+
+  // Beyond it, the eviction thread cleans up to the cleanup threshold
+  Insert(9, kFileSize);
+  ASSERT_TRUE(WaitForSize(5*kFileSize));
+  EXPECT_EQ(5*kFileSize, quota::GetSize());
+  const quota::Statistics statistics = quota::GetStatistics();
+  EXPECT_EQ(5U, statistics.num_evicted);
+  EXPECT_EQ(0U, statistics.num_sync_cleanups);
+  for (unsigned i = 0; i < 10; ++i)
+    EXPECT_EQ(i >= 5, IsCached(i)) << i;
+  EXPECT_EQ(5U, quota::List().size());
+}
+
+
+TEST_F(T_Quota, EvictPinnedLast) {
+  const uint64_t kFileSize = 100*1024;
+  ASSERT_TRUE(quota::Init(cache_dir_, 10*kFileSize, 5*kFileSize, false));
+  quota::Spawn();
+
+  ASSERT_TRUE(quota::Pin(MakeHash(0), kFileSize, "/pinned", false));
+  Insert(0, kFileSize);
+  for (unsigned i = 1; i < 10; ++i)
+    Insert(i, kFileSize);
+  ASSERT_TRUE(WaitForSize(5*kFileSize));
+  EXPECT_TRUE(IsCached(0));
+  EXPECT_FALSE(IsCached(1));
+  EXPECT_EQ(5U, quota::GetStatistics().num_evicted);
+}
+
+
+TEST_F(T_Quota, FlushTouchesInBackground) {
+  ASSERT_TRUE(quota::Init(cache_dir_, 1024*1024, 512*1024, false));
+  quota::Spawn();
+  quota::Insert(MakeHash(0), 100, "/file0");
+  quota::Insert(MakeHash(1), 100, "/file1");
+  const quota::Statistics before = quota::GetStatistics();
+  // Goes out immediately, the last flush is long ago
+  quota::Touch(MakeHash(0));
+  // Buffered and merged
+  quota::Touch(MakeHash(1));
+  quota::Touch(MakeHash(1));
+
+  // Without further touches, the batch is forwarded by the flusher thread
+  quota::Statistics statistics;
+  for (unsigned i = 0; i < 50; ++i) {
+    statistics = quota::GetStatistics();
+    if (statistics.num_touch_writes - before.num_touch_writes > 1)
+      break;
+    SafeSleepMs(100);
+  }
+  EXPECT_EQ(3U, statistics.num_touches - before.num_touches);
+  EXPECT_EQ(2U, statistics.num_touches_forwarded -
+                before.num_touches_forwarded);
+  EXPECT_EQ(2U, statistics.num_touch_writes - before.num_touch_writes);
+}
+
+
+TEST_F(T_Quota, RebuildParallelScan) {
+  // Spread over the cache subdirectories, the oldest file has the highest i
+  const unsigned kNumFiles = 500;
+  for (unsigned i = 0; i < kNumFiles; ++i)
+    CreateFile(i, 1000, 1000000 + kNumFiles - i);
+  ASSERT_TRUE(quota::Init(cache_dir_, 100*1024*1024, 50*1024*1024, true));
+  quota::Spawn();
+  EXPECT_EQ(kNumFiles*1000, quota::GetSize());
+  EXPECT_EQ(kNumFiles, quota::List().size());
+
+  // The oldest file has acseq 0 and is not listed
+  const vector<quota::LruEntry> entries = ListLru();
+  ASSERT_EQ(kNumFiles - 1, entries.size());
+  for (unsigned i = 0; i < entries.size(); ++i)
+    EXPECT_EQ(MakeHash(kNumFiles - 2 - i), entries[i].hash) << i;
+}
+
+
+TEST_F(T_Quota, RebuildInBackground) {
+  const unsigned kNumFiles = 100;
+  for (unsigned i = 0; i < kNumFiles; ++i)
+    CreateFile(i, 1000, 1000000 + i);
+  quota::SetRebuildInBackground(true);
+  ASSERT_TRUE(quota::Init(cache_dir_, 100*1024*1024, 50*1024*1024, true));
+  quota::Spawn();
+
+  // Whether or not the scan has seen it, a removed file must not come back
+  Insert(kNumFiles, 1000);
+  ASSERT_EQ(0, unlink((cache_dir_ + MakeHash(0).MakePath(1, 2)).c_str()));
+  quota::Remove(MakeHash(0));
+  ASSERT_TRUE(WaitForRebuild());
+
+  EXPECT_EQ(kNumFiles*1000, quota::GetSize());
+  EXPECT_EQ(kNumFiles, quota::List().size());
+  const vector<quota::LruEntry> entries = ListLru();
+  ASSERT_FALSE(entries.empty());
+  for (unsigned i = 0; i < entries.size(); ++i)
+    EXPECT_NE(MakeHash(0), entries[i].hash) << i;
+  // Files inserted meanwhile are the most recently used ones
+  EXPECT_EQ(MakeHash(kNumFiles), entries.back().hash);
+}
+
+
+TEST_F(T_Quota, RebuildInBackgroundKeepsLimit) {
+  const uint64_t kFileSize = 100*1024;
+  const unsigned kNumFiles = 20;
+  for (unsigned i = 0; i < kNumFiles; ++i)
+    CreateFile(i, kFileSize, 1000000 + i);
+  quota::SetRebuildInBackground(true);
+  ASSERT_TRUE(quota::Init(cache_dir_, 10*kFileSize, 5*kFileSize, true));
+  quota::Spawn();
+  Insert(kNumFiles, kFileSize);
+  EXPECT_LE(quota::GetSize(), 10*kFileSize);
+  ASSERT_TRUE(WaitForRebuild());
+  // Below the high watermark, once the eviction thread is done
+  ASSERT_TRUE(WaitForSize(9*kFileSize));
+  unsigned num_cached = 0;
+  for (unsigned retries = 0; retries < 50; ++retries) {
+    num_cached = 0;
+    for (unsigned i = 0; i <= kNumFiles; ++i)
+      num_cached += IsCached(i);
+    if (num_cached*kFileSize == quota::GetSize())
+      break;
+    SafeSleepMs(50);
+  }
+
+  // Scanned files go first, evicted ones do not end up in the cache catalog
+  EXPECT_TRUE(IsCached(kNumFiles));
+  EXPECT_EQ(num_cached*kFileSize, quota::GetSize());
+  EXPECT_EQ(num_cached, quota::List().size());
+}
+
+
+TEST_F(T_Quota, InMemoryRebuildsAfterCrash) {
+  quota::SetInMemory(true);
+  ASSERT_TRUE(quota::Init(cache_dir_, 100*1024*1024, 50*1024*1024, false));
+  quota::Spawn();
+  CreateFile(0, 1000, 1000000);
+  quota::Insert(MakeHash(0), 1000, "/file0");
+  quota::Fini();
+
+  // An insert lost from the journal buffer, its file is in the cache
+  CreateFile(1, 1000, 1000000);
+  ASSERT_TRUE(quota::Init(cache_dir_, 100*1024*1024, 50*1024*1024, true));
+  quota::Spawn();
+  EXPECT_EQ(2000U, quota::GetSize());
+  EXPECT_EQ(2U, quota::List().size());
+}
@@ -0,0 +1,256 @@
+#include <gtest/gtest.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "../../cvmfs/hash.h"
+#include "../../cvmfs/quota_memory.h"
+
+using quota::MemoryCacheCatalog;
+
+class T_QuotaMemory : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    char path[] = "/tmp/cvmfs_ut_quota_memory.XXXXXX";
+    ASSERT_TRUE(mkdtemp(path) != NULL);
+    dir_ = path;
+    prefix_ = dir_ + "/cachedb";
+  }
+
+  virtual void TearDown() {
+    MemoryCacheCatalog::Unlink(prefix_);
+    rmdir(dir_.c_str());
+  }
+
+  static hash::Any MakeHash(const unsigned i) {
+    hash::Any hash(hash::kSha1);
+    for (unsigned j = 0; j < 20; ++j)
+      hash.digest[j] = (i * 31 + j * 7) & 0xff;
+    hash.digest[0] = i & 0xff;
+    hash.digest[1] = (i >> 8) & 0xff;
+    return hash;
+  }
+
+  // Inserts n regular files with acseq 0..n-1
+  static void Fill(MemoryCacheCatalog *catalog, const unsigned n) {
+    for (unsigned i = 0; i < n; ++i)
+      catalog->Insert(MakeHash(i), 100 + i, i, "/file", 0, false);
+  }
+
+  // Access sequence numbers of the LRU list followed by the pinned list
+  static std::vector<uint64_t> GetOrder(const MemoryCacheCatalog &catalog) {
+    std::vector<uint64_t> result;
+    for (const MemoryCacheCatalog::Entry *entry = catalog.head(); entry;
+         entry = entry->next)
+    {
+      result.push_back(entry->acseq);
+    }
+    for (const MemoryCacheCatalog::Entry *entry = catalog.pinned_head();
+         entry; entry = entry->next)
+    {
+      result.push_back(entry->acseq);
+    }
+    return result;
+  }
+
+ protected:
+  std::string dir_;
+  std::string prefix_;
+};
+
+
+TEST_F(T_QuotaMemory, LruOrder) {
+  MemoryCacheCatalog catalog(prefix_);
+  Fill(&catalog, 10);
+  EXPECT_EQ(10u, catalog.num_entries());
+  EXPECT_EQ(10u*100 + 45, catalog.size());
+  EXPECT_EQ(0u, catalog.GetLru()->acseq);
+
+  EXPECT_TRUE(catalog.Touch(MakeHash(0), 10));
+  EXPECT_FALSE(catalog.Touch(MakeHash(100), 11));
+  EXPECT_EQ(1u, catalog.GetLru()->acseq);
+  EXPECT_EQ(10u, catalog.max_acseq());
+
+  catalog.Insert(MakeHash(1), 500, 11, "/pinned", 1, true);
+  EXPECT_EQ(2u, catalog.GetLru()->acseq);
+  EXPECT_TRUE(catalog.Remove(MakeHash(2)));
+  EXPECT_FALSE(catalog.Remove(MakeHash(2)));
+  EXPECT_EQ(3u, catalog.GetLru()->acseq);
+  EXPECT_EQ(9u, catalog.num_entries());
+  EXPECT_EQ(10u*100 + 45 - 101 + 500 - 102, catalog.size());
+  EXPECT_TRUE(catalog.Lookup(MakeHash(2)) == NULL);
+  EXPECT_EQ(std::string("/pinned"), catalog.Lookup(MakeHash(1))->path);
+}
+
+
+TEST_F(T_QuotaMemory, PinnedList) {
+  MemoryCacheCatalog catalog(prefix_);
+  Fill(&catalog, 10);
+  // Pinning moves the entries out of the LRU list
+  for (unsigned i = 0; i < 5; ++i)
+    catalog.Insert(MakeHash(i), 100 + i, i, "/pinned", 0, true);
+  EXPECT_EQ(5u, catalog.GetLru()->acseq);
+  EXPECT_EQ(0u, catalog.pinned_head()->acseq);
+  EXPECT_EQ(10u, catalog.num_entries());
+  EXPECT_EQ(9u, catalog.max_acseq());
+
+  // Touching keeps an entry pinned
+  EXPECT_TRUE(catalog.Touch(MakeHash(4), 10));
+  EXPECT_EQ(10u, catalog.max_acseq());
+  EXPECT_TRUE(catalog.Lookup(MakeHash(4))->pinned);
+
+  // Unpinned entries return at the position of their acseq
+  EXPECT_TRUE(catalog.Unpin(MakeHash(2)));
+  EXPECT_TRUE(catalog.Unpin(MakeHash(4)));
+  EXPECT_TRUE(catalog.Unpin(MakeHash(4)));
+  EXPECT_FALSE(catalog.Unpin(MakeHash(100)));
+  EXPECT_EQ(2u, catalog.GetLru()->acseq);
+  const uint64_t expected[] = {2, 5, 6, 7, 8, 9, 10, 0, 1, 3};
+  EXPECT_EQ(std::vector<uint64_t>(expected, expected + 10),
+            GetOrder(catalog));
+
+  // Listings include the pinned entries in LRU order
+  std::vector<const MemoryCacheCatalog::Entry *> entries;
+  catalog.ListAfter(0, 0, 4, &entries);
+  ASSERT_EQ(4u, entries.size());
+  EXPECT_EQ(1u, entries[0]->acseq);
+  EXPECT_EQ(5u, entries[3]->acseq);
+
+  EXPECT_TRUE(catalog.Remove(MakeHash(0)));
+  EXPECT_EQ(1u, catalog.pinned_head()->acseq);
+  EXPECT_TRUE(catalog.Unpin(MakeHash(1)));
+  EXPECT_TRUE(catalog.Unpin(MakeHash(3)));
+  EXPECT_TRUE(catalog.pinned_head() == NULL);
+  EXPECT_EQ(1u, catalog.GetLru()->acseq);
+}
+
+
+TEST_F(T_QuotaMemory, ListAfter) {
+  MemoryCacheCatalog catalog(prefix_);
+  Fill(&catalog, 10);
+  catalog.Insert(MakeHash(3), 103, 10, "/catalog", 1, false);
+
+  std::vector<const MemoryCacheCatalog::Entry *> entries;
+  catalog.ListAfter(0, 0, 4, &entries);
+  ASSERT_EQ(4u, entries.size());
+  EXPECT_EQ(1u, entries[0]->acseq);
+  EXPECT_EQ(5u, entries[3]->acseq);
+
+  // Continues behind the cursor, even if the cursor entry moved
+  catalog.Touch(MakeHash(5), 11);
+  entries.clear();
+  catalog.ListAfter(5, 0, 100, &entries);
+  ASSERT_EQ(5u, entries.size());
+  EXPECT_EQ(6u, entries[0]->acseq);
+  EXPECT_EQ(11u, entries[4]->acseq);
+}
+
+
+TEST_F(T_QuotaMemory, SnapshotAndJournal) {
+  std::vector<uint64_t> expected_order;
+  {
+    MemoryCacheCatalog catalog(prefix_);
+    EXPECT_FALSE(catalog.Load());
+    Fill(&catalog, 100);
+    ASSERT_TRUE(catalog.WriteSnapshot());
+
+    // Journaled operations
+    catalog.Touch(MakeHash(0), 100);
+    catalog.Remove(MakeHash(1));
+    catalog.Insert(MakeHash(1000), 42, 101, "/new", 0, true);
+    catalog.Sync();
+    expected_order = GetOrder(catalog);
+  }
+
+  MemoryCacheCatalog catalog(prefix_);
+  ASSERT_TRUE(catalog.Load());
+  EXPECT_EQ(3u, catalog.statistics().num_replayed);
+  EXPECT_EQ(expected_order, GetOrder(catalog));
+  EXPECT_EQ(101u, catalog.max_acseq());
+  ASSERT_TRUE(catalog.Lookup(MakeHash(1000)) != NULL);
+  EXPECT_FALSE(catalog.Lookup(MakeHash(1000))->pinned);
+  EXPECT_EQ(std::string("/new"), catalog.Lookup(MakeHash(1000))->path);
+  EXPECT_TRUE(catalog.Lookup(MakeHash(1)) == NULL);
+}
+
+
+TEST_F(T_QuotaMemory, TornJournal) {
+  {
+    MemoryCacheCatalog catalog(prefix_);
+    Fill(&catalog, 10);
+    ASSERT_TRUE(catalog.WriteSnapshot());
+    catalog.Touch(MakeHash(0), 10);
+    catalog.Touch(MakeHash(1), 11);
+    catalog.Sync();
+  }
+
+  // Cut the last touch record in half
+  const std::string journal = prefix_ + ".journal";
+  struct stat info;
+  ASSERT_EQ(0, stat(journal.c_str(), &info));
+  ASSERT_EQ(0, truncate(journal.c_str(), info.st_size - 4));
+
+  {
+    MemoryCacheCatalog catalog(prefix_);
+    ASSERT_TRUE(catalog.Load());
+    EXPECT_EQ(1u, catalog.statistics().num_replayed);
+    EXPECT_EQ(10u, catalog.max_acseq());
+    // The journal continues behind the last complete record
+    catalog.Touch(MakeHash(2), 11);
+    catalog.Sync();
+  }
+
+  MemoryCacheCatalog catalog(prefix_);
+  ASSERT_TRUE(catalog.Load());
+  EXPECT_EQ(2u, catalog.statistics().num_replayed);
+  EXPECT_EQ(1u, catalog.GetLru()->acseq);
+  EXPECT_EQ(11u, catalog.max_acseq());
+}
+
+
+TEST_F(T_QuotaMemory, StaleJournal) {
+  {
+    MemoryCacheCatalog catalog(prefix_);
+    Fill(&catalog, 10);
+    ASSERT_TRUE(catalog.WriteSnapshot());
+    catalog.Remove(MakeHash(0));
+    catalog.Sync();
+  }
+  // A journal of a previous generation must not be applied
+  const std::string journal = prefix_ + ".journal";
+  ASSERT_EQ(0, rename(journal.c_str(), (journal + ".old").c_str()));
+  {
+    MemoryCacheCatalog catalog(prefix_);
+    ASSERT_TRUE(catalog.Load());
+    EXPECT_EQ(10u, catalog.num_entries());
+    ASSERT_TRUE(catalog.WriteSnapshot());
+  }
+  ASSERT_EQ(0, rename((journal + ".old").c_str(), journal.c_str()));
+
+  MemoryCacheCatalog catalog(prefix_);
+  ASSERT_TRUE(catalog.Load());
+  EXPECT_EQ(0u, catalog.statistics().num_replayed);
+  EXPECT_EQ(10u, catalog.num_entries());
+}
+
+
+TEST_F(T_QuotaMemory, CorruptSnapshot) {
+  {
+    MemoryCacheCatalog catalog(prefix_);
+    Fill(&catalog, 10);
+    ASSERT_TRUE(catalog.WriteSnapshot());
+  }
+  const std::string snapshot = prefix_ + ".snapshot";
+  struct stat info;
+  ASSERT_EQ(0, stat(snapshot.c_str(), &info));
+  ASSERT_EQ(0, truncate(snapshot.c_str(), info.st_size - 1));
+
+  MemoryCacheCatalog catalog(prefix_);
+  EXPECT_FALSE(catalog.Load());
+  EXPECT_EQ(0u, catalog.num_entries());
+}
@@ -0,0 +1,165 @@
+#include <gtest/gtest.h>
+
+#include "../../cvmfs/hash.h"
+#include "../../cvmfs/quota_policy.h"
+
+using quota::CacheSimulator;
+using quota::ReplacementPolicy;
+
+class T_QuotaPolicy : public ::testing::Test {
+ protected:
+  static hash::Any MakeHash(const unsigned i) {
+    hash::Any hash(hash::kSha1);
+    hash.digest[0] = i & 0xff;
+    hash.digest[1] = (i >> 8) & 0xff;
+    return hash;
+  }
+
+  // Accesses the hot files [0, num_hot) twice in a cache of 200 bytes, with
+  // enough other files in between to evict them.  Then, each round scans
+  // num_scan new files once and accesses the hot files again.  Returns the
+  // hits on the hot files during the rounds.
+  static uint64_t RunScan(const quota::PolicyType type,
+                          const unsigned num_hot, const unsigned num_scan,
+                          const unsigned num_rounds)
+  {
+    CacheSimulator simulator(type, 200);
+    unsigned next_file = 1000;
+    for (unsigned i = 0; i < num_hot; ++i)
+      simulator.Access(MakeHash(i), 1);
+    for (unsigned i = 0; i < 250; ++i)
+      simulator.Access(MakeHash(next_file++), 1);
+    for (unsigned i = 0; i < num_hot; ++i)
+      simulator.Access(MakeHash(i), 1);
+
+    uint64_t hot_hits = 0;
+    for (unsigned round = 0; round < num_rounds; ++round) {
+      for (unsigned i = 0; i < num_scan; ++i)
+        simulator.Access(MakeHash(next_file++), 1);
+      for (unsigned i = 0; i < num_hot; ++i) {
+        const uint64_t hits = simulator.num_hits();
+        simulator.Access(MakeHash(i), 1);
+        hot_hits += simulator.num_hits() - hits;
+      }
+    }
+    return hot_hits;
+  }
+};
+
+
+TEST_F(T_QuotaPolicy, ParseType) {
+  quota::PolicyType type;
+  EXPECT_TRUE(ReplacementPolicy::ParseType("GDSF", &type));
+  EXPECT_EQ(quota::kPolicyGdsf, type);
+  EXPECT_TRUE(ReplacementPolicy::ParseType("2q", &type));
+  EXPECT_EQ(quota::kPolicy2Q, type);
+  EXPECT_TRUE(ReplacementPolicy::ParseType("lru", &type));
+  EXPECT_EQ(quota::kPolicyLru, type);
+  EXPECT_FALSE(ReplacementPolicy::ParseType("arc", &type));
+  EXPECT_EQ("2q", ReplacementPolicy::GetName(quota::kPolicy2Q));
+}
+
+
+TEST_F(T_QuotaPolicy, Lru) {
+  ReplacementPolicy *policy = ReplacementPolicy::Create(quota::kPolicyLru, 0);
+  hash::Any victim;
+  EXPECT_FALSE(policy->GetVictim(&victim));
+  for (unsigned i = 0; i < 3; ++i)
+    policy->Insert(MakeHash(i), 1);
+  policy->Touch(MakeHash(0));
+  ASSERT_TRUE(policy->GetVictim(&victim));
+  EXPECT_EQ(MakeHash(1), victim);
+  policy->Remove(MakeHash(1));
+  policy->Remove(MakeHash(42));
+  ASSERT_TRUE(policy->GetVictim(&victim));
+  EXPECT_EQ(MakeHash(2), victim);
+  EXPECT_EQ(2u, policy->num_entries());
+  delete policy;
+}
+
+
+TEST_F(T_QuotaPolicy, TwoQueue) {
+  ReplacementPolicy *policy = ReplacementPolicy::Create(quota::kPolicy2Q, 400);
+  hash::Any victim;
+  // The FIFO queue takes up to 100 bytes
+  policy->Insert(MakeHash(0), 60);
+  policy->Insert(MakeHash(1), 60);
+  policy->Touch(MakeHash(0));
+  ASSERT_TRUE(policy->GetVictim(&victim));
+  EXPECT_EQ(MakeHash(0), victim);
+
+  // Evicted from the FIFO queue and seen again: promoted to the main queue
+  policy->Evict(MakeHash(0));
+  policy->Insert(MakeHash(0), 60);
+  policy->Insert(MakeHash(2), 60);
+  ASSERT_TRUE(policy->GetVictim(&victim));
+  EXPECT_EQ(MakeHash(1), victim);
+  // The FIFO queue is within its share now
+  policy->Evict(MakeHash(1));
+  ASSERT_TRUE(policy->GetVictim(&victim));
+  EXPECT_EQ(MakeHash(0), victim);
+  policy->Evict(MakeHash(0));
+  ASSERT_TRUE(policy->GetVictim(&victim));
+  EXPECT_EQ(MakeHash(2), victim);
+  delete policy;
+}
+
+
+TEST_F(T_QuotaPolicy, TwoQueueRemoveLeavesNoGhost) {
+  ReplacementPolicy *policy = ReplacementPolicy::Create(quota::kPolicy2Q, 400);
+  hash::Any victim;
+  for (unsigned i = 0; i < 3; ++i)
+    policy->Insert(MakeHash(i), 30);
+  // Removed (or pinned) instead of evicted: starts over in the FIFO queue
+  policy->Remove(MakeHash(0));
+  EXPECT_EQ(2u, policy->num_entries());
+  policy->Insert(MakeHash(0), 30);
+  ASSERT_TRUE(policy->GetVictim(&victim));
+  EXPECT_EQ(MakeHash(1), victim);
+  delete policy;
+}
+
+
+TEST_F(T_QuotaPolicy, Gdsf) {
+  ReplacementPolicy *policy = ReplacementPolicy::Create(quota::kPolicyGdsf, 0);
+  hash::Any victim;
+  policy->Insert(MakeHash(0), 1000);
+  policy->Insert(MakeHash(1), 10);
+  policy->Insert(MakeHash(2), 10);
+  policy->Touch(MakeHash(2));
+  // Large files go first
+  ASSERT_TRUE(policy->GetVictim(&victim));
+  EXPECT_EQ(MakeHash(0), victim);
+  policy->Evict(MakeHash(0));
+  ASSERT_TRUE(policy->GetVictim(&victim));
+  EXPECT_EQ(MakeHash(1), victim);
+
+  // The inflation value lets new files overtake unused ones
+  policy->Evict(MakeHash(1));
+  policy->Insert(MakeHash(3), 10);
+  ASSERT_TRUE(policy->GetVictim(&victim));
+  EXPECT_EQ(MakeHash(2), victim);
+  delete policy;
+}
+
+
+TEST_F(T_QuotaPolicy, ScanResistance) {
+  // The scans are larger than the cache
+  EXPECT_EQ(0u, RunScan(quota::kPolicyLru, 40, 1000, 10));
+  EXPECT_EQ(10u * 40, RunScan(quota::kPolicy2Q, 40, 1000, 10));
+}
+
+
+TEST_F(T_QuotaPolicy, Simulator) {
+  CacheSimulator simulator(quota::kPolicyLru, 100);
+  simulator.Access(MakeHash(0), 60);
+  simulator.Access(MakeHash(0), 60);
+  simulator.Access(MakeHash(1), 60);
+  simulator.Access(MakeHash(2), 200);  // too large, never cached
+  simulator.Access(MakeHash(1), 60);
+  EXPECT_EQ(5u, simulator.num_accesses());
+  EXPECT_EQ(2u, simulator.num_hits());
+  EXPECT_EQ(440u, simulator.bytes_accessed());
+  EXPECT_EQ(120u, simulator.bytes_hit());
+  EXPECT_EQ(1u, simulator.num_evictions());
+}
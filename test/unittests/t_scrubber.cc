@@ -0,0 +1,120 @@
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "../../cvmfs/hash.h"
+#include "../../cvmfs/quota.h"
+#include "../../cvmfs/scrubber.h"
+#include "../../cvmfs/util.h"
+
+using namespace std;  // NOLINT
+
+class T_Scrubber : public ::testing::Test {
+ protected:
+  static const unsigned kFileSize = 64*1024;
+
+  virtual void SetUp() {
+    char path[] = "/tmp/cvmfs_ut_scrubber.XXXXXX";
+    ASSERT_TRUE(mkdtemp(path) != NULL);
+    cache_dir_ = path;
+    ASSERT_TRUE(MakeCacheDirectories(cache_dir_, 0700));
+    ASSERT_TRUE(quota::Init(cache_dir_, 64*1024*1024, 32*1024*1024, false));
+    quota::Spawn();
+  }
+
+  virtual void TearDown() {
+    scrubber::Fini();
+    quota::Fini();
+    RemoveTree(cache_dir_);
+  }
+
+  /**
+   * Stores a file with random content under its content hash.  A corrupted
+   * file has one of its bytes flipped after hashing.
+   */
+  hash::Any AddFile(const string &path, const bool corrupt) {
+    unsigned char *content = static_cast<unsigned char *>(malloc(kFileSize));
+    for (unsigned i = 0; i < kFileSize; ++i)
+      content[i] = random() & 0xff;
+    hash::Any hash(hash::kSha1);
+    hash::HashMem(content, kFileSize, &hash);
+    if (corrupt)
+      content[kFileSize / 2] ^= 0xff;
+
+    const int fd = open((cache_dir_ + hash.MakePath(1, 2)).c_str(),
+                        O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    EXPECT_GE(fd, 0);
+    EXPECT_EQ(static_cast<ssize_t>(kFileSize), write(fd, content, kFileSize));
+    close(fd);
+    free(content);
+    quota::Insert(hash, kFileSize, path);
+    return hash;
+  }
+
+  /**
+   * Runs the scrubber until it completed its first pass.
+   *
+   * \return Wall clock seconds of the pass
+   */
+  double RunPass(const uint64_t max_rate) {
+    EXPECT_TRUE(scrubber::Init(cache_dir_, max_rate, 100, 3600));
+    struct timeval start, now;
+    gettimeofday(&start, NULL);
+    scrubber::Spawn();
+    do {
+      SafeSleepMs(10);
+      gettimeofday(&now, NULL);
+    } while ((scrubber::GetStatistics().pass == 0) &&
+             (DiffTimeSeconds(start, now) < 30.0));
+    return DiffTimeSeconds(start, now);
+  }
+
+  string cache_dir_;
+};
+
+
+TEST_F(T_Scrubber, QuarantineCorrupted) {
+  AddFile("/good1", false);
+  const hash::Any corrupted = AddFile("/corrupted", true);
+  AddFile("/good2", false);
+  RunPass(0);
+
+  const scrubber::Statistics statistics = scrubber::GetStatistics();
+  EXPECT_EQ(1U, statistics.pass);
+  EXPECT_EQ(3U, statistics.num_verified);
+  EXPECT_EQ(1U, statistics.num_corrupted);
+  EXPECT_EQ(1U, statistics.num_quarantined);
+  EXPECT_EQ(0U, statistics.num_errors);
+  EXPECT_EQ(3U * kFileSize, statistics.bytes_verified);
+
+  EXPECT_FALSE(FileExists(cache_dir_ + corrupted.MakePath(1, 2)));
+  EXPECT_TRUE(FileExists(cache_dir_ + "/quarantaine/" + corrupted.ToString()));
+  const vector<string> cached = quota::List();
+  EXPECT_EQ(2U, cached.size());
+  for (unsigned i = 0; i < cached.size(); ++i)
+    EXPECT_NE("/corrupted", cached[i]);
+  EXPECT_NE(string::npos,
+            scrubber::GetFindings().find(corrupted.ToString()));
+}
+
+
+TEST_F(T_Scrubber, RateLimit) {
+  const unsigned kNumFiles = 8;
+  for (unsigned i = 0; i < kNumFiles; ++i)
+    AddFile("/file" + StringifyInt(i), false);
+  // 512kB at 1MB/s
+  const double elapsed = RunPass(1024*1024);
+
+  const scrubber::Statistics statistics = scrubber::GetStatistics();
+  EXPECT_EQ(kNumFiles, statistics.num_verified);
+  EXPECT_EQ(0U, statistics.num_corrupted);
+  EXPECT_GE(elapsed, 0.4);
+  // Throttling pauses do not count as verification time
+  EXPECT_LT(statistics.elapsed, elapsed);
+}
@@ -7,6 +7,17 @@
   #include <sys/sysctl.h>
 #endif
 
+#include "../../cvmfs/loader.h"
+
+
+// Globals of the Fuse module, which is not part of the unit tests.  The
+// cache manager and the watchdog refer to them.
+namespace cvmfs {
+pid_t pid_ = 0;
+bool foreground_ = false;
+}
+loader::CvmfsExports *g_cvmfs_exports = NULL;
+
 
 void SkipWhitespace(std::istringstream &iss) {
   while (iss.good()) {